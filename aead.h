@@ -0,0 +1,317 @@
+#pragma once
+
+// AES-128-GCM and QUIC-style packet protection built on AES-NI and
+// PCLMULQDQ. The kernels carry target attributes, so the rest of the build
+// keeps its baseline flags; call aead_supported() before using them.
+//
+// Protected QUIC packet layout (short-header style):
+//   [flags:1][connection ID:4, network order][packet number:4, big endian]
+//   [ciphertext][tag:16]
+// The header is the AAD. Header protection masks the low flag bits and the
+// packet number with AES-ECB of a 16 byte ciphertext sample. Keys come from a
+// fixed test secret and the connection ID (there is no handshake), separately
+// for each direction.
+
+#include <immintrin.h>
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+
+const size_t QUIC_HEADER_SIZE = 9;
+const size_t QUIC_PN_OFFSET = 5;
+const size_t QUIC_TAG_SIZE = 16;
+const size_t QUIC_SAMPLE_OFFSET = QUIC_PN_OFFSET + 4;
+const uint8_t QUIC_SHORT_HEADER_FLAGS = 0x43;  // Fixed bit, 4 byte packet number
+
+struct Aes128Key {
+    __m128i rounds[11];
+};
+
+struct AeadKey {
+    Aes128Key aes;
+    Aes128Key header_protection;
+    __m128i hash_key;  // H = AES(0), byte reversed for GHASH
+    __m128i hash_powers[3];  // H^2, H^3, H^4 for four-block aggregation
+    uint8_t iv[12];
+};
+
+struct QuicPacketKeys {
+    AeadKey client;  // Client to server
+    AeadKey server;  // Server to client
+};
+
+inline bool aead_supported() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul") &&
+           __builtin_cpu_supports("sse4.1");
+}
+
+#define AEAD_TARGET __attribute__((target("aes,pclmul,sse4.1")))
+
+AEAD_TARGET inline __m128i aes128_expand_step(__m128i key, __m128i assist) {
+    assist = _mm_shuffle_epi32(assist, 0xff);
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+    return _mm_xor_si128(key, assist);
+}
+
+AEAD_TARGET inline void aes128_expand(const uint8_t key[16], Aes128Key& out) {
+    __m128i k = _mm_loadu_si128((const __m128i*)key);
+    out.rounds[0] = k;
+    out.rounds[1] = k = aes128_expand_step(k, _mm_aeskeygenassist_si128(k, 0x01));
+    out.rounds[2] = k = aes128_expand_step(k, _mm_aeskeygenassist_si128(k, 0x02));
+    out.rounds[3] = k = aes128_expand_step(k, _mm_aeskeygenassist_si128(k, 0x04));
+    out.rounds[4] = k = aes128_expand_step(k, _mm_aeskeygenassist_si128(k, 0x08));
+    out.rounds[5] = k = aes128_expand_step(k, _mm_aeskeygenassist_si128(k, 0x10));
+    out.rounds[6] = k = aes128_expand_step(k, _mm_aeskeygenassist_si128(k, 0x20));
+    out.rounds[7] = k = aes128_expand_step(k, _mm_aeskeygenassist_si128(k, 0x40));
+    out.rounds[8] = k = aes128_expand_step(k, _mm_aeskeygenassist_si128(k, 0x80));
+    out.rounds[9] = k = aes128_expand_step(k, _mm_aeskeygenassist_si128(k, 0x1b));
+    out.rounds[10] = aes128_expand_step(k, _mm_aeskeygenassist_si128(k, 0x36));
+}
+
+AEAD_TARGET inline __m128i aes128_encrypt(const Aes128Key& key, __m128i block) {
+    block = _mm_xor_si128(block, key.rounds[0]);
+    for (int i = 1; i < 10; i++) block = _mm_aesenc_si128(block, key.rounds[i]);
+    return _mm_aesenclast_si128(block, key.rounds[10]);
+}
+
+// Four independent blocks at once so the AES units stay busy
+AEAD_TARGET inline void aes128_encrypt4(const Aes128Key& key, __m128i& b0, __m128i& b1,
+                                        __m128i& b2, __m128i& b3) {
+    b0 = _mm_xor_si128(b0, key.rounds[0]);
+    b1 = _mm_xor_si128(b1, key.rounds[0]);
+    b2 = _mm_xor_si128(b2, key.rounds[0]);
+    b3 = _mm_xor_si128(b3, key.rounds[0]);
+    for (int i = 1; i < 10; i++) {
+        b0 = _mm_aesenc_si128(b0, key.rounds[i]);
+        b1 = _mm_aesenc_si128(b1, key.rounds[i]);
+        b2 = _mm_aesenc_si128(b2, key.rounds[i]);
+        b3 = _mm_aesenc_si128(b3, key.rounds[i]);
+    }
+    b0 = _mm_aesenclast_si128(b0, key.rounds[10]);
+    b1 = _mm_aesenclast_si128(b1, key.rounds[10]);
+    b2 = _mm_aesenclast_si128(b2, key.rounds[10]);
+    b3 = _mm_aesenclast_si128(b3, key.rounds[10]);
+}
+
+AEAD_TARGET inline __m128i ghash_byte_reverse(__m128i x) {
+    return _mm_shuffle_epi8(x, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+// Carry-less multiply of byte-reversed operands in GF(2^128) with the GCM
+// polynomial (shift-and-reduce method from Intel's CLMUL white paper)
+AEAD_TARGET inline __m128i ghash_multiply(__m128i a, __m128i b) {
+    __m128i lo = _mm_clmulepi64_si128(a, b, 0x00);
+    __m128i mid = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01));
+    __m128i hi = _mm_clmulepi64_si128(a, b, 0x11);
+    lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+    hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+
+    // Shift the 256-bit product left by one bit
+    __m128i lo_carry = _mm_srli_epi32(lo, 31);
+    __m128i hi_carry = _mm_srli_epi32(hi, 31);
+    lo = _mm_slli_epi32(lo, 1);
+    hi = _mm_slli_epi32(hi, 1);
+    __m128i cross = _mm_srli_si128(lo_carry, 12);
+    hi_carry = _mm_slli_si128(hi_carry, 4);
+    lo_carry = _mm_slli_si128(lo_carry, 4);
+    lo = _mm_or_si128(lo, lo_carry);
+    hi = _mm_or_si128(_mm_or_si128(hi, hi_carry), cross);
+
+    // Reduce modulo x^128 + x^7 + x^2 + x + 1
+    __m128i t = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(lo, 31), _mm_slli_epi32(lo, 30)),
+                              _mm_slli_epi32(lo, 25));
+    __m128i t_high = _mm_srli_si128(t, 4);
+    lo = _mm_xor_si128(lo, _mm_slli_si128(t, 12));
+    __m128i r = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(lo, 1), _mm_srli_epi32(lo, 2)),
+                              _mm_srli_epi32(lo, 7));
+    r = _mm_xor_si128(r, t_high);
+    lo = _mm_xor_si128(lo, r);
+    return _mm_xor_si128(hi, lo);
+}
+
+// Absorbs data into the GHASH state, zero padding the final partial block.
+// Four blocks at a time are folded as (X^B0)*H^4 + B1*H^3 + B2*H^2 + B3*H,
+// so the multiplies are independent instead of one serial chain.
+AEAD_TARGET inline __m128i ghash_update(__m128i state, __m128i hash_key, const __m128i powers[3],
+                                        const uint8_t* data, size_t length) {
+    while (length >= 64) {
+        const __m128i* p = (const __m128i*)data;
+        __m128i b0 = _mm_xor_si128(state, ghash_byte_reverse(_mm_loadu_si128(p)));
+        __m128i b1 = ghash_byte_reverse(_mm_loadu_si128(p + 1));
+        __m128i b2 = ghash_byte_reverse(_mm_loadu_si128(p + 2));
+        __m128i b3 = ghash_byte_reverse(_mm_loadu_si128(p + 3));
+        state = _mm_xor_si128(_mm_xor_si128(ghash_multiply(b0, powers[2]), ghash_multiply(b1, powers[1])),
+                              _mm_xor_si128(ghash_multiply(b2, powers[0]), ghash_multiply(b3, hash_key)));
+        data += 64;
+        length -= 64;
+    }
+    while (length >= 16) {
+        __m128i block = ghash_byte_reverse(_mm_loadu_si128((const __m128i*)data));
+        state = ghash_multiply(_mm_xor_si128(state, block), hash_key);
+        data += 16;
+        length -= 16;
+    }
+    if (length > 0) {
+        uint8_t last[16] = {0};
+        memcpy(last, data, length);
+        __m128i block = ghash_byte_reverse(_mm_loadu_si128((const __m128i*)last));
+        state = ghash_multiply(_mm_xor_si128(state, block), hash_key);
+    }
+    return state;
+}
+
+AEAD_TARGET inline void aead_init_key(AeadKey& key, const uint8_t aes_key[16], const uint8_t iv[12],
+                                      const uint8_t hp_key[16]) {
+    aes128_expand(aes_key, key.aes);
+    aes128_expand(hp_key, key.header_protection);
+    key.hash_key = ghash_byte_reverse(aes128_encrypt(key.aes, _mm_setzero_si128()));
+    key.hash_powers[0] = ghash_multiply(key.hash_key, key.hash_key);
+    key.hash_powers[1] = ghash_multiply(key.hash_powers[0], key.hash_key);
+    key.hash_powers[2] = ghash_multiply(key.hash_powers[1], key.hash_key);
+    memcpy(key.iv, iv, sizeof(key.iv));
+}
+
+// Counter block J0 for a 96-bit nonce, with the 32-bit counter set to ctr
+AEAD_TARGET inline __m128i gcm_counter_block(const uint8_t nonce[12], uint32_t ctr) {
+    uint8_t block[16];
+    memcpy(block, nonce, 12);
+    __m128i b = _mm_loadu_si128((const __m128i*)block);
+    return _mm_insert_epi32(b, (int)__builtin_bswap32(ctr), 3);
+}
+
+// XORs the CTR keystream starting at counter 2 into data
+AEAD_TARGET inline void gcm_ctr(const AeadKey& key, const uint8_t nonce[12], uint8_t* data, size_t length) {
+    uint32_t ctr = 2;
+    while (length >= 64) {
+        __m128i k0 = gcm_counter_block(nonce, ctr);
+        __m128i k1 = gcm_counter_block(nonce, ctr + 1);
+        __m128i k2 = gcm_counter_block(nonce, ctr + 2);
+        __m128i k3 = gcm_counter_block(nonce, ctr + 3);
+        aes128_encrypt4(key.aes, k0, k1, k2, k3);
+        __m128i* p = (__m128i*)data;
+        _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), k0));
+        _mm_storeu_si128(p + 1, _mm_xor_si128(_mm_loadu_si128(p + 1), k1));
+        _mm_storeu_si128(p + 2, _mm_xor_si128(_mm_loadu_si128(p + 2), k2));
+        _mm_storeu_si128(p + 3, _mm_xor_si128(_mm_loadu_si128(p + 3), k3));
+        ctr += 4;
+        data += 64;
+        length -= 64;
+    }
+    while (length > 0) {
+        uint8_t stream[16];
+        _mm_storeu_si128((__m128i*)stream, aes128_encrypt(key.aes, gcm_counter_block(nonce, ctr++)));
+        size_t n = length < 16 ? length : 16;
+        for (size_t i = 0; i < n; i++) data[i] ^= stream[i];
+        data += n;
+        length -= n;
+    }
+}
+
+AEAD_TARGET inline void gcm_tag(const AeadKey& key, const uint8_t nonce[12], const uint8_t* aad,
+                                size_t aad_length, const uint8_t* ciphertext, size_t length,
+                                uint8_t tag[16]) {
+    __m128i state = _mm_setzero_si128();
+    state = ghash_update(state, key.hash_key, key.hash_powers, aad, aad_length);
+    state = ghash_update(state, key.hash_key, key.hash_powers, ciphertext, length);
+    __m128i lengths = _mm_set_epi64x((long long)aad_length * 8, (long long)length * 8);
+    state = ghash_multiply(_mm_xor_si128(state, lengths), key.hash_key);
+    __m128i s = ghash_byte_reverse(state);
+    __m128i mask = aes128_encrypt(key.aes, gcm_counter_block(nonce, 1));
+    _mm_storeu_si128((__m128i*)tag, _mm_xor_si128(s, mask));
+}
+
+// QUIC nonce: the IV with the packet number XORed into its low bytes
+inline void aead_nonce(const AeadKey& key, uint64_t packet_number, uint8_t nonce[12]) {
+    memcpy(nonce, key.iv, 12);
+    for (int i = 0; i < 8; i++) nonce[11 - i] ^= (uint8_t)(packet_number >> (8 * i));
+}
+
+// Encrypts data in place and writes the tag
+AEAD_TARGET inline void aead_seal(const AeadKey& key, uint64_t packet_number, const uint8_t* aad,
+                                  size_t aad_length, uint8_t* data, size_t length, uint8_t tag[16]) {
+    uint8_t nonce[12];
+    aead_nonce(key, packet_number, nonce);
+    gcm_ctr(key, nonce, data, length);
+    gcm_tag(key, nonce, aad, aad_length, data, length, tag);
+}
+
+// Verifies the tag and, only if it matches, decrypts data in place
+AEAD_TARGET inline bool aead_open(const AeadKey& key, uint64_t packet_number, const uint8_t* aad,
+                                  size_t aad_length, uint8_t* data, size_t length, const uint8_t tag[16]) {
+    uint8_t nonce[12];
+    uint8_t expected[16];
+    aead_nonce(key, packet_number, nonce);
+    gcm_tag(key, nonce, aad, aad_length, data, length, expected);
+    uint8_t diff = 0;
+    for (int i = 0; i < 16; i++) diff |= expected[i] ^ tag[i];
+    if (diff != 0) return false;
+    gcm_ctr(key, nonce, data, length);
+    return true;
+}
+
+AEAD_TARGET inline void quic_header_mask(const AeadKey& key, const uint8_t* sample, uint8_t mask[5]) {
+    uint8_t block[16];
+    _mm_storeu_si128((__m128i*)block,
+                     aes128_encrypt(key.header_protection, _mm_loadu_si128((const __m128i*)sample)));
+    memcpy(mask, block, 5);
+}
+
+// Derives both directions' keys for a connection from the fixed test secret
+AEAD_TARGET inline void quic_derive_keys(uint32_t connection_id, QuicPacketKeys& keys) {
+    static const uint8_t secret[16] = {0x6e, 0x65, 0x74, 0x74, 0x65, 0x73, 0x74, 0x2d,
+                                       0x71, 0x75, 0x69, 0x63, 0x2d, 0x6b, 0x65, 0x79};
+    Aes128Key master;
+    aes128_expand(secret, master);
+
+    uint8_t material[6][16];
+    for (int i = 0; i < 6; i++) {
+        __m128i label = _mm_set_epi32(0, 0, i, (int)connection_id);
+        _mm_storeu_si128((__m128i*)material[i], aes128_encrypt(master, label));
+    }
+    aead_init_key(keys.client, material[0], material[1], material[2]);
+    aead_init_key(keys.server, material[3], material[4], material[5]);
+}
+
+// Builds a protected packet in out (QUIC_HEADER_SIZE + length + QUIC_TAG_SIZE
+// bytes) and returns its size. connection_id is in network byte order.
+AEAD_TARGET inline size_t quic_protect(const AeadKey& key, uint32_t connection_id, uint32_t packet_number,
+                                       const uint8_t* payload, size_t length, uint8_t* out) {
+    out[0] = QUIC_SHORT_HEADER_FLAGS;
+    memcpy(out + 1, &connection_id, 4);
+    uint32_t pn = __builtin_bswap32(packet_number);
+    memcpy(out + QUIC_PN_OFFSET, &pn, 4);
+
+    uint8_t* body = out + QUIC_HEADER_SIZE;
+    if (body != payload) memmove(body, payload, length);
+    aead_seal(key, packet_number, out, QUIC_HEADER_SIZE, body, length, body + length);
+
+    uint8_t mask[5];
+    quic_header_mask(key, out + QUIC_SAMPLE_OFFSET, mask);
+    out[0] ^= mask[0] & 0x1f;
+    for (int i = 0; i < 4; i++) out[QUIC_PN_OFFSET + i] ^= mask[1 + i];
+    return QUIC_HEADER_SIZE + length + QUIC_TAG_SIZE;
+}
+
+// Removes header protection and decrypts in place. On success the payload
+// is at packet + QUIC_HEADER_SIZE and `length` - QUIC_HEADER_SIZE -
+// QUIC_TAG_SIZE bytes long. Returns false for short or forged packets.
+AEAD_TARGET inline bool quic_unprotect(const AeadKey& key, uint8_t* packet, size_t length,
+                                       uint32_t& packet_number) {
+    if (length < QUIC_HEADER_SIZE + QUIC_TAG_SIZE) return false;
+    uint8_t mask[5];
+    quic_header_mask(key, packet + QUIC_SAMPLE_OFFSET, mask);
+    packet[0] ^= mask[0] & 0x1f;
+    for (int i = 0; i < 4; i++) packet[QUIC_PN_OFFSET + i] ^= mask[1 + i];
+    if (packet[0] != QUIC_SHORT_HEADER_FLAGS) return false;
+
+    uint32_t pn;
+    memcpy(&pn, packet + QUIC_PN_OFFSET, 4);
+    packet_number = __builtin_bswap32(pn);
+
+    size_t body_length = length - QUIC_HEADER_SIZE - QUIC_TAG_SIZE;
+    uint8_t* body = packet + QUIC_HEADER_SIZE;
+    return aead_open(key, packet_number, packet, QUIC_HEADER_SIZE, body, body_length, body + body_length);
+}
@@ -0,0 +1,217 @@
+#pragma once
+
+// Rolling per-symbol trade analytics: session VWAP, OHLC bars at up to
+// ANALYTICS_LANES intervals at once, and a session volume profile.
+//
+// State is laid out structure-of-arrays: one column per field (open, high,
+// low, close, volume, notional, trades), indexed by symbol. Each symbol's
+// slot in a column holds one value per bar interval, the interval being the
+// SIMD lane. A trade updates all intervals of its symbol with a single AVX2
+// operation per column; the scalar path loops over the lanes. Closing an
+// interval's bars walks that lane across all symbols.
+//
+// The volume profile buckets each symbol's session volume into PROFILE_BINS
+// price bins of PROFILE_BIN_WIDTH, centred on the symbol's first trade.
+
+#include <immintrin.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+const int ANALYTICS_LANES = 4;                   // Bar intervals updated together
+const uint32_t ANALYTICS_MAX_SYMBOLS = 65536;    // MarketMessage symbols are 16 bit
+const int PROFILE_BINS = 32;
+const int64_t PROFILE_BIN_WIDTH = 100;           // One cent at 4 decimal places
+
+enum class AnalyticsUpdate { Scalar, Avx2 };
+
+// One closed bar as published to subscribers. Prices are fixed point with 4
+// decimal places, as in MarketMessage.
+struct AnalyticsBar {
+    uint16_t symbol;
+    uint16_t lane;           // Which interval
+    uint32_t trades;
+    uint64_t end_ns;         // Bar boundary, steady clock
+    int64_t open;
+    int64_t high;
+    int64_t low;
+    int64_t close;
+    uint64_t volume;
+    int64_t vwap;            // Of this bar
+    int64_t session_vwap;
+    int64_t profile_peak;    // Price of the session's highest volume bin
+};
+
+inline AnalyticsUpdate analytics_best_update() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? AnalyticsUpdate::Avx2 : AnalyticsUpdate::Scalar;
+}
+
+// Returns false for an unknown name or one this CPU cannot run
+inline bool parse_analytics_update(const std::string& name, AnalyticsUpdate& update) {
+    if (name == "scalar") {
+        update = AnalyticsUpdate::Scalar;
+    } else if (name == "avx2") {
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("avx2")) return false;
+        update = AnalyticsUpdate::Avx2;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline const char* analytics_update_name(AnalyticsUpdate update) {
+    return update == AnalyticsUpdate::Avx2 ? "avx2" : "scalar";
+}
+
+class TradeAnalytics {
+private:
+    AnalyticsUpdate mode;
+    size_t capacity;  // Symbols the columns hold
+
+    // Bar columns, ANALYTICS_LANES values per symbol
+    std::vector<int64_t> open;
+    std::vector<int64_t> high;
+    std::vector<int64_t> low;
+    std::vector<int64_t> close;
+    std::vector<int64_t> volume;
+    std::vector<int64_t> trades;
+    std::vector<double> notional;
+
+    // Session columns, one value per symbol
+    std::vector<int64_t> session_volume;
+    std::vector<double> session_notional;
+    std::vector<int64_t> profile_base;       // Price at the bottom of bin 0, 0 before the first trade
+    std::vector<uint64_t> profile;           // PROFILE_BINS per symbol
+    std::vector<uint8_t> peak_bin;           // Highest volume bin so far, kept up per trade
+
+    void grow(size_t symbols) {
+        size_t lanes = symbols * ANALYTICS_LANES;
+        for (std::vector<int64_t>* column : {&open, &high, &low, &close, &volume, &trades}) column->resize(lanes, 0);
+        notional.resize(lanes, 0.0);
+        session_volume.resize(symbols, 0);
+        session_notional.resize(symbols, 0.0);
+        profile_base.resize(symbols, 0);
+        profile.resize(symbols * PROFILE_BINS, 0);
+        peak_bin.resize(symbols, 0);
+        capacity = symbols;
+    }
+
+    void update_bars_scalar(size_t at, int64_t price, int64_t quantity, double value) {
+        for (int lane = 0; lane < ANALYTICS_LANES; lane++) {
+            size_t i = at + lane;
+            if (volume[i] == 0) {
+                open[i] = high[i] = low[i] = price;
+            } else {
+                if (price > high[i]) high[i] = price;
+                if (price < low[i]) low[i] = price;
+            }
+            close[i] = price;
+            volume[i] += quantity;
+            trades[i]++;
+            notional[i] += value;
+        }
+    }
+
+    __attribute__((target("avx2")))
+    void update_bars_avx2(size_t at, int64_t price, int64_t quantity, double value) {
+        __m256i p = _mm256_set1_epi64x(price);
+        __m256i v = _mm256_loadu_si256((const __m256i*)&volume[at]);
+        __m256i fresh = _mm256_cmpeq_epi64(v, _mm256_setzero_si256());
+        __m256i o = _mm256_loadu_si256((const __m256i*)&open[at]);
+        __m256i h = _mm256_loadu_si256((const __m256i*)&high[at]);
+        __m256i l = _mm256_loadu_si256((const __m256i*)&low[at]);
+        __m256i t = _mm256_loadu_si256((const __m256i*)&trades[at]);
+        __m256d n = _mm256_loadu_pd(&notional[at]);
+
+        o = _mm256_blendv_epi8(o, p, fresh);
+        h = _mm256_blendv_epi8(h, p, _mm256_or_si256(fresh, _mm256_cmpgt_epi64(p, h)));
+        l = _mm256_blendv_epi8(l, p, _mm256_or_si256(fresh, _mm256_cmpgt_epi64(l, p)));
+        v = _mm256_add_epi64(v, _mm256_set1_epi64x(quantity));
+        t = _mm256_add_epi64(t, _mm256_set1_epi64x(1));
+        n = _mm256_add_pd(n, _mm256_set1_pd(value));
+
+        _mm256_storeu_si256((__m256i*)&open[at], o);
+        _mm256_storeu_si256((__m256i*)&high[at], h);
+        _mm256_storeu_si256((__m256i*)&low[at], l);
+        _mm256_storeu_si256((__m256i*)&close[at], p);
+        _mm256_storeu_si256((__m256i*)&volume[at], v);
+        _mm256_storeu_si256((__m256i*)&trades[at], t);
+        _mm256_storeu_pd(&notional[at], n);
+    }
+
+public:
+    uint64_t trade_count = 0;
+
+    explicit TradeAnalytics(AnalyticsUpdate update = analytics_best_update(), size_t symbols = 1024)
+        : mode(update), capacity(0) {
+        grow(symbols);
+    }
+
+    size_t symbols() const {
+        return capacity;
+    }
+
+    void add_trade(uint16_t symbol, int64_t price, uint32_t quantity) {
+        if (symbol >= capacity) grow(std::min<size_t>(ANALYTICS_MAX_SYMBOLS, std::max<size_t>(capacity * 2, symbol + 1)));
+        trade_count++;
+        double value = (double)price * quantity;
+        size_t at = (size_t)symbol * ANALYTICS_LANES;
+        if (mode == AnalyticsUpdate::Avx2) {
+            update_bars_avx2(at, price, quantity, value);
+        } else {
+            update_bars_scalar(at, price, quantity, value);
+        }
+
+        session_volume[symbol] += quantity;
+        session_notional[symbol] += value;
+        if (profile_base[symbol] == 0) profile_base[symbol] = price - PROFILE_BINS / 2 * PROFILE_BIN_WIDTH;
+        int64_t bin = (price - profile_base[symbol]) / PROFILE_BIN_WIDTH;
+        bin = bin < 0 ? 0 : bin >= PROFILE_BINS ? PROFILE_BINS - 1 : bin;  // Outliers land in the end bins
+        uint64_t* bins = &profile[(size_t)symbol * PROFILE_BINS];
+        bins[bin] += quantity;
+        if (bins[bin] > bins[peak_bin[symbol]]) peak_bin[symbol] = (uint8_t)bin;
+    }
+
+    int64_t session_vwap(uint16_t symbol) const {
+        if (symbol >= capacity || session_volume[symbol] == 0) return 0;
+        return (int64_t)(session_notional[symbol] / session_volume[symbol] + 0.5);
+    }
+
+    // Price at the middle of the symbol's highest volume bin, 0 if none
+    int64_t profile_peak(uint16_t symbol) const {
+        if (symbol >= capacity || profile_base[symbol] == 0) return 0;
+        return profile_base[symbol] + peak_bin[symbol] * PROFILE_BIN_WIDTH + PROFILE_BIN_WIDTH / 2;
+    }
+
+    // Appends the bars of every symbol that traded in this lane's interval
+    // and starts the lane's next bar. Returns the number of bars closed.
+    size_t close_bars(int lane, uint64_t end_ns, std::vector<AnalyticsBar>& out) {
+        size_t closed = 0;
+        for (size_t symbol = 0; symbol < capacity; symbol++) {
+            size_t i = symbol * ANALYTICS_LANES + lane;
+            if (volume[i] == 0) continue;
+            AnalyticsBar bar;
+            bar.symbol = (uint16_t)symbol;
+            bar.lane = (uint16_t)lane;
+            bar.trades = (uint32_t)trades[i];
+            bar.end_ns = end_ns;
+            bar.open = open[i];
+            bar.high = high[i];
+            bar.low = low[i];
+            bar.close = close[i];
+            bar.volume = (uint64_t)volume[i];
+            bar.vwap = (int64_t)(notional[i] / volume[i] + 0.5);
+            bar.session_vwap = session_vwap((uint16_t)symbol);
+            bar.profile_peak = profile_peak((uint16_t)symbol);
+            out.push_back(bar);
+            volume[i] = 0;
+            trades[i] = 0;
+            notional[i] = 0.0;
+            closed++;
+        }
+        return closed;
+    }
+};
@@ -0,0 +1,129 @@
+#pragma once
+
+// Client-side load balancing over equivalent replicas. Each replica tracks
+// its outstanding requests and an EWMA of its response time; pick() chooses
+// a replica by the policy:
+//
+//   RoundRobin        next replica in turn, blind to load
+//   LeastOutstanding  fewest requests in flight, ties broken at random
+//   PowerOfTwo        two distinct replicas at random, the lower
+//                     (outstanding + 1) * EWMA latency wins
+//
+// The EWMA of a replica that stops getting traffic halves every
+// BALANCE_DECAY_NS, so a replica that was slow is probed again once it may
+// have recovered. State is shared by all client threads; updates are
+// relaxed atomics and a lost EWMA update only costs one sample.
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+
+const uint64_t BALANCE_DECAY_NS = 100000000;  // 100 ms
+const int BALANCE_EWMA_SHIFT = 3;             // New sample weighs 1/8
+
+enum class BalancePolicy { RoundRobin, LeastOutstanding, PowerOfTwo };
+
+inline bool parse_balance_policy(const std::string& name, BalancePolicy& policy) {
+    if (name == "round-robin") policy = BalancePolicy::RoundRobin;
+    else if (name == "least-outstanding") policy = BalancePolicy::LeastOutstanding;
+    else if (name == "p2c") policy = BalancePolicy::PowerOfTwo;
+    else return false;
+    return true;
+}
+
+inline const char* balance_policy_name(BalancePolicy policy) {
+    switch (policy) {
+        case BalancePolicy::RoundRobin: return "round-robin";
+        case BalancePolicy::LeastOutstanding: return "least-outstanding";
+        case BalancePolicy::PowerOfTwo: return "p2c";
+    }
+    return "unknown";
+}
+
+class ReplicaBalancer {
+private:
+    struct Replica {
+        std::atomic<int> outstanding{0};
+        std::atomic<uint64_t> ewma_ns{0};
+        std::atomic<uint64_t> updated_ns{0};
+        std::atomic<uint64_t> requests{0};
+    };
+
+    BalancePolicy policy;
+    size_t count;
+    std::unique_ptr<Replica[]> replicas;
+    std::atomic<uint64_t> next{0};
+
+    static uint64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    uint64_t score(size_t r, uint64_t now) const {
+        uint64_t ewma = replicas[r].ewma_ns.load(std::memory_order_relaxed);
+        uint64_t idle = now - std::min(now, replicas[r].updated_ns.load(std::memory_order_relaxed));
+        uint64_t halvings = idle / BALANCE_DECAY_NS;
+        ewma = halvings >= 64 ? 0 : ewma >> halvings;
+        return (uint64_t)(replicas[r].outstanding.load(std::memory_order_relaxed) + 1) * (ewma + 1);
+    }
+
+public:
+    ReplicaBalancer(size_t replica_count, BalancePolicy balance_policy)
+        : policy(balance_policy), count(replica_count), replicas(new Replica[replica_count]) {}
+
+    // random: a fresh 64-bit value from the caller's generator
+    size_t pick(uint64_t random) {
+        if (count < 2) return 0;
+        switch (policy) {
+            case BalancePolicy::RoundRobin:
+                return next.fetch_add(1, std::memory_order_relaxed) % count;
+            case BalancePolicy::LeastOutstanding: {
+                size_t start = random % count;
+                size_t best = start;
+                for (size_t i = 1; i < count; i++) {
+                    size_t r = (start + i) % count;
+                    if (replicas[r].outstanding.load(std::memory_order_relaxed) <
+                        replicas[best].outstanding.load(std::memory_order_relaxed)) {
+                        best = r;
+                    }
+                }
+                return best;
+            }
+            case BalancePolicy::PowerOfTwo: {
+                size_t a = random % count;
+                size_t b = (a + 1 + (random >> 32) % (count - 1)) % count;
+                uint64_t now = now_ns();
+                return score(a, now) <= score(b, now) ? a : b;
+            }
+        }
+        return 0;
+    }
+
+    void start(size_t r) {
+        replicas[r].outstanding.fetch_add(1, std::memory_order_relaxed);
+        replicas[r].requests.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void finish(size_t r, uint64_t latency_ns) {
+        replicas[r].outstanding.fetch_sub(1, std::memory_order_relaxed);
+        uint64_t ewma = replicas[r].ewma_ns.load(std::memory_order_relaxed);
+        ewma = ewma == 0 ? latency_ns : ewma - (ewma >> BALANCE_EWMA_SHIFT) + (latency_ns >> BALANCE_EWMA_SHIFT);
+        replicas[r].ewma_ns.store(ewma, std::memory_order_relaxed);
+        replicas[r].updated_ns.store(now_ns(), std::memory_order_relaxed);
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    uint64_t requests(size_t r) const {
+        return replicas[r].requests.load(std::memory_order_relaxed);
+    }
+
+    uint64_t ewma_ns(size_t r) const {
+        return replicas[r].ewma_ns.load(std::memory_order_relaxed);
+    }
+};
@@ -0,0 +1,1192 @@
+#pragma once
+
+// Asynchronous client for the server's TCP, UDP and QUIC echo ports. A
+// ClientLoop is a single-threaded epoll reactor that keeps microsecond
+// timers by waiting with epoll_pwait2's nanosecond timeout (a timerfd before
+// Linux 5.11); a Client is a pool of connections (TCP) or sockets
+// (UDP, QUIC) on one loop. request() hands a payload to the least loaded
+// member and calls back with its echo, a timeout or a failure:
+//
+//   ClientLoop loop;
+//   ClientOptions options;
+//   options.protocol = ClientProtocol::Udp;
+//   options.port = 9001;
+//   Client client(loop, options);
+//   client.open();
+//   client.request(data, length, [](ClientReply& reply) { ... });
+//   loop.run_until([&] { return client.outstanding() == 0; });
+//
+// Each member keeps up to options.pipeline requests in flight and queues
+// the rest. TCP echoes come back in order, so replies are matched by
+// position; a request that times out still owns its bytes in the stream,
+// which are discarded when they arrive. A TCP connection that fails fails
+// its requests in flight and reconnects with exponential backoff; queued
+// requests wait for it, within their timeouts.
+//
+// UDP requests carry an IdempotentHeader (idempotency.h) and QUIC requests
+// a "[id:attempt]" tag after the connection ID, so replies are matched by
+// request and attempt. Both retransmit after the socket's RetransmitTimer
+// (rto.h) timeout, doubled per attempt, until the request's timeout; the
+// UDP server answers retransmissions from its idempotency cache. Replies
+// hold the payload alone, without header, tag or "QUIC Echo: " prefix.
+// QUIC packets may be protected as well (options.quic_aead, aead.h).
+//
+// With options.hedge, a request still unanswered after the HedgeTrigger's
+// delay (hedge.h) goes out again on a second socket or connection, to
+// options.hedge_port or the same port, and whichever reply comes first
+// completes it.
+//
+// A loop and its clients belong to the thread that runs the loop, and
+// callbacks run on it. Other threads hand work over with post(), or start()
+// the loop on its own thread and use the future form of request(). Clients
+// must not be destroyed from inside a callback.
+//
+// Channels are ClientHandlers, the loop's interface for descriptor events
+// and timers; anything else may share a loop the same way (script.h does).
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "aead.h"
+#include "hedge.h"
+#include "idempotency.h"
+#include "rto.h"
+
+const uint64_t CLIENT_DEFAULT_TIMEOUT_NS = 1000000000ULL;
+const size_t CLIENT_DEFAULT_PIPELINE = 16;                // Requests in flight per connection or socket
+const uint64_t CLIENT_RECONNECT_MIN_NS = 10000000ULL;     // 10 ms, doubling per failed attempt...
+const uint64_t CLIENT_RECONNECT_MAX_NS = 1000000000ULL;   // ...up to 1 s
+const int CLIENT_MAX_EVENTS = 64;
+const size_t CLIENT_READ_SIZE = 64 * 1024;
+const int CLIENT_RECV_BATCH = 32;                         // Datagrams per recvmmsg
+const size_t CLIENT_DATAGRAM_SIZE = 2048;                 // The server's receive buffer
+const size_t CLIENT_QUIC_ECHO_LIMIT = 1024;               // The server echoes at most this much of a QUIC packet
+const int CLIENT_MAX_ATTEMPTS = 16;                       // One hex digit in the QUIC tag
+const uint32_t CLIENT_HEDGE_CONNECTION_OFFSET = 1000000;  // QUIC connection IDs of the hedge sockets
+const char CLIENT_QUIC_ECHO_PREFIX[] = "QUIC Echo: ";
+const size_t CLIENT_QUIC_ECHO_PREFIX_SIZE = sizeof(CLIENT_QUIC_ECHO_PREFIX) - 1;
+
+inline uint64_t client_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+enum class ClientProtocol { Tcp, Udp, Quic };
+enum class ClientStatus { Ok, Timeout, Failed };
+
+struct ClientReply {
+    ClientStatus status = ClientStatus::Failed;
+    std::string data;         // The echoed payload
+    uint64_t latency_ns = 0;
+    int attempts = 0;         // Transmissions; more than one after retransmission
+    int attempt = 0;          // The transmission answered, from 0
+    bool hedge_won = false;   // Answered on the hedge path
+};
+
+typedef std::function<void(ClientReply&)> ClientCallback;
+
+struct ClientOptions {
+    ClientProtocol protocol = ClientProtocol::Tcp;
+    std::string host = "127.0.0.1";
+    int port = 0;
+    size_t connections = 1;                      // Pool size
+    size_t pipeline = CLIENT_DEFAULT_PIPELINE;
+    uint64_t timeout_ns = CLIENT_DEFAULT_TIMEOUT_NS;
+    uint32_t client_id = 0;                      // UDP idempotency client and QUIC connection ID base; 0 for one unique to the Client
+    uint64_t fixed_rto_ns = 0;                   // UDP and QUIC retransmit after this, not the adaptive RTO (rto.h)
+    bool quic_aead = false;                      // QUIC packets are protected (aead.h), for a server run with --quic-aead
+    HedgeTrigger* hedge = nullptr;               // Set: requests are hedged on a second member per member (hedge.h)...
+    int hedge_port = 0;                          // ...to this port, or to port when 0
+};
+
+// Totals over a client's pool
+struct ClientCounters {
+    uint64_t requests = 0;
+    uint64_t completed = 0;
+    uint64_t timeouts = 0;
+    uint64_t failures = 0;
+    uint64_t retransmits = 0;
+    uint64_t reconnects = 0;     // TCP connections re-established after a failure
+    uint64_t bytes_sent = 0;     // On the wire, retransmissions and hedges included
+    uint64_t bytes_received = 0;
+    uint64_t crypto_ns = 0;      // Protecting and opening QUIC packets
+    uint64_t crypto_packets = 0;
+};
+
+// What the loop calls back: for events on the descriptors it watches on the
+// handler's behalf and, once add()ed, for the handler's timers
+class ClientHandler {
+public:
+    virtual ~ClientHandler() {}
+    virtual void on_events(uint32_t events) = 0;
+
+    // Earliest timer, 0 for none
+    virtual uint64_t next_timer_ns() {
+        return 0;
+    }
+
+    virtual void on_timer(uint64_t) {}
+};
+
+class ClientLoop {
+private:
+    int epoll_fd;
+    int wake_fd;      // post() and stop() from other threads
+    int timer_fd;     // Earliest handler timer, without epoll_pwait2
+    uint64_t timer_armed_ns = 0;
+    bool precise_wait = true;   // epoll_pwait2 is there
+    std::vector<ClientHandler*> handlers;
+    std::mutex post_mutex;
+    std::vector<std::function<void()>> posted;
+    std::vector<std::function<void()>> running;
+    std::atomic<bool> stopping{false};
+    std::thread thread;
+
+    void arm_timer(uint64_t when_ns);
+    void run_timers(uint64_t now_ns);
+
+    void run_posted() {
+        {
+            std::lock_guard<std::mutex> lock(post_mutex);
+            running.swap(posted);
+        }
+        for (auto& work : running) work();
+        running.clear();
+    }
+
+public:
+    ClientLoop() {
+        epoll_fd = epoll_create1(0);
+        wake_fd = eventfd(0, EFD_NONBLOCK);
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (epoll_fd == -1 || wake_fd == -1 || timer_fd == -1) {
+            perror("client loop");
+            return;
+        }
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;   // The loop's own descriptors
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev);
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+    }
+
+    ~ClientLoop() {
+        stop();
+        if (timer_fd != -1) close(timer_fd);
+        if (wake_fd != -1) close(wake_fd);
+        if (epoll_fd != -1) close(epoll_fd);
+    }
+
+    bool ok() const {
+        return epoll_fd != -1 && wake_fd != -1 && timer_fd != -1;
+    }
+
+    // Registers fd for events on behalf of handler, or changes its events
+    void watch(int fd, uint32_t events, ClientHandler* handler, bool registered) {
+        struct epoll_event ev;
+        ev.events = events;
+        ev.data.ptr = handler;
+        epoll_ctl(epoll_fd, registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    void unwatch(int fd) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    // Handlers with timers
+    void add(ClientHandler* handler) {
+        handlers.push_back(handler);
+    }
+
+    void remove(ClientHandler* handler) {
+        handlers.erase(std::remove(handlers.begin(), handlers.end(), handler), handlers.end());
+    }
+
+    // Runs work on the loop's thread. Safe from any thread.
+    void post(std::function<void()> work) {
+        {
+            std::lock_guard<std::mutex> lock(post_mutex);
+            posted.push_back(std::move(work));
+        }
+        uint64_t one = 1;
+        ssize_t written = write(wake_fd, &one, sizeof(one));
+        (void)written;
+    }
+
+    // One wait of at most max_wait_ns, then the ready descriptors, due
+    // timers and posted work
+    void run_once(uint64_t max_wait_ns);
+
+    void run_until(const std::function<bool()>& done, uint64_t max_wait_ns = 1000000) {
+        while (!done()) run_once(max_wait_ns);
+    }
+
+    // Runs the loop on a thread of its own until stop()
+    void start() {
+        stopping = false;
+        thread = std::thread([this]() {
+            while (!stopping) run_once(CLIENT_RECONNECT_MAX_NS);
+        });
+    }
+
+    void stop() {
+        if (!thread.joinable()) return;
+        stopping = true;
+        post([]() {});
+        thread.join();
+    }
+};
+
+// One connection or socket of a pool. Keeps its requests by ID, the ones
+// not yet sent in order, and a heap of deadlines and retransmission times.
+class ClientChannel : public ClientHandler {
+protected:
+    struct Request {
+        std::string payload;
+        ClientCallback done;
+        uint64_t start_ns = 0;
+        uint64_t sent_ns[CLIENT_MAX_ATTEMPTS] = {};  // Each datagram transmission
+        uint64_t deadline_ns = 0;
+        int attempts = 0;
+    };
+
+    struct Timer {
+        uint64_t when_ns;
+        uint64_t id;
+        int attempt;                // Retransmission due unless answered since; -1 for the deadline
+        bool operator>(const Timer& other) const {
+            return when_ns > other.when_ns;
+        }
+    };
+
+    ClientLoop& loop;
+    const ClientOptions& options;
+    ClientCounters& counters;
+    struct sockaddr_in server;
+    int fd = -1;
+    bool registered = false;
+    std::unordered_map<uint64_t, Request> requests;
+    std::deque<uint64_t> queued;
+    size_t in_flight = 0;
+    uint64_t next_id = 1;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+    ClientReply reply;              // Reused for every completion
+    bool finishing = false;
+    uint32_t watched = 0;
+
+    // Calls back and forgets the request; the caller accounts for in_flight.
+    // A completion inside a callback (a failed send) gets a reply of its own.
+    void finish(std::unordered_map<uint64_t, Request>::iterator it, ClientStatus status,
+                const char* data, size_t length, int attempt = -1) {
+        Request request = std::move(it->second);
+        requests.erase(it);
+        ClientReply nested;
+        ClientReply& reply = finishing ? nested : this->reply;
+        bool outer = !finishing;
+        finishing = true;
+        reply.status = status;
+        reply.data.assign(data, length);
+        reply.latency_ns = client_now_ns() - request.start_ns;
+        reply.attempts = request.attempts;
+        reply.attempt = attempt >= 0 ? attempt : std::max(0, request.attempts - 1);
+        reply.hedge_won = false;
+        if (status == ClientStatus::Ok) {
+            counters.completed++;
+        } else if (status == ClientStatus::Timeout) {
+            counters.timeouts++;
+        } else {
+            counters.failures++;
+        }
+        request.done(reply);
+        if (outer) finishing = false;
+    }
+
+    // Sends queued requests while the pipeline has room
+    void pump() {
+        while (!queued.empty() && in_flight < options.pipeline && ready()) {
+            uint64_t id = queued.front();
+            queued.pop_front();
+            auto it = requests.find(id);
+            if (it == requests.end()) continue;  // Timed out while queued
+            in_flight++;
+            transmit(id, it->second);
+        }
+    }
+
+    void watch(uint32_t events) {
+        if (registered && events == watched) return;
+        loop.watch(fd, events, this, registered);
+        registered = true;
+        watched = events;
+    }
+
+    void close_socket() {
+        if (fd == -1) return;
+        loop.unwatch(fd);
+        close(fd);
+        fd = -1;
+        registered = false;
+    }
+
+    virtual bool ready() = 0;         // Whether queued[0] may be sent now
+    virtual void transmit(uint64_t id, Request& request) = 0;
+    // Accounts for a request about to be dropped unanswered
+    virtual void release(std::unordered_map<uint64_t, Request>::iterator it) = 0;
+    virtual void retransmit(uint64_t, Request&) {}
+
+    void expire(std::unordered_map<uint64_t, Request>::iterator it) {
+        release(it);
+        finish(it, ClientStatus::Timeout, nullptr, 0);
+    }
+
+public:
+    ClientChannel(ClientLoop& client_loop, const ClientOptions& client_options, ClientCounters& client_counters,
+                  const struct sockaddr_in& address)
+        : loop(client_loop), options(client_options), counters(client_counters), server(address) {
+        loop.add(this);
+    }
+
+    virtual ~ClientChannel() {
+        loop.remove(this);
+        close_socket();
+    }
+
+    virtual bool open() = 0;
+
+    // Queues a request and returns its ID. A hedge passes the ID of the
+    // original, so a UDP hedge carries the same idempotency sequence.
+    uint64_t submit(const char* data, size_t length, ClientCallback done, uint64_t timeout_ns, uint64_t id = 0) {
+        if (!id) id = next_id;
+        next_id = std::max(next_id, id + 1);
+        Request& request = requests[id];
+        request.payload.assign(data, length);
+        request.done = std::move(done);
+        request.start_ns = client_now_ns();
+        request.deadline_ns = request.start_ns + (timeout_ns ? timeout_ns : options.timeout_ns);
+        timers.push(Timer{request.deadline_ns, id, -1});
+        queued.push_back(id);
+        pump();
+        return id;
+    }
+
+    // Forgets a request without calling back: the other path answered it
+    void cancel(uint64_t id) {
+        auto it = requests.find(id);
+        if (it == requests.end()) return;
+        release(it);
+        requests.erase(it);
+        pump();
+    }
+
+    // Earliest timer, 0 for none. Timers of requests that completed since
+    // are dropped here rather than woken for.
+    uint64_t next_timer_ns() override {
+        while (!timers.empty()) {
+            const Timer& top = timers.top();
+            auto it = requests.find(top.id);
+            if (it != requests.end() && (top.attempt == -1 || top.attempt == it->second.attempts - 1)) {
+                return top.when_ns;
+            }
+            timers.pop();
+        }
+        return 0;
+    }
+
+    void on_timer(uint64_t now_ns) override {
+        while (!timers.empty() && timers.top().when_ns <= now_ns) {
+            Timer timer = timers.top();
+            timers.pop();
+            auto it = requests.find(timer.id);
+            if (it == requests.end()) continue;
+            if (timer.attempt == -1) {
+                expire(it);
+            } else if (timer.attempt == it->second.attempts - 1) {
+                retransmit(timer.id, it->second);
+            }
+        }
+        pump();
+    }
+
+    virtual bool connected() const {
+        return fd != -1;
+    }
+
+    size_t load() const {
+        return requests.size();
+    }
+
+    // Smoothed RTT, 0 before the first sample or where there is none
+    virtual uint64_t srtt_ns() const {
+        return 0;
+    }
+};
+
+// TCP: echoes return in order, so the request in flight longest owns the
+// next bytes. Reconnects with backoff after any failure.
+class TcpClientChannel : public ClientChannel {
+private:
+    struct InFlight {
+        uint64_t id;
+        size_t length;
+    };
+
+    bool connecting = false;
+    bool was_connected = false;
+    uint64_t reconnect_at_ns = 0;
+    uint64_t backoff_ns = CLIENT_RECONNECT_MIN_NS;
+    std::deque<InFlight> order;
+    std::string out;
+    size_t out_offset = 0;
+    std::string echo;               // Bytes of order.front() so far
+    size_t discard = 0;             // Bytes of order.front() so far, when its request is gone
+    std::vector<char> read_buffer;
+
+    bool ready() override {
+        return fd != -1 && !connecting;
+    }
+
+    void transmit(uint64_t id, Request& request) override {
+        request.attempts++;
+        order.push_back(InFlight{id, request.payload.size()});
+        bool idle = out_offset == out.size();
+        out.append(request.payload);
+        counters.bytes_sent += request.payload.size();
+        if (idle) flush();
+    }
+
+    // The request stays in order: its echo is still coming and is skipped
+    void release(std::unordered_map<uint64_t, Request>::iterator it) override {
+        if (it->second.attempts > 0 && order.front().id == it->first) {
+            discard = echo.size();
+            echo.clear();
+        }
+    }
+
+    void flush() {
+        while (out_offset < out.size()) {
+            ssize_t n = send(fd, out.data() + out_offset, out.size() - out_offset, MSG_NOSIGNAL);
+            if (n > 0) {
+                out_offset += n;
+                continue;
+            }
+            if (n == -1 && errno == EINTR) continue;
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            disconnect();
+            return;
+        }
+        if (out_offset == out.size()) {
+            out.clear();
+            out_offset = 0;
+        }
+        watch(EPOLLIN | EPOLLRDHUP | (out.empty() ? 0u : (uint32_t)EPOLLOUT));
+    }
+
+    void receive() {
+        while (fd != -1) {
+            ssize_t n = recv(fd, read_buffer.data(), read_buffer.size(), 0);
+            if (n == -1 && errno == EINTR) continue;
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+            if (n <= 0) {
+                disconnect();
+                return;
+            }
+            counters.bytes_received += n;
+            consume(read_buffer.data(), n);
+        }
+    }
+
+    void consume(const char* data, size_t length) {
+        while (length > 0 && !order.empty()) {
+            InFlight& head = order.front();
+            auto it = requests.find(head.id);
+            size_t have = it == requests.end() ? discard : echo.size();
+            size_t take = std::min(length, head.length - have);
+            if (it == requests.end()) {
+                discard += take;
+            } else {
+                echo.append(data, take);
+            }
+            data += take;
+            length -= take;
+            if (have + take < head.length) return;
+
+            order.pop_front();
+            in_flight--;
+            discard = 0;
+            if (it != requests.end()) finish(it, ClientStatus::Ok, echo.data(), echo.size());
+            echo.clear();
+        }
+        pump();
+    }
+
+    // Fails what is in flight, keeps what is queued, and schedules the
+    // reconnect
+    void disconnect() {
+        close_socket();
+        connecting = false;
+        out.clear();
+        out_offset = 0;
+        echo.clear();
+        discard = 0;
+        std::deque<InFlight> failed;
+        failed.swap(order);
+        in_flight = 0;
+        for (const InFlight& entry : failed) {
+            auto it = requests.find(entry.id);
+            if (it != requests.end()) finish(it, ClientStatus::Failed, nullptr, 0);
+        }
+        reconnect_at_ns = client_now_ns() + backoff_ns;
+        backoff_ns = std::min(CLIENT_RECONNECT_MAX_NS, backoff_ns * 2);
+    }
+
+    bool connect_socket() {
+        reconnect_at_ns = 0;
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (fd == -1) {
+            perror("client socket");
+            return false;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (connect(fd, (const struct sockaddr*)&server, sizeof(server)) == 0) {
+            connected_now();
+            return true;
+        }
+        if (errno != EINPROGRESS) {
+            disconnect();
+            return false;
+        }
+        connecting = true;
+        watch(EPOLLOUT);
+        return true;
+    }
+
+    void connected_now() {
+        connecting = false;
+        backoff_ns = CLIENT_RECONNECT_MIN_NS;
+        if (was_connected) counters.reconnects++;
+        was_connected = true;
+        watch(EPOLLIN | EPOLLRDHUP);
+        pump();
+    }
+
+public:
+    TcpClientChannel(ClientLoop& client_loop, const ClientOptions& client_options, ClientCounters& client_counters,
+                     const struct sockaddr_in& address)
+        : ClientChannel(client_loop, client_options, client_counters, address), read_buffer(CLIENT_READ_SIZE) {}
+
+    bool open() override {
+        return connect_socket();
+    }
+
+    bool connected() const override {
+        return fd != -1 && !connecting;
+    }
+
+    void on_events(uint32_t events) override {
+        if (fd == -1) return;
+        if (connecting) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length);
+            if (error != 0 || (events & (EPOLLERR | EPOLLHUP))) {
+                disconnect();
+            } else {
+                connected_now();
+            }
+            return;
+        }
+        if (events & EPOLLIN) receive();
+        if (fd != -1 && (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))) {
+            disconnect();
+            return;
+        }
+        if (fd != -1 && (events & EPOLLOUT)) flush();
+    }
+
+    uint64_t next_timer_ns() override {
+        uint64_t next = ClientChannel::next_timer_ns();
+        if (reconnect_at_ns && (!next || reconnect_at_ns < next)) next = reconnect_at_ns;
+        return next;
+    }
+
+    void on_timer(uint64_t now_ns) override {
+        if (reconnect_at_ns && reconnect_at_ns <= now_ns) connect_socket();
+        ClientChannel::on_timer(now_ns);
+    }
+};
+
+// UDP and QUIC: one connected socket, replies matched by request and
+// attempt, retransmission on the socket's RTO
+class DatagramClientChannel : public ClientChannel {
+private:
+    RetransmitTimer rto;
+    std::string packet;
+    struct mmsghdr headers[CLIENT_RECV_BATCH];
+    struct iovec iovecs[CLIENT_RECV_BATCH];
+    char buffers[CLIENT_RECV_BATCH][CLIENT_DATAGRAM_SIZE];
+
+    void retransmit(uint64_t id, Request& request) override {
+        if (request.attempts >= CLIENT_MAX_ATTEMPTS) return;  // Wait for the deadline
+        counters.retransmits++;
+        transmit(id, request);
+    }
+
+    void release(std::unordered_map<uint64_t, Request>::iterator it) override {
+        if (it->second.attempts > 0) in_flight--;
+    }
+
+    void receive() {
+        while (true) {
+            for (int i = 0; i < CLIENT_RECV_BATCH; i++) {
+                iovecs[i].iov_base = buffers[i];
+                iovecs[i].iov_len = CLIENT_DATAGRAM_SIZE;
+                memset(&headers[i].msg_hdr, 0, sizeof(headers[i].msg_hdr));
+                headers[i].msg_hdr.msg_iov = &iovecs[i];
+                headers[i].msg_hdr.msg_iovlen = 1;
+            }
+            int n = recvmmsg(fd, headers, CLIENT_RECV_BATCH, MSG_DONTWAIT, nullptr);
+            if (n <= 0) break;  // Drained, or ECONNREFUSED while the server is away
+            for (int i = 0; i < n; i++) {
+                uint64_t id;
+                int attempt;
+                const char* payload;
+                size_t length;
+                counters.bytes_received += headers[i].msg_len;
+                if (!decode(buffers[i], headers[i].msg_len, id, attempt, payload, length)) continue;
+                auto it = requests.find(id);
+                if (it == requests.end() || attempt >= it->second.attempts) continue;
+                // The attempt names the send it answers, so even the reply
+                // to a spurious retransmission's original is a sample
+                rto.sample(client_now_ns() - it->second.sent_ns[attempt]);
+                in_flight--;
+                finish(it, ClientStatus::Ok, payload, length, attempt);
+            }
+            if (n < CLIENT_RECV_BATCH) break;
+        }
+        pump();
+    }
+
+protected:
+    bool ready() override {
+        return fd != -1;
+    }
+
+    // Each retransmission of a request waits twice as long as the last,
+    // unless the timeout is fixed. The socket's RTO itself only follows
+    // samples: with a pipeline of requests, backing it off on every expiry
+    // would compound one loss into the maximum.
+    void transmit(uint64_t id, Request& request) override {
+        encode(id, request.attempts, request.payload);
+        uint64_t timeout = options.fixed_rto_ns ? options.fixed_rto_ns
+                                                : std::min(RTO_MAX_NS, rto.timeout_ns() << request.attempts);
+        uint64_t now = client_now_ns();
+        request.sent_ns[request.attempts] = now;
+        request.attempts++;
+        timers.push(Timer{now + timeout, id, request.attempts - 1});
+        // A send that fails is as good as a lost datagram; the timer resends it
+        ssize_t written = send(fd, packet.data(), packet.size(), 0);
+        if (written > 0) counters.bytes_sent += written;
+    }
+
+    // Builds the datagram for a request's attempt into packet
+    virtual void encode(uint64_t id, int attempt, const std::string& payload) = 0;
+    // Finds the request, attempt and payload a reply carries; may rewrite
+    // the datagram in place
+    virtual bool decode(char* data, size_t length, uint64_t& id, int& attempt,
+                        const char*& payload, size_t& payload_length) = 0;
+
+    std::string& packet_buffer() {
+        return packet;
+    }
+
+public:
+    DatagramClientChannel(ClientLoop& client_loop, const ClientOptions& client_options,
+                          ClientCounters& client_counters, const struct sockaddr_in& address)
+        : ClientChannel(client_loop, client_options, client_counters, address), rto(client_options.fixed_rto_ns) {}
+
+    bool open() override {
+        fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (fd == -1) {
+            perror("client socket");
+            return false;
+        }
+        if (connect(fd, (const struct sockaddr*)&server, sizeof(server)) == -1) {
+            perror("client connect");
+            close(fd);
+            fd = -1;
+            return false;
+        }
+        watch(EPOLLIN);
+        return true;
+    }
+
+    void on_events(uint32_t events) override {
+        if (fd != -1 && (events & (EPOLLIN | EPOLLERR))) receive();
+    }
+
+    uint64_t srtt_ns() const override {
+        return rto.srtt_ns();
+    }
+};
+
+// The server drops a request more than IDEMPOTENCY_WINDOW sequences behind
+// the newest it has seen from this client as stale, so nothing is sent that
+// far ahead of the oldest request still unanswered
+class UdpClientChannel : public DatagramClientChannel {
+private:
+    IdempotentHeader header;
+    std::deque<uint64_t> sent;      // In sequence order; answered ones leave from the front
+
+    bool ready() override {
+        if (!DatagramClientChannel::ready()) return false;
+        while (!sent.empty() && !requests.count(sent.front())) sent.pop_front();
+        return sent.empty() || queued.empty() || queued.front() - sent.front() < IDEMPOTENCY_WINDOW;
+    }
+
+    void transmit(uint64_t id, Request& request) override {
+        if (request.attempts == 0) sent.push_back(id);
+        DatagramClientChannel::transmit(id, request);
+    }
+
+    void encode(uint64_t id, int attempt, const std::string& payload) override {
+        header.sequence = id;
+        header.attempt = attempt;
+        std::string& packet = packet_buffer();
+        packet.assign((const char*)&header, sizeof(header));
+        packet.append(payload);
+    }
+
+    bool decode(char* data, size_t length, uint64_t& id, int& attempt, const char*& payload,
+                size_t& payload_length) override {
+        IdempotentHeader echoed;
+        if (!parse_idempotent(data, length, echoed) || echoed.client != header.client) return false;
+        id = echoed.sequence;
+        attempt = (int)echoed.attempt;
+        payload = data + sizeof(echoed);
+        payload_length = length - sizeof(echoed);
+        return true;
+    }
+
+public:
+    UdpClientChannel(ClientLoop& client_loop, const ClientOptions& client_options, ClientCounters& client_counters,
+                     const struct sockaddr_in& address, uint32_t client)
+        : DatagramClientChannel(client_loop, client_options, client_counters, address) {
+        memset(&header, 0, sizeof(header));
+        header.magic = IDEMPOTENT_MAGIC;
+        header.client = client;
+    }
+};
+
+// [connection ID]["[id:attempt]"][payload], echoed as
+// [connection ID]["QUIC Echo: "]["[id:attempt]"][payload]. The server
+// echoes the ID in host order. With options.quic_aead everything after the
+// connection ID is sealed into a protected packet (aead.h), and the opened
+// reply is "QUIC Echo: " and the rest, without the ID.
+class QuicClientChannel : public DatagramClientChannel {
+private:
+    uint32_t connection_id;   // Network order
+    uint32_t echoed_id;
+    char tag[32];
+    QuicPacketKeys keys;
+    uint32_t packet_number = 0;
+    std::string plain;        // A protected packet's contents before sealing
+
+    void encode(uint64_t id, int attempt, const std::string& payload) override {
+        static const char attempt_digits[] = "0123456789abcdef";
+        int tag_size = snprintf(tag, sizeof(tag), "[%llu:%c]", (unsigned long long)id, attempt_digits[attempt]);
+        std::string& packet = options.quic_aead ? plain : packet_buffer();
+        packet.assign((const char*)&connection_id, sizeof(connection_id));
+        packet.append(tag, tag_size);
+        packet.append(payload);
+        if (!options.quic_aead) return;
+
+        uint64_t start = client_now_ns();
+        std::string& sealed = packet_buffer();
+        sealed.resize(QUIC_HEADER_SIZE + plain.size() - sizeof(connection_id) + QUIC_TAG_SIZE);
+        quic_protect(keys.client, connection_id, packet_number++, (const uint8_t*)plain.data() + sizeof(connection_id),
+                     plain.size() - sizeof(connection_id), (uint8_t*)&sealed[0]);
+        counters.crypto_ns += client_now_ns() - start;
+        counters.crypto_packets++;
+    }
+
+    bool decode(char* data, size_t length, uint64_t& id, int& attempt, const char*& payload,
+                size_t& payload_length) override {
+        const char* end = data + length;
+        const char* p;
+        if (options.quic_aead) {
+            if (length < QUIC_HEADER_SIZE + QUIC_TAG_SIZE || memcmp(data + 1, &connection_id, sizeof(connection_id)) != 0) {
+                return false;
+            }
+            uint64_t start = client_now_ns();
+            uint32_t reply_number;
+            bool authentic = quic_unprotect(keys.server, (uint8_t*)data, length, reply_number);
+            counters.crypto_ns += client_now_ns() - start;
+            counters.crypto_packets++;
+            if (!authentic) return false;  // Forged or stale: not a reply
+            end -= QUIC_TAG_SIZE;
+            p = data + QUIC_HEADER_SIZE + CLIENT_QUIC_ECHO_PREFIX_SIZE;
+        } else {
+            if (length < sizeof(connection_id) || memcmp(data, &echoed_id, sizeof(echoed_id)) != 0) return false;
+            p = data + sizeof(connection_id) + CLIENT_QUIC_ECHO_PREFIX_SIZE;
+        }
+        return parse_tag(p, end, id, attempt, payload, payload_length);
+    }
+
+    // "[id:attempt]" at p, the attempt one hex digit
+    static bool parse_tag(const char* p, const char* end, uint64_t& id, int& attempt, const char*& payload,
+                          size_t& payload_length) {
+        if (end - p < 5 || *p++ != '[') return false;
+        const char* digits = p;
+        id = 0;
+        while (p < end && *p >= '0' && *p <= '9') id = id * 10 + (*p++ - '0');
+        if (p == digits || end - p < 3 || p[0] != ':' || p[2] != ']') return false;
+        char digit = p[1];
+        if (digit >= '0' && digit <= '9') {
+            attempt = digit - '0';
+        } else if (digit >= 'a' && digit <= 'f') {
+            attempt = digit - 'a' + 10;
+        } else {
+            return false;
+        }
+        payload = p + 3;
+        payload_length = end - payload;
+        return true;
+    }
+
+public:
+    QuicClientChannel(ClientLoop& client_loop, const ClientOptions& client_options, ClientCounters& client_counters,
+                      const struct sockaddr_in& address, uint32_t connection)
+        : DatagramClientChannel(client_loop, client_options, client_counters, address),
+          connection_id(htonl(connection)), echoed_id(connection) {
+        if (options.quic_aead) quic_derive_keys(connection_id, keys);
+    }
+};
+
+// Distinct client IDs for count members: consecutive from a random base
+// read once per process, so Clients of one process never share a window in
+// the server's idempotency cache and other processes only do by chance
+inline uint32_t client_allocate_ids(size_t count) {
+    static std::atomic<uint32_t> allocated{(uint32_t)std::random_device{}()};
+    return allocated.fetch_add((uint32_t)count);
+}
+
+// A pool of channels to one server port. With options.hedge, member i has a
+// twin on options.hedge_port: a request still outstanding after the
+// trigger's delay is sent on the twin too, under the same ID (and so, over
+// UDP, the same idempotency client and sequence), and the first reply wins.
+class Client : public ClientHandler {
+private:
+    struct Hedged {
+        size_t member;
+        uint64_t id = 0;            // On both paths
+        std::string payload;
+        ClientCallback done;
+        uint64_t start_ns;
+        uint64_t deadline_ns;
+        int pending = 1;            // Paths still to answer
+        bool hedge_sent = false;
+    };
+
+    ClientLoop& loop;
+    ClientOptions options;
+    struct sockaddr_in server;
+    struct sockaddr_in hedge_server;
+    std::vector<std::unique_ptr<ClientChannel>> channels;
+    std::vector<std::unique_ptr<ClientChannel>> hedge_channels;   // Twins of channels, with options.hedge
+    size_t next = 0;
+    std::unordered_map<uint64_t, Hedged> hedged;
+    std::priority_queue<std::pair<uint64_t, uint64_t>, std::vector<std::pair<uint64_t, uint64_t>>,
+                        std::greater<std::pair<uint64_t, uint64_t>>> hedge_timers;   // (when, serial)
+    uint64_t next_serial = 1;
+
+    size_t pick() {
+        size_t best = next;
+        for (size_t i = 0; i < channels.size(); i++) {
+            size_t candidate = (next + i) % channels.size();
+            const ClientChannel* channel = channels[candidate].get();
+            const ClientChannel* current = channels[best].get();
+            if ((channel->connected() && !current->connected()) ||
+                (channel->connected() == current->connected() && channel->load() < current->load())) {
+                best = candidate;
+            }
+        }
+        next = (next + 1) % channels.size();
+        return best;
+    }
+
+    ClientChannel* open_channel(const struct sockaddr_in& address, uint32_t id) {
+        ClientChannel* channel;
+        if (options.protocol == ClientProtocol::Tcp) {
+            channel = new TcpClientChannel(loop, options, counters, address);
+        } else if (options.protocol == ClientProtocol::Udp) {
+            channel = new UdpClientChannel(loop, options, counters, address, id);
+        } else {
+            channel = new QuicClientChannel(loop, options, counters, address, id);
+        }
+        return channel;
+    }
+
+    void hedged_request(size_t member, const char* data, size_t length, ClientCallback done, uint64_t timeout_ns) {
+        uint64_t serial = next_serial++;
+        Hedged& request = hedged[serial];
+        request.member = member;
+        request.payload.assign(data, length);
+        request.done = std::move(done);
+        request.start_ns = client_now_ns();
+        request.deadline_ns = request.start_ns + (timeout_ns ? timeout_ns : options.timeout_ns);
+        options.hedge->start();
+        uint64_t id = channels[member]->submit(data, length, [this, serial](ClientReply& reply) {
+            hedge_reply(serial, false, reply);
+        }, timeout_ns);
+
+        auto it = hedged.find(serial);
+        if (it == hedged.end()) return;  // Failed as it was sent
+        it->second.id = id;
+        uint32_t delay_us = options.hedge->delay_us();
+        if (delay_us) hedge_timers.push(std::make_pair(it->second.start_ns + delay_us * 1000ULL, serial));
+    }
+
+    // The first reply wins and the other path forgets the request; a path
+    // that fails leaves the request to the other one, if it is out
+    void hedge_reply(uint64_t serial, bool from_hedge, ClientReply& reply) {
+        auto it = hedged.find(serial);
+        if (it == hedged.end()) return;
+        Hedged& request = it->second;
+        request.pending--;
+        if (reply.status != ClientStatus::Ok && request.pending > 0) return;
+        if (request.pending > 0) {
+            (from_hedge ? channels : hedge_channels)[request.member]->cancel(request.id);
+        }
+        ClientCallback done = std::move(request.done);
+        uint64_t start_ns = request.start_ns;
+        hedged.erase(it);
+        reply.latency_ns = client_now_ns() - start_ns;
+        reply.hedge_won = from_hedge;
+        if (reply.status == ClientStatus::Ok) options.hedge->finish(reply.latency_ns / 1000.0, from_hedge);
+        done(reply);
+    }
+
+public:
+    ClientCounters counters;
+
+    Client(ClientLoop& client_loop, const ClientOptions& client_options)
+        : loop(client_loop), options(client_options) {
+        options.connections = std::max<size_t>(1, options.connections);
+        options.pipeline = std::max<size_t>(1, options.pipeline);
+        if (!options.client_id) options.client_id = client_allocate_ids(options.connections);
+        memset(&server, 0, sizeof(server));
+        memset(&hedge_server, 0, sizeof(hedge_server));
+        if (options.hedge) loop.add(this);
+    }
+
+    ~Client() {
+        if (options.hedge) loop.remove(this);
+    }
+
+    // Resolves the server and opens every member of the pool, and their
+    // hedge twins. A TCP connection that is refused is retried in the
+    // background.
+    bool open() {
+        server.sin_family = AF_INET;
+        server.sin_port = htons(options.port);
+        if (inet_pton(AF_INET, options.host.c_str(), &server.sin_addr) != 1) {
+            fprintf(stderr, "Unknown client host: %s\n", options.host.c_str());
+            return false;
+        }
+        hedge_server = server;
+        if (options.hedge_port) hedge_server.sin_port = htons(options.hedge_port);
+        for (size_t i = 0; i < options.connections; i++) {
+            uint32_t id = options.client_id + (uint32_t)i;
+            channels.emplace_back(open_channel(server, id));
+            if (!channels.back()->open()) return false;
+            if (!options.hedge) continue;
+            // UDP twins share the member's idempotency client; QUIC twins
+            // are connections of their own
+            if (options.protocol == ClientProtocol::Quic) id += CLIENT_HEDGE_CONNECTION_OFFSET;
+            hedge_channels.emplace_back(open_channel(hedge_server, id));
+            if (!hedge_channels.back()->open()) return false;
+        }
+        return true;
+    }
+
+    // Largest payload one request may carry
+    size_t max_payload() const {
+        if (options.protocol == ClientProtocol::Udp) return CLIENT_DATAGRAM_SIZE - sizeof(IdempotentHeader);
+        if (options.protocol == ClientProtocol::Quic) {
+            return CLIENT_QUIC_ECHO_LIMIT - sizeof(uint32_t) - CLIENT_QUIC_ECHO_PREFIX_SIZE - 24;  // Longest tag
+        }
+        return SIZE_MAX;
+    }
+
+    // Sends data and calls done with the outcome, on the loop's thread.
+    // timeout_ns 0 takes options.timeout_ns.
+    void request(const char* data, size_t length, ClientCallback done, uint64_t timeout_ns = 0) {
+        counters.requests++;
+        if (length > max_payload() || channels.empty()) {
+            ClientReply failed;
+            counters.failures++;
+            done(failed);
+            return;
+        }
+        size_t member = pick();
+        if (options.hedge) {
+            hedged_request(member, data, length, std::move(done), timeout_ns);
+            return;
+        }
+        channels[member]->submit(data, length, std::move(done), timeout_ns);
+    }
+
+    // From any thread but the loop's, with the loop started
+    std::future<ClientReply> request(const std::string& data, uint64_t timeout_ns = 0) {
+        auto promise = std::make_shared<std::promise<ClientReply>>();
+        std::future<ClientReply> result = promise->get_future();
+        loop.post([this, data, timeout_ns, promise]() {
+            request(data.data(), data.size(), [promise](ClientReply& reply) {
+                promise->set_value(std::move(reply));
+            }, timeout_ns);
+        });
+        return result;
+    }
+
+    // Requests sent or queued and not yet called back
+    size_t outstanding() const {
+        size_t total = 0;
+        for (const auto& channel : channels) total += channel->load();
+        return total;
+    }
+
+    size_t connected() const {
+        size_t total = 0;
+        for (const auto& channel : channels) total += channel->connected();
+        return total;
+    }
+
+    // Smoothed RTTs of the members and twins that have one, summed, and how
+    // many there are
+    void srtt(uint64_t& total_ns, size_t& sockets) const {
+        total_ns = 0;
+        sockets = 0;
+        for (const auto* pool : {&channels, &hedge_channels}) {
+            for (const auto& channel : *pool) {
+                uint64_t srtt = channel->srtt_ns();
+                if (!srtt) continue;
+                total_ns += srtt;
+                sockets++;
+            }
+        }
+    }
+
+    void on_events(uint32_t) override {}
+
+    uint64_t next_timer_ns() override {
+        while (!hedge_timers.empty() && !hedged.count(hedge_timers.top().second)) hedge_timers.pop();
+        return hedge_timers.empty() ? 0 : hedge_timers.top().first;
+    }
+
+    // A request still outstanding is hedged if its twin is up, it has time
+    // left and the trigger's budget allows
+    void on_timer(uint64_t now_ns) override {
+        while (!hedge_timers.empty() && hedge_timers.top().first <= now_ns) {
+            uint64_t serial = hedge_timers.top().second;
+            hedge_timers.pop();
+            auto it = hedged.find(serial);
+            if (it == hedged.end()) continue;
+            Hedged& request = it->second;
+            ClientChannel& twin = *hedge_channels[request.member];
+            if (request.hedge_sent || !twin.connected() || now_ns >= request.deadline_ns) continue;
+            if (!options.hedge->try_hedge()) continue;
+            request.hedge_sent = true;
+            request.pending++;
+            twin.submit(request.payload.data(), request.payload.size(), [this, serial](ClientReply& reply) {
+                hedge_reply(serial, true, reply);
+            }, request.deadline_ns - now_ns, request.id);
+        }
+    }
+};
+
+// Waking early is harmless, the next run_once() re-arms, so the timer is
+// only moved forward when it was not armed
+inline void ClientLoop::arm_timer(uint64_t when_ns) {
+    if (!when_ns || (timer_armed_ns && timer_armed_ns <= when_ns)) return;
+    timer_armed_ns = when_ns;
+    struct itimerspec at;
+    memset(&at, 0, sizeof(at));
+    at.it_value.tv_sec = when_ns / 1000000000ULL;
+    at.it_value.tv_nsec = when_ns % 1000000000ULL;
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &at, nullptr);
+}
+
+inline void ClientLoop::run_timers(uint64_t now_ns) {
+    for (size_t i = 0; i < handlers.size(); i++) {
+        uint64_t due = handlers[i]->next_timer_ns();
+        if (due && due <= now_ns) handlers[i]->on_timer(now_ns);
+    }
+}
+
+inline void ClientLoop::run_once(uint64_t max_wait_ns) {
+    uint64_t now = client_now_ns();
+    uint64_t earliest = 0;
+    for (ClientHandler* handler : handlers) {
+        uint64_t due = handler->next_timer_ns();
+        if (due && (!earliest || due < earliest)) earliest = due;
+    }
+
+    // The timeout ends the wait on time, so nothing is armed that a request
+    // answered since would leave to fire for nothing
+    struct epoll_event events[CLIENT_MAX_EVENTS];
+    int n = -1;
+    if (precise_wait) {
+        uint64_t wait = earliest ? std::min(max_wait_ns, earliest > now ? earliest - now : 0) : max_wait_ns;
+        struct timespec timeout = {(time_t)(wait / 1000000000ULL), (long)(wait % 1000000000ULL)};
+        n = epoll_pwait2(epoll_fd, events, CLIENT_MAX_EVENTS, &timeout, nullptr);
+        if (n == -1 && errno == ENOSYS) precise_wait = false;
+    }
+    if (!precise_wait) {
+        arm_timer(earliest);
+        int timeout_ms = (int)((max_wait_ns + 999999) / 1000000);
+        if (earliest && earliest <= now) timeout_ms = 0;
+        n = epoll_wait(epoll_fd, events, CLIENT_MAX_EVENTS, timeout_ms);
+    }
+    for (int i = 0; i < n; i++) {
+        ClientHandler* handler = (ClientHandler*)events[i].data.ptr;
+        if (handler) {
+            handler->on_events(events[i].events);
+            continue;
+        }
+        uint64_t count;
+        while (read(wake_fd, &count, sizeof(count)) > 0) {}
+        while (read(timer_fd, &count, sizeof(count)) > 0) {}
+    }
+    now = client_now_ns();
+    if (timer_armed_ns && timer_armed_ns <= now) timer_armed_ns = 0;
+    run_timers(now);
+    run_posted();
+}
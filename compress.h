@@ -0,0 +1,328 @@
+#pragma once
+
+// LZ77 payload compression with a shared dictionary, in the LZ4 block
+// style: each sequence is a token (literal length << 4 | match length - 4),
+// extended lengths as runs of 255, the literals, and a 16 bit little endian
+// match offset. The last sequence has literals only and the block simply
+// ends after them, so the frame or datagram around a block supplies its
+// length.
+//
+// Encoder and decoder both see the stream as [dictionary][message 1]
+// [message 2]... and offsets may reach back into anything they keep:
+// - Message mode drops every message again, so each block stands alone
+//   against the dictionary. It suits datagrams.
+// - Stream mode keeps the last LZ_WINDOW bytes, so later messages can
+//   reference earlier ones. The two ends must see the same messages in order.
+//
+// The level (1-9) sets how many hash chain candidates the encoder tries per
+// position: 1 is a single probe, 9 tries up to 256.
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+enum class LzMode { Message, Stream };
+
+const size_t LZ_WINDOW = 65535;        // Largest match offset
+const size_t LZ_MIN_MATCH = 4;
+const int LZ_HASH_BITS = 12;           // 16 KB of heads: stays cache resident between messages
+const size_t LZ_MAX_OUTPUT = 1 << 20;  // Decoded bytes accepted per block
+const int LZ_MAX_LEVEL = 9;
+
+inline bool parse_lz_mode(const std::string& name, LzMode& mode) {
+    if (name == "message") {
+        mode = LzMode::Message;
+    } else if (name == "stream") {
+        mode = LzMode::Stream;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline uint32_t lz_hash(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+inline void lz_put_length(std::string& out, size_t length) {
+    while (length >= 255) {
+        out.push_back((char)255);
+        length -= 255;
+    }
+    out.push_back((char)length);
+}
+
+// Reads the 255-run continuation of a length field
+inline bool lz_get_length(const uint8_t*& ip, const uint8_t* end, size_t& length) {
+    uint8_t b;
+    do {
+        if (ip >= end) return false;
+        b = *ip++;
+        length += b;
+    } while (b == 255);
+    return true;
+}
+
+// History both sides keep: the dictionary followed by the messages seen so
+// far (stream mode) or by the current message only (message mode)
+class LzWindow {
+protected:
+    std::vector<uint8_t> window;
+    size_t dictionary_length;
+    size_t length;
+    LzMode mode;
+
+    LzWindow(const std::string& dictionary, LzMode m)
+        : window(dictionary.begin(), dictionary.end()), dictionary_length(dictionary.size()),
+          length(dictionary.size()), mode(m) {}
+
+    void reserve(size_t extra) {
+        if (length + extra > window.size()) window.resize(std::max(window.size() * 2, length + extra));
+    }
+
+    // Forgets the message just handled (message mode), or in stream mode
+    // drops all but the last LZ_WINDOW bytes once twice that has built up.
+    // Returns true when the stream slid, which moves every position.
+    bool finish_message() {
+        if (mode == LzMode::Message) {
+            length = dictionary_length;
+            return false;
+        }
+        if (length < 2 * LZ_WINDOW) return false;
+        memmove(window.data(), window.data() + length - LZ_WINDOW, LZ_WINDOW);
+        length = LZ_WINDOW;
+        return true;
+    }
+};
+
+class LzEncoder : private LzWindow {
+private:
+    int max_chain;
+    std::vector<int32_t> head;
+    std::vector<int32_t> prev;
+    std::vector<std::pair<uint32_t, int32_t>> undo;  // Message mode: head slots to restore
+
+    void insert(size_t position) {
+        uint32_t h = lz_hash(&window[position]);
+        if (mode == LzMode::Message) undo.emplace_back(h, head[h]);
+        prev[position] = head[h];
+        head[h] = (int32_t)position;
+    }
+
+    void rebuild() {
+        std::fill(head.begin(), head.end(), -1);
+        prev.assign(window.size(), -1);
+        for (size_t p = 0; p + LZ_MIN_MATCH <= length; p++) {
+            uint32_t h = lz_hash(&window[p]);
+            prev[p] = head[h];
+            head[h] = (int32_t)p;
+        }
+    }
+
+    void emit(std::string& out, const uint8_t* literals, size_t literal_length,
+              size_t offset, size_t match_length) {
+        size_t match_code = match_length ? match_length - LZ_MIN_MATCH : 0;
+        out.push_back((char)((std::min<size_t>(literal_length, 15) << 4) | std::min<size_t>(match_code, 15)));
+        if (literal_length >= 15) lz_put_length(out, literal_length - 15);
+        out.append((const char*)literals, literal_length);
+        if (match_length == 0) return;
+        out.push_back((char)(offset & 0xff));
+        out.push_back((char)(offset >> 8));
+        if (match_code >= 15) lz_put_length(out, match_code - 15);
+    }
+
+public:
+    LzEncoder(const std::string& dictionary, LzMode mode, int level)
+        : LzWindow(dictionary, mode),
+          max_chain(1 << (std::max(1, std::min(level, LZ_MAX_LEVEL)) - 1)),
+          head((size_t)1 << LZ_HASH_BITS, -1) {
+        rebuild();
+    }
+
+    // Appends the compressed block for one message to out
+    void compress(const char* data, size_t size, std::string& out) {
+        reserve(size);
+        if (prev.size() < window.size()) prev.resize(window.size(), -1);
+        out.reserve(out.size() + size + size / 255 + 16);  // Worst case: all literals
+        memcpy(&window[length], data, size);
+
+        size_t start = length;
+        size_t end = length + size;
+        size_t anchor = start;
+        size_t position = start;
+        length = end;
+        while (position + LZ_MIN_MATCH <= end) {
+            size_t best_length = 0;
+            size_t best_offset = 0;
+            int32_t candidate = head[lz_hash(&window[position])];
+            for (int steps = max_chain; candidate >= 0 && steps > 0; steps--) {
+                size_t offset = position - candidate;
+                if (offset > LZ_WINDOW) break;
+                size_t n = 0;
+                while (position + n < end && window[candidate + n] == window[position + n]) n++;
+                if (n > best_length) {
+                    best_length = n;
+                    best_offset = offset;
+                    if (position + n == end) break;
+                }
+                candidate = prev[candidate];
+            }
+
+            insert(position);
+            if (best_length < LZ_MIN_MATCH) {
+                position++;
+                continue;
+            }
+            emit(out, &window[anchor], position - anchor, best_offset, best_length);
+            for (size_t p = position + 1; p < position + best_length && p + LZ_MIN_MATCH <= end; p++) {
+                insert(p);
+            }
+            position += best_length;
+            anchor = position;
+        }
+        for (; position + LZ_MIN_MATCH <= end; position++) insert(position);
+        if (anchor < end) emit(out, &window[anchor], end - anchor, 0, 0);
+
+        if (mode == LzMode::Message) {
+            // Unwind newest first so every slot ends up at its dictionary value
+            for (auto it = undo.rbegin(); it != undo.rend(); ++it) head[it->first] = it->second;
+            undo.clear();
+        }
+        if (finish_message()) rebuild();
+    }
+};
+
+class LzDecoder : private LzWindow {
+public:
+    LzDecoder(const std::string& dictionary, LzMode mode) : LzWindow(dictionary, mode) {}
+
+    // Decodes one block and appends the message to out. Returns false for a
+    // malformed block; in stream mode the decoder is unusable afterwards.
+    bool decompress(const char* data, size_t size, std::string& out) {
+        const uint8_t* ip = (const uint8_t*)data;
+        const uint8_t* end = ip + size;
+        size_t start = length;
+        bool ok = true;
+
+        while (ip < end) {
+            uint8_t token = *ip++;
+            size_t literal_length = token >> 4;
+            if ((literal_length == 15 && !lz_get_length(ip, end, literal_length)) ||
+                (size_t)(end - ip) < literal_length || length - start + literal_length > LZ_MAX_OUTPUT) {
+                ok = false;
+                break;
+            }
+            reserve(literal_length);
+            memcpy(&window[length], ip, literal_length);
+            length += literal_length;
+            ip += literal_length;
+            if (ip == end) break;
+
+            if (end - ip < 2) {
+                ok = false;
+                break;
+            }
+            size_t offset = ip[0] | (ip[1] << 8);
+            ip += 2;
+            size_t match_length = (token & 15) + LZ_MIN_MATCH;
+            if (((token & 15) == 15 && !lz_get_length(ip, end, match_length)) || offset == 0 || offset > length || length - start + match_length > LZ_MAX_OUTPUT) {
+                ok = false;
+                break;
+            }
+            reserve(match_length);
+            uint8_t* dst = &window[length];
+            const uint8_t* src = dst - offset;
+            for (size_t i = 0; i < match_length; i++) dst[i] = src[i];  // May overlap
+            length += match_length;
+        }
+
+        if (!ok) {
+            if (mode == LzMode::Message) length = dictionary_length;
+            return false;
+        }
+        out.append((const char*)&window[start], length - start);
+        finish_message();
+        return true;
+    }
+};
+
+// Builds a dictionary of at most `size` bytes from sample messages. Samples
+// are cut into LZ_SEGMENT byte segments scored by how often their 8 byte
+// substrings occur across all samples; segments are picked greedily and the
+// substrings of each pick stop counting for later ones, so the dictionary
+// covers many different common fragments rather than one fragment many
+// times. The best segments go last, closest to the data.
+const size_t LZ_SEGMENT = 32;
+const size_t LZ_GRAM = 8;
+
+inline std::string lz_train_dictionary(const std::vector<std::string>& samples, size_t size) {
+    auto gram_key = [](const char* p) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    };
+
+    std::unordered_map<uint64_t, uint32_t> frequency;
+    for (const std::string& sample : samples) {
+        for (size_t i = 0; i + LZ_GRAM <= sample.size(); i++) frequency[gram_key(&sample[i])]++;
+    }
+
+    struct Segment {
+        uint64_t score;
+        size_t sample;
+        size_t offset;
+        bool operator<(const Segment& other) const { return score < other.score; }
+    };
+    auto score = [&](size_t sample, size_t offset) {
+        const std::string& s = samples[sample];
+        uint64_t total = 0;
+        size_t stop = std::min(s.size(), offset + LZ_SEGMENT);
+        for (size_t i = offset; i + LZ_GRAM <= stop; i++) {
+            auto it = frequency.find(gram_key(&s[i]));
+            if (it != frequency.end() && it->second > 1) total += it->second - 1;
+        }
+        return total;
+    };
+
+    std::priority_queue<Segment> candidates;
+    for (size_t s = 0; s < samples.size(); s++) {
+        for (size_t offset = 0; offset < samples[s].size(); offset += LZ_SEGMENT / 2) {
+            candidates.push(Segment{score(s, offset), s, offset});
+        }
+    }
+
+    std::vector<std::string> picked;
+    std::unordered_set<std::string> seen;
+    size_t total = 0;
+    while (!candidates.empty() && total < size) {
+        Segment best = candidates.top();
+        candidates.pop();
+        uint64_t current = score(best.sample, best.offset);
+        if (current < best.score) {
+            // Stale after earlier picks: requeue with its real score
+            best.score = current;
+            candidates.push(best);
+            continue;
+        }
+        if (current == 0) break;
+
+        const std::string& s = samples[best.sample];
+        std::string segment = s.substr(best.offset, std::min(LZ_SEGMENT, size - total));
+        if (!seen.insert(segment).second) continue;
+        for (size_t i = 0; i + LZ_GRAM <= segment.size(); i++) frequency.erase(gram_key(&segment[i]));
+        picked.push_back(segment);
+        total += segment.size();
+    }
+
+    std::string dictionary;
+    dictionary.reserve(total);
+    for (auto it = picked.rbegin(); it != picked.rend(); ++it) dictionary += *it;
+    return dictionary;
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+// Synthetic market data feed for tests whose results depend on payload
+// content (compression, encodings). It produces trades and two-sided quotes
+// over a fixed symbol universe:
+// - a skewed symbol mix (a few names take most of the traffic)
+// - per-symbol random-walk prices on a one cent grid
+// - round-lot sizes
+// - increasing sequence numbers and nanosecond timestamps
+// Messages are rendered as compact JSON, as many consolidated feeds send
+// them, so the repetition is that of real feed traffic, not a constant fill.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+const int64_t FEED_PRICE_SCALE = 10000;  // Prices are fixed point, 1/10000 of a unit
+const int64_t FEED_TICK = 100;           // One cent
+
+struct FeedEvent {
+    bool trade;
+    uint32_t symbol;     // Index into FeedGenerator::symbol_name
+    uint64_t sequence;
+    uint64_t timestamp_ns;
+    int64_t bid_price;   // Quotes: bid and ask; trades: price in bid_price
+    int64_t ask_price;
+    uint32_t bid_size;   // Trades: size in bid_size
+    uint32_t ask_size;
+    char side;           // Trades: 'B' or 'S'
+    uint8_t venue;       // Index into feed_venue()
+};
+
+inline const char* feed_venue(int venue) {
+    static const char* venues[] = {"XNAS", "XNYS", "ARCX", "BATS", "EDGX", "IEXG"};
+    return venues[venue % 6];
+}
+
+class FeedGenerator {
+private:
+    struct Symbol {
+        std::string name;
+        int64_t mid;      // Mid price in FEED_PRICE_SCALE units
+        int64_t spread;   // In ticks
+
+        // Standing quote for next_quote()
+        int64_t bid;
+        int64_t ask;
+        uint32_t bid_size;
+        uint32_t ask_size;
+    };
+
+    std::vector<Symbol> symbols;
+    std::mt19937_64 rng;
+    uint64_t sequence;
+    uint64_t clock_ns;
+
+public:
+    // The symbol universe depends only on symbol_count, so generators with
+    // different seeds (one per client) trade the same names
+    explicit FeedGenerator(uint64_t seed, int symbol_count = 64)
+        : rng(seed), sequence(seed << 32), clock_ns(34200ull * 1000000000ull) {
+        std::mt19937_64 universe(20240101);
+        for (int i = 0; i < symbol_count; i++) {
+            Symbol s;
+            int letters = 2 + universe() % 3;
+            for (int c = 0; c < letters; c++) s.name.push_back('A' + universe() % 26);
+            s.mid = (int64_t)(5 + universe() % 500) * FEED_PRICE_SCALE;
+            s.spread = 1 + universe() % 4;
+            s.bid = s.mid - s.spread * FEED_TICK / 2;
+            s.ask = s.bid + s.spread * FEED_TICK;
+            s.bid_size = 500;
+            s.ask_size = 500;
+            symbols.push_back(s);
+        }
+    }
+
+    const std::string& symbol_name(uint32_t symbol) const {
+        return symbols[symbol].name;
+    }
+
+    size_t symbol_count() const {
+        return symbols.size();
+    }
+
+    FeedEvent next_event() {
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        FeedEvent event;
+        double u = unit(rng);
+        event.symbol = (uint32_t)(symbols.size() * u * u * u);  // Skewed towards the front
+        Symbol& s = symbols[event.symbol];
+
+        // Mostly small moves, now and then a jump
+        int step = (int)(rng() % 5) - 2;
+        if (rng() % 50 == 0) step *= 10;
+        s.mid = std::max<int64_t>(FEED_TICK * 10, s.mid + step * FEED_TICK);
+
+        clock_ns += 1000 + rng() % 50000;
+        event.sequence = ++sequence;
+        event.timestamp_ns = clock_ns;
+        event.trade = rng() % 10 < 3;
+        event.venue = (uint8_t)(rng() % 6);
+        event.side = rng() % 2 ? 'B' : 'S';
+        int64_t half = s.spread * FEED_TICK / 2;
+        event.bid_price = s.mid - half;
+        event.ask_price = event.bid_price + s.spread * FEED_TICK;
+        event.bid_size = (uint32_t)(1 + rng() % 20) * 100;
+        event.ask_size = (uint32_t)(1 + rng() % 20) * 100;
+        if (event.trade) {
+            event.bid_price = event.side == 'B' ? event.ask_price : event.bid_price;
+            event.bid_size = (uint32_t)(1 + rng() % 5) * 100;
+        }
+        return event;
+    }
+
+    // Next update of a symbol's standing quote. Like real quote traffic,
+    // most updates touch one size or one price; a few move the whole quote.
+    FeedEvent next_quote() {
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        double u = unit(rng);
+        uint32_t index = (uint32_t)(symbols.size() * u * u * u);
+        Symbol& s = symbols[index];
+
+        int kind = rng() % 100;
+        int64_t move = ((int64_t)(rng() % 2) * 2 - 1) * (1 + rng() % 2) * FEED_TICK;
+        uint32_t size = (uint32_t)(1 + rng() % 20) * 100;
+        if (kind < 30) {
+            s.bid_size = size;
+        } else if (kind < 60) {
+            s.ask_size = size;
+        } else if (kind < 72) {
+            s.bid = std::min(s.bid + move, s.ask - FEED_TICK);
+            s.bid_size = size;
+        } else if (kind < 84) {
+            s.ask = std::max(s.ask + move, s.bid + FEED_TICK);
+            s.ask_size = size;
+        } else if (kind < 92) {
+            s.bid_size = size;
+            s.ask_size = (uint32_t)(1 + rng() % 20) * 100;
+        } else {
+            int64_t floor = FEED_TICK * 10 - s.bid;
+            move = std::max(move, floor);
+            s.bid += move;
+            s.ask += move;
+        }
+
+        FeedEvent event;
+        clock_ns += 1000 + rng() % 50000;
+        event.trade = false;
+        event.symbol = index;
+        event.sequence = ++sequence;
+        event.timestamp_ns = clock_ns;
+        event.bid_price = s.bid;
+        event.ask_price = s.ask;
+        event.bid_size = s.bid_size;
+        event.ask_size = s.ask_size;
+        event.side = 0;
+        event.venue = (uint8_t)(index % 6);
+        return event;
+    }
+
+    // Renders an event as one JSON message, replacing out
+    void format(const FeedEvent& event, std::string& out) const {
+        char text[256];
+        const char* name = symbols[event.symbol].name.c_str();
+        int n;
+        if (event.trade) {
+            n = snprintf(text, sizeof(text),
+                         "{\"type\":\"trade\",\"seq\":%llu,\"sym\":\"%s\",\"px\":%lld.%04lld,\"sz\":%u,"
+                         "\"side\":\"%c\",\"venue\":\"%s\",\"ts\":%llu}",
+                         (unsigned long long)event.sequence, name,
+                         (long long)(event.bid_price / FEED_PRICE_SCALE), (long long)(event.bid_price % FEED_PRICE_SCALE),
+                         event.bid_size, event.side, feed_venue(event.venue),
+                         (unsigned long long)event.timestamp_ns);
+        } else {
+            n = snprintf(text, sizeof(text),
+                         "{\"type\":\"quote\",\"seq\":%llu,\"sym\":\"%s\",\"bid\":%lld.%04lld,\"bsz\":%u,"
+                         "\"ask\":%lld.%04lld,\"asz\":%u,\"venue\":\"%s\",\"ts\":%llu}",
+                         (unsigned long long)event.sequence, name,
+                         (long long)(event.bid_price / FEED_PRICE_SCALE), (long long)(event.bid_price % FEED_PRICE_SCALE),
+                         event.bid_size,
+                         (long long)(event.ask_price / FEED_PRICE_SCALE), (long long)(event.ask_price % FEED_PRICE_SCALE),
+                         event.ask_size, feed_venue(event.venue), (unsigned long long)event.timestamp_ns);
+        }
+        out.assign(text, std::min<int>(n, sizeof(text) - 1));
+    }
+
+    void next(std::string& out) {
+        format(next_event(), out);
+    }
+};
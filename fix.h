@@ -0,0 +1,471 @@
+#pragma once
+
+// FIX 4.4 tag=value messages. The parser finds the SOH and '=' delimiters a
+// vector at a time (32 bytes with AVX2, 16 with SSE2) into two bitmaps and
+// sums the bytes for the checksum in the same pass; fields are then read
+// off the bitmaps. A parsed message is a flat table indexed by tag holding
+// views into the receive buffer, so parsing allocates nothing. Tags at or
+// above FIX_TABLE_SIZE are checked but not stored, and a repeated tag keeps
+// its first value (no repeating groups).
+//
+// FixBuilder writes outgoing messages, filling in BodyLength and CheckSum.
+
+#include <immintrin.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+
+const char FIX_SOH = '\x01';
+const char FIX_BEGIN[] = "8=FIX.4.4\x01";
+const size_t FIX_BEGIN_LENGTH = sizeof(FIX_BEGIN) - 1;
+const size_t FIX_TRAILER_LENGTH = 7;      // "10=nnn" and SOH
+const size_t FIX_MAX_MESSAGE = 8192;
+const int FIX_TABLE_SIZE = 1024;
+const int FIX_MAX_FIELDS = 128;
+const int64_t FIX_PRICE_SCALE = 10000;    // Prices parse to 4 decimal places, as in market.h
+
+enum FixTag {
+    FIX_AVG_PX = 6,
+    FIX_BEGIN_STRING = 8,
+    FIX_BODY_LENGTH = 9,
+    FIX_CHECK_SUM = 10,
+    FIX_CL_ORD_ID = 11,
+    FIX_CUM_QTY = 14,
+    FIX_EXEC_ID = 17,
+    FIX_MSG_SEQ_NUM = 34,
+    FIX_MSG_TYPE = 35,
+    FIX_ORDER_ID = 37,
+    FIX_ORDER_QTY = 38,
+    FIX_ORD_STATUS = 39,
+    FIX_ORD_TYPE = 40,
+    FIX_ORIG_CL_ORD_ID = 41,
+    FIX_PRICE = 44,
+    FIX_REF_SEQ_NUM = 45,
+    FIX_SENDER_COMP_ID = 49,
+    FIX_SENDING_TIME = 52,
+    FIX_SIDE = 54,
+    FIX_SYMBOL = 55,
+    FIX_TARGET_COMP_ID = 56,
+    FIX_TEXT = 58,
+    FIX_TRANSACT_TIME = 60,
+    FIX_ENCRYPT_METHOD = 98,
+    FIX_CXL_REJ_REASON = 102,
+    FIX_ORD_REJ_REASON = 103,
+    FIX_HEART_BT_INT = 108,
+    FIX_TEST_REQ_ID = 112,
+    FIX_NO_RELATED_SYM = 146,
+    FIX_EXEC_TYPE = 150,
+    FIX_LEAVES_QTY = 151,
+    FIX_MD_REQ_ID = 262,
+    FIX_SUBSCRIPTION_REQUEST_TYPE = 263,
+    FIX_MARKET_DEPTH = 264,
+    FIX_NO_MD_ENTRIES = 268,
+    FIX_MD_ENTRY_TYPE = 269,
+    FIX_MD_ENTRY_PX = 270,
+    FIX_MD_ENTRY_SIZE = 271,
+    FIX_REF_TAG_ID = 371,
+    FIX_SESSION_REJECT_REASON = 373,
+    FIX_CXL_REJ_RESPONSE_TO = 434
+};
+
+// Session level reject reasons (373)
+const int FIX_REJECT_REQUIRED_TAG_MISSING = 1;
+const int FIX_REJECT_VALUE_INCORRECT = 5;
+const int FIX_REJECT_INVALID_MSG_TYPE = 11;
+
+// Order reject reasons (103)
+const int FIX_ORD_REJ_UNSUPPORTED_ORDER_CHARACTERISTIC = 11;
+
+enum class FixScan { Scalar, Sse2, Avx2 };
+
+enum class FixStatus {
+    Ok,
+    Incomplete,   // Need more bytes
+    Malformed,    // Not a FIX 4.4 message: the stream cannot be resynchronized
+    BadChecksum   // Well framed but corrupt; `consumed` skips it
+};
+
+inline FixScan fix_best_scan() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? FixScan::Avx2 : FixScan::Sse2;
+}
+
+inline bool parse_fix_scan(const std::string& name, FixScan& scan) {
+    if (name == "scalar") {
+        scan = FixScan::Scalar;
+    } else if (name == "sse2") {
+        scan = FixScan::Sse2;
+    } else if (name == "avx2") {
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("avx2")) return false;
+        scan = FixScan::Avx2;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline const char* fix_scan_name(FixScan scan) {
+    switch (scan) {
+        case FixScan::Scalar: return "scalar";
+        case FixScan::Sse2: return "sse2";
+        case FixScan::Avx2: return "avx2";
+    }
+    return "?";
+}
+
+struct FixField {
+    const char* data;
+    uint32_t length;
+};
+
+class FixMessage {
+private:
+    FixField table[FIX_TABLE_SIZE];
+    uint16_t tags[FIX_MAX_FIELDS];
+    int tag_count;
+
+public:
+    size_t length;  // Of the whole message, trailer included
+
+    FixMessage() : tag_count(0), length(0) {
+        memset(table, 0, sizeof(table));
+    }
+
+    // Forgets the previous message, touching only the slots it used
+    void clear() {
+        for (int i = 0; i < tag_count; i++) table[tags[i]].data = nullptr;
+        tag_count = 0;
+        length = 0;
+    }
+
+    // Returns false once the message has more than FIX_MAX_FIELDS fields
+    bool set(uint32_t tag, const char* data, uint32_t value_length) {
+        if (tag >= (uint32_t)FIX_TABLE_SIZE || table[tag].data) return true;
+        if (tag_count == FIX_MAX_FIELDS) return false;
+        table[tag].data = data;
+        table[tag].length = value_length;
+        tags[tag_count++] = (uint16_t)tag;
+        return true;
+    }
+
+    const FixField* get(int tag) const {
+        if (tag < 0 || tag >= FIX_TABLE_SIZE || !table[tag].data) return nullptr;
+        return &table[tag];
+    }
+
+    bool equals(int tag, const char* text) const {
+        const FixField* field = get(tag);
+        return field && field->length == strlen(text) && memcmp(field->data, text, field->length) == 0;
+    }
+
+    bool get_int(int tag, int64_t& value) const {
+        const FixField* field = get(tag);
+        if (!field || field->length == 0 || field->length > 18) return false;
+        size_t i = 0;
+        bool negative = field->data[0] == '-';
+        if (negative) i++;
+        if (i == field->length) return false;
+        value = 0;
+        for (; i < field->length; i++) {
+            char c = field->data[i];
+            if (c < '0' || c > '9') return false;
+            value = value * 10 + (c - '0');
+        }
+        if (negative) value = -value;
+        return true;
+    }
+
+    // Decimal price to fixed point, FIX_PRICE_SCALE units; extra decimals
+    // are truncated
+    bool get_price(int tag, int64_t& value) const {
+        const FixField* field = get(tag);
+        if (!field || field->length == 0 || field->length > 18) return false;
+        int64_t whole = 0, fraction = 0, scale = FIX_PRICE_SCALE;
+        bool seen_point = false, seen_digit = false;
+        for (uint32_t i = 0; i < field->length; i++) {
+            char c = field->data[i];
+            if (c == '.' && !seen_point) {
+                seen_point = true;
+            } else if (c >= '0' && c <= '9') {
+                seen_digit = true;
+                if (!seen_point) {
+                    whole = whole * 10 + (c - '0');
+                } else if (scale > 1) {
+                    scale /= 10;
+                    fraction += (c - '0') * scale;
+                }
+            } else {
+                return false;
+            }
+        }
+        if (!seen_digit) return false;
+        value = whole * FIX_PRICE_SCALE + fraction;
+        return true;
+    }
+};
+
+// Sets bit i of eq_bits and soh_bits for each '=' and SOH in data[0, length)
+// and returns the sum of the bytes. The bitmaps need length / 64 + 1 words.
+inline uint32_t fix_scan_scalar(const char* data, size_t length, uint64_t* eq_bits, uint64_t* soh_bits) {
+    for (size_t w = 0; w <= length / 64; w++) {
+        eq_bits[w] = 0;
+        soh_bits[w] = 0;
+    }
+    uint32_t sum = 0;
+    for (size_t i = 0; i < length; i++) {
+        uint8_t c = (uint8_t)data[i];
+        sum += c;
+        if (c == '=') eq_bits[i / 64] |= 1ULL << (i % 64);
+        if (c == (uint8_t)FIX_SOH) soh_bits[i / 64] |= 1ULL << (i % 64);
+    }
+    return sum;
+}
+
+// The vector scans go 64 bytes at a time; the last partial block is copied
+// into a zeroed one first, since zero bytes match neither delimiter and add
+// nothing to the sum
+inline uint32_t fix_scan_sse2(const char* data, size_t length, uint64_t* eq_bits, uint64_t* soh_bits) {
+    const __m128i eq = _mm_set1_epi8('=');
+    const __m128i soh = _mm_set1_epi8(FIX_SOH);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sums = _mm_setzero_si128();
+    char tail[64];
+    for (size_t i = 0; i < length; i += 64) {
+        const char* block = data + i;
+        if (length - i < 64) {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, block, length - i);
+            block = tail;
+        }
+        uint64_t eq_word = 0, soh_word = 0;
+        for (int k = 0; k < 4; k++) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(block + 16 * k));
+            eq_word |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, eq)) << (16 * k);
+            soh_word |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, soh)) << (16 * k);
+            sums = _mm_add_epi64(sums, _mm_sad_epu8(v, zero));
+        }
+        eq_bits[i / 64] = eq_word;
+        soh_bits[i / 64] = soh_word;
+    }
+    return (uint32_t)(_mm_cvtsi128_si64(sums) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(sums, sums)));
+}
+
+__attribute__((target("avx2")))
+inline uint32_t fix_scan_avx2(const char* data, size_t length, uint64_t* eq_bits, uint64_t* soh_bits) {
+    const __m256i eq = _mm256_set1_epi8('=');
+    const __m256i soh = _mm256_set1_epi8(FIX_SOH);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i sums = _mm256_setzero_si256();
+    char tail[64];
+    for (size_t i = 0; i < length; i += 64) {
+        const char* block = data + i;
+        if (length - i < 64) {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, block, length - i);
+            block = tail;
+        }
+        __m256i low = _mm256_loadu_si256((const __m256i*)block);
+        __m256i high = _mm256_loadu_si256((const __m256i*)(block + 32));
+        eq_bits[i / 64] = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, eq)) |
+                          (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, eq)) << 32;
+        soh_bits[i / 64] = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, soh)) |
+                           (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, soh)) << 32;
+        sums = _mm256_add_epi64(sums, _mm256_add_epi64(_mm256_sad_epu8(low, zero), _mm256_sad_epu8(high, zero)));
+    }
+    __m128i folded = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+    return (uint32_t)(_mm_cvtsi128_si64(folded) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(folded, folded)));
+}
+
+// Position of the first set bit in [from, limit), or limit
+inline size_t fix_next_bit(const uint64_t* bits, size_t from, size_t limit) {
+    if (from >= limit) return limit;
+    size_t word = from / 64;
+    uint64_t w = bits[word] & (~0ULL << (from % 64));
+    while (!w) {
+        if (++word * 64 >= limit) return limit;
+        w = bits[word];
+    }
+    size_t position = word * 64 + __builtin_ctzll(w);
+    return position < limit ? position : limit;
+}
+
+// Reads an unsigned decimal of 1 to max_digits digits
+inline bool fix_parse_digits(const char* data, size_t length, size_t max_digits, uint32_t& value) {
+    if (length == 0 || length > max_digits) return false;
+    value = 0;
+    for (size_t i = 0; i < length; i++) {
+        char c = data[i];
+        if (c < '0' || c > '9') return false;
+        value = value * 10 + (c - '0');
+    }
+    return true;
+}
+
+// Parses the message at the start of data into message. On Ok and
+// BadChecksum, consumed is the message's length.
+inline FixStatus fix_parse(const char* data, size_t length, FixMessage& message, size_t& consumed,
+                           FixScan scan) {
+    message.clear();
+    consumed = 0;
+
+    // Framing: BeginString, BodyLength, then the body and the trailer
+    size_t begin = std::min(length, FIX_BEGIN_LENGTH);
+    if (memcmp(data, FIX_BEGIN, begin) != 0) return FixStatus::Malformed;
+    if (length < FIX_BEGIN_LENGTH + 2) return FixStatus::Incomplete;
+    if (data[FIX_BEGIN_LENGTH] != '9' || data[FIX_BEGIN_LENGTH + 1] != '=') return FixStatus::Malformed;
+    const char* digits = data + FIX_BEGIN_LENGTH + 2;
+    const char* limit = data + std::min(length, FIX_BEGIN_LENGTH + 2 + 8);
+    const char* end = (const char*)memchr(digits, FIX_SOH, limit - digits);
+    if (!end) return limit - data == (ptrdiff_t)length ? FixStatus::Incomplete : FixStatus::Malformed;
+    uint32_t body_length;
+    if (!fix_parse_digits(digits, end - digits, 7, body_length)) return FixStatus::Malformed;
+    size_t body_start = end + 1 - data;
+    size_t trailer = body_start + body_length;
+    size_t total = trailer + FIX_TRAILER_LENGTH;
+    if (total > FIX_MAX_MESSAGE) return FixStatus::Malformed;
+    if (length < total) return FixStatus::Incomplete;
+    uint32_t checksum;
+    if (body_length == 0 || data[trailer - 1] != FIX_SOH || memcmp(data + trailer, "10=", 3) != 0 ||
+        data[total - 1] != FIX_SOH || !fix_parse_digits(data + trailer + 3, 3, 3, checksum)) {
+        return FixStatus::Malformed;
+    }
+
+    uint64_t eq_bits[FIX_MAX_MESSAGE / 64 + 1];
+    uint64_t soh_bits[FIX_MAX_MESSAGE / 64 + 1];
+    uint32_t sum;
+    switch (scan) {
+        case FixScan::Avx2: sum = fix_scan_avx2(data, trailer, eq_bits, soh_bits); break;
+        case FixScan::Sse2: sum = fix_scan_sse2(data, trailer, eq_bits, soh_bits); break;
+        default: sum = fix_scan_scalar(data, trailer, eq_bits, soh_bits); break;
+    }
+    consumed = total;
+    if (sum % 256 != checksum) return FixStatus::BadChecksum;
+
+    // Each field runs to the next SOH; its tag ends at the first '=' before it
+    message.set(FIX_BEGIN_STRING, data + 2, FIX_BEGIN_LENGTH - 3);
+    message.set(FIX_BODY_LENGTH, digits, end - digits);
+    size_t position = body_start;
+    while (position < trailer) {
+        size_t soh = fix_next_bit(soh_bits, position, trailer);
+        size_t eq = fix_next_bit(eq_bits, position, soh);
+        uint32_t tag;
+        if (eq == soh || !fix_parse_digits(data + position, eq - position, 9, tag) || tag == 0) {
+            return FixStatus::Malformed;
+        }
+        if (position == body_start && tag != FIX_MSG_TYPE) return FixStatus::Malformed;
+        if (!message.set(tag, data + eq + 1, soh - eq - 1)) return FixStatus::Malformed;
+        position = soh + 1;
+    }
+    message.set(FIX_CHECK_SUM, data + trailer + 3, 3);
+    message.length = total;
+    return FixStatus::Ok;
+}
+
+// Writes a decimal into out, returning its length
+inline size_t fix_format_uint(uint64_t value, char* out) {
+    char digits[20];
+    size_t n = 0;
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    for (size_t i = 0; i < n; i++) out[i] = digits[n - 1 - i];
+    return n;
+}
+
+// One outgoing message: start() it with its MsgType, add the other fields in
+// order, then finish() it into a buffer
+class FixBuilder {
+private:
+    char body[FIX_MAX_MESSAGE];
+    size_t length;
+    bool overflow;
+
+    char* field(int tag, size_t value_length) {
+        if (length + value_length + 12 > sizeof(body)) {
+            overflow = true;
+            return nullptr;
+        }
+        length += fix_format_uint(tag, body + length);
+        body[length++] = '=';
+        char* value = body + length;
+        length += value_length;
+        body[length++] = FIX_SOH;
+        return value;
+    }
+
+public:
+    FixBuilder() : length(0), overflow(false) {}
+
+    void start(const char* msg_type) {
+        length = 0;
+        overflow = false;
+        add(FIX_MSG_TYPE, msg_type);
+    }
+
+    void add(int tag, const char* value, size_t value_length) {
+        char* out = field(tag, value_length);
+        if (out) memcpy(out, value, value_length);
+    }
+
+    void add(int tag, const char* value) {
+        add(tag, value, strlen(value));
+    }
+
+    void add(int tag, const FixField& value) {
+        add(tag, value.data, value.length);
+    }
+
+    void add_int(int tag, int64_t value) {
+        char text[24];
+        size_t n = 0;
+        if (value < 0) {
+            text[n++] = '-';
+            value = -value;
+        }
+        n += fix_format_uint((uint64_t)value, text + n);
+        add(tag, text, n);
+    }
+
+    // Fixed point price with FIX_PRICE_SCALE, written with 4 decimals
+    void add_price(int tag, int64_t value) {
+        char text[32];
+        size_t n = 0;
+        if (value < 0) {
+            text[n++] = '-';
+            value = -value;
+        }
+        n += fix_format_uint((uint64_t)(value / FIX_PRICE_SCALE), text + n);
+        text[n++] = '.';
+        int64_t fraction = value % FIX_PRICE_SCALE;
+        for (int64_t scale = FIX_PRICE_SCALE / 10; scale > 0; scale /= 10) {
+            text[n++] = (char)('0' + fraction / scale % 10);
+        }
+        add(tag, text, n);
+    }
+
+    // Appends the complete message to out; false if the body overflowed
+    bool finish(std::string& out) {
+        if (overflow) return false;
+        char header[32];
+        memcpy(header, FIX_BEGIN, FIX_BEGIN_LENGTH);
+        size_t n = FIX_BEGIN_LENGTH;
+        header[n++] = '9';
+        header[n++] = '=';
+        n += fix_format_uint(length, header + n);
+        header[n++] = FIX_SOH;
+
+        uint32_t sum = 0;
+        for (size_t i = 0; i < n; i++) sum += (uint8_t)header[i];
+        for (size_t i = 0; i < length; i++) sum += (uint8_t)body[i];
+        uint32_t checksum = sum % 256;
+        char trailer[FIX_TRAILER_LENGTH] = {'1', '0', '=', (char)('0' + checksum / 100),
+                                            (char)('0' + checksum / 10 % 10), (char)('0' + checksum % 10), FIX_SOH};
+        out.append(header, n);
+        out.append(body, length);
+        out.append(trailer, sizeof(trailer));
+        return true;
+    }
+};
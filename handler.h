@@ -0,0 +1,510 @@
+#pragma once
+
+// Coroutine connection handlers for the server's epoll reactor. A handler
+// is a C++20 coroutine per connection that co_awaits read, write and
+// sleep_until on its CoroConnection, so framing and multi-step protocols
+// are straight-line code instead of a state machine:
+//
+//   ConnTask echo(CoroConnection& conn) {
+//       char buffer[1024];
+//       ssize_t n;
+//       while ((n = co_await conn.read(buffer, sizeof(buffer))) > 0) {
+//           if (!co_await conn.write(buffer, n)) break;
+//       }
+//   }
+//
+// An operation tries the syscall first and suspends only on EAGAIN, so a
+// handler costs no more syscalls than the callback it replaces. The owner
+// registers the socket edge-triggered for input and output and passes its
+// events to on_events(); the reactor retries the operation the handler is
+// waiting on and resumes it once it completes. Deadlines and sleeps share
+// one timerfd, the owner calls on_timer() when it fires. A handler that
+// returns is listed in ended for the owner to close its connection.
+//
+// Nothing is allocated per operation. Coroutine frames, sub-handlers
+// included, come from a FramePool that keeps freed frames on per-size free
+// lists, and connections are kept by descriptor and reused, so once the
+// pool has seen the peak number of concurrent connections, accepting,
+// serving and closing them allocates nothing. The reactor and its pool
+// belong to the thread that runs them.
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <new>
+#include <queue>
+#include <utility>
+#include <vector>
+
+const size_t FRAME_POOL_GRANULE = 256;    // Frame sizes are rounded up to a multiple of this...
+const size_t FRAME_POOL_CLASSES = 64;     // ...and pooled below 64 granules (16 KB); larger go to the heap
+
+// Free lists of coroutine frames by size class, threaded through the freed
+// frames themselves. Frames are never returned to the system.
+class FramePool {
+private:
+    struct FreeFrame {
+        FreeFrame* next;
+    };
+
+    FreeFrame* free_lists[FRAME_POOL_CLASSES] = {};
+
+public:
+    uint64_t allocated = 0;    // Frames taken from the heap
+    uint64_t reused = 0;       // Frames taken from a free list
+    uint64_t oversized = 0;    // Too big to pool: heap allocated every time
+    uint64_t pooled = 0;       // Frames on the free lists
+
+    ~FramePool() {
+        for (FreeFrame*& list : free_lists) {
+            while (list) {
+                FreeFrame* next = list->next;
+                ::operator delete(list);
+                list = next;
+            }
+        }
+    }
+
+    static FramePool& local() {
+        thread_local FramePool pool;
+        return pool;
+    }
+
+    void* allocate(size_t size) {
+        size_t size_class = (size + FRAME_POOL_GRANULE - 1) / FRAME_POOL_GRANULE;
+        if (size_class >= FRAME_POOL_CLASSES) {
+            oversized++;
+            return ::operator new(size);
+        }
+        FreeFrame*& list = free_lists[size_class];
+        if (list) {
+            FreeFrame* frame = list;
+            list = frame->next;
+            reused++;
+            pooled--;
+            return frame;
+        }
+        allocated++;
+        return ::operator new(size_class * FRAME_POOL_GRANULE);
+    }
+
+    void release(void* frame, size_t size) {
+        size_t size_class = (size + FRAME_POOL_GRANULE - 1) / FRAME_POOL_GRANULE;
+        if (size_class >= FRAME_POOL_CLASSES) {
+            ::operator delete(frame);
+            return;
+        }
+        FreeFrame* free_frame = static_cast<FreeFrame*>(frame);
+        free_frame->next = free_lists[size_class];
+        free_lists[size_class] = free_frame;
+        pooled++;
+    }
+};
+
+// A connection handler or sub-handler, its frame from the thread's
+// FramePool. Starts suspended; co_await runs a sub-handler to its end and
+// resumes the caller.
+class ConnTask {
+public:
+    struct promise_type {
+        std::coroutine_handle<> caller;   // Resumed at the end of a sub-handler
+
+        struct FinalAwaiter {
+            bool await_ready() const noexcept {
+                return false;
+            }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                std::coroutine_handle<> caller = handle.promise().caller;
+                return caller ? caller : std::noop_coroutine();
+            }
+            void await_resume() const noexcept {}
+        };
+
+        static void* operator new(size_t size) {
+            return FramePool::local().allocate(size);
+        }
+        static void operator delete(void* frame, size_t size) {
+            FramePool::local().release(frame, size);
+        }
+
+        ConnTask get_return_object() {
+            return ConnTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+        FinalAwaiter final_suspend() noexcept {
+            return {};
+        }
+        void return_void() {}
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+
+    ConnTask() = default;
+
+    ConnTask(ConnTask&& other) noexcept : handle(other.handle) {
+        other.handle = nullptr;
+    }
+
+    ConnTask& operator=(ConnTask&& other) noexcept {
+        std::swap(handle, other.handle);
+        return *this;
+    }
+
+    ConnTask(const ConnTask&) = delete;
+    ConnTask& operator=(const ConnTask&) = delete;
+
+    ~ConnTask() {
+        if (handle) handle.destroy();
+    }
+
+    bool done() const {
+        return !handle || handle.done();
+    }
+
+    // Sub-handler: symmetric transfer in, and back out at its final suspend
+    bool await_ready() const noexcept {
+        return false;
+    }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+        handle.promise().caller = caller;
+        return handle;
+    }
+    void await_resume() const noexcept {}
+
+private:
+    std::coroutine_handle<promise_type> handle;
+
+    explicit ConnTask(std::coroutine_handle<promise_type> task_handle) : handle(task_handle) {}
+
+    friend class CoroReactor;
+};
+
+class CoroReactor;
+
+// A connection as its handler sees it
+class CoroConnection {
+private:
+    enum class Wait { None, Read, Write, Sleep };
+
+    CoroReactor& reactor;
+    ConnTask task;
+    std::coroutine_handle<> waiting;  // The innermost handler of the suspended operation
+    Wait wait = Wait::None;
+    uint64_t generation = 0;          // Descriptor reuse
+    uint64_t deadline_ns = 0;         // Of the suspended operation, 0 for none
+    uint64_t timer_ns = 0;            // Earliest timer queued for this connection, 0 for none
+    bool ended = false;
+
+    // The operation in progress
+    char* read_buffer = nullptr;
+    const char* write_data = nullptr;
+    size_t io_size = 0;
+    size_t io_done = 0;
+    ssize_t result = 0;
+
+    // True once the read has an outcome in result: bytes, 0 at end of
+    // stream, -1 on error
+    bool try_read() {
+        for (;;) {
+            ssize_t n = ::read(fd, read_buffer, io_size);
+            if (n == -1 && errno == EINTR) continue;
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return false;
+            result = n;
+            return true;
+        }
+    }
+
+    // True once everything is written (result 1) or the socket failed (0)
+    bool try_write() {
+        while (io_done < io_size) {
+            ssize_t n = ::write(fd, write_data + io_done, io_size - io_done);
+            if (n > 0) {
+                io_done += n;
+                continue;
+            }
+            if (n == -1 && errno == EINTR) continue;
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return false;
+            result = 0;
+            return true;
+        }
+        result = 1;
+        return true;
+    }
+
+    void suspend(std::coroutine_handle<> handle, Wait kind, uint64_t deadline);
+
+    friend class CoroReactor;
+
+public:
+    int fd = -1;
+    uint64_t timeouts = 0;      // Operations that reached their deadline
+
+    explicit CoroConnection(CoroReactor& owner) : reactor(owner) {}
+
+    struct [[nodiscard]] ReadOp {
+        CoroConnection& conn;
+        uint64_t deadline_ns;
+
+        bool await_ready() {
+            return conn.try_read();
+        }
+        void await_suspend(std::coroutine_handle<> handle) {
+            conn.suspend(handle, Wait::Read, deadline_ns);
+        }
+        ssize_t await_resume() const noexcept {
+            return conn.result;
+        }
+    };
+
+    struct [[nodiscard]] WriteOp {
+        CoroConnection& conn;
+        uint64_t deadline_ns;
+
+        bool await_ready() {
+            return conn.try_write();
+        }
+        void await_suspend(std::coroutine_handle<> handle) {
+            conn.suspend(handle, Wait::Write, deadline_ns);
+        }
+        bool await_resume() const noexcept {
+            return conn.result == 1;
+        }
+    };
+
+    struct [[nodiscard]] SleepOp {
+        CoroConnection& conn;
+        uint64_t when_ns;
+
+        bool await_ready() const;
+        void await_suspend(std::coroutine_handle<> handle) {
+            conn.suspend(handle, Wait::Sleep, when_ns);
+        }
+        void await_resume() const noexcept {}
+    };
+
+    // Reads what is there, up to size bytes, waiting for some if there is
+    // none: the byte count, 0 at end of stream, -1 on error or at the
+    // deadline (0 for none)
+    ReadOp read(char* buffer, size_t size, uint64_t deadline = 0) {
+        read_buffer = buffer;
+        io_size = size;
+        return ReadOp{*this, deadline};
+    }
+
+    // Writes all of data, waiting while the socket is full; false if the
+    // connection failed or the deadline passed first. data must stay valid
+    // until then.
+    WriteOp write(const char* data, size_t length, uint64_t deadline = 0) {
+        write_data = data;
+        io_size = length;
+        io_done = 0;
+        return WriteOp{*this, deadline};
+    }
+
+    SleepOp sleep_until(uint64_t when_ns) {
+        return SleepOp{*this, when_ns};
+    }
+};
+
+// Runs the handlers of one thread's connections
+class CoroReactor {
+private:
+    struct Timer {
+        uint64_t when_ns;
+        int fd;
+        uint64_t generation;
+        bool operator>(const Timer& other) const {
+            return when_ns > other.when_ns;
+        }
+    };
+
+    std::vector<std::unique_ptr<CoroConnection>> connections;   // By descriptor
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+    uint64_t timer_armed_ns = 0;
+    uint64_t next_generation = 1;
+
+    void run(CoroConnection& conn) {
+        conn.wait = Wait::None;
+        conn.deadline_ns = 0;
+        std::coroutine_handle<> handle = conn.waiting;
+        conn.waiting = nullptr;
+        handle.resume();
+        if (conn.task.done() && !conn.ended) {
+            conn.ended = true;
+            ended.push_back(conn.fd);
+        }
+    }
+
+    // Completes a suspended operation
+    void resume(CoroConnection& conn) {
+        resumes++;
+        run(conn);
+    }
+
+    void arm_timer() {
+        uint64_t when = timers.empty() ? 0 : timers.top().when_ns;
+        if (when == timer_armed_ns) return;
+        timer_armed_ns = when;
+        struct itimerspec at;
+        memset(&at, 0, sizeof(at));
+        at.it_value.tv_sec = when / 1000000000ULL;
+        at.it_value.tv_nsec = when % 1000000000ULL;
+        timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &at, nullptr);
+    }
+
+    typedef CoroConnection::Wait Wait;
+    friend class CoroConnection;
+
+public:
+    int timer_fd = -1;
+    std::vector<int> ended;     // Descriptors whose handler returned, for the owner to close
+    uint64_t started = 0;
+    uint64_t resumes = 0;       // Suspended operations completed by the reactor
+    uint64_t timeouts = 0;
+
+    ~CoroReactor() {
+        connections.clear();
+        if (timer_fd != -1) close(timer_fd);
+    }
+
+    static uint64_t now_ns() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    // Creates the timerfd and registers it with epoll_fd for input
+    bool open(int epoll_fd) {
+        timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (timer_fd == -1) {
+            perror("timerfd_create coroutine");
+            return false;
+        }
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = timer_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) == -1) {
+            perror("epoll_ctl coroutine timer");
+            return false;
+        }
+        return true;
+    }
+
+    // The connection object for fd, reset for a new handler
+    CoroConnection& attach(int fd) {
+        if ((size_t)fd >= connections.size()) connections.resize(fd + 1);
+        std::unique_ptr<CoroConnection>& slot = connections[fd];
+        if (!slot) slot.reset(new CoroConnection(*this));
+        CoroConnection& conn = *slot;
+        conn.task = ConnTask();
+        conn.waiting = nullptr;
+        conn.wait = Wait::None;
+        conn.generation = next_generation++;
+        conn.deadline_ns = 0;
+        conn.timer_ns = 0;
+        conn.ended = false;
+        conn.timeouts = 0;
+        conn.fd = fd;
+        return conn;
+    }
+
+    // Runs handler, made for attach(fd)'s connection, to its first
+    // suspension
+    void start(int fd, ConnTask handler) {
+        CoroConnection& conn = *connections[fd];
+        conn.task = std::move(handler);
+        conn.waiting = conn.task.handle;
+        started++;
+        run(conn);
+    }
+
+    bool owns(int fd) const {
+        return fd >= 0 && (size_t)fd < connections.size() && connections[fd] && connections[fd]->fd == fd;
+    }
+
+    // Destroys fd's handler wherever it is suspended, returning its frames
+    // to the pool; the owner closes the descriptor
+    void detach(int fd) {
+        if (!owns(fd)) return;
+        CoroConnection& conn = *connections[fd];
+        conn.task = ConnTask();
+        conn.waiting = nullptr;
+        conn.wait = Wait::None;
+        conn.fd = -1;
+    }
+
+    void on_events(int fd, uint32_t events) {
+        if (!owns(fd)) return;
+        CoroConnection& conn = *connections[fd];
+        if (conn.ended) return;
+        bool failed = events & (EPOLLERR | EPOLLHUP);
+        if (conn.wait == Wait::Read && (events & (EPOLLIN | EPOLLRDHUP) || failed)) {
+            if (conn.try_read()) resume(conn);
+        } else if (conn.wait == Wait::Write && (events & EPOLLOUT || failed)) {
+            if (conn.try_write()) resume(conn);
+        }
+    }
+
+    // A deadline can move later while its timer is queued; the timer then
+    // goes back in for the new time instead of expiring
+    void on_timer() {
+        uint64_t expirations;
+        while (::read(timer_fd, &expirations, sizeof(expirations)) > 0) {}
+        uint64_t now = now_ns();
+        while (!timers.empty() && timers.top().when_ns <= now) {
+            Timer timer = timers.top();
+            timers.pop();
+            if (!owns(timer.fd)) continue;
+            CoroConnection& conn = *connections[timer.fd];
+            if (conn.generation != timer.generation || conn.timer_ns != timer.when_ns) continue;
+            conn.timer_ns = 0;
+            if (conn.wait == Wait::None || !conn.deadline_ns) continue;
+            if (conn.deadline_ns > now) {
+                conn.timer_ns = conn.deadline_ns;
+                timers.push(Timer{conn.deadline_ns, conn.fd, conn.generation});
+                continue;
+            }
+            if (conn.wait != Wait::Sleep) {
+                conn.result = conn.wait == Wait::Read ? -1 : 0;
+                conn.timeouts++;
+                timeouts++;
+            }
+            resume(conn);
+        }
+        arm_timer();
+    }
+
+    size_t active() const {
+        size_t count = 0;
+        for (const auto& conn : connections) {
+            if (conn && conn->fd != -1 && !conn->ended) count++;
+        }
+        return count;
+    }
+};
+
+inline void CoroConnection::suspend(std::coroutine_handle<> handle, Wait kind, uint64_t deadline) {
+    waiting = handle;
+    wait = kind;
+    deadline_ns = deadline;
+    if (!deadline || (timer_ns && timer_ns <= deadline)) return;
+    timer_ns = deadline;
+    reactor.timers.push(CoroReactor::Timer{deadline, fd, generation});
+    reactor.arm_timer();
+}
+
+inline bool CoroConnection::SleepOp::await_ready() const {
+    return when_ns <= CoroReactor::now_ns();
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+// Consistent-hash ring with virtual nodes. Each node is placed on the ring
+// at virtual_nodes points; a key belongs to the first point at or after its
+// hash, so adding or removing a node only moves that node's share of keys.
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+// splitmix64 finalizer: cheap and well distributed for integer keys
+inline uint64_t hash_mix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+class ConsistentHashRing {
+private:
+    struct Point {
+        uint64_t hash;
+        int node;
+
+        bool operator<(const Point& other) const {
+            return hash < other.hash;
+        }
+    };
+
+    int virtual_nodes;
+    std::vector<Point> points;
+    std::vector<int> nodes;
+
+public:
+    explicit ConsistentHashRing(int vnodes = 128) : virtual_nodes(vnodes) {}
+
+    void add_node(int node) {
+        if (std::find(nodes.begin(), nodes.end(), node) != nodes.end()) return;
+        nodes.push_back(node);
+        // Hashed twice so points never coincide with the hashes of small
+        // integer keys (node 0's points would otherwise be keys 0..vnodes-1)
+        uint64_t seed = hash_mix64((uint64_t)node);
+        for (int v = 0; v < virtual_nodes; v++) {
+            points.push_back(Point{hash_mix64(seed ^ (uint32_t)v), node});
+        }
+        std::sort(points.begin(), points.end());
+    }
+
+    void remove_node(int node) {
+        nodes.erase(std::remove(nodes.begin(), nodes.end(), node), nodes.end());
+        points.erase(std::remove_if(points.begin(), points.end(),
+                                    [node](const Point& p) { return p.node == node; }),
+                     points.end());
+    }
+
+    // Returns the node owning key, or -1 if the ring is empty
+    int lookup(uint64_t key) const {
+        if (points.empty()) return -1;
+        Point probe{hash_mix64(key), 0};
+        auto it = std::lower_bound(points.begin(), points.end(), probe);
+        if (it == points.end()) it = points.begin();
+        return it->node;
+    }
+
+    size_t node_count() const {
+        return nodes.size();
+    }
+};
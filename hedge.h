@@ -0,0 +1,93 @@
+#pragma once
+
+// Hedged requests for idempotent calls. A request still outstanding after
+// delay_us() is sent again on a second path or replica and the first reply
+// wins. The delay is the HEDGE_QUANTILE of the last HEDGE_WINDOW latencies,
+// recomputed every HEDGE_REFRESH samples, so only the slowest ~5% of
+// requests are duplicated. Until HEDGE_WINDOW samples are in there is no
+// delay and nothing is hedged.
+//
+// try_hedge() also enforces a budget: hedges stay under budget times the
+// requests started, so a replica that is slow across the board (every
+// request past the old p95) cannot double the load.
+//
+// State is shared by all client threads. Samples go into a ring of relaxed
+// atomics; whichever thread completes a refresh interval sorts a copy.
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+const size_t HEDGE_WINDOW = 1024;     // Recent latencies the quantile is taken over
+const size_t HEDGE_REFRESH = 128;     // Samples between recomputations
+const double HEDGE_QUANTILE = 0.95;
+const double HEDGE_BUDGET = 0.10;     // Hedges per request, at most
+
+class HedgeTrigger {
+private:
+    std::unique_ptr<std::atomic<uint32_t>[]> window;  // Microseconds
+    std::atomic<uint64_t> samples{0};
+    std::atomic<uint32_t> delay{0};
+    std::atomic<uint64_t> started{0};
+    std::atomic<uint64_t> hedged{0};
+    std::atomic<uint64_t> won{0};
+    std::mutex refresh_mutex;
+    std::vector<uint32_t> sorted;
+
+    void refresh() {
+        std::unique_lock<std::mutex> lock(refresh_mutex, std::try_to_lock);
+        if (!lock.owns_lock()) return;  // Someone else is on it
+        sorted.resize(HEDGE_WINDOW);
+        for (size_t i = 0; i < HEDGE_WINDOW; i++) sorted[i] = window[i].load(std::memory_order_relaxed);
+        size_t rank = (size_t)(HEDGE_WINDOW * HEDGE_QUANTILE);
+        std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+        delay.store(std::max<uint32_t>(1, sorted[rank]), std::memory_order_relaxed);
+    }
+
+public:
+    HedgeTrigger() : window(new std::atomic<uint32_t>[HEDGE_WINDOW]) {
+        for (size_t i = 0; i < HEDGE_WINDOW; i++) window[i].store(0, std::memory_order_relaxed);
+    }
+
+    // How long a request may be outstanding before it is hedged, 0 for never
+    uint32_t delay_us() const {
+        return delay.load(std::memory_order_relaxed);
+    }
+
+    // A request went out
+    void start() {
+        started.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // True if this request may be hedged within the budget; counts the hedge
+    bool try_hedge() {
+        uint64_t limit = (uint64_t)(started.load(std::memory_order_relaxed) * HEDGE_BUDGET);
+        if (hedged.load(std::memory_order_relaxed) >= limit) return false;
+        hedged.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // A request completed after latency_us; hedge_won when the duplicate's
+    // reply came first
+    void finish(double latency_us, bool hedge_won) {
+        if (hedge_won) won.fetch_add(1, std::memory_order_relaxed);
+        uint64_t n = samples.fetch_add(1, std::memory_order_relaxed);
+        window[n % HEDGE_WINDOW].store((uint32_t)std::min(latency_us, 4e9), std::memory_order_relaxed);
+        if (n + 1 >= HEDGE_WINDOW && (n + 1) % HEDGE_REFRESH == 0) refresh();
+    }
+
+    uint64_t requests() const {
+        return started.load(std::memory_order_relaxed);
+    }
+
+    uint64_t hedges() const {
+        return hedged.load(std::memory_order_relaxed);
+    }
+
+    uint64_t hedge_wins() const {
+        return won.load(std::memory_order_relaxed);
+    }
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+// Idempotency cache for retransmitted requests. A request that starts with
+// an IdempotentHeader names its client and a per-client sequence number.
+// Clients are told apart by the ID together with the peer's IP address, not
+// its port, so a hedge sent from a second socket still finds the window.
+// Per client the server keeps a sliding window over the last
+// IDEMPOTENCY_WINDOW sequences, as a bitmap of which were seen (the replay
+// window of IPsec and DTLS), and the response to each. A retransmission or
+// hedge of a seen sequence is answered from the window instead of being
+// processed again; one older than the window is stale and dropped, since the
+// client has long moved on. Sequence 1 arriving once the window has moved
+// past it is a client that restarted under the same ID: its window starts
+// over instead.
+//
+// At most IDEMPOTENCY_MAX_CLIENTS windows are kept, evicting the least
+// recently used client first, so a busy client keeps its window. Response slots keep their capacity, so once a client's slots
+// have been filled a store does not allocate.
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string.h>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+const uint32_t IDEMPOTENT_MAGIC = 0x31504449;    // "IDP1" on the wire
+const uint64_t IDEMPOTENCY_WINDOW = 32;          // Sequences per client, at most 64 (bitmap)
+const size_t IDEMPOTENCY_MAX_CLIENTS = 4096;
+
+struct IdempotentHeader {
+    uint32_t magic;
+    uint32_t client;
+    uint64_t sequence;    // Per client, from 1
+    uint32_t attempt;     // Transmission of this sequence; replies carry the current one
+    uint32_t reserved;
+};
+
+inline bool parse_idempotent(const char* data, size_t length, IdempotentHeader& header) {
+    if (length < sizeof(IdempotentHeader)) return false;
+    memcpy(&header, data, sizeof(header));
+    return header.magic == IDEMPOTENT_MAGIC && header.sequence != 0;
+}
+
+enum class IdempotentLookup { New, Duplicate, Stale };
+
+class IdempotencyCache {
+public:
+    struct Entry {
+        uint64_t sequence = 0;
+        uint64_t journal_sequence = 0;   // Input sequence the original was recorded under
+        std::string response;            // Without the header
+    };
+
+private:
+    struct Window {
+        uint64_t highest = 0;
+        uint64_t seen = 0;               // Bit i: highest - i was processed
+        std::list<uint64_t>::iterator use;  // Place in order
+        Entry entries[IDEMPOTENCY_WINDOW];
+    };
+
+    std::unordered_map<uint64_t, std::unique_ptr<Window>> windows;   // (IPv4 address << 32) | client
+    std::list<uint64_t> order;           // Clients by last request, least recent first, for eviction
+
+    void touch(Window& window) {
+        order.splice(order.end(), order, window.use);
+    }
+
+    static uint64_t key(const IdempotentHeader& header, const struct sockaddr_in& peer) {
+        return ((uint64_t)peer.sin_addr.s_addr << 32) | header.client;
+    }
+
+    static bool restarted(const Window& window, const IdempotentHeader& header) {
+        return header.sequence == 1 && window.highest >= IDEMPOTENCY_WINDOW;
+    }
+
+public:
+    uint64_t requests = 0;
+    uint64_t duplicates = 0;
+    uint64_t stale = 0;
+    uint64_t evictions = 0;
+    uint64_t restarts = 0;
+
+    // New requests are to be processed and then stored. For a duplicate,
+    // cached is its entry.
+    IdempotentLookup lookup(const IdempotentHeader& header, const struct sockaddr_in& peer, const Entry*& cached) {
+        requests++;
+        auto it = windows.find(key(header, peer));
+        if (it == windows.end()) return IdempotentLookup::New;
+        Window& window = *it->second;
+        touch(window);
+        if (header.sequence > window.highest) return IdempotentLookup::New;
+        if (restarted(window, header)) return IdempotentLookup::New;
+        uint64_t age = window.highest - header.sequence;
+        if (age >= IDEMPOTENCY_WINDOW) {
+            stale++;
+            return IdempotentLookup::Stale;
+        }
+        if (!(window.seen & (1ULL << age))) return IdempotentLookup::New;  // Arrived out of order
+        duplicates++;
+        cached = &window.entries[header.sequence % IDEMPOTENCY_WINDOW];
+        return IdempotentLookup::Duplicate;
+    }
+
+    void store(const IdempotentHeader& header, const struct sockaddr_in& peer, uint64_t journal_sequence,
+               const char* response, size_t length) {
+        uint64_t client = key(header, peer);
+        auto it = windows.find(client);
+        if (it == windows.end()) {
+            if (windows.size() >= IDEMPOTENCY_MAX_CLIENTS) {
+                windows.erase(order.front());
+                order.pop_front();
+                evictions++;
+            }
+            it = windows.emplace(client, std::unique_ptr<Window>(new Window())).first;
+            it->second->use = order.insert(order.end(), client);
+        }
+        Window& window = *it->second;
+        touch(window);
+        if (restarted(window, header)) {
+            window.highest = 0;
+            window.seen = 0;
+            restarts++;
+        }
+        if (header.sequence > window.highest) {
+            uint64_t shift = header.sequence - window.highest;
+            window.seen = shift >= 64 ? 0 : window.seen << shift;
+            window.highest = header.sequence;
+        }
+        window.seen |= 1ULL << (window.highest - header.sequence);
+
+        Entry& entry = window.entries[header.sequence % IDEMPOTENCY_WINDOW];
+        entry.sequence = header.sequence;
+        entry.journal_sequence = journal_sequence;
+        entry.response.assign(response, length);
+    }
+
+    size_t clients() const {
+        return windows.size();
+    }
+};
@@ -0,0 +1,310 @@
+#pragma once
+
+// Memory-mapped, preallocated append-only journal of inbound messages.
+// The reactor thread appends records; durability is handled by one of the
+// JournalPolicy modes, with group commit running on its own flusher thread.
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+const uint64_t JOURNAL_MAGIC = 0x314C4E524A54454EULL;  // "NETJRNL1"
+const uint32_t JOURNAL_VERSION = 1;
+const size_t JOURNAL_HEADER_SIZE = 4096;  // First page holds the file header
+
+enum JournalProtocol : uint8_t {
+    JOURNAL_TCP = 1,
+    JOURNAL_UDP = 2,
+    JOURNAL_QUIC = 3
+};
+
+enum class JournalPolicy {
+    None,   // Journaling disabled
+    Async,  // Write into the mapping, leave writeback to the kernel
+    Group,  // Flusher thread msyncs every N messages or T microseconds
+    Sync    // msync after every message on the reactor thread
+};
+
+struct JournalFileHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t capacity;  // Bytes available for records after the header page
+};
+
+// Fixed header in front of every record, followed by `length` payload bytes
+// padded to an 8 byte boundary. A zero sequence marks the end of the journal.
+struct JournalRecord {
+    uint64_t sequence;
+    uint64_t timestamp_ns;   // steady_clock, comparable across local processes
+    uint32_t length;
+    uint32_t connection_id;
+    uint32_t peer_addr;      // Network byte order
+    uint16_t peer_port;      // Network byte order
+    uint8_t protocol;        // JournalProtocol
+    uint8_t reserved;
+};
+
+inline size_t journal_record_size(uint32_t length) {
+    return (sizeof(JournalRecord) + length + 7) & ~(size_t)7;
+}
+
+inline uint64_t journal_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline bool parse_journal_policy(const std::string& name, JournalPolicy& policy) {
+    if (name == "none") policy = JournalPolicy::None;
+    else if (name == "async") policy = JournalPolicy::Async;
+    else if (name == "group") policy = JournalPolicy::Group;
+    else if (name == "sync") policy = JournalPolicy::Sync;
+    else return false;
+    return true;
+}
+
+class Journal {
+private:
+    int fd;
+    char* base;
+    size_t mapped_size;
+    size_t capacity;
+    size_t tail;                  // Reactor-owned write offset (relative to records)
+    uint64_t next_sequence;
+    bool full_reported;
+
+    std::atomic<size_t> published_tail{0};
+    std::atomic<uint64_t> published_sequence{0};
+    std::atomic<uint64_t> durable_sequence{0};
+    size_t durable_tail;          // Flusher-owned
+
+    // Group commit state
+    std::thread flusher;
+    std::mutex flush_mutex;
+    std::condition_variable flush_cv;
+    std::atomic<bool> flusher_running{false};
+    std::atomic<bool> wake_requested{false};
+    int commit_every;
+    int commit_interval_us;
+    int notify_fd;
+
+public:
+    Journal() : fd(-1), base(nullptr), mapped_size(0), capacity(0), tail(0),
+                next_sequence(1), full_reported(false), durable_tail(0),
+                commit_every(64), commit_interval_us(200), notify_fd(-1) {}
+
+    ~Journal() {
+        close();
+    }
+
+    // Opens or creates the journal. An existing journal is appended to after
+    // its last record, so sequence numbers keep increasing across restarts.
+    bool open(const std::string& path, size_t capacity_bytes) {
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd == -1) {
+            perror("journal open");
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            perror("journal fstat");
+            return false;
+        }
+
+        bool existing = st.st_size >= (off_t)JOURNAL_HEADER_SIZE;
+        if (existing) {
+            capacity = st.st_size - JOURNAL_HEADER_SIZE;
+        } else {
+            capacity = capacity_bytes;
+            // Reserve the blocks up front so appends never hit ENOSPC via SIGBUS
+            int err = posix_fallocate(fd, 0, JOURNAL_HEADER_SIZE + capacity);
+            if (err != 0) {
+                fprintf(stderr, "journal fallocate: %s\n", strerror(err));
+                return false;
+            }
+        }
+
+        mapped_size = JOURNAL_HEADER_SIZE + capacity;
+        void* mapping = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            perror("journal mmap");
+            base = nullptr;
+            return false;
+        }
+        base = static_cast<char*>(mapping);
+
+        JournalFileHeader* header = reinterpret_cast<JournalFileHeader*>(base);
+        if (existing) {
+            if (header->magic != JOURNAL_MAGIC || header->version != JOURNAL_VERSION) {
+                fprintf(stderr, "journal %s: bad magic or version\n", path.c_str());
+                return false;
+            }
+            // Recovery and replay both walk the file front to back
+            madvise(base + JOURNAL_HEADER_SIZE, capacity, MADV_SEQUENTIAL);
+            recover_tail();
+        } else {
+            header->magic = JOURNAL_MAGIC;
+            header->version = JOURNAL_VERSION;
+            header->reserved = 0;
+            header->capacity = capacity;
+            msync(base, JOURNAL_HEADER_SIZE, MS_SYNC);
+        }
+
+        published_tail = tail;
+        published_sequence = next_sequence - 1;
+        durable_sequence = next_sequence - 1;
+        durable_tail = tail;
+        return true;
+    }
+
+    // Appends one record from the reactor thread. Returns the assigned
+    // sequence number, or 0 if the journal has no space left.
+    uint64_t append(uint8_t protocol, uint32_t connection_id,
+                    const struct sockaddr_in* peer, const char* data, size_t length) {
+        size_t record_size = journal_record_size(length);
+        if (tail + record_size > capacity) {
+            if (!full_reported) {
+                fprintf(stderr, "Journal full after %llu records - journaling stopped\n",
+                        (unsigned long long)(next_sequence - 1));
+                full_reported = true;
+            }
+            return 0;
+        }
+
+        char* dst = base + JOURNAL_HEADER_SIZE + tail;
+        JournalRecord* record = reinterpret_cast<JournalRecord*>(dst);
+        record->timestamp_ns = journal_now_ns();
+        record->length = length;
+        record->connection_id = connection_id;
+        record->peer_addr = peer ? peer->sin_addr.s_addr : 0;
+        record->peer_port = peer ? peer->sin_port : 0;
+        record->protocol = protocol;
+        record->reserved = 0;
+        memcpy(dst + sizeof(JournalRecord), data, length);
+
+        // Sequence goes in last so a torn record is never mistaken for a valid one
+        uint64_t sequence = next_sequence++;
+        __atomic_store_n(&record->sequence, sequence, __ATOMIC_RELEASE);
+
+        tail += record_size;
+        published_tail.store(tail, std::memory_order_release);
+        published_sequence.store(sequence, std::memory_order_release);
+
+        if (flusher_running &&
+            sequence - durable_sequence.load(std::memory_order_relaxed) >= (uint64_t)commit_every &&
+            !wake_requested.exchange(true)) {
+            flush_cv.notify_one();
+        }
+        return sequence;
+    }
+
+    // Flushes everything appended so far to stable storage. Safe to call from
+    // either the reactor (sync policy) or the flusher thread, not both.
+    void commit() {
+        size_t end = published_tail.load(std::memory_order_acquire);
+        uint64_t sequence = published_sequence.load(std::memory_order_acquire);
+        if (sequence == durable_sequence.load(std::memory_order_relaxed)) return;
+
+        long page = sysconf(_SC_PAGESIZE);
+        size_t start = (JOURNAL_HEADER_SIZE + durable_tail) & ~(size_t)(page - 1);
+        size_t stop = JOURNAL_HEADER_SIZE + end;
+        if (msync(base + start, stop - start, MS_SYNC) == -1) {
+            perror("journal msync");
+            return;
+        }
+
+        durable_tail = end;
+        durable_sequence.store(sequence, std::memory_order_release);
+    }
+
+    // Starts the group-commit flusher. After each flush that makes new records
+    // durable, an eventfd counter is bumped on notify_eventfd (if not -1).
+    void start_group_commit(int every, int interval_us, int notify_eventfd) {
+        commit_every = every > 0 ? every : 1;
+        commit_interval_us = interval_us > 0 ? interval_us : 1;
+        notify_fd = notify_eventfd;
+        flusher_running = true;
+        flusher = std::thread(&Journal::flusher_loop, this);
+    }
+
+    uint64_t get_durable_sequence() const {
+        return durable_sequence.load(std::memory_order_acquire);
+    }
+
+    uint64_t get_last_sequence() const {
+        return next_sequence - 1;
+    }
+
+    // Start of the record area and the number of bytes of valid records in it
+    const char* records() const {
+        return base + JOURNAL_HEADER_SIZE;
+    }
+
+    size_t records_size() const {
+        return tail;
+    }
+
+    void close() {
+        if (flusher_running) {
+            flusher_running = false;
+            flush_cv.notify_one();
+            flusher.join();
+        }
+        if (base) {
+            commit();
+            munmap(base, mapped_size);
+            base = nullptr;
+        }
+        if (fd != -1) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+private:
+    void recover_tail() {
+        tail = 0;
+        next_sequence = 1;
+        while (tail + sizeof(JournalRecord) <= capacity) {
+            const JournalRecord* record =
+                reinterpret_cast<const JournalRecord*>(base + JOURNAL_HEADER_SIZE + tail);
+            if (record->sequence != next_sequence) break;
+            size_t record_size = journal_record_size(record->length);
+            if (tail + record_size > capacity) break;
+            tail += record_size;
+            next_sequence++;
+        }
+    }
+
+    void flusher_loop() {
+        while (flusher_running) {
+            {
+                std::unique_lock<std::mutex> lock(flush_mutex);
+                flush_cv.wait_for(lock, std::chrono::microseconds(commit_interval_us), [this] {
+                    return !flusher_running || wake_requested.load();
+                });
+            }
+            wake_requested = false;
+
+            uint64_t before = durable_sequence.load(std::memory_order_relaxed);
+            commit();
+            if (notify_fd != -1 && durable_sequence.load(std::memory_order_relaxed) != before) {
+                uint64_t one = 1;
+                ssize_t ignored = write(notify_fd, &one, sizeof(one));
+                (void)ignored;
+            }
+        }
+    }
+};
@@ -0,0 +1,459 @@
+#pragma once
+
+// Log-buffer reliable UDP transport in the style of term-buffer designs such
+// as Aeron. A publication appends length-prefixed frames to a memory-mapped
+// log made of LOG_PARTITIONS terms and sends byte ranges of that log as
+// datagrams. The receiving image copies each range to the same position in
+// its own log, so a message split over several datagrams is reassembled in
+// place and handed to the subscriber without another copy. Gaps are repaired
+// with NAKs, and status messages carrying the subscriber's position bound how
+// far the publication may run ahead (flow control).
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+const uint32_t LOG_MAGIC = 0x31474F4C;  // "LOG1"
+const int LOG_PARTITIONS = 3;
+const size_t LOG_TERM_LENGTH = 4 * 1024 * 1024;
+const uint32_t LOG_FRAME_ALIGNMENT = 8;
+const size_t LOG_DATAGRAM_SIZE = 1408;  // Header plus log bytes; fits a 1500 byte MTU
+const int LOG_SEND_BATCH = 64;
+const uint64_t LOG_NAK_INTERVAL_NS = 1000000;        // Re-NAK a gap that stays open
+const uint64_t LOG_STATUS_INTERVAL_NS = 1000000;
+const uint64_t LOG_HEARTBEAT_INTERVAL_NS = 1000000;  // Idle sender re-announces its position
+
+enum LogDatagramType : uint16_t {
+    LOG_DATA = 1,
+    LOG_NAK = 2,
+    LOG_STATUS = 3
+};
+
+enum LogFrameType : uint32_t {
+    LOG_FRAME_MESSAGE = 1,
+    LOG_FRAME_PADDING = 2  // Fills the rest of a term a message did not fit in
+};
+
+struct LogDatagramHeader {
+    uint32_t magic;
+    uint16_t type;        // LogDatagramType
+    uint16_t reserved;
+    uint32_t session_id;
+    uint32_t length;      // DATA: log bytes that follow; NAK: bytes missing
+    uint64_t position;    // DATA: log position of the first byte; NAK: gap start;
+                          // STATUS: subscriber position
+    uint64_t value;       // DATA: sender position (heartbeats); STATUS: receiver window
+};
+
+// Frame header in the log; length includes the header, frames are padded to
+// LOG_FRAME_ALIGNMENT and never cross a term boundary
+struct LogFrameHeader {
+    uint32_t length;
+    uint32_t type;        // LogFrameType
+};
+
+inline uint32_t log_align(uint32_t length) {
+    return (length + LOG_FRAME_ALIGNMENT - 1) & ~(LOG_FRAME_ALIGNMENT - 1);
+}
+
+// Returns true and the session ID if data is a log transport datagram
+inline bool is_log_datagram(const char* data, size_t length, uint32_t& session_id) {
+    if (length < sizeof(LogDatagramHeader)) return false;
+    LogDatagramHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != LOG_MAGIC) return false;
+    session_id = header.session_id;
+    return true;
+}
+
+// LOG_PARTITIONS terms of one shared mapping, addressed by a 64-bit stream
+// position that keeps growing as terms rotate
+class LogBuffer {
+private:
+    char* base;
+    size_t term_length;
+
+public:
+    LogBuffer() : base(nullptr), term_length(0) {}
+    LogBuffer(const LogBuffer&) = delete;
+    LogBuffer& operator=(const LogBuffer&) = delete;
+
+    ~LogBuffer() {
+        if (base) munmap(base, term_length * LOG_PARTITIONS);
+    }
+
+    // Maps the terms onto an unlinked file in /dev/shm
+    bool map(size_t term_bytes) {
+        char path[] = "/dev/shm/nettest-log-XXXXXX";
+        int fd = mkstemp(path);
+        if (fd == -1) {
+            perror("log buffer mkstemp");
+            return false;
+        }
+        unlink(path);
+
+        size_t size = term_bytes * LOG_PARTITIONS;
+        if (ftruncate(fd, size) == -1) {
+            perror("log buffer ftruncate");
+            close(fd);
+            return false;
+        }
+        void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED) {
+            perror("log buffer mmap");
+            return false;
+        }
+        base = static_cast<char*>(mapping);
+        term_length = term_bytes;
+        return true;
+    }
+
+    char* at(uint64_t position) const {
+        return base + ((position / term_length) % LOG_PARTITIONS) * term_length + position % term_length;
+    }
+
+    size_t term_remaining(uint64_t position) const {
+        return term_length - position % term_length;
+    }
+
+    size_t get_term_length() const {
+        return term_length;
+    }
+};
+
+class LogPublication {
+private:
+    LogBuffer log;
+    uint32_t session_id;
+    uint64_t tail;                // End of appended frames
+    uint64_t sent;                // End of data sent at least once
+    uint64_t limit;               // Flow control: tail may not pass this
+    uint64_t receiver_position;
+    uint64_t last_send_ns;
+    std::vector<std::pair<uint64_t, uint64_t>> retransmits;  // [start, end) asked for by NAKs
+
+    // sendmmsg batch; each datagram is a header plus a range of the log
+    struct mmsghdr messages[LOG_SEND_BATCH];
+    struct iovec iovecs[LOG_SEND_BATCH][2];
+    LogDatagramHeader headers[LOG_SEND_BATCH];
+    uint64_t fresh_start[LOG_SEND_BATCH];  // First new-data position per slot, or UINT64_MAX
+    int batch_count;
+
+public:
+    uint64_t naks_received;
+    uint64_t retransmitted_bytes;
+
+    LogPublication() : session_id(0), tail(0), sent(0), limit(0), receiver_position(0),
+                       last_send_ns(0), batch_count(0), naks_received(0), retransmitted_bytes(0) {}
+
+    bool init(uint32_t session, size_t term_length = LOG_TERM_LENGTH) {
+        session_id = session;
+        limit = term_length / 2;  // Until the first status message arrives
+        return log.map(term_length);
+    }
+
+    size_t max_message() const {
+        return log.get_term_length() / 8 - sizeof(LogFrameHeader);
+    }
+
+    // Appends one message. Returns false when flow control (or the message
+    // size) does not allow it yet; the caller should retry later.
+    bool offer(const char* data, uint32_t length) {
+        if (length > max_message()) return false;
+        uint32_t frame_length = sizeof(LogFrameHeader) + length;
+        uint32_t aligned = log_align(frame_length);
+        size_t remaining = log.term_remaining(tail);
+        uint64_t needed = aligned + (aligned > remaining ? remaining : 0);
+        if (tail + needed > limit) return false;
+
+        if (aligned > remaining) {
+            LogFrameHeader padding = {(uint32_t)remaining, LOG_FRAME_PADDING};
+            memcpy(log.at(tail), &padding, sizeof(padding));
+            tail += remaining;
+        }
+
+        char* dst = log.at(tail);
+        LogFrameHeader header = {frame_length, LOG_FRAME_MESSAGE};
+        memcpy(dst, &header, sizeof(header));
+        memcpy(dst + sizeof(header), data, length);
+        tail += aligned;
+        return true;
+    }
+
+    void on_status(uint64_t position, uint64_t window) {
+        if (position > receiver_position) receiver_position = position;
+        uint64_t window_limit = position + std::min<uint64_t>(window, log.get_term_length() / 2);
+        if (window_limit > limit) limit = window_limit;
+    }
+
+    void on_nak(uint64_t position, uint32_t length) {
+        naks_received++;
+        // Only the current and previous terms are still intact
+        uint64_t term_start = tail - tail % log.get_term_length();
+        uint64_t oldest = term_start > (LOG_PARTITIONS - 1) * log.get_term_length()
+            ? term_start - (LOG_PARTITIONS - 1) * log.get_term_length() : 0;
+        uint64_t start = std::max(position, oldest);
+        uint64_t end = std::min(position + length, sent);
+        if (start < end) retransmits.push_back(std::make_pair(start, end));
+    }
+
+    // Sends NAKed ranges, then new data up to the flow control limit. An idle
+    // sender whose data is not all acknowledged sends a heartbeat so the
+    // receiver can detect a lost tail. Returns the datagrams sent.
+    int send(int fd, const struct sockaddr_in* peer, uint64_t now_ns) {
+        int total = 0;
+        for (const auto& range : retransmits) {
+            retransmitted_bytes += range.second - range.first;
+            total += add_range(fd, peer, range.first, range.second, false);
+        }
+        retransmits.clear();
+
+        if (sent < tail) {
+            uint64_t end = tail;
+            total += add_range(fd, peer, sent, end, true);
+            sent = end;
+        }
+
+        if (total == 0 && receiver_position < sent && now_ns - last_send_ns >= LOG_HEARTBEAT_INTERVAL_NS) {
+            add_datagram(fd, peer, sent, 0, false);
+            total++;
+        }
+        total -= flush(fd);
+
+        if (total > 0) last_send_ns = now_ns;
+        return total;
+    }
+
+    bool idle() const {
+        return sent == tail && retransmits.empty() && receiver_position >= sent;
+    }
+
+private:
+    int add_range(int fd, const struct sockaddr_in* peer, uint64_t start, uint64_t end, bool fresh) {
+        const size_t chunk = LOG_DATAGRAM_SIZE - sizeof(LogDatagramHeader);
+        int count = 0;
+        while (start < end) {
+            size_t length = std::min<uint64_t>(end - start, std::min(chunk, log.term_remaining(start)));
+            add_datagram(fd, peer, start, length, fresh);
+            start += length;
+            count++;
+        }
+        return count;
+    }
+
+    void add_datagram(int fd, const struct sockaddr_in* peer, uint64_t position, size_t length, bool fresh) {
+        if (batch_count == LOG_SEND_BATCH) flush(fd);
+
+        int i = batch_count++;
+        LogDatagramHeader& header = headers[i];
+        header.magic = LOG_MAGIC;
+        header.type = LOG_DATA;
+        header.reserved = 0;
+        header.session_id = session_id;
+        header.length = length;
+        header.position = position;
+        header.value = length ? position + length : sent;
+
+        iovecs[i][0].iov_base = &header;
+        iovecs[i][0].iov_len = sizeof(header);
+        iovecs[i][1].iov_base = log.at(position);
+        iovecs[i][1].iov_len = length;
+        memset(&messages[i].msg_hdr, 0, sizeof(messages[i].msg_hdr));
+        messages[i].msg_hdr.msg_name = const_cast<struct sockaddr_in*>(peer);
+        messages[i].msg_hdr.msg_namelen = peer ? sizeof(*peer) : 0;
+        messages[i].msg_hdr.msg_iov = iovecs[i];
+        messages[i].msg_hdr.msg_iovlen = length ? 2 : 1;
+        fresh_start[i] = fresh ? position : UINT64_MAX;
+    }
+
+    // Returns the number of datagrams that could not be sent. Unsent new data
+    // is rewound so the next send() retries it; anything else is left to NAKs.
+    int flush(int fd) {
+        int sent_count = 0;
+        while (sent_count < batch_count) {
+            int n = sendmmsg(fd, messages + sent_count, batch_count - sent_count, 0);
+            if (n <= 0) break;
+            sent_count += n;
+        }
+
+        int unsent = batch_count - sent_count;
+        for (int i = sent_count; i < batch_count; i++) {
+            if (fresh_start[i] != UINT64_MAX) {
+                sent = std::min(sent, fresh_start[i]);
+                break;
+            }
+        }
+        batch_count = 0;
+        return unsent;
+    }
+};
+
+class LogImage {
+private:
+    LogBuffer log;
+    uint32_t session_id;
+    uint64_t rebuild;             // Everything before this has arrived
+    uint64_t high;                // Furthest position the sender has reported
+    uint64_t consumed;            // Subscriber position
+    uint64_t window;
+    std::map<uint64_t, uint64_t> out_of_order;  // Received [start, end) past rebuild
+    uint64_t last_status_position;
+    uint64_t last_status_ns;
+    uint64_t last_nak_position;
+    uint64_t last_nak_ns;
+    bool status_requested;
+
+public:
+    uint64_t naks_sent;
+    bool broken;                  // A frame header could not be valid; nothing more is read
+
+    LogImage() : session_id(0), rebuild(0), high(0), consumed(0), window(0),
+                 last_status_position(0), last_status_ns(0), last_nak_position(UINT64_MAX),
+                 last_nak_ns(0), status_requested(false), naks_sent(0), broken(false) {}
+
+    bool init(uint32_t session, size_t term_length = LOG_TERM_LENGTH) {
+        session_id = session;
+        window = term_length / 2;
+        return log.map(term_length);
+    }
+
+    // Copies a received range into place. Ranges past what the subscriber
+    // could have freed, or crossing a term, are dropped and recovered by NAK.
+    void on_data(uint64_t position, const char* data, uint32_t length, uint64_t sender_position) {
+        if (length == 0) status_requested = true;  // Heartbeat: the sender may be blocked on us
+        uint64_t end = position + length;
+        high = std::max(high, std::max(end, sender_position));
+        if (length == 0 || end <= rebuild) return;
+        if (end > consumed + (LOG_PARTITIONS - 1) * log.get_term_length() ||
+            length > log.term_remaining(position)) {
+            return;
+        }
+
+        memcpy(log.at(position), data, length);
+        if (position <= rebuild) {
+            rebuild = end;
+        } else {
+            uint64_t& existing = out_of_order[position];
+            existing = std::max(existing, end);
+        }
+        while (!out_of_order.empty() && out_of_order.begin()->first <= rebuild) {
+            rebuild = std::max(rebuild, out_of_order.begin()->second);
+            out_of_order.erase(out_of_order.begin());
+        }
+    }
+
+    // Hands complete messages to fn(data, length) in order, straight from the
+    // log. fn returns false to leave the message for a later poll. A frame
+    // shorter than its header (which would never advance) or running past
+    // its term marks the image broken.
+    template <typename Fn>
+    int poll(Fn fn, int max_messages) {
+        int count = 0;
+        while (!broken && count < max_messages && consumed + sizeof(LogFrameHeader) <= rebuild) {
+            const char* frame = log.at(consumed);
+            LogFrameHeader header;
+            memcpy(&header, frame, sizeof(header));
+            if (header.length < sizeof(LogFrameHeader) || header.length > log.term_remaining(consumed)) {
+                broken = true;
+                break;
+            }
+            if (consumed + header.length > rebuild) break;
+
+            if (header.type == LOG_FRAME_MESSAGE) {
+                if (!fn(frame + sizeof(header), header.length - (uint32_t)sizeof(header))) break;
+                count++;
+            }
+            consumed += log_align(header.length);
+        }
+        return count;
+    }
+
+    // NAKs the first gap as soon as it is seen and again every
+    // LOG_NAK_INTERVAL_NS while it stays open; reports the subscriber
+    // position when it has moved a quarter window, when asked, or every
+    // LOG_STATUS_INTERVAL_NS while it keeps moving.
+    void send_control(int fd, const struct sockaddr_in* peer, uint64_t now_ns) {
+        if (rebuild < high && (rebuild != last_nak_position || now_ns - last_nak_ns >= LOG_NAK_INTERVAL_NS)) {
+            uint64_t gap_end = out_of_order.empty() ? high : out_of_order.begin()->first;
+            send_header(fd, peer, LOG_NAK, rebuild, gap_end - rebuild, 0);
+            last_nak_position = rebuild;
+            last_nak_ns = now_ns;
+            naks_sent++;
+        }
+
+        bool moved = consumed != last_status_position;
+        if (status_requested || consumed - last_status_position >= window / 4 ||
+            (moved && now_ns - last_status_ns >= LOG_STATUS_INTERVAL_NS)) {
+            send_header(fd, peer, LOG_STATUS, consumed, 0, window);
+            last_status_position = consumed;
+            last_status_ns = now_ns;
+            status_requested = false;
+        }
+    }
+
+private:
+    void send_header(int fd, const struct sockaddr_in* peer, uint16_t type,
+                     uint64_t position, uint64_t length, uint64_t value) {
+        LogDatagramHeader header;
+        header.magic = LOG_MAGIC;
+        header.type = type;
+        header.reserved = 0;
+        header.session_id = session_id;
+        header.length = (uint32_t)std::min<uint64_t>(length, UINT32_MAX);
+        header.position = position;
+        header.value = value;
+        sendto(fd, &header, sizeof(header), 0, (const struct sockaddr*)peer, peer ? sizeof(*peer) : 0);
+    }
+};
+
+// Both directions of one peer conversation: data we publish to the peer and
+// the image of what the peer publishes to us
+struct LogSession {
+    LogPublication publication;
+    LogImage image;
+    struct sockaddr_in peer;
+    uint32_t id = 0;
+    uint64_t last_active_ns = 0;
+
+    bool init(uint32_t session_id, size_t term_length = LOG_TERM_LENGTH) {
+        id = session_id;
+        return publication.init(session_id, term_length) && image.init(session_id, term_length);
+    }
+
+    void on_datagram(const char* data, size_t length, uint64_t now_ns) {
+        LogDatagramHeader header;
+        memcpy(&header, data, sizeof(header));
+        last_active_ns = now_ns;
+        switch (header.type) {
+        case LOG_DATA:
+            if (sizeof(header) + header.length <= length) {
+                image.on_data(header.position, data + sizeof(header), header.length, header.value);
+            }
+            break;
+        case LOG_NAK:
+            publication.on_nak(header.position, header.length);
+            break;
+        case LOG_STATUS:
+            publication.on_status(header.position, header.value);
+            break;
+        }
+    }
+
+    // Sends control messages and pending data; peer is null on a connected socket
+    void send(int fd, const struct sockaddr_in* peer, uint64_t now_ns) {
+        image.send_control(fd, peer, now_ns);
+        publication.send(fd, peer, now_ns);
+    }
+};
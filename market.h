@@ -0,0 +1,139 @@
+#pragma once
+
+// Minimal binary market messages and the per-symbol state the server keeps
+// for them: an order book and a last-value cache. All fields are host byte
+// order; these messages only travel between processes on the same box.
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <unordered_map>
+
+const uint32_t MARKET_MAGIC = 0x31544B4D;  // "MKT1"
+
+enum MarketMessageType : uint8_t {
+    MARKET_QUOTE = 1,
+    MARKET_TRADE = 2,
+    MARKET_NEW_ORDER = 3,
+    MARKET_CANCEL = 4
+};
+
+enum MarketSide : uint8_t {
+    SIDE_BUY = 1,
+    SIDE_SELL = 2
+};
+
+struct MarketMessage {
+    uint32_t magic;
+    uint8_t type;        // MarketMessageType
+    uint8_t side;        // MarketSide; for quotes, which side is updated
+    uint16_t symbol;
+    uint64_t order_id;
+    int64_t price;       // Fixed point, 4 decimal places
+    uint32_t quantity;
+    uint32_t reserved;
+};
+
+// Calls fn for each complete MarketMessage laid back to back at the start of
+// data. Stops at the first bytes that are not a market message, so echo
+// traffic and other payloads are ignored.
+template <typename Fn>
+inline void for_each_market_message(const char* data, size_t length, Fn fn) {
+    MarketMessage msg;
+    while (length >= sizeof(MarketMessage)) {
+        memcpy(&msg, data, sizeof(msg));
+        if (msg.magic != MARKET_MAGIC) break;
+        fn(msg);
+        data += sizeof(MarketMessage);
+        length -= sizeof(MarketMessage);
+    }
+}
+
+struct LastValue {
+    int64_t bid_price = 0;
+    int64_t ask_price = 0;
+    uint32_t bid_size = 0;
+    uint32_t ask_size = 0;
+    int64_t last_price = 0;
+    uint32_t last_size = 0;
+    uint64_t updates = 0;
+};
+
+struct RestingOrder {
+    uint8_t side;
+    int64_t price;
+    uint32_t quantity;
+};
+
+class OrderBook {
+public:
+    std::map<int64_t, uint64_t, std::greater<int64_t>> bids;  // Price -> total quantity
+    std::map<int64_t, uint64_t> asks;
+    std::unordered_map<uint64_t, RestingOrder> orders;
+
+    void add(uint64_t order_id, uint8_t side, int64_t price, uint32_t quantity) {
+        if (!orders.emplace(order_id, RestingOrder{side, price, quantity}).second) return;
+        if (side == SIDE_BUY) bids[price] += quantity;
+        else asks[price] += quantity;
+    }
+
+    void cancel(uint64_t order_id) {
+        auto it = orders.find(order_id);
+        if (it == orders.end()) return;
+        if (it->second.side == SIDE_BUY) reduce_level(bids, it->second.price, it->second.quantity);
+        else reduce_level(asks, it->second.price, it->second.quantity);
+        orders.erase(it);
+    }
+
+private:
+    template <typename Levels>
+    static void reduce_level(Levels& levels, int64_t price, uint32_t quantity) {
+        auto level = levels.find(price);
+        if (level == levels.end()) return;
+        if (level->second <= quantity) levels.erase(level);
+        else level->second -= quantity;
+    }
+};
+
+// Books and last values for the symbols that hash to one partition. Each
+// partition is only ever touched by one thread at a time.
+struct MarketPartition {
+    std::unordered_map<uint16_t, OrderBook> books;
+    std::unordered_map<uint16_t, LastValue> last_values;
+    uint64_t messages = 0;
+    uint64_t highest_order_id = 0;
+
+    void apply(const MarketMessage& msg) {
+        messages++;
+        switch (msg.type) {
+        case MARKET_QUOTE: {
+            LastValue& lv = last_values[msg.symbol];
+            if (msg.side == SIDE_BUY) {
+                lv.bid_price = msg.price;
+                lv.bid_size = msg.quantity;
+            } else {
+                lv.ask_price = msg.price;
+                lv.ask_size = msg.quantity;
+            }
+            lv.updates++;
+            break;
+        }
+        case MARKET_TRADE: {
+            LastValue& lv = last_values[msg.symbol];
+            lv.last_price = msg.price;
+            lv.last_size = msg.quantity;
+            lv.updates++;
+            break;
+        }
+        case MARKET_NEW_ORDER:
+            books[msg.symbol].add(msg.order_id, msg.side, msg.price, msg.quantity);
+            highest_order_id = std::max(highest_order_id, msg.order_id);
+            break;
+        case MARKET_CANCEL:
+            books[msg.symbol].cancel(msg.order_id);
+            break;
+        }
+    }
+};
@@ -0,0 +1,267 @@
+#pragma once
+
+// Application-level packing of small messages into datagrams. A packer keeps
+// one open datagram per destination (address and channel) and appends
+// messages to it. It sends the datagram once the next message would not fit
+// the MTU, or once the first message in it has waited `deadline` ns. Full
+// and expired datagrams go out together in one sendmmsg.
+//
+// Datagram, big endian:
+//   [u16 PACK_MAGIC][u16 count][u32 channel]
+//   count times: [u16 length][message]
+// The channel tells the receiver whose messages these are, e.g. the QUIC
+// connection ID.
+//
+// A destination with nothing waiting that has not been sent to for
+// PACK_IDLE_NS is forgotten; flush() looks for them every PACK_SWEEP_NS.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+const uint16_t PACK_MAGIC = 0x504b;     // "PK"
+const size_t PACK_HEADER_SIZE = 8;
+const size_t PACK_RECORD_HEADER = 2;
+const size_t PACK_DEFAULT_MTU = 1472;   // Ethernet MTU less the IPv4 and UDP headers
+const int PACK_SEND_BATCH = 64;         // Datagrams per sendmmsg
+const uint64_t PACK_IDLE_NS = 10000000000ULL;
+const uint64_t PACK_SWEEP_NS = 1000000000ULL;
+
+// A message inside a received datagram; points into the receive buffer
+struct PackedView {
+    const char* data;
+    uint16_t length;
+};
+
+// Reads the channel and the message views of a packed datagram, replacing
+// views. Returns false if the datagram is not a well formed packed one.
+inline bool unpack_datagram(const char* data, size_t length, uint32_t& channel, std::vector<PackedView>& views) {
+    views.clear();
+    if (length < PACK_HEADER_SIZE) return false;
+    uint16_t magic, count;
+    memcpy(&magic, data, sizeof(magic));
+    memcpy(&count, data + 2, sizeof(count));
+    memcpy(&channel, data + 4, sizeof(channel));
+    if (ntohs(magic) != PACK_MAGIC) return false;
+    count = ntohs(count);
+    channel = ntohl(channel);
+
+    size_t offset = PACK_HEADER_SIZE;
+    for (uint16_t i = 0; i < count; i++) {
+        if (length - offset < PACK_RECORD_HEADER) return false;
+        uint16_t record;
+        memcpy(&record, data + offset, sizeof(record));
+        record = ntohs(record);
+        offset += PACK_RECORD_HEADER;
+        if (length - offset < record) return false;
+        views.push_back(PackedView{data + offset, record});
+        offset += record;
+    }
+    return offset == length;
+}
+
+class DatagramPacker {
+private:
+    struct Destination {
+        struct sockaddr_in addr;
+        uint32_t channel;
+        std::string datagram;  // Empty while nothing is waiting
+        uint16_t count;
+        uint64_t first_ns;     // When the first message went in
+        uint64_t last_ns;      // When the latest message went in
+        bool listed;           // In open
+    };
+
+    size_t mtu;
+    uint64_t deadline_ns;
+    std::vector<Destination> destinations;
+    std::map<std::pair<uint64_t, uint32_t>, size_t> index;
+    size_t last;                   // Most recently used destination
+    std::vector<size_t> open;      // Destinations holding a partial datagram
+    std::vector<std::string> ready;
+    std::vector<struct sockaddr_in> ready_addrs;
+    size_t ready_count;
+    uint64_t swept_ns;
+
+    static uint64_t address_key(const struct sockaddr_in& addr) {
+        return ((uint64_t)addr.sin_addr.s_addr << 16) | addr.sin_port;
+    }
+
+    size_t find(const struct sockaddr_in& addr, uint32_t channel) {
+        if (last < destinations.size() && destinations[last].channel == channel &&
+            address_key(destinations[last].addr) == address_key(addr)) {
+            return last;
+        }
+        auto key = std::make_pair(address_key(addr), channel);
+        auto it = index.find(key);
+        if (it == index.end()) {
+            Destination destination;
+            destination.addr = addr;
+            destination.channel = channel;
+            destination.count = 0;
+            destination.first_ns = 0;
+            destination.last_ns = 0;
+            destination.listed = false;
+            destinations.push_back(destination);
+            it = index.emplace(key, destinations.size() - 1).first;
+        }
+        last = it->second;
+        return last;
+    }
+
+    // Moves a destination's datagram to the send queue
+    void close_datagram(Destination& destination) {
+        uint16_t count = htons(destination.count);
+        memcpy(&destination.datagram[2], &count, sizeof(count));
+        if (ready_count == ready.size()) {
+            ready.emplace_back();
+            ready_addrs.emplace_back();
+        }
+        ready[ready_count].swap(destination.datagram);
+        ready_addrs[ready_count] = destination.addr;
+        ready_count++;
+        destination.datagram.clear();
+        destination.count = 0;
+    }
+
+    // Drops idle destinations that have nothing waiting, moving the last
+    // destination into each freed slot
+    void evict_idle(uint64_t now_ns) {
+        if (now_ns - swept_ns < PACK_SWEEP_NS) return;
+        swept_ns = now_ns;
+        size_t slot = 0;
+        while (slot < destinations.size()) {
+            Destination& destination = destinations[slot];
+            if (destination.listed || now_ns - destination.last_ns < PACK_IDLE_NS) {
+                slot++;
+                continue;
+            }
+            index.erase(std::make_pair(address_key(destination.addr), destination.channel));
+            size_t moved = destinations.size() - 1;
+            if (slot != moved) {
+                destination = std::move(destinations[moved]);
+                index[std::make_pair(address_key(destination.addr), destination.channel)] = slot;
+                if (destination.listed) std::replace(open.begin(), open.end(), moved, slot);
+            }
+            destinations.pop_back();
+            evicted++;
+        }
+        last = destinations.size();
+    }
+
+public:
+    uint64_t messages = 0;
+    uint64_t datagrams = 0;
+    uint64_t send_calls = 0;
+    uint64_t evicted = 0;
+
+    DatagramPacker(size_t mtu_bytes, uint64_t deadline)
+        : mtu(mtu_bytes), deadline_ns(deadline), last(0), ready_count(0), swept_ns(0) {}
+
+    size_t destination_count() const {
+        return destinations.size();
+    }
+
+    size_t max_message() const {
+        return mtu - PACK_HEADER_SIZE - PACK_RECORD_HEADER;
+    }
+
+    // Room for a length byte message to addr on channel, to be filled in
+    // before the next call. Returns nullptr if length exceeds max_message().
+    char* reserve(const struct sockaddr_in& addr, uint32_t channel, size_t length, uint64_t now_ns) {
+        if (length > max_message()) return nullptr;
+        size_t slot = find(addr, channel);
+        Destination& destination = destinations[slot];
+        destination.last_ns = now_ns;
+        if (!destination.datagram.empty() &&
+            (destination.datagram.size() + PACK_RECORD_HEADER + length > mtu || destination.count == UINT16_MAX)) {
+            close_datagram(destination);
+        }
+        if (destination.datagram.empty()) {
+            destination.datagram.reserve(mtu);
+            uint16_t magic = htons(PACK_MAGIC);
+            uint32_t wire_channel = htonl(channel);
+            destination.datagram.append((const char*)&magic, sizeof(magic));
+            destination.datagram.append(2, '\0');
+            destination.datagram.append((const char*)&wire_channel, sizeof(wire_channel));
+            destination.first_ns = now_ns;
+            if (!destination.listed) open.push_back(slot);
+            destination.listed = true;
+        }
+
+        uint16_t record = htons((uint16_t)length);
+        destination.datagram.append((const char*)&record, sizeof(record));
+        size_t offset = destination.datagram.size();
+        destination.datagram.resize(offset + length);
+        destination.count++;
+        messages++;
+        return &destination.datagram[offset];
+    }
+
+    bool add(const struct sockaddr_in& addr, uint32_t channel, const char* data, size_t length, uint64_t now_ns) {
+        char* slot = reserve(addr, channel, length, now_ns);
+        if (!slot) return false;
+        memcpy(slot, data, length);
+        return true;
+    }
+
+    // When the oldest partial datagram falls due, 0 if none is waiting
+    uint64_t next_deadline() const {
+        uint64_t earliest = 0;
+        for (size_t slot : open) {
+            const Destination& destination = destinations[slot];
+            if (destination.datagram.empty()) continue;
+            uint64_t due = destination.first_ns + deadline_ns;
+            if (earliest == 0 || due < earliest) earliest = due;
+        }
+        return earliest;
+    }
+
+    // Sends the full datagrams and the partial ones that are due (all of
+    // them with force) through fd, then forgets idle destinations. Sends
+    // are best effort, like the plain echo path.
+    void flush(int fd, uint64_t now_ns, bool force = false) {
+        size_t kept = 0;
+        for (size_t slot : open) {
+            Destination& destination = destinations[slot];
+            if (!destination.datagram.empty() && !force && now_ns - destination.first_ns < deadline_ns) {
+                open[kept++] = slot;
+                continue;
+            }
+            if (!destination.datagram.empty()) close_datagram(destination);
+            destination.listed = false;
+        }
+        open.resize(kept);
+
+        struct mmsghdr headers[PACK_SEND_BATCH];
+        struct iovec iovecs[PACK_SEND_BATCH];
+        size_t sent = 0;
+        while (sent < ready_count) {
+            int batch = (int)std::min<size_t>(PACK_SEND_BATCH, ready_count - sent);
+            for (int i = 0; i < batch; i++) {
+                iovecs[i].iov_base = &ready[sent + i][0];
+                iovecs[i].iov_len = ready[sent + i].size();
+                memset(&headers[i].msg_hdr, 0, sizeof(headers[i].msg_hdr));
+                headers[i].msg_hdr.msg_name = &ready_addrs[sent + i];
+                headers[i].msg_hdr.msg_namelen = sizeof(ready_addrs[sent + i]);
+                headers[i].msg_hdr.msg_iov = &iovecs[i];
+                headers[i].msg_hdr.msg_iovlen = 1;
+            }
+            int n = sendmmsg(fd, headers, batch, 0);
+            send_calls++;
+            if (n <= 0) break;
+            datagrams += n;
+            sent += n;
+        }
+        for (size_t i = 0; i < ready_count; i++) ready[i].clear();
+        ready_count = 0;
+        evict_idle(now_ns);
+    }
+};
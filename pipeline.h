@@ -0,0 +1,54 @@
+#pragma once
+
+// Hop-timestamp trailer carried at the end of pipeline messages. Each stage
+// that handles a message stamps the next slot, so the final subscriber can
+// split end-to-end latency into per-hop latency. Stamps come from
+// journal_now_ns() (steady_clock), which is comparable across processes on
+// one box.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "journal.h"
+
+const uint32_t HOP_TRAILER_MAGIC = 0x31504F48;  // "HOP1"
+const int MAX_HOPS = 8;
+
+// Stamp order along the order client -> subscriber path
+enum PipelineHop {
+    HOP_CLIENT = 0,
+    HOP_GATEWAY,
+    HOP_MATCHING,
+    HOP_PUBLISHER,
+    HOP_SUBSCRIBER,
+    PIPELINE_HOPS
+};
+
+inline const char* pipeline_hop_name(int hop) {
+    static const char* names[PIPELINE_HOPS] = {"client", "gateway", "matching", "publisher", "subscriber"};
+    return hop >= 0 && hop < PIPELINE_HOPS ? names[hop] : "?";
+}
+
+struct HopTrailer {
+    uint64_t stamps_ns[MAX_HOPS];
+    uint32_t count;
+    uint32_t magic;  // Last so a payload can be recognised from its end
+};
+
+// Copies out the trailer at the end of payload. Returns false if the payload
+// does not end with one.
+inline bool read_hop_trailer(const char* payload, size_t length, HopTrailer& trailer) {
+    if (length < sizeof(HopTrailer)) return false;
+    memcpy(&trailer, payload + length - sizeof(HopTrailer), sizeof(HopTrailer));
+    return trailer.magic == HOP_TRAILER_MAGIC && trailer.count <= (uint32_t)MAX_HOPS;
+}
+
+// Records the current time in the next free slot of the payload's trailer.
+// Payloads without a trailer, or with every slot used, are left untouched.
+inline bool stamp_hop(char* payload, size_t length) {
+    HopTrailer trailer;
+    if (!read_hop_trailer(payload, length, trailer) || trailer.count == (uint32_t)MAX_HOPS) return false;
+    trailer.stamps_ns[trailer.count++] = journal_now_ns();
+    memcpy(payload + length - sizeof(HopTrailer), &trailer, sizeof(HopTrailer));
+    return true;
+}
@@ -0,0 +1,297 @@
+#pragma once
+
+// Quote update encodings for the publisher's fan-out.
+//
+// Fixed layout: frames are arrays of QuoteUpdate, 48 bytes each.
+//
+// Delta: a frame is nothing but unsigned LEB128 varints, so a receiver can
+// decode the whole frame in bulk and then walk the values:
+//   QUOTE_FRAME_DELTA, count, first sequence, first timestamp
+//   per update: field mask, symbol, sequence delta, timestamp delta,
+//               then one value per field set in the mask
+// Sequence and timestamp deltas are against the previous update in the frame
+// (the first one against the frame header). Price and size values are
+// zig-zag deltas against the symbol's last published state. A refresh
+// carries every field as a zig-zag absolute value (a delta against zero).
+// The publisher sends one the first time a symbol appears and again after
+// every `refresh_every` updates of it. A subscriber that joins late skips a
+// symbol's deltas until that symbol's next refresh.
+
+#include <immintrin.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+struct QuoteUpdate {
+    uint32_t symbol;
+    uint32_t bid_size;
+    uint32_t ask_size;
+    uint32_t reserved;
+    uint64_t sequence;
+    uint64_t timestamp_ns;
+    int64_t bid_price;  // Fixed point, FEED_PRICE_SCALE units
+    int64_t ask_price;
+};
+
+const uint64_t QUOTE_FRAME_DELTA = 2;
+const uint32_t QUOTE_MAX_SYMBOLS = 1 << 20;  // Symbol IDs are dense indexes below this
+
+enum QuoteFieldMask : uint64_t {
+    QUOTE_BID_PRICE = 1,
+    QUOTE_ASK_PRICE = 2,
+    QUOTE_BID_SIZE = 4,
+    QUOTE_ASK_SIZE = 8,
+    QUOTE_ALL_FIELDS = 15,
+    QUOTE_REFRESH = 16
+};
+
+inline uint64_t zigzag_encode(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+inline int64_t zigzag_decode(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+inline void put_varint(std::string& out, uint64_t value) {
+    char bytes[10];
+    int n = 0;
+    while (value >= 0x80) {
+        bytes[n++] = (char)(value | 0x80);
+        value >>= 7;
+    }
+    bytes[n++] = (char)value;
+    out.append(bytes, n);
+}
+
+// Decodes every varint in [in, in + length) into out, which must have room
+// for `length` values. Returns false on a truncated or over-long varint.
+inline bool varint_decode_scalar(const uint8_t* in, size_t length, uint64_t* out, size_t& count) {
+    count = 0;
+    size_t i = 0;
+    while (i < length) {
+        uint64_t value = 0;
+        int shift = 0;
+        while (true) {
+            if (i >= length || shift > 63) return false;
+            uint8_t b = in[i++];
+            value |= (uint64_t)(b & 0x7f) << shift;
+            if (!(b & 0x80)) break;
+            shift += 7;
+        }
+        out[count++] = value;
+    }
+    return true;
+}
+
+inline bool varint_simd_supported() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("bmi2");
+}
+
+// Bulk decode, same contract as varint_decode_scalar. Each 16 byte block
+// yields a continuation-bit mask in one movemask. A block with no
+// continuation bits is 16 one-byte values, widened straight into the
+// output. Otherwise the terminator bits mark the varint boundaries, and
+// each varint of up to 8 bytes is gathered with a single pext. Longer
+// varints and the tail go through the scalar decoder.
+__attribute__((target("sse4.1,bmi2")))
+inline bool varint_decode_simd(const uint8_t* in, size_t length, uint64_t* out, size_t& count) {
+    count = 0;
+    size_t i = 0;
+    while (i + 24 <= length) {  // Every 8 byte load below stays in bounds
+        __m128i block = _mm_loadu_si128((const __m128i*)(in + i));
+        uint32_t continuation = (uint32_t)_mm_movemask_epi8(block);
+        if (continuation == 0) {
+            for (int k = 0; k < 16; k += 2) {
+                _mm_storeu_si128((__m128i*)(out + count + k), _mm_cvtepu8_epi64(block));
+                block = _mm_srli_si128(block, 2);
+            }
+            count += 16;
+            i += 16;
+            continue;
+        }
+
+        uint32_t ends = ~continuation & 0xffff;
+        if (ends == 0) break;  // A varint longer than the block: let the scalar path judge it
+        size_t start = 0;
+        bool long_varint = false;
+        while (ends) {
+            size_t end = __builtin_ctz(ends);
+            size_t bytes = end - start + 1;
+            if (bytes > 8) {
+                long_varint = true;
+                break;
+            }
+            uint64_t word;
+            memcpy(&word, in + i + start, sizeof(word));
+            uint64_t mask = bytes == 8 ? 0x7f7f7f7f7f7f7f7full : 0x7f7f7f7f7f7f7f7full & ((1ull << (8 * bytes)) - 1);
+            out[count++] = _pext_u64(word, mask);
+            start = end + 1;
+            ends &= ends - 1;
+        }
+        i += start;
+        if (long_varint) {
+            // Decode just this one varint the slow way, then carry on
+            size_t consumed = 0;
+            uint64_t value = 0;
+            int shift = 0;
+            while (true) {
+                if (i + consumed >= length || shift > 63) return false;
+                uint8_t b = in[i + consumed++];
+                value |= (uint64_t)(b & 0x7f) << shift;
+                if (!(b & 0x80)) break;
+                shift += 7;
+            }
+            out[count++] = value;
+            i += consumed;
+        }
+    }
+
+    size_t tail = 0;
+    if (!varint_decode_scalar(in + i, length - i, out + count, tail)) return false;
+    count += tail;
+    return true;
+}
+
+// Publisher side: per-symbol state and refresh schedule
+class QuoteDeltaEncoder {
+private:
+    struct SymbolState {
+        QuoteUpdate last;
+        uint32_t since_refresh;
+        bool published;
+    };
+
+    std::vector<SymbolState> symbols;
+    uint32_t refresh_every;
+
+public:
+    uint64_t refreshes = 0;
+
+    explicit QuoteDeltaEncoder(uint32_t refresh_interval = 256) : refresh_every(refresh_interval) {}
+
+    // Appends one delta frame for the updates to out. Symbols must be below
+    // QUOTE_MAX_SYMBOLS.
+    void encode(const QuoteUpdate* updates, size_t count, std::string& out) {
+        if (count == 0) return;
+        put_varint(out, QUOTE_FRAME_DELTA);
+        put_varint(out, count);
+        put_varint(out, updates[0].sequence);
+        put_varint(out, updates[0].timestamp_ns);
+
+        uint64_t sequence = updates[0].sequence;
+        uint64_t timestamp = updates[0].timestamp_ns;
+        for (size_t i = 0; i < count; i++) {
+            const QuoteUpdate& update = updates[i];
+            if (update.symbol >= symbols.size()) symbols.resize(update.symbol + 1, SymbolState());
+            SymbolState& state = symbols[update.symbol];
+            bool refresh = !state.published || state.since_refresh + 1 >= refresh_every;
+
+            int64_t deltas[4];
+            uint64_t mask;
+            if (refresh) {
+                mask = QUOTE_ALL_FIELDS | QUOTE_REFRESH;
+                deltas[0] = update.bid_price;
+                deltas[1] = update.ask_price;
+                deltas[2] = update.bid_size;
+                deltas[3] = update.ask_size;
+                state.since_refresh = 0;
+                state.published = true;
+                refreshes++;
+            } else {
+                deltas[0] = update.bid_price - state.last.bid_price;
+                deltas[1] = update.ask_price - state.last.ask_price;
+                deltas[2] = (int64_t)update.bid_size - state.last.bid_size;
+                deltas[3] = (int64_t)update.ask_size - state.last.ask_size;
+                mask = 0;
+                for (int f = 0; f < 4; f++) {
+                    if (deltas[f] != 0) mask |= 1ull << f;
+                }
+                state.since_refresh++;
+            }
+            state.last = update;
+
+            put_varint(out, mask);
+            put_varint(out, update.symbol);
+            put_varint(out, zigzag_encode((int64_t)(update.sequence - sequence)));
+            put_varint(out, zigzag_encode((int64_t)(update.timestamp_ns - timestamp)));
+            for (int f = 0; f < 4; f++) {
+                if (mask & (1ull << f)) put_varint(out, zigzag_encode(deltas[f]));
+            }
+            sequence = update.sequence;
+            timestamp = update.timestamp_ns;
+        }
+    }
+};
+
+// Subscriber side
+class QuoteDeltaDecoder {
+private:
+    std::vector<QuoteUpdate> symbols;
+    std::vector<bool> known;
+    size_t known_count;
+    std::vector<uint64_t> values;
+    bool simd;
+
+public:
+    uint64_t awaiting_refresh = 0;  // Deltas skipped: no baseline for the symbol yet
+
+    explicit QuoteDeltaDecoder(bool use_simd = varint_simd_supported()) : known_count(0), simd(use_simd) {}
+
+    size_t known_symbols() const {
+        return known_count;
+    }
+
+    // Appends the updates of one frame to out. Returns false if the frame is
+    // malformed.
+    bool decode(const char* frame, size_t length, std::vector<QuoteUpdate>& out) {
+        if (values.size() < length) values.resize(length);
+        size_t count;
+        const uint8_t* bytes = (const uint8_t*)frame;
+        bool ok = simd ? varint_decode_simd(bytes, length, values.data(), count)
+                       : varint_decode_scalar(bytes, length, values.data(), count);
+        if (!ok || count < 4 || values[0] != QUOTE_FRAME_DELTA) return false;
+
+        const uint64_t* v = values.data() + 4;
+        const uint64_t* end = values.data() + count;
+        uint64_t sequence = values[2];
+        uint64_t timestamp = values[3];
+        for (uint64_t n = 0; n < values[1]; n++) {
+            if (end - v < 4) return false;
+            uint64_t mask = v[0];
+            uint32_t symbol = (uint32_t)v[1];
+            sequence += zigzag_decode(v[2]);
+            timestamp += zigzag_decode(v[3]);
+            v += 4;
+            if ((size_t)(end - v) < (size_t)__builtin_popcountll(mask & QUOTE_ALL_FIELDS)) return false;
+
+            if (symbol >= QUOTE_MAX_SYMBOLS) return false;
+            if (symbol >= symbols.size()) {
+                symbols.resize(symbol + 1);
+                known.resize(symbol + 1, false);
+            }
+            if (!(mask & QUOTE_REFRESH) && !known[symbol]) {
+                v += __builtin_popcountll(mask & QUOTE_ALL_FIELDS);
+                awaiting_refresh++;
+                continue;
+            }
+            QuoteUpdate& state = symbols[symbol];
+            if (mask & QUOTE_REFRESH) {
+                memset(&state, 0, sizeof(state));
+                if (!known[symbol]) known_count++;
+                known[symbol] = true;
+            }
+            if (mask & QUOTE_BID_PRICE) state.bid_price += zigzag_decode(*v++);
+            if (mask & QUOTE_ASK_PRICE) state.ask_price += zigzag_decode(*v++);
+            if (mask & QUOTE_BID_SIZE) state.bid_size += (uint32_t)zigzag_decode(*v++);
+            if (mask & QUOTE_ASK_SIZE) state.ask_size += (uint32_t)zigzag_decode(*v++);
+            state.symbol = symbol;
+            state.sequence = sequence;
+            state.timestamp_ns = timestamp;
+            out.push_back(state);
+        }
+        return true;
+    }
+};
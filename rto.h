@@ -0,0 +1,66 @@
+#pragma once
+
+// Retransmission timeout from measured round trips, after RFC 6298:
+//
+//   RTTVAR <- 3/4 RTTVAR + 1/4 |SRTT - R|
+//   SRTT   <- 7/8 SRTT + 1/8 R
+//   RTO     = SRTT + max(RTO_GRANULARITY_NS, 4 RTTVAR), within [RTO_MIN_NS, RTO_MAX_NS]
+//
+// with SRTT = R, RTTVAR = R / 2 on the first sample and RTO_INITIAL_NS
+// before it. Every expiry doubles the RTO until the next sample. Callers
+// number their retransmissions and have the reply echo the number, so a
+// reply always matches one send and every reply is a sample (Karn's
+// ambiguity does not arise, as with QUIC packet numbers).
+//
+// A fixed timer (fixed_ns > 0) still measures SRTT but keeps its timeout
+// and never backs off, for comparison. One instance per socket, used by
+// one thread. Times are nanoseconds.
+
+#include <stdint.h>
+#include <algorithm>
+
+const uint64_t RTO_INITIAL_NS = 200000000ULL;   // Not RFC 6298's 1 s: that is all a QUIC request may take
+const uint64_t RTO_MIN_NS = 100000;             // 100 us: loopback RTTs are tens of us
+const uint64_t RTO_MAX_NS = 1000000000ULL;
+const uint64_t RTO_GRANULARITY_NS = 20000;      // Timer wake-up jitter
+
+class RetransmitTimer {
+private:
+    uint64_t fixed;
+    uint64_t srtt;
+    uint64_t rttvar;
+    uint64_t rto;
+
+public:
+    uint64_t samples = 0;
+
+    explicit RetransmitTimer(uint64_t fixed_ns = 0)
+        : fixed(fixed_ns), srtt(0), rttvar(0), rto(fixed_ns ? fixed_ns : RTO_INITIAL_NS) {}
+
+    uint64_t timeout_ns() const {
+        return rto;
+    }
+
+    uint64_t srtt_ns() const {
+        return srtt;
+    }
+
+    void sample(uint64_t rtt_ns) {
+        samples++;
+        if (samples == 1) {
+            srtt = rtt_ns;
+            rttvar = rtt_ns / 2;
+        } else {
+            uint64_t error = srtt > rtt_ns ? srtt - rtt_ns : rtt_ns - srtt;
+            rttvar = rttvar - rttvar / 4 + error / 4;
+            srtt = srtt - srtt / 8 + rtt_ns / 8;
+        }
+        if (fixed) return;
+        rto = std::min(RTO_MAX_NS, std::max(RTO_MIN_NS, srtt + std::max(RTO_GRANULARITY_NS, 4 * rttvar)));
+    }
+
+    // The timer expired: wait twice as long for the retransmission
+    void backoff() {
+        if (!fixed) rto = std::min(RTO_MAX_NS, rto * 2);
+    }
+};
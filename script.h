@@ -0,0 +1,449 @@
+#pragma once
+
+// Scripted client sessions: C++20 coroutines over one TCP connection each,
+// run by a ClientLoop (client.h). A script is straight-line code that
+// co_awaits its steps, and may co_await other scripts as sub-steps:
+//
+//   ScriptTask trader(ScriptSession& session, const sockaddr_in& server) {
+//       if (!co_await session.connect(server, client_now_ns() + timeout)) co_return;
+//       co_await session.write(logon.data(), logon.size());
+//       while (!complete_reply(session.in)) {
+//           if (!co_await session.receive(client_now_ns() + timeout)) co_return;
+//       }
+//       co_await session.sleep_until(next_order_ns);
+//       ...
+//   }
+//
+//   ScriptScheduler scheduler(loop);
+//   ScriptSession& session = scheduler.spawn();
+//   session.start(trader(session, server));
+//   loop.run_until([&] { return scheduler.running() == 0; });
+//
+// A suspended step is a registration with the loop: the socket's events for
+// connect, write and receive, the scheduler's timer heap for sleeps and
+// deadlines. Nothing else waits, so a session costs its coroutine frames and
+// buffers, and one thread runs thousands. The socket stays registered for
+// input while the script sleeps; what arrives is appended to `in` and the
+// next receive() returns at once.
+//
+// Steps return false on timeout, closure or a socket error (a sleep always
+// returns true). A script that ends has its socket closed; its session stays
+// with the scheduler, which owns every session, until the scheduler goes.
+// Scripts take what they use as parameters: a coroutine lambda's captures
+// die with the lambda, before the coroutine. An exception out of a script
+// terminates.
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "client.h"
+
+const size_t SCRIPT_READ_SIZE = 64 * 1024;
+
+// A script or sub-script. Starts suspended; co_await runs a sub-script to
+// its end and resumes the caller.
+class ScriptTask {
+public:
+    struct promise_type {
+        std::coroutine_handle<> caller;   // Resumed at the end of a sub-script
+
+        struct FinalAwaiter {
+            bool await_ready() const noexcept {
+                return false;
+            }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                std::coroutine_handle<> caller = handle.promise().caller;
+                return caller ? caller : std::noop_coroutine();
+            }
+            void await_resume() const noexcept {}
+        };
+
+        ScriptTask get_return_object() {
+            return ScriptTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+        FinalAwaiter final_suspend() noexcept {
+            return {};
+        }
+        void return_void() {}
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+
+    ScriptTask(ScriptTask&& other) noexcept : handle(other.handle) {
+        other.handle = nullptr;
+    }
+
+    ScriptTask& operator=(ScriptTask&& other) noexcept {
+        std::swap(handle, other.handle);
+        return *this;
+    }
+
+    ScriptTask(const ScriptTask&) = delete;
+    ScriptTask& operator=(const ScriptTask&) = delete;
+
+    ~ScriptTask() {
+        if (handle) handle.destroy();
+    }
+
+    bool done() const {
+        return !handle || handle.done();
+    }
+
+    // Sub-script: symmetric transfer in, and back out at its final suspend
+    bool await_ready() const noexcept {
+        return false;
+    }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+        handle.promise().caller = caller;
+        return handle;
+    }
+    void await_resume() const noexcept {}
+
+private:
+    std::coroutine_handle<promise_type> handle;
+
+    explicit ScriptTask(std::coroutine_handle<promise_type> task_handle) : handle(task_handle) {}
+
+    friend class ScriptSession;
+};
+
+class ScriptScheduler;
+
+class ScriptSession : public ClientHandler {
+private:
+    enum class Wait { None, Connect, Write, Receive, Sleep };
+
+    ScriptScheduler& scheduler;
+    ScriptTask task = ScriptTask(nullptr);
+    std::coroutine_handle<> waiting;  // The innermost script of the suspended step
+    Wait wait = Wait::None;
+    uint64_t wait_id = 0;             // Numbers the steps, so a stale deadline is ignored
+    bool result = false;
+    bool fresh = false;               // Bytes arrived since the last receive()
+    int fd = -1;
+    bool registered = false;
+    uint32_t watched = 0;
+    std::string out;
+    size_t out_offset = 0;
+
+    struct [[nodiscard]] Step {
+        ScriptSession& session;
+        bool ready;
+
+        bool await_ready() const noexcept {
+            return ready;
+        }
+        void await_suspend(std::coroutine_handle<> handle) noexcept {
+            session.waiting = handle;
+        }
+        bool await_resume() const noexcept {
+            return session.result;
+        }
+    };
+
+    Step complete(bool ok) {
+        result = ok;
+        return Step{*this, true};
+    }
+
+    Step suspend(Wait kind, uint64_t deadline_ns);
+
+    void watch(uint32_t events) {
+        if (fd == -1 || (registered && events == watched)) return;
+        loop().watch(fd, events, this, registered);
+        registered = true;
+        watched = events;
+    }
+
+    // Returns false if the socket failed; what it would not take stays in out
+    bool flush() {
+        while (out_offset < out.size()) {
+            ssize_t n = ::write(fd, out.data() + out_offset, out.size() - out_offset);
+            if (n > 0) {
+                out_offset += n;
+                continue;
+            }
+            if (n == -1 && errno == EINTR) continue;
+            return n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+        out.clear();
+        out_offset = 0;
+        return true;
+    }
+
+    // Appends what the socket has to in; closes it on end of stream or error
+    void read_available();
+
+    void resume(bool ok);
+    void close_socket();
+    ClientLoop& loop();
+
+public:
+    std::string in;    // Received and not yet consumed by the script
+    size_t id;         // Spawn order
+
+    ScriptSession(ScriptScheduler& owner, size_t number) : scheduler(owner), id(number) {}
+
+    ~ScriptSession() {
+        close_socket();
+    }
+
+    // Runs script until its first suspended step
+    void start(ScriptTask script) {
+        task = std::move(script);
+        waiting = task.handle;
+        resume(true);
+    }
+
+    bool finished() const {
+        return task.done();
+    }
+
+    bool connected() const {
+        return fd != -1 && wait != Wait::Connect;
+    }
+
+    // Opens a new connection, closing any previous one and dropping its
+    // buffers
+    Step connect(const struct sockaddr_in& address, uint64_t deadline_ns);
+
+    // Sends data (copied at the call), waiting while the socket is full
+    Step write(const char* data, size_t length, uint64_t deadline_ns = 0) {
+        if (fd == -1) return complete(false);
+        out.append(data, length);
+        if (!flush()) {
+            close_socket();
+            return complete(false);
+        }
+        if (out.empty()) return complete(true);
+        return suspend(Wait::Write, deadline_ns);
+    }
+
+    Step write(const std::string& data, uint64_t deadline_ns = 0) {
+        return write(data.data(), data.size(), deadline_ns);
+    }
+
+    // Waits for bytes beyond those already in `in`; false once the
+    // connection is gone and nothing new arrived
+    Step receive(uint64_t deadline_ns) {
+        if (fresh) {
+            fresh = false;
+            return complete(true);
+        }
+        if (fd == -1) return complete(false);
+        return suspend(Wait::Receive, deadline_ns);
+    }
+
+    Step sleep_until(uint64_t when_ns) {
+        if (when_ns <= client_now_ns()) return complete(true);
+        return suspend(Wait::Sleep, when_ns);
+    }
+
+    void close() {
+        close_socket();
+    }
+
+    void on_events(uint32_t events) override;
+
+    // The scheduler's timer for step wait_id is due
+    void on_deadline(uint64_t step) {
+        if (step != wait_id || wait == Wait::None) return;
+        if (wait == Wait::Connect) close_socket();
+        resume(wait == Wait::Sleep);
+    }
+};
+
+// Owns the sessions of one loop and their timers
+class ScriptScheduler : public ClientHandler {
+private:
+    struct Timer {
+        uint64_t when_ns;
+        ScriptSession* session;
+        uint64_t step;
+        bool operator>(const Timer& other) const {
+            return when_ns > other.when_ns;
+        }
+    };
+
+    std::vector<std::unique_ptr<ScriptSession>> sessions;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+    size_t active = 0;
+
+public:
+    ClientLoop& loop;
+    std::vector<char> read_buffer;   // Shared: sessions read one at a time
+    size_t open_sockets = 0;
+    size_t peak_open_sockets = 0;
+
+    explicit ScriptScheduler(ClientLoop& client_loop) : loop(client_loop), read_buffer(SCRIPT_READ_SIZE) {
+        loop.add(this);
+    }
+
+    ~ScriptScheduler() {
+        loop.remove(this);
+        sessions.clear();
+    }
+
+    ScriptSession& spawn() {
+        sessions.emplace_back(new ScriptSession(*this, sessions.size()));
+        active++;
+        return *sessions.back();
+    }
+
+    // Sessions whose script has not ended
+    size_t running() const {
+        return active;
+    }
+
+    void script_ended() {
+        active--;
+    }
+
+    void add_timer(uint64_t when_ns, ScriptSession* session, uint64_t step) {
+        timers.push(Timer{when_ns, session, step});
+    }
+
+    void on_events(uint32_t) override {}
+
+    // Deadlines of steps that completed first are left in the heap and
+    // skipped when due
+    uint64_t next_timer_ns() override {
+        return timers.empty() ? 0 : timers.top().when_ns;
+    }
+
+    void on_timer(uint64_t now_ns) override {
+        while (!timers.empty() && timers.top().when_ns <= now_ns) {
+            Timer timer = timers.top();
+            timers.pop();
+            timer.session->on_deadline(timer.step);
+        }
+    }
+};
+
+inline ClientLoop& ScriptSession::loop() {
+    return scheduler.loop;
+}
+
+inline ScriptSession::Step ScriptSession::suspend(Wait kind, uint64_t deadline_ns) {
+    wait = kind;
+    wait_id++;
+    if (kind == Wait::Connect || kind == Wait::Write) {
+        watch(EPOLLIN | EPOLLOUT);
+    } else {
+        watch(EPOLLIN);
+    }
+    if (deadline_ns) scheduler.add_timer(deadline_ns, this, wait_id);
+    return Step{*this, false};
+}
+
+inline void ScriptSession::resume(bool ok) {
+    result = ok;
+    wait = Wait::None;
+    std::coroutine_handle<> handle = waiting;
+    waiting = nullptr;
+    handle.resume();
+    if (task.done()) {
+        close_socket();
+        scheduler.script_ended();
+    }
+}
+
+inline void ScriptSession::close_socket() {
+    if (fd == -1) return;
+    if (registered) loop().unwatch(fd);
+    ::close(fd);
+    fd = -1;
+    registered = false;
+    scheduler.open_sockets--;
+}
+
+inline ScriptSession::Step ScriptSession::connect(const struct sockaddr_in& address, uint64_t deadline_ns) {
+    close_socket();
+    in.clear();
+    out.clear();
+    out_offset = 0;
+    fresh = false;
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd == -1) {
+        perror("script socket");
+        return complete(false);
+    }
+    scheduler.open_sockets++;
+    scheduler.peak_open_sockets = std::max(scheduler.peak_open_sockets, scheduler.open_sockets);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (::connect(fd, (const struct sockaddr*)&address, sizeof(address)) == 0) {
+        watch(EPOLLIN);
+        return complete(true);
+    }
+    if (errno != EINPROGRESS) {
+        close_socket();
+        return complete(false);
+    }
+    return suspend(Wait::Connect, deadline_ns);
+}
+
+inline void ScriptSession::read_available() {
+    std::vector<char>& buffer = scheduler.read_buffer;
+    while (fd != -1) {
+        ssize_t n = read(fd, buffer.data(), buffer.size());
+        if (n > 0) {
+            in.append(buffer.data(), n);
+            fresh = true;
+            continue;
+        }
+        if (n == -1 && errno == EINTR) continue;
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) close_socket();
+        return;
+    }
+}
+
+inline void ScriptSession::on_events(uint32_t events) {
+    if (fd == -1) return;  // Closed earlier in this batch of events
+    if (wait == Wait::Connect) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        if (error) {
+            close_socket();
+            resume(false);
+        } else {
+            watch(EPOLLIN);
+            resume(true);
+        }
+        return;
+    }
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) read_available();
+    if (wait == Wait::Write) {
+        if (fd == -1 || !flush()) {
+            close_socket();
+            resume(false);
+        } else if (out.empty()) {
+            watch(EPOLLIN);
+            resume(true);
+        }
+    } else if (wait == Wait::Receive && (fresh || fd == -1)) {
+        bool got = fresh;
+        fresh = false;
+        resume(got);
+    }
+}
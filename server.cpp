@@ -6,11 +6,44 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
+#include <stdlib.h>
 #include <vector>
 #include <chrono>
 #include <atomic>
 #include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
 #include <unordered_map>
+#include <deque>
+#include <string>
+#include <thread>
+#include <sstream>
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <sys/sendfile.h>
+#include <condition_variable>
+#include <mutex>
+
+#include "aead.h"
+#include "analytics.h"
+#include "compress.h"
+#include "fix.h"
+#include "handler.h"
+#include "hash_ring.h"
+#include "idempotency.h"
+#include "journal.h"
+#include "logbuffer.h"
+#include "market.h"
+#include "packing.h"
+#include "pipeline.h"
+#include "quote.h"
+#include "session.h"
+#include "tickstore.h"
+#include "txqueue.h"
+#include "ws.h"
 
 const int MAX_EVENTS = 1024;
 const int BUFFER_SIZE = 1024;
@@ -18,6 +51,270 @@ const int TCP_PORT = 8080;
 const int UDP_PORT = 8081;
 const int QUIC_PORT = 8082;
 
+enum class TcpHandler { Callback, Coroutine };
+
+// Runtime configuration, filled from --key=value command line flags
+struct ServerConfig {
+    int tcp_port = TCP_PORT;
+    int udp_port = UDP_PORT;
+    int quic_port = QUIC_PORT;
+
+    // Inbound message journal
+    std::string journal_path;
+    JournalPolicy journal_policy = JournalPolicy::None;
+    size_t journal_size_mb = 1024;
+    int commit_every = 64;          // Group commit after this many messages...
+    int commit_interval_us = 200;   // ...or after this many microseconds
+    bool replay = false;            // Rebuild state from the journal at startup
+
+    // Market state is split by symbol into this many partitions, and replay
+    // runs one thread per partition
+    int partitions = std::max(1u, std::thread::hardware_concurrency());
+
+    // Hot-standby replication
+    std::string replicate_to;       // Primary: HOST:PORT of the standby
+    int standby_port = 0;           // Standby: port the primary connects to
+    int failover_timeout_ms = 500;  // Standby promotes after this much silence
+
+    int stats_port = 0;             // Text counters endpoint, 0 disables
+
+    // L4 proxy mode: HOST:PORT_BASE of each backend server. UDP flows and
+    // QUIC client addresses idle for proxy_idle_ms are forgotten.
+    std::vector<std::string> proxy_backends;
+    int proxy_idle_ms = 30000;
+
+    // Multiplexing gateway mode: HOST:PORT_BASE of the backend server
+    std::string gateway_upstream;
+    int upstream_connections = 4;
+
+    // Order pipeline stage: "matching" (publishes to downstream) or "publisher"
+    std::string pipeline_stage;
+    std::string downstream;
+    std::string quote_encoding;  // Publisher: frames are QuoteUpdate arrays, fanned out "fixed" or "delta"
+    int refresh_every = 256;     // Delta: a symbol's full refresh interval, in updates
+
+    // Sequenced session mode on the TCP port
+    bool sessions = false;
+    int resend_store = 65536;  // Messages kept per session for replay
+    int resend_store_mb = 64;  // ... and at most this many MB of them
+    int session_idle_ms = 60000;  // Sessions without a connection this long are dropped, 0 never
+
+    // AES-128-GCM packet and header protection on the QUIC port
+    bool quic_aead = false;
+
+    // LZ payload compression on the TCP and UDP echo paths: "message" or
+    // "stream", empty for none
+    std::string compression;
+    int compression_level = 1;
+    std::string dictionary_path;    // Shared dictionary, e.g. trained by the tester
+
+    // Message packing on the UDP and QUIC echo ports: datagram size limit
+    // (0 for one message per datagram) and how long a partial reply
+    // datagram may wait for more messages
+    int pack_mtu = 0;
+    int pack_deadline_us = 50;
+
+    // FIX 4.4 order entry on the TCP port instead of the echo
+    bool fix = false;
+    std::string fix_scan;  // Delimiter scan: scalar|sse2|avx2, empty for the best available
+
+    // WebSocket echo and feed port, 0 disables
+    int ws_port = 0;
+    std::string ws_unmask;  // scalar|sse2|avx2, empty for the best available
+
+    // Trade analytics: OHLC/VWAP bars at up to ANALYTICS_LANES intervals,
+    // published to subscribers on analytics_port (0: counted only)
+    bool analytics = false;
+    std::vector<int> bar_intervals_ms = {1000, 10000, 60000};
+    int analytics_port = 0;
+    std::string analytics_update;  // scalar|avx2, empty for the best available
+
+    // Tick store: inbound trades persisted per symbol and day under tick_store,
+    // time-range queries served on tick_query_port
+    std::string tick_store;
+    int tick_query_port = 0;
+    bool tick_send_copy = false;   // pread/write instead of sendfile, for comparison
+
+    // Synthetic service time per echoed TCP read, UDP or QUIC datagram, to
+    // make a replica deliberately slow; stall_us more on every stall_every-th
+    // request gives it a tail
+    int service_time_us = 0;
+    int stall_every = 0;
+    int stall_us = 0;
+
+    // Synthetic loss: every drop_every-th UDP or QUIC echo request is ignored
+    int drop_every = 0;
+
+    // UDP requests with an IdempotentHeader are deduplicated (idempotency.h)
+    bool dedupe = true;
+
+    // Echo replies the UDP or QUIC socket refuses wait in a transmit queue
+    // of tx_queue replies (txqueue.h); 0 drops them as before. The socket
+    // acts full on every tx_saturate_every-th reply, for testing.
+    size_t tx_queue = TX_QUEUE_DEFAULT;
+    TxDropPolicy tx_drop = TxDropPolicy::Oldest;
+    int tx_saturate_every = 0;
+
+    // TCP echo connections are served by callbacks or by a coroutine each
+    // (handler.h). Coroutine connections idle for tcp_idle_timeout_ms are
+    // closed; 0 never closes them.
+    TcpHandler tcp_handler = TcpHandler::Callback;
+    int tcp_idle_timeout_ms = 0;
+};
+
+// How far ahead of the replay cursor to request readahead, and how far
+// ahead to prefetch into cache
+const size_t REPLAY_READAHEAD_BYTES = 64 * 1024 * 1024;
+const size_t REPLAY_PREFETCH_BYTES = 1024;
+
+// Market messages handed from the journal reader to a partition per batch,
+// and how many batches may wait for one partition before the reader stalls
+const size_t REPLAY_BATCH_MESSAGES = 4096;
+const size_t REPLAY_QUEUE_BATCHES = 64;
+
+// Batches of one partition's market messages, from the replay reader to
+// that partition's thread
+struct ReplayQueue {
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::condition_variable room;
+    std::deque<std::vector<MarketMessage>> batches;
+    bool done = false;
+
+    void push(std::vector<MarketMessage>& batch) {
+        std::unique_lock<std::mutex> lock(mutex);
+        room.wait(lock, [&] { return batches.size() < REPLAY_QUEUE_BATCHES; });
+        batches.push_back(std::move(batch));
+        batch.clear();
+        ready.notify_one();
+    }
+
+    void finish() {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+        ready.notify_one();
+    }
+
+    // Returns false once the reader has finished and every batch is taken
+    bool pop(std::vector<MarketMessage>& batch) {
+        std::unique_lock<std::mutex> lock(mutex);
+        ready.wait(lock, [&] { return !batches.empty() || done; });
+        if (batches.empty()) return false;
+        batch = std::move(batches.front());
+        batches.pop_front();
+        room.notify_one();
+        return true;
+    }
+};
+
+// Replication stream: JournalRecord headers followed by their payload.
+// Records with protocol REPLICATION_HEARTBEAT carry no payload.
+const uint8_t REPLICATION_HEARTBEAT = 0;
+const int HEARTBEAT_INTERVAL_MS = 50;
+const int STANDBY_TICK_MS = 10;
+const size_t REPLICATION_BUFFER_LIMIT = 64 * 1024 * 1024;
+const size_t LAG_SAMPLE_CAPACITY = 1 << 20;
+
+// Proxy datagram batching
+const int DATAGRAM_BATCH = 64;
+const int DATAGRAM_SIZE = 2048;
+const size_t SPLICE_CHUNK = 64 * 1024;
+
+// Log-buffer transport on the UDP port
+const int LOG_TICK_US = 1000;                       // NAK, status and heartbeat timer
+const uint64_t LOG_SESSION_IDLE_NS = 10000000000ULL;  // Sessions silent this long are dropped
+const size_t LOG_MAX_SESSIONS = 64;                 // Each maps two logs of LOG_PARTITIONS terms
+const int LOG_POLL_LIMIT = 4096;                    // Messages echoed per session per pass
+
+// Protected QUIC: keys of connections silent this long are dropped, checked
+// at most once per sweep interval
+const uint64_t QUIC_CRYPTO_IDLE_NS = 30000000000ULL;
+const uint64_t QUIC_CRYPTO_SWEEP_NS = 1000000000ULL;
+
+// Tick queries are parsed only while the connection's queued reply parts stay
+// under this; each day of a reply is four parts, three of them holding an fd
+const size_t TICK_QUERY_MAX_SENDS = 256;
+
+// A FIX session's record of the orders it placed is swept of those no longer
+// resting once it doubles past its last sweep, and never below this
+const size_t FIX_ORDER_SWEEP_MIN = 4096;
+
+// Gateway framing: clients send [u32 length][payload]; upstream frames are
+// [u32 length][u64 correlation ID][payload]. Lengths are network byte order.
+const uint32_t MAX_FRAME_SIZE = 1024 * 1024;
+const size_t CORRELATION_SIZE = sizeof(uint64_t);
+const size_t SUBSCRIBER_BUFFER_LIMIT = 64 * 1024 * 1024;
+const size_t STREAM_BACKLOG_LIMIT = 16 * 1024 * 1024;  // Unsent output per TCP client before it is dropped
+const int GATEWAY_RECONNECT_MIN_MS = 10;               // First retry after an upstream is lost
+const int GATEWAY_RECONNECT_MAX_MS = 1000;             // Retries back off, doubling up to this
+
+// A reply held back until the inbound message it answers is durable
+struct PendingReply {
+    uint64_t sequence;
+    int fd;
+    bool datagram;
+    struct sockaddr_in addr;
+    std::string data;
+};
+
+// Creates a non-blocking socket bound to port on all interfaces and adds it
+// to epoll_fd for EPOLLIN. Stream sockets are put into listening state and
+// datagram sockets get 1MB buffers. Returns the descriptor, or -1 after
+// reporting the error.
+int open_server_socket(int epoll_fd, int type, int port, const std::string& label,
+                       int backlog = SOMAXCONN) {
+    int fd = socket(AF_INET, type, 0);
+    if (fd == -1) {
+        perror((label + " socket").c_str());
+        return -1;
+    }
+
+    // Set socket to non-blocking
+    int flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+    // Set SO_REUSEADDR
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    if (type == SOCK_DGRAM) {
+        // Increase socket buffer sizes for better datagram performance
+        int buf_size = 1024 * 1024;  // 1MB buffer
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size));
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        perror((label + " bind").c_str());
+        close(fd);
+        return -1;
+    }
+
+    if (type == SOCK_STREAM && listen(fd, backlog) == -1) {
+        perror((label + " listen").c_str());
+        close(fd);
+        return -1;
+    }
+
+    // Add to epoll
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        perror(("epoll_ctl " + label).c_str());
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
 // Basic QUIC connection tracking
 struct QuicConnection {
     uint32_t connection_id;
@@ -30,8 +327,145 @@ struct QuicConnection {
           last_activity(std::chrono::steady_clock::now()), established(false) {}
 };
 
+// Packet protection keys of one protected QUIC connection
+struct QuicCryptoState {
+    QuicPacketKeys keys;
+    uint32_t next_packet_number = 0;  // Server to client
+    uint64_t last_active_ns = 0;
+};
+
+// Frame reassembly and, in stream mode, the codec pair of one compressed TCP
+// connection
+struct CompressedConnection {
+    std::string in;
+    std::unique_ptr<LzEncoder> encoder;
+    std::unique_ptr<LzDecoder> decoder;
+};
+
+// Receive buffer and outbound sequence number of one FIX session, and the
+// orders it placed: OrderIDs are sequential, so only these may it cancel
+struct FixSession {
+    std::string in;
+    uint64_t next_out_sequence = 1;
+    std::unordered_map<uint64_t, uint16_t> orders;  // OrderID -> symbol, while it may still rest
+    size_t orders_sweep_at = FIX_ORDER_SWEEP_MIN;
+};
+
+// Output waiting for a WebSocket connection's socket to drain. Broadcast
+// blocks are shared by every feed connection that still has to send them.
+struct WsChunk {
+    std::shared_ptr<const std::string> data;
+    size_t offset;
+};
+
+// Part of a tick query reply: header bytes, or a byte range of a column
+// file sent with sendfile (or pread and write with --tick-send=copy)
+struct TickSend {
+    std::string bytes;
+    int fd = -1;                 // Closed once the range is sent
+    off_t offset = 0;
+    size_t remaining = 0;
+};
+
+struct TickQueryConnection {
+    std::string in;
+    std::deque<TickSend> out;
+    bool readable = false;       // EPOLLIN seen and the socket not yet read to EAGAIN
+};
+
+struct WsConnection {
+    bool upgraded = false;
+    bool feed = false;           // Connected to WS_FEED_PATH: receives the broadcast
+    std::string in;
+    std::string message;         // Fragmented message being reassembled
+    uint8_t message_opcode = 0;  // Its opcode, 0 when none is in progress
+    std::deque<WsChunk> out;
+    size_t queued = 0;           // Bytes in out
+    bool out_armed = false;
+};
+
+// Fixed set of datagram slots for recvmmsg/sendmmsg. Received datagrams are
+// forwarded straight from their slot without copying.
+struct DatagramBatch {
+    struct mmsghdr headers[DATAGRAM_BATCH];
+    struct iovec iovecs[DATAGRAM_BATCH];
+    struct sockaddr_in addrs[DATAGRAM_BATCH];
+    char buffers[DATAGRAM_BATCH][DATAGRAM_SIZE];
+    int count = 0;
+
+    // Receives into the free slots [count, DATAGRAM_BATCH) and returns the
+    // number of datagrams read
+    int receive(int fd) {
+        int room = DATAGRAM_BATCH - count;
+        if (room <= 0) return 0;
+        for (int i = count; i < DATAGRAM_BATCH; i++) {
+            iovecs[i].iov_base = buffers[i];
+            iovecs[i].iov_len = DATAGRAM_SIZE;
+            memset(&headers[i].msg_hdr, 0, sizeof(headers[i].msg_hdr));
+            headers[i].msg_hdr.msg_name = &addrs[i];
+            headers[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+            headers[i].msg_hdr.msg_iov = &iovecs[i];
+            headers[i].msg_hdr.msg_iovlen = 1;
+        }
+        int n = recvmmsg(fd, headers + count, room, MSG_DONTWAIT, nullptr);
+        if (n <= 0) return 0;
+        for (int i = count; i < count + n; i++) {
+            iovecs[i].iov_len = headers[i].msg_len;
+        }
+        count += n;
+        return n;
+    }
+
+    // Sends every filled slot to its addrs[] entry, until the socket refuses
+    // one, and returns how many went out
+    int flush(int fd) {
+        int sent = 0;
+        while (sent < count) {
+            int n = sendmmsg(fd, headers + sent, count - sent, 0);
+            if (n <= 0) break;
+            sent += n;
+        }
+        count = 0;
+        return sent;
+    }
+};
+
+void append_frame(std::string& out, const char* payload, uint32_t length) {
+    uint32_t prefix = htonl(length);
+    out.append((const char*)&prefix, sizeof(prefix));
+    out.append(payload, length);
+}
+
+// Calls fn(payload, length) for each complete [u32 length][payload] frame at
+// the front of in, then drops the consumed bytes. fn may modify the payload
+// in place and returns false to reject it. Returns false on an oversized or
+// rejected frame.
+template <typename Fn>
+bool consume_frames(std::string& in, uint32_t max_length, Fn fn) {
+    size_t offset = 0;
+    bool ok = true;
+    while (in.size() - offset >= sizeof(uint32_t)) {
+        uint32_t length;
+        memcpy(&length, in.data() + offset, sizeof(length));
+        length = ntohl(length);
+        if (length > max_length) {
+            ok = false;
+            break;
+        }
+        if (in.size() - offset - sizeof(uint32_t) < length) break;
+        if (!fn(&in[offset + sizeof(uint32_t)], length)) {
+            ok = false;
+            break;
+        }
+        offset += sizeof(uint32_t) + length;
+    }
+    in.erase(0, offset);
+    return ok;
+}
+
 class EpollServer {
 private:
+    ServerConfig config;
     int epoll_fd;
     int tcp_fd;
     int udp_fd;
@@ -41,9 +475,193 @@ private:
     std::atomic<int> udp_packets{0};
     std::atomic<int> quic_connections{0};
     std::unordered_map<uint32_t, QuicConnection> quic_connections_map;
+    std::unordered_map<int, struct sockaddr_in> tcp_peers;
+
+    // Journaling
+    Journal journal;
+    bool journaling;
+    int journal_event_fd;
+    std::deque<PendingReply> pending_replies;
+    std::unordered_map<int, size_t> pending_stream_replies;  // Held TCP replies per fd
+
+    // Order books and last-value caches, partitioned by symbol
+    std::vector<MarketPartition> partitions;
+    uint64_t input_sequence;
+
+    // Replication, primary side
+    int replication_fd;
+    int heartbeat_fd;
+    bool replication_out_armed;
+    std::string replication_out;
+
+    // Replication, standby side
+    bool standby;
+    int standby_listen_fd;
+    int primary_fd;
+    bool primary_seen;
+    std::chrono::steady_clock::time_point last_primary_data;
+    std::vector<char> replication_in;
+    uint64_t replicated_records;
+    std::vector<uint64_t> lag_samples_ns;
+    size_t lag_sample_count;
+
+    // Log-buffer transport sessions on the UDP port, keyed by session ID
+    std::unordered_map<uint32_t, LogSession*> log_sessions;
+    std::vector<LogSession*> log_active;
+    DatagramBatch udp_batch;
+    int log_timer_fd;
+    uint64_t log_messages;
+    uint64_t log_sessions_refused;
+    uint64_t log_sessions_broken;
+
+    // Protected QUIC: keys per connection ID, and the crypto cost counters.
+    // Keys depend only on the connection ID, so a connection that returns
+    // after expiry resumes numbering from quic_packet_number_floor rather
+    // than reusing a nonce.
+    std::unordered_map<uint32_t, QuicCryptoState> quic_crypto;
+    DatagramBatch quic_batch;
+    DatagramBatch quic_replies;
+    uint64_t quic_opened;
+    uint64_t quic_sealed;
+    uint64_t quic_open_ns;
+    uint64_t quic_seal_ns;
+    uint64_t quic_auth_failures;
+    uint32_t quic_packet_number_floor;
+    uint64_t quic_crypto_swept_ns;
+    uint64_t quic_crypto_expired;
+
+    // Payload compression. Message mode (and all UDP traffic) shares one
+    // codec pair; stream mode gives each TCP connection its own.
+    std::string dictionary;
+    std::unique_ptr<LzEncoder> message_encoder;
+    std::unique_ptr<LzDecoder> message_decoder;
+    std::unordered_map<int, CompressedConnection> compressed_connections;
+
+    // TCP client output the socket has not taken yet, sent on EPOLLOUT
+    // before anything newer so frames and codec history stay intact
+    std::unordered_map<int, std::string> stream_backlog;
+    std::string codec_plain;
+    std::string codec_block;
+    uint64_t compressed_messages;
+    uint64_t plain_bytes;
+    uint64_t wire_bytes;
+    uint64_t compress_ns;
+    uint64_t decompress_ns;
+    uint64_t compression_errors;
+
+    // Message packing (packing.h): one packer per port, and a one-shot timer
+    // for the earliest partial datagram
+    std::unique_ptr<DatagramPacker> udp_packer;
+    std::unique_ptr<DatagramPacker> quic_packer;
+    std::vector<PackedView> pack_views;
+    int pack_timer_fd;
+    uint64_t pack_timer_due;
+    uint64_t packed_datagrams_in;
+    uint64_t packed_messages_in;
+    uint64_t pack_errors;
+    uint64_t echo_syscalls;  // Receive, send and timer calls of the UDP and QUIC echo paths
+
+    // FIX order entry (fix.h)
+    FixScan fix_scan;
+    std::unordered_map<int, FixSession> fix_sessions;
+    FixMessage fix_message;
+    FixBuilder fix_builder;
+    uint64_t fix_messages;
+    uint64_t fix_parse_ns;
+    uint64_t fix_orders;
+    uint64_t fix_cancels;
+    uint64_t fix_cancel_rejects;
+    uint64_t fix_md_requests;
+    uint64_t fix_rejects;
+    uint64_t fix_order_rejects;
+    uint64_t fix_checksum_errors;
+    uint64_t fix_next_order_id;  // Highest order ID seen; FIX assigns the ones after it
+    uint64_t fix_next_exec_id;
+
+    // WebSocket port (ws.h). Every inbound message is framed once into
+    // ws_broadcast, and at the end of the wakeup that block goes to all feed
+    // connections.
+    int ws_fd;
+    WsUnmask ws_unmask;
+    std::unordered_map<int, WsConnection> ws_connections;
+    std::vector<int> ws_feed;
+    std::shared_ptr<std::string> ws_broadcast;
+    uint64_t ws_messages;
+    uint64_t ws_unmasked_bytes;
+    uint64_t ws_broadcast_frames;
+    uint64_t ws_broadcast_blocks;
+    uint64_t ws_writes;
+    uint64_t ws_handshake_failures;
+    uint64_t ws_feed_disconnects;
+
+    // Trade analytics (analytics.h). A periodic timer at the GCD of the bar
+    // intervals closes the bars that are due and publishes them as one
+    // [u32 length][AnalyticsBar...] frame to every subscriber.
+    std::unique_ptr<TradeAnalytics> analytics;
+    std::vector<uint64_t> bar_end_ns;  // Per lane
+    int analytics_timer_fd;
+    int analytics_fd;
+    std::unordered_map<int, std::string> analytics_subscribers;  // Output not yet written
+    std::vector<AnalyticsBar> closed_bars;
+    uint64_t analytics_ingest_ns;
+    uint64_t analytics_bars;
+    uint64_t analytics_ticks;
+    uint64_t analytics_close_ns;
+    uint64_t analytics_subscriber_drops;
+
+    // Tick store (tickstore.h). Queries queue their reply as header bytes
+    // and column file ranges, drained on EPOLLOUT.
+    std::unique_ptr<TickStore> ticks;
+    int tick_query_fd;
+    std::unordered_map<int, TickQueryConnection> tick_queries;
+    uint64_t tick_append_ns;
+    uint64_t tick_queries_served;
+    uint64_t tick_query_rows;
+    uint64_t tick_query_bytes;
+
+    uint64_t service_requests;
+    uint64_t service_stalls;
+    uint64_t drop_count;
+    uint64_t dropped_datagrams;
+
+    // Idempotency cache (idempotency.h): duplicates of UDP requests are
+    // answered with the cached response behind their own header
+    std::unique_ptr<IdempotencyCache> idempotency;
+    std::string cached_reply;
+
+    // Replies waiting for room on the UDP and QUIC sockets
+    DatagramTxQueue udp_tx;
+    DatagramTxQueue quic_tx;
+    uint64_t tx_saturate_count;
+    uint64_t tx_saturations;
+
+    // Coroutine TCP echo handlers (--tcp-handler=coroutine)
+    CoroReactor coro;
+
+    int stats_fd;
 
 public:
-    EpollServer() : epoll_fd(-1), tcp_fd(-1), udp_fd(-1), quic_fd(-1) {}
+    explicit EpollServer(const ServerConfig& cfg)
+        : config(cfg), epoll_fd(-1), tcp_fd(-1), udp_fd(-1), quic_fd(-1),
+          journaling(false), journal_event_fd(-1), input_sequence(0),
+          replication_fd(-1), heartbeat_fd(-1), replication_out_armed(false),
+          standby(cfg.standby_port > 0), standby_listen_fd(-1), primary_fd(-1),
+          primary_seen(false), replicated_records(0), lag_sample_count(0),
+          log_timer_fd(-1), log_messages(0), log_sessions_refused(0), log_sessions_broken(0), quic_opened(0), quic_sealed(0),
+          quic_open_ns(0), quic_seal_ns(0), quic_auth_failures(0),
+          quic_packet_number_floor(0), quic_crypto_swept_ns(0), quic_crypto_expired(0), compressed_messages(0),
+          plain_bytes(0), wire_bytes(0), compress_ns(0), decompress_ns(0), compression_errors(0),
+          pack_timer_fd(-1), pack_timer_due(0), packed_datagrams_in(0), packed_messages_in(0), pack_errors(0),
+          echo_syscalls(0), fix_scan(fix_best_scan()), fix_messages(0), fix_parse_ns(0), fix_orders(0),
+          fix_cancels(0), fix_cancel_rejects(0), fix_md_requests(0), fix_rejects(0), fix_order_rejects(0),
+          fix_checksum_errors(0), fix_next_order_id(0), fix_next_exec_id(0),
+          ws_fd(-1), ws_unmask(ws_best_unmask()),
+          ws_messages(0), ws_unmasked_bytes(0), ws_broadcast_frames(0), ws_broadcast_blocks(0), ws_writes(0),
+          ws_handshake_failures(0), ws_feed_disconnects(0), analytics_timer_fd(-1), analytics_fd(-1),
+          analytics_ingest_ns(0), analytics_bars(0), analytics_ticks(0), analytics_close_ns(0),
+          analytics_subscriber_drops(0), tick_query_fd(-1), tick_append_ns(0), tick_queries_served(0),
+          tick_query_rows(0), tick_query_bytes(0), service_requests(0), service_stalls(0), drop_count(0),
+          dropped_datagrams(0), tx_saturate_count(0), tx_saturations(0), stats_fd(-1) {}
 
     ~EpollServer() {
         cleanup();
@@ -60,6 +678,64 @@ public:
             return false;
         }
 
+        partitions.resize(config.partitions);
+
+        // Setup the journal and replay it before any port accepts clients
+        if (!setup_journal()) {
+            return false;
+        }
+
+        if (config.stats_port > 0 && !setup_stats_socket()) {
+            return false;
+        }
+
+        if (!config.compression.empty() && !setup_compression()) {
+            return false;
+        }
+
+        if (config.dedupe) {
+            idempotency.reset(new IdempotencyCache());
+        }
+        udp_tx.configure(config.tx_queue, config.tx_drop);
+        quic_tx.configure(config.tx_queue, config.tx_drop);
+
+        if (config.pack_mtu > 0 && !setup_packing()) {
+            return false;
+        }
+
+        if (config.fix && !setup_fix()) {
+            return false;
+        }
+
+        if (config.tcp_handler == TcpHandler::Coroutine && !setup_coroutine_handlers()) {
+            return false;
+        }
+
+        if (config.analytics && !setup_analytics()) {
+            return false;
+        }
+
+        if (!config.tick_store.empty()) {
+            ticks.reset(new TickStore());
+            if (!ticks->open(config.tick_store)) {
+                return false;
+            }
+            std::cout << "Tick store in " << config.tick_store << std::endl;
+        }
+
+        // A standby only opens the client ports once it is promoted
+        if (standby) {
+            return setup_standby_listener();
+        }
+
+        if (!config.replicate_to.empty() && !setup_replication()) {
+            return false;
+        }
+
+        return setup_client_sockets();
+    }
+
+    bool setup_client_sockets() {
         // Setup TCP socket
         if (!setup_tcp_socket()) {
             return false;
@@ -75,146 +751,355 @@ public:
             return false;
         }
 
+        if (config.ws_port > 0 && !setup_ws_socket()) {
+            return false;
+        }
+
+        if (config.analytics && config.analytics_port > 0 && !setup_analytics_socket()) {
+            return false;
+        }
+
+        if (ticks && config.tick_query_port > 0) {
+            tick_query_fd = open_server_socket(epoll_fd, SOCK_STREAM, config.tick_query_port, "tick query", 64);
+            if (tick_query_fd == -1) {
+                return false;
+            }
+            std::cout << "Tick queries on port " << config.tick_query_port << " ("
+                      << (config.tick_send_copy ? "copy" : "sendfile") << ")" << std::endl;
+        }
+
         return true;
     }
 
-    bool setup_tcp_socket() {
-        tcp_fd = socket(AF_INET, SOCK_STREAM, 0);
-        if (tcp_fd == -1) {
-            perror("TCP socket");
+    bool setup_compression() {
+        if (!config.dictionary_path.empty()) {
+            std::ifstream file(config.dictionary_path, std::ios::binary);
+            if (!file) {
+                perror(config.dictionary_path.c_str());
+                return false;
+            }
+            dictionary.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+        message_encoder.reset(new LzEncoder(dictionary, LzMode::Message, config.compression_level));
+        message_decoder.reset(new LzDecoder(dictionary, LzMode::Message));
+        std::cout << "Compressing TCP and UDP payloads (" << config.compression << " mode, level "
+                  << config.compression_level << ", " << dictionary.size() << " byte dictionary)" << std::endl;
+        return true;
+    }
+
+    bool setup_packing() {
+        if (config.pack_mtu <= (int)(PACK_HEADER_SIZE + PACK_RECORD_HEADER) || config.pack_mtu > DATAGRAM_SIZE) {
+            std::cerr << "--pack-mtu must be between " << PACK_HEADER_SIZE + PACK_RECORD_HEADER + 1
+                      << " and " << DATAGRAM_SIZE << std::endl;
+            return false;
+        }
+        if (config.quic_aead || !config.compression.empty() || config.journal_policy == JournalPolicy::Group) {
+            std::cerr << "--pack-mtu does not combine with --quic-aead, --compress or group commit" << std::endl;
             return false;
         }
 
-        // Set socket to non-blocking
-        int flags = fcntl(tcp_fd, F_GETFL, 0);
-        fcntl(tcp_fd, F_SETFL, flags | O_NONBLOCK);
+        pack_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (pack_timer_fd == -1) {
+            perror("timerfd_create");
+            return false;
+        }
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = pack_timer_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pack_timer_fd, &ev) == -1) {
+            perror("epoll_ctl pack timer");
+            return false;
+        }
 
-        // Set SO_REUSEADDR
-        int opt = 1;
-        setsockopt(tcp_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        uint64_t deadline_ns = (uint64_t)std::max(0, config.pack_deadline_us) * 1000;
+        udp_packer.reset(new DatagramPacker(config.pack_mtu, deadline_ns));
+        quic_packer.reset(new DatagramPacker(config.pack_mtu, deadline_ns));
+        std::cout << "Packing UDP and QUIC echoes into datagrams of up to " << config.pack_mtu
+                  << " bytes, " << config.pack_deadline_us << "us deadline" << std::endl;
+        return true;
+    }
 
-        struct sockaddr_in addr;
-        memset(&addr, 0, sizeof(addr));
-        addr.sin_family = AF_INET;
-        addr.sin_addr.s_addr = INADDR_ANY;
-        addr.sin_port = htons(TCP_PORT);
+    bool setup_fix() {
+        if (!config.fix_scan.empty() && !parse_fix_scan(config.fix_scan, fix_scan)) {
+            std::cerr << "Unknown or unsupported FIX scan: " << config.fix_scan << std::endl;
+            return false;
+        }
+        if (!config.compression.empty()) {
+            std::cerr << "--fix does not combine with --compress" << std::endl;
+            return false;
+        }
+        std::cout << "FIX 4.4 order entry on the TCP port (" << fix_scan_name(fix_scan) << " scan)" << std::endl;
+        return true;
+    }
 
-        if (bind(tcp_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
-            perror("TCP bind");
+    bool setup_coroutine_handlers() {
+        if (!coro.open(epoll_fd)) {
             return false;
         }
+        std::cout << "TCP echo served by a coroutine per connection";
+        if (config.tcp_idle_timeout_ms > 0) std::cout << ", idle timeout " << config.tcp_idle_timeout_ms << "ms";
+        std::cout << std::endl;
+        return true;
+    }
 
-        if (listen(tcp_fd, SOMAXCONN) == -1) {
-            perror("TCP listen");
+    bool setup_analytics() {
+        AnalyticsUpdate update = analytics_best_update();
+        if (!config.analytics_update.empty() && !parse_analytics_update(config.analytics_update, update)) {
+            std::cerr << "Unknown or unsupported analytics update: " << config.analytics_update << std::endl;
+            return false;
+        }
+        if (config.bar_intervals_ms.empty() || config.bar_intervals_ms.size() > (size_t)ANALYTICS_LANES) {
+            std::cerr << "--bar-intervals-ms takes 1 to " << ANALYTICS_LANES << " intervals" << std::endl;
             return false;
         }
+        int tick_ms = 0;
+        for (int interval : config.bar_intervals_ms) {
+            if (interval <= 0) {
+                std::cerr << "Bar intervals must be positive" << std::endl;
+                return false;
+            }
+            int a = tick_ms, b = interval;
+            while (b) {
+                int r = a % b;
+                a = b;
+                b = r;
+            }
+            tick_ms = a;
+        }
+
+        analytics.reset(new TradeAnalytics(update));
+        uint64_t now = journal_now_ns();
+        for (int interval : config.bar_intervals_ms) {
+            uint64_t interval_ns = (uint64_t)interval * 1000000;
+            bar_end_ns.push_back((now / interval_ns + 1) * interval_ns);
+        }
 
-        // Add to epoll
+        // Ticks fall on multiples of tick_ms, so every bar boundary is one
+        analytics_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (analytics_timer_fd == -1) {
+            perror("timerfd_create");
+            return false;
+        }
+        uint64_t tick_ns = (uint64_t)tick_ms * 1000000;
+        uint64_t first = (now / tick_ns + 1) * tick_ns;
+        struct itimerspec spec;
+        spec.it_value.tv_sec = first / 1000000000;
+        spec.it_value.tv_nsec = first % 1000000000;
+        spec.it_interval.tv_sec = tick_ns / 1000000000;
+        spec.it_interval.tv_nsec = tick_ns % 1000000000;
+        if (timerfd_settime(analytics_timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr) == -1) {
+            perror("timerfd_settime");
+            return false;
+        }
         struct epoll_event ev;
         ev.events = EPOLLIN;
-        ev.data.fd = tcp_fd;
-        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, tcp_fd, &ev) == -1) {
-            perror("epoll_ctl TCP");
+        ev.data.fd = analytics_timer_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, analytics_timer_fd, &ev) == -1) {
+            perror("epoll_ctl analytics timer");
             return false;
         }
 
-        std::cout << "TCP server listening on port " << TCP_PORT << std::endl;
+        std::cout << "Trade analytics (" << analytics_update_name(update) << " update), bars every";
+        for (int interval : config.bar_intervals_ms) std::cout << " " << interval << "ms";
+        std::cout << std::endl;
         return true;
     }
 
-    bool setup_udp_socket() {
-        udp_fd = socket(AF_INET, SOCK_DGRAM, 0);
-        if (udp_fd == -1) {
-            perror("UDP socket");
+    bool setup_analytics_socket() {
+        analytics_fd = open_server_socket(epoll_fd, SOCK_STREAM, config.analytics_port, "analytics", 64);
+        if (analytics_fd == -1) {
+            return false;
+        }
+
+        std::cout << "Analytics subscribers on port " << config.analytics_port << std::endl;
+        return true;
+    }
+
+    bool setup_journal() {
+        if (config.journal_path.empty() ||
+            (config.journal_policy == JournalPolicy::None && !config.replay)) {
+            return true;
+        }
+
+        if (!journal.open(config.journal_path, config.journal_size_mb * 1024 * 1024)) {
             return false;
         }
 
-        // Set socket to non-blocking
-        int flags = fcntl(udp_fd, F_GETFL, 0);
-        fcntl(udp_fd, F_SETFL, flags | O_NONBLOCK);
+        if (config.replay) {
+            replay_journal();
+        }
 
-        // Set SO_REUSEADDR for UDP as well
-        int opt = 1;
-        setsockopt(udp_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        if (config.journal_policy == JournalPolicy::None) {
+            return true;
+        }
+        journaling = true;
 
-        // Increase socket buffer sizes for better UDP performance
-        int buf_size = 1024 * 1024;  // 1MB buffer
-        setsockopt(udp_fd, SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
-        setsockopt(udp_fd, SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size));
+        if (config.journal_policy == JournalPolicy::Group) {
+            // The flusher thread signals durable progress through an eventfd
+            journal_event_fd = eventfd(0, EFD_NONBLOCK);
+            if (journal_event_fd == -1) {
+                perror("eventfd");
+                return false;
+            }
 
-        struct sockaddr_in addr;
-        memset(&addr, 0, sizeof(addr));
-        addr.sin_family = AF_INET;
-        addr.sin_addr.s_addr = INADDR_ANY;
-        addr.sin_port = htons(UDP_PORT);
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.fd = journal_event_fd;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, journal_event_fd, &ev) == -1) {
+                perror("epoll_ctl journal");
+                return false;
+            }
 
-        if (bind(udp_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
-            perror("UDP bind");
+            journal.start_group_commit(config.commit_every, config.commit_interval_us, journal_event_fd);
+        }
+
+        std::cout << "Journaling to " << config.journal_path << " (next sequence "
+                  << journal.get_last_sequence() + 1 << ")" << std::endl;
+        return true;
+    }
+
+    bool setup_tcp_socket() {
+        tcp_fd = open_server_socket(epoll_fd, SOCK_STREAM, config.tcp_port, "TCP");
+        if (tcp_fd == -1) {
             return false;
         }
 
-        // Add to epoll
-        struct epoll_event ev;
-        ev.events = EPOLLIN;
-        ev.data.fd = udp_fd;
-        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, udp_fd, &ev) == -1) {
-            perror("epoll_ctl UDP");
+        std::cout << "TCP server listening on port " << config.tcp_port << std::endl;
+        return true;
+    }
+
+    bool setup_udp_socket() {
+        udp_fd = open_server_socket(epoll_fd, SOCK_DGRAM, config.udp_port, "UDP");
+        if (udp_fd == -1) {
             return false;
         }
 
-        std::cout << "UDP server listening on port " << UDP_PORT << std::endl;
+        std::cout << "UDP server listening on port " << config.udp_port << std::endl;
         return true;
     }
 
     bool setup_quic_socket() {
-        quic_fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (config.quic_aead && !aead_supported()) {
+            std::cerr << "--quic-aead needs a CPU with AES-NI and PCLMULQDQ" << std::endl;
+            return false;
+        }
+        quic_fd = open_server_socket(epoll_fd, SOCK_DGRAM, config.quic_port, "QUIC");
         if (quic_fd == -1) {
-            perror("QUIC socket");
             return false;
         }
 
-        // Set socket to non-blocking
-        int flags = fcntl(quic_fd, F_GETFL, 0);
-        fcntl(quic_fd, F_SETFL, flags | O_NONBLOCK);
+        std::cout << "QUIC server listening on port " << config.quic_port
+                  << (config.quic_aead ? " (AES-128-GCM protected)" : "") << std::endl;
+        return true;
+    }
 
-        // Set SO_REUSEADDR
-        int opt = 1;
-        setsockopt(quic_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    bool setup_ws_socket() {
+        if (!config.ws_unmask.empty() && !parse_ws_unmask(config.ws_unmask, ws_unmask)) {
+            std::cerr << "Unknown or unsupported WebSocket unmask: " << config.ws_unmask << std::endl;
+            return false;
+        }
+        if (config.journal_policy == JournalPolicy::Group) {
+            std::cerr << "--ws-port does not combine with group commit" << std::endl;
+            return false;
+        }
+        ws_fd = open_server_socket(epoll_fd, SOCK_STREAM, config.ws_port, "WebSocket");
+        if (ws_fd == -1) {
+            return false;
+        }
 
-        // Increase socket buffer sizes for better QUIC performance
-        int buf_size = 1024 * 1024;  // 1MB buffer
-        setsockopt(quic_fd, SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
-        setsockopt(quic_fd, SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size));
+        std::cout << "WebSocket server listening on port " << config.ws_port << " (" << ws_unmask_name(ws_unmask)
+                  << " unmask, feed at " << WS_FEED_PATH << ")" << std::endl;
+        return true;
+    }
+
+    bool setup_stats_socket() {
+        stats_fd = open_server_socket(epoll_fd, SOCK_STREAM, config.stats_port, "stats", 16);
+        if (stats_fd == -1) {
+            return false;
+        }
+
+        std::cout << "Stats endpoint listening on port " << config.stats_port << std::endl;
+        return true;
+    }
+
+    // Primary side: connect to the standby and start the heartbeat timer
+    bool setup_replication() {
+        size_t colon = config.replicate_to.rfind(':');
+        if (colon == std::string::npos) {
+            std::cerr << "Bad --replicate-to address: " << config.replicate_to << std::endl;
+            return false;
+        }
+        std::string host = config.replicate_to.substr(0, colon);
+        int port = atoi(config.replicate_to.c_str() + colon + 1);
 
         struct sockaddr_in addr;
         memset(&addr, 0, sizeof(addr));
         addr.sin_family = AF_INET;
-        addr.sin_addr.s_addr = INADDR_ANY;
-        addr.sin_port = htons(QUIC_PORT);
+        addr.sin_port = htons(port);
+        if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+            std::cerr << "Bad --replicate-to host: " << host << std::endl;
+            return false;
+        }
 
-        if (bind(quic_fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
-            perror("QUIC bind");
+        // The standby may still be starting up
+        for (int attempt = 0; attempt < 100; attempt++) {
+            replication_fd = socket(AF_INET, SOCK_STREAM, 0);
+            if (connect(replication_fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) break;
+            close(replication_fd);
+            replication_fd = -1;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        if (replication_fd == -1) {
+            perror("replication connect");
             return false;
         }
 
-        // Add to epoll
+        int opt = 1;
+        setsockopt(replication_fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+        int flags = fcntl(replication_fd, F_GETFL, 0);
+        fcntl(replication_fd, F_SETFL, flags | O_NONBLOCK);
+
         struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = replication_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, replication_fd, &ev) == -1) {
+            perror("epoll_ctl replication");
+            return false;
+        }
+
+        heartbeat_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        struct itimerspec interval;
+        interval.it_interval.tv_sec = 0;
+        interval.it_interval.tv_nsec = HEARTBEAT_INTERVAL_MS * 1000000L;
+        interval.it_value = interval.it_interval;
+        timerfd_settime(heartbeat_fd, 0, &interval, nullptr);
         ev.events = EPOLLIN;
-        ev.data.fd = quic_fd;
-        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, quic_fd, &ev) == -1) {
-            perror("epoll_ctl QUIC");
+        ev.data.fd = heartbeat_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, heartbeat_fd, &ev) == -1) {
+            perror("epoll_ctl heartbeat");
             return false;
         }
 
-        std::cout << "QUIC server listening on port " << QUIC_PORT << std::endl;
+        std::cout << "Replicating to standby at " << config.replicate_to << std::endl;
         return true;
     }
 
-    void run() {
-        std::cout << "Server started. Press Ctrl+C to stop." << std::endl;
-        
+    bool setup_standby_listener() {
+        standby_listen_fd = open_server_socket(epoll_fd, SOCK_STREAM, config.standby_port, "standby", 1);
+        if (standby_listen_fd == -1) {
+            return false;
+        }
+
+        std::cout << "Standby waiting for primary on port " << config.standby_port << std::endl;
+        return true;
+    }
+
+    void run() {
+        std::cout << "Server started. Press Ctrl+C to stop." << std::endl;
+        
         while (true) {
-            int nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+            int timeout_ms = standby ? STANDBY_TICK_MS : -1;
+            int nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
             if (nfds == -1) {
                 if (errno == EINTR) continue;  // Interrupted by signal, continue
                 perror("epoll_wait");
@@ -225,22 +1110,505 @@ public:
                 if (events[i].data.fd == tcp_fd) {
                     handle_tcp_connection();
                 } else if (events[i].data.fd == udp_fd) {
-                    handle_udp_packet();
+                    if (events[i].events & EPOLLOUT) udp_tx.flush(udp_fd, journal_now_ns());
+                    if (events[i].events & EPOLLIN) handle_udp_packet();
                 } else if (events[i].data.fd == quic_fd) {
-                    handle_quic_connection();
+                    if (events[i].events & EPOLLOUT) quic_tx.flush(quic_fd, journal_now_ns());
+                    if (events[i].events & EPOLLIN) handle_quic_connection();
+                } else if (events[i].data.fd == journal_event_fd) {
+                    release_durable_replies();
+                } else if (events[i].data.fd == stats_fd) {
+                    handle_stats_request();
+                } else if (events[i].data.fd == heartbeat_fd) {
+                    send_heartbeat();
+                } else if (events[i].data.fd == log_timer_fd) {
+                    handle_log_timer();
+                } else if (events[i].data.fd == pack_timer_fd) {
+                    handle_pack_timer();
+                } else if (events[i].data.fd == analytics_timer_fd) {
+                    handle_analytics_timer();
+                } else if (events[i].data.fd == coro.timer_fd) {
+                    coro.on_timer();
+                } else if (events[i].data.fd == analytics_fd) {
+                    handle_analytics_connection();
+                } else if (!analytics_subscribers.empty() && analytics_subscribers.count(events[i].data.fd)) {
+                    handle_analytics_subscriber(events[i].data.fd, events[i].events);
+                } else if (events[i].data.fd == tick_query_fd) {
+                    handle_tick_query_connection();
+                } else if (!tick_queries.empty() && tick_queries.count(events[i].data.fd)) {
+                    handle_tick_query_client(events[i].data.fd, events[i].events);
+                } else if (events[i].data.fd == ws_fd) {
+                    handle_ws_connection();
+                } else if (!ws_connections.empty() && ws_connections.count(events[i].data.fd)) {
+                    handle_ws_client(events[i].data.fd, events[i].events);
+                } else if (events[i].data.fd == replication_fd) {
+                    if (events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP | EPOLLIN)) {
+                        drop_replication("standby closed the replication link");
+                    } else if (events[i].events & EPOLLOUT) {
+                        flush_replication();
+                    }
+                } else if (events[i].data.fd == standby_listen_fd) {
+                    accept_primary();
+                } else if (events[i].data.fd == primary_fd) {
+                    handle_replication_stream();
+                } else if (coro.owns(events[i].data.fd)) {
+                    // Group-committed replies the socket refused go out ahead of the coroutine's own
+                    if ((events[i].events & EPOLLOUT) && !flush_stream(events[i].data.fd)) {
+                        close_client(events[i].data.fd);
+                    } else {
+                        coro.on_events(events[i].data.fd, events[i].events);
+                    }
                 } else {
                     // Check for errors or hangup
                     if (events[i].events & (EPOLLERR | EPOLLHUP)) {
                         close_client(events[i].data.fd);
-                    } else {
+                    } else if ((events[i].events & EPOLLOUT) && !flush_stream(events[i].data.fd)) {
+                        close_client(events[i].data.fd);
+                    } else if (events[i].events & (EPOLLIN | EPOLLRDHUP)) {
                         handle_tcp_client(events[i].data.fd);
                     }
                 }
             }
+
+            // Replicate everything sequenced during this wakeup in one write
+            if (!replication_out.empty() && !replication_out_armed) {
+                flush_replication();
+            }
+            if (ws_broadcast) {
+                flush_ws_broadcast();
+            }
+            watch_tx(udp_fd, udp_tx);
+            watch_tx(quic_fd, quic_tx);
+            for (int fd : coro.ended) close_client(fd);
+            coro.ended.clear();
+            if (standby) {
+                check_failover();
+            }
         }
     }
 
 private:
+    // Rebuilds market state and QUIC connection IDs from the journal. This
+    // thread reads the file once and hands each market message to the
+    // thread of the partition its symbol hashes to, so no state is shared
+    // and the journal is walked once whatever the partition count. A single
+    // partition is applied here, without the handoff.
+    void replay_journal() {
+        auto start = std::chrono::steady_clock::now();
+        size_t partition_count = partitions.size();
+        std::vector<ReplayQueue> queues(partition_count > 1 ? partition_count : 0);
+        std::vector<std::thread> workers;
+
+        for (size_t p = 0; p < queues.size(); p++) {
+            workers.emplace_back(&EpollServer::replay_partition, this, p, std::ref(queues[p]));
+        }
+        read_journal_for_replay(queues);
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        quic_connections = quic_connections_map.size();
+        seed_fix_order_ids();
+
+        uint64_t market_messages = 0;
+        size_t books = 0;
+        for (const auto& partition : partitions) {
+            market_messages += partition.messages;
+            books += partition.books.size();
+        }
+
+        double elapsed_ms = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count() / 1000.0;
+        std::cout << "Replayed " << journal.get_last_sequence() << " journal records ("
+                  << market_messages << " market messages, " << books << " books, "
+                  << quic_connections_map.size() << " QUIC connections) in "
+                  << elapsed_ms << " ms using " << partition_count << " threads" << std::endl;
+    }
+
+    void read_journal_for_replay(std::vector<ReplayQueue>& queues) {
+        const char* records = journal.records();
+        size_t bytes = journal.records_size();
+        size_t partition_count = queues.size();
+        std::vector<std::vector<MarketMessage>> batches(partition_count);
+        MarketPartition& only = partitions[0];
+        long page = sysconf(_SC_PAGESIZE);
+        size_t advised = 0;
+
+        size_t offset = 0;
+        while (offset < bytes) {
+            // Keep kernel readahead running well ahead of the cursor
+            if (offset >= advised) {
+                size_t from = offset & ~(size_t)(page - 1);
+                size_t length = std::min(REPLAY_READAHEAD_BYTES, bytes - from);
+                madvise(const_cast<char*>(records) + from, length, MADV_WILLNEED);
+                advised = from + length / 2;
+            }
+            __builtin_prefetch(records + offset + REPLAY_PREFETCH_BYTES);
+
+            const JournalRecord* record = reinterpret_cast<const JournalRecord*>(records + offset);
+            const char* payload = records + offset + sizeof(JournalRecord);
+            offset += journal_record_size(record->length);
+
+            if (record->protocol == JOURNAL_QUIC) {
+                struct sockaddr_in addr;
+                memset(&addr, 0, sizeof(addr));
+                addr.sin_family = AF_INET;
+                addr.sin_addr.s_addr = record->peer_addr;
+                addr.sin_port = record->peer_port;
+                quic_connections_map.insert_or_assign(record->connection_id,
+                                                      QuicConnection(record->connection_id, addr));
+            }
+
+            size_t length = record->length;
+            const char* market = market_payload(record->protocol, payload, length);
+            for_each_market_message(market, length, [&](const MarketMessage& msg) {
+                if (partition_count == 0) {
+                    only.apply(msg);
+                    return;
+                }
+                size_t p = msg.symbol % partition_count;
+                batches[p].push_back(msg);
+                if (batches[p].size() == REPLAY_BATCH_MESSAGES) queues[p].push(batches[p]);
+            });
+        }
+
+        for (size_t p = 0; p < partition_count; p++) {
+            if (!batches[p].empty()) queues[p].push(batches[p]);
+            queues[p].finish();
+        }
+    }
+
+    void replay_partition(size_t partition, ReplayQueue& queue) {
+        MarketPartition& state = partitions[partition];
+        std::vector<MarketMessage> batch;
+        while (queue.pop(batch)) {
+            for (const MarketMessage& msg : batch) state.apply(msg);
+        }
+    }
+
+    // FIX OrderIDs continue after the highest order ID replayed from the
+    // journal, so they never name an order already resting
+    void seed_fix_order_ids() {
+        for (const MarketPartition& partition : partitions) {
+            fix_next_order_id = std::max(fix_next_order_id, partition.highest_order_id);
+        }
+    }
+
+    // QUIC payloads carry the connection ID in front of the application data
+    static const char* market_payload(uint8_t protocol, const char* data, size_t& length) {
+        if (protocol == JOURNAL_QUIC) {
+            if (length < sizeof(uint32_t)) {
+                length = 0;
+                return data;
+            }
+            length -= sizeof(uint32_t);
+            return data + sizeof(uint32_t);
+        }
+        return data;
+    }
+
+    void track_quic_connection(uint32_t connection_id, const struct sockaddr_in& client_addr) {
+        auto it = quic_connections_map.find(connection_id);
+        if (it == quic_connections_map.end()) {
+            // New connection
+            quic_connections_map.emplace(connection_id, QuicConnection(connection_id, client_addr));
+            quic_connections++;
+            if (quic_connections % 100 == 0) {
+                std::cout << "QUIC connections: " << quic_connections << std::endl;
+            }
+        } else {
+            // Update existing connection
+            it->second.last_activity = std::chrono::steady_clock::now();
+        }
+    }
+
+    void apply_market_state(uint8_t protocol, const char* data, size_t length) {
+        const char* market = market_payload(protocol, data, length);
+        size_t partition_count = partitions.size();
+        for_each_market_message(market, length, [&](const MarketMessage& msg) {
+            partitions[msg.symbol % partition_count].apply(msg);
+            // Binary clients pick their own order IDs; FIX's stay past them
+            if (msg.type == MARKET_NEW_ORDER) fix_next_order_id = std::max(fix_next_order_id, msg.order_id);
+        });
+    }
+
+    void ingest_trades(uint8_t protocol, const char* data, size_t length) {
+        const char* market = market_payload(protocol, data, length);
+        uint64_t before = analytics->trade_count;
+        uint64_t start = journal_now_ns();
+        for_each_market_message(market, length, [&](const MarketMessage& msg) {
+            if (msg.type == MARKET_TRADE) analytics->add_trade(msg.symbol, msg.price, msg.quantity);
+        });
+        if (analytics->trade_count != before) analytics_ingest_ns += journal_now_ns() - start;
+    }
+
+    // Closes every bar that is due (several, if ticks were missed) and
+    // publishes them in one frame
+    void handle_analytics_timer() {
+        uint64_t expirations;
+        while (read(analytics_timer_fd, &expirations, sizeof(expirations)) > 0) {}
+
+        uint64_t now = journal_now_ns();
+        uint64_t start = now;
+        closed_bars.clear();
+        for (size_t lane = 0; lane < bar_end_ns.size(); lane++) {
+            uint64_t interval_ns = (uint64_t)config.bar_intervals_ms[lane] * 1000000;
+            while (bar_end_ns[lane] <= now) {
+                analytics->close_bars((int)lane, bar_end_ns[lane], closed_bars);
+                bar_end_ns[lane] += interval_ns;
+            }
+        }
+        analytics_ticks++;
+        analytics_bars += closed_bars.size();
+        analytics_close_ns += journal_now_ns() - start;
+        if (closed_bars.empty() || analytics_subscribers.empty()) return;
+
+        std::string frame;
+        append_frame(frame, (const char*)closed_bars.data(), closed_bars.size() * sizeof(AnalyticsBar));
+        std::vector<int> slow;
+        for (auto& subscriber : analytics_subscribers) {
+            if (!send_analytics(subscriber.first, subscriber.second, frame)) slow.push_back(subscriber.first);
+        }
+        for (int fd : slow) {
+            analytics_subscriber_drops++;
+            close_analytics_subscriber(fd);
+        }
+    }
+
+    // Writes what the socket takes and keeps the rest, armed for EPOLLOUT.
+    // Returns false when the subscriber failed or fell too far behind.
+    bool send_analytics(int fd, std::string& pending, const std::string& data) {
+        size_t offset = 0;
+        if (pending.empty()) {
+            ssize_t written = write(fd, data.data(), data.size());
+            if (written == -1) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+                written = 0;
+            }
+            offset = written;
+            if (offset == data.size()) return true;
+        }
+        bool arm = pending.empty();
+        pending.append(data, offset, std::string::npos);
+        if (pending.size() > SUBSCRIBER_BUFFER_LIMIT) return false;
+        if (arm) {
+            struct epoll_event ev;
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+            ev.data.fd = fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+        }
+        return true;
+    }
+
+    void handle_analytics_connection() {
+        int fd;
+        while ((fd = accept4(analytics_fd, nullptr, nullptr, SOCK_NONBLOCK)) != -1) {
+            int opt = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+            struct epoll_event ev;
+            ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+            ev.data.fd = fd;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+                perror("epoll_ctl analytics subscriber");
+                close(fd);
+                continue;
+            }
+            analytics_subscribers[fd];
+        }
+    }
+
+    // Subscribers only listen: input is discarded, EOF closes
+    void handle_analytics_subscriber(int fd, uint32_t event_mask) {
+        std::string& pending = analytics_subscribers[fd];
+        if ((event_mask & EPOLLOUT) && !pending.empty()) {
+            ssize_t written = write(fd, pending.data(), pending.size());
+            if (written == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                close_analytics_subscriber(fd);
+                return;
+            }
+            if (written > 0) pending.erase(0, written);
+            if (pending.empty()) {
+                struct epoll_event ev;
+                ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+                ev.data.fd = fd;
+                epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+            }
+        }
+        if (event_mask & (EPOLLERR | EPOLLHUP)) {
+            close_analytics_subscriber(fd);
+            return;
+        }
+        char buffer[BUFFER_SIZE];
+        ssize_t n;
+        while ((n = read(fd, buffer, sizeof(buffer))) > 0) {}
+        if (n == 0 || (n == -1 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            close_analytics_subscriber(fd);
+        }
+    }
+
+    void close_analytics_subscriber(int fd) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        analytics_subscribers.erase(fd);
+    }
+
+    void store_ticks(uint8_t protocol, const char* data, size_t length) {
+        const char* market = market_payload(protocol, data, length);
+        uint64_t before = ticks->rows_written;
+        int64_t now = tick_wall_ns();
+        for_each_market_message(market, length, [&](const MarketMessage& msg) {
+            if (msg.type == MARKET_TRADE) ticks->append(msg.symbol, now, msg.price, msg.quantity);
+        });
+        if (ticks->rows_written != before) tick_append_ns += tick_wall_ns() - now;
+    }
+
+    void handle_tick_query_connection() {
+        int fd;
+        while ((fd = accept4(tick_query_fd, nullptr, nullptr, SOCK_NONBLOCK)) != -1) {
+            int opt = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+            struct epoll_event ev;
+            ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+            ev.data.fd = fd;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+                perror("epoll_ctl tick query");
+                close(fd);
+                continue;
+            }
+            tick_queries[fd];
+        }
+    }
+
+    // Reads queries only while the reply backlog has room: a client that
+    // pipelines faster than it drains stays in its socket buffer, and EPOLLOUT
+    // resumes reading once the queued replies have gone out
+    void handle_tick_query_client(int fd, uint32_t event_mask) {
+        TickQueryConnection& connection = tick_queries[fd];
+        if (event_mask & (EPOLLERR | EPOLLHUP)) {
+            close_tick_query(fd);
+            return;
+        }
+        if (event_mask & (EPOLLIN | EPOLLRDHUP)) connection.readable = true;
+        bool was_blocked = event_mask & EPOLLOUT;
+        while (true) {
+            size_t offset = 0;
+            while (connection.out.size() < TICK_QUERY_MAX_SENDS &&
+                   connection.in.size() - offset >= sizeof(TickQuery)) {
+                TickQuery query;
+                memcpy(&query, connection.in.data() + offset, sizeof(query));
+                offset += sizeof(query);
+                if (query.magic != TICK_QUERY_MAGIC) {
+                    close_tick_query(fd);
+                    return;
+                }
+                queue_tick_reply(connection, query);
+            }
+            connection.in.erase(0, offset);
+            if (!flush_tick_query(fd, connection)) {
+                close_tick_query(fd);
+                return;
+            }
+            if (!connection.out.empty()) break;
+            if (connection.in.size() >= sizeof(TickQuery)) continue;
+            if (!connection.readable) break;
+            char buffer[BUFFER_SIZE];
+            ssize_t n = read(fd, buffer, sizeof(buffer));
+            if (n > 0) {
+                connection.in.append(buffer, n);
+                continue;
+            }
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                close_tick_query(fd);
+                return;
+            }
+            connection.readable = false;
+            break;
+        }
+        bool blocked = !connection.out.empty();
+        if (blocked != was_blocked) {
+            struct epoll_event ev;
+            ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP | (blocked ? (uint32_t)EPOLLOUT : 0u);
+            ev.data.fd = fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+        }
+    }
+
+    // One segment per day that has rows, each its three column ranges, then
+    // the zero-row terminator. Rows appended after this point are not sent.
+    void queue_tick_reply(TickQueryConnection& connection, const TickQuery& query) {
+        tick_queries_served++;
+        for (const TickPartition* partition : ticks->partitions_in(query.symbol, query.from_ns, query.to_ns)) {
+            uint64_t first, rows;
+            partition->range(query.from_ns, query.to_ns, first, rows);
+            if (rows == 0) continue;
+
+            TickSend header;
+            TickSegment segment = {TICK_QUERY_MAGIC, partition->day(), rows};
+            header.bytes.assign((const char*)&segment, sizeof(segment));
+            connection.out.push_back(std::move(header));
+            for (int column = 0; column < TICK_COLUMNS; column++) {
+                TickSend range;
+                range.fd = open(partition->path(column).c_str(), O_RDONLY);
+                if (range.fd == -1) {
+                    perror("tick query open");
+                    // Keep the reply well formed: the client sees zeros
+                    range.bytes.assign(rows * TICK_COLUMN_WIDTH[column], '\0');
+                }
+                range.offset = first * TICK_COLUMN_WIDTH[column];
+                range.remaining = rows * TICK_COLUMN_WIDTH[column];
+                connection.out.push_back(std::move(range));
+            }
+            tick_query_rows += rows;
+        }
+        TickSend end;
+        TickSegment terminator = {TICK_QUERY_MAGIC, 0, 0};
+        end.bytes.assign((const char*)&terminator, sizeof(terminator));
+        connection.out.push_back(std::move(end));
+    }
+
+    // Sends until the socket blocks. Returns false when the peer failed.
+    bool flush_tick_query(int fd, TickQueryConnection& connection) {
+        char buffer[64 * 1024];
+        while (!connection.out.empty()) {
+            TickSend& next = connection.out.front();
+            ssize_t sent;
+            if (next.fd == -1) {
+                // Segment headers ride with the column data that follows
+                int flags = connection.out.size() > 1 ? MSG_MORE : 0;
+                sent = send(fd, next.bytes.data(), next.bytes.size(), flags | MSG_NOSIGNAL);
+                if (sent > 0) next.bytes.erase(0, sent);
+            } else if (config.tick_send_copy) {
+                ssize_t got = pread(next.fd, buffer, std::min(sizeof(buffer), next.remaining), next.offset);
+                if (got <= 0) {
+                    perror("tick query pread");
+                    return false;
+                }
+                sent = write(fd, buffer, got);
+                if (sent > 0) next.offset += sent;
+            } else {
+                sent = sendfile(fd, next.fd, &next.offset, next.remaining);
+            }
+            if (sent == -1) {
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            tick_query_bytes += sent;
+            if (next.fd != -1) next.remaining -= sent;
+            if (next.fd == -1 ? next.bytes.empty() : next.remaining == 0) {
+                if (next.fd != -1) close(next.fd);
+                connection.out.pop_front();
+            }
+        }
+        return true;
+    }
+
+    void close_tick_query(int fd) {
+        for (TickSend& pending : tick_queries[fd].out) {
+            if (pending.fd != -1) close(pending.fd);
+        }
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        tick_queries.erase(fd);
+    }
+
     void handle_tcp_connection() {
         struct sockaddr_in client_addr;
         socklen_t client_len = sizeof(client_addr);
@@ -265,47 +1633,76 @@ private:
                 std::cout << "TCP connections: " << tcp_connections << std::endl;
             }
 
+            tcp_peers[client_fd] = client_addr;
+
             // Set client socket to non-blocking
             int flags = fcntl(client_fd, F_GETFL, 0);
             fcntl(client_fd, F_SETFL, flags | O_NONBLOCK);
 
-            // Add client to epoll with error detection
+            // Add client to epoll with error detection. A coroutine
+            // handler also waits for output room, so gets EPOLLOUT edges.
+            bool coroutine = config.tcp_handler == TcpHandler::Coroutine;
             struct epoll_event ev;
             ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+            if (coroutine) ev.events |= EPOLLOUT;
             ev.data.fd = client_fd;
             if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) == -1) {
                 perror("epoll_ctl client");
                 close(client_fd);
                 continue;
             }
+            if (coroutine) {
+                coro.start(client_fd, tcp_echo_task(coro.attach(client_fd)));
+            }
+        }
+    }
+
+    // The TCP echo of handle_tcp_client as one coroutine per connection
+    // (--tcp-handler=coroutine). A reply the socket cannot take whole waits
+    // for room instead of losing the rest; while group-committed replies are
+    // still queued in stream_backlog, new ones join them there to keep order.
+    ConnTask tcp_echo_task(CoroConnection& conn) {
+        char buffer[BUFFER_SIZE];
+        uint64_t idle_ns = config.tcp_idle_timeout_ms * 1000000ULL;
+        for (;;) {
+            uint64_t deadline = idle_ns ? CoroReactor::now_ns() + idle_ns : 0;
+            ssize_t bytes_read = co_await conn.read(buffer, sizeof(buffer), deadline);
+            if (bytes_read <= 0) co_return;
+            uint64_t sequence = record_inbound(JOURNAL_TCP, conn.fd, peer_of(conn.fd), buffer, bytes_read);
+            service_pause();
+            if (defer_reply(sequence, conn.fd, nullptr, buffer, bytes_read)) continue;
+            if (stream_backlog.count(conn.fd)) {
+                if (!send_stream(conn.fd, buffer, bytes_read)) co_return;
+                continue;
+            }
+            if (!co_await conn.write(buffer, bytes_read)) co_return;
         }
     }
 
     void handle_tcp_client(int client_fd) {
+        if (!config.compression.empty()) {
+            handle_compressed_tcp(client_fd);
+            return;
+        }
+        if (config.fix) {
+            handle_fix_client(client_fd);
+            return;
+        }
+
         char buffer[BUFFER_SIZE];
         ssize_t bytes_read;
 
         while ((bytes_read = read(client_fd, buffer, sizeof(buffer))) > 0) {
+            uint64_t sequence = record_inbound(JOURNAL_TCP, client_fd, peer_of(client_fd), buffer, bytes_read);
+            service_pause();
+            if (defer_reply(sequence, client_fd, nullptr, buffer, bytes_read)) {
+                continue;
+            }
+
             // Echo back the data
-            ssize_t bytes_written = 0;
-            ssize_t total_written = 0;
-            
-            while (total_written < bytes_read) {
-                bytes_written = write(client_fd, buffer + total_written, bytes_read - total_written);
-                if (bytes_written == -1) {
-                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                        break;
-                    }
-                    if (errno == EPIPE) {
-                        // Client disconnected
-                        close_client(client_fd);
-                        return;
-                    }
-                    perror("write");
-                    close_client(client_fd);
-                    return;
-                }
-                total_written += bytes_written;
+            if (!send_stream(client_fd, buffer, bytes_read)) {
+                close_client(client_fd);
+                return;
             }
         }
 
@@ -319,111 +1716,3472 @@ private:
         }
     }
 
-    void handle_udp_packet() {
-        char buffer[BUFFER_SIZE];
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
+    // Synthetic service time of one processed echo request, also counted
+    // for the stats. The whole reactor
+    // stalls, so other clients queue as on a slow replica.
+    void service_pause() {
+        service_requests++;
+        if (config.service_time_us <= 0 && config.stall_every <= 0) return;
+        long us = config.service_time_us;
+        if (config.stall_every > 0 && service_requests % config.stall_every == 0) {
+            us += config.stall_us;
+            service_stalls++;
+        }
+        if (us <= 0) return;
+        struct timespec pause = {us / 1000000, (us % 1000000) * 1000L};
+        nanosleep(&pause, nullptr);
+    }
 
-        // Process multiple packets in one go to handle high load
-        while (true) {
-            memset(&client_addr, 0, sizeof(client_addr));
-            client_len = sizeof(client_addr);
-            
-            ssize_t bytes_read = recvfrom(udp_fd, buffer, sizeof(buffer), 0, 
-                                         (struct sockaddr*)&client_addr, &client_len);
-            if (bytes_read > 0) {
-                // Echo back the data
-                ssize_t bytes_sent = sendto(udp_fd, buffer, bytes_read, 0, 
-                                          (struct sockaddr*)&client_addr, client_len);
-                if (bytes_sent == -1) {
-                    perror("UDP sendto");
-                } else {
-                    udp_packets++;
-                    if (udp_packets % 1000 == 0) {
-                        std::cout << "UDP packets processed: " << udp_packets << std::endl;
-                    }
+    // True for every drop_every-th echo datagram, which is then ignored as
+    // if the network had lost it
+    bool drop_datagram() {
+        if (config.drop_every <= 0 || ++drop_count % config.drop_every != 0) return false;
+        dropped_datagrams++;
+        return true;
+    }
+
+    DatagramTxQueue& tx_queue_of(int fd) {
+        return fd == quic_fd ? quic_tx : udp_tx;
+    }
+
+    // True for every tx_saturate_every-th reply, for which the socket then
+    // acts full until the next EPOLLOUT
+    bool saturate_tx(DatagramTxQueue& queue) {
+        if (config.tx_saturate_every <= 0 || ++tx_saturate_count % config.tx_saturate_every != 0) return false;
+        tx_saturations++;
+        queue.block();
+        return true;
+    }
+
+    // Sends a UDP or QUIC reply, or queues it behind earlier ones while the
+    // socket is full. Returns false if it was dropped.
+    bool send_datagram(int fd, const struct sockaddr_in& addr, const char* data, size_t length) {
+        DatagramTxQueue& queue = tx_queue_of(fd);
+        saturate_tx(queue);
+        echo_syscalls++;
+        return queue.send(fd, addr, data, length, journal_now_ns());
+    }
+
+    // Sends a batch of replies with one sendmmsg; those the socket does not
+    // take, and all of them while replies are queued, go through the queue
+    void send_batch(int fd, DatagramBatch& batch) {
+        DatagramTxQueue& queue = tx_queue_of(fd);
+        int count = batch.count;
+        int direct = 0;
+        while (direct < count && !queue.wants_out() && !saturate_tx(queue)) direct++;
+        batch.count = direct;
+        int sent = direct > 0 ? batch.flush(fd) : 0;
+        uint64_t now = journal_now_ns();
+        for (int i = sent; i < count; i++) {
+            queue.send(fd, batch.addrs[i], batch.buffers[i], batch.iovecs[i].iov_len, now);
+        }
+        batch.count = 0;
+    }
+
+    // Waits for EPOLLOUT on a datagram socket only while its queue needs it
+    void watch_tx(int fd, DatagramTxQueue& queue) {
+        if (fd == -1 || queue.wants_out() == queue.out_armed) return;
+        queue.out_armed = queue.wants_out();
+        struct epoll_event ev;
+        ev.events = EPOLLIN | (queue.out_armed ? (uint32_t)EPOLLOUT : 0u);
+        ev.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+    }
+
+    // Compressed TCP carries [u32 length][LZ block] frames both ways. Each
+    // block is decoded and recorded as plain text, and its echo is
+    // compressed again. Stream mode uses the connection's own codec pair, so
+    // history builds up in both directions.
+    void handle_compressed_tcp(int client_fd) {
+        CompressedConnection& connection = compressed_connections[client_fd];
+        if (config.compression == "stream" && !connection.encoder) {
+            connection.encoder.reset(new LzEncoder(dictionary, LzMode::Stream, config.compression_level));
+            connection.decoder.reset(new LzDecoder(dictionary, LzMode::Stream));
+        }
+        LzEncoder& encoder = connection.encoder ? *connection.encoder : *message_encoder;
+        LzDecoder& decoder = connection.decoder ? *connection.decoder : *message_decoder;
+
+        char buffer[BUFFER_SIZE * 16];
+        ssize_t bytes_read;
+        while ((bytes_read = read(client_fd, buffer, sizeof(buffer))) > 0) {
+            connection.in.append(buffer, bytes_read);
+            std::string out;
+            bool valid = consume_frames(connection.in, MAX_FRAME_SIZE, [&](char* block, uint32_t length) {
+                if (!decode_payload(decoder, block, length)) return false;
+                uint64_t sequence = record_inbound(JOURNAL_TCP, client_fd, peer_of(client_fd),
+                                                   codec_plain.data(), codec_plain.size());
+                encode_payload(encoder);
+                size_t frame_start = out.size();
+                append_frame(out, codec_block.data(), codec_block.size());
+                if (defer_reply(sequence, client_fd, nullptr, out.data() + frame_start, out.size() - frame_start)) {
+                    out.resize(frame_start);
                 }
-            } else if (bytes_read == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-                // No more packets to read
-                break;
-            } else if (bytes_read == -1) {
-                perror("UDP recvfrom");
-                break;
+                return true;
+            });
+            if (!valid) {
+                close_client(client_fd);
+                return;
+            }
+
+            // Echo back the data
+            if (!send_stream(client_fd, out.data(), out.size())) {
+                close_client(client_fd);
+                return;
             }
         }
+
+        if (bytes_read == 0) {
+            close_client(client_fd);
+        } else if (bytes_read == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            close_client(client_fd);
+        }
     }
 
-    void handle_quic_connection() {
-        char buffer[BUFFER_SIZE];
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
-        
-        while (true) {
-            ssize_t bytes_received = recvfrom(quic_fd, buffer, BUFFER_SIZE - 1, 0,
-                                            (struct sockaddr*)&client_addr, &client_len);
-            if (bytes_received == -1) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                    break;  // No more data
+    // FIX order entry: parses every complete message in the stream and
+    // answers in the same write. Each reply goes through defer_reply, so
+    // under group commit an ExecutionReport waits until its order is
+    // durable and later replies queue behind it. NewOrderSingle rests in the order book (as a
+    // MARKET_NEW_ORDER through record_inbound, so it is journaled and
+    // replicated like binary orders) and gets an ExecutionReport; an
+    // OrderCancelRequest takes it out again (MARKET_CANCEL), and a
+    // MarketDataRequest is answered with the book's top. A message
+    // with a bad checksum is dropped, as FIX prescribes; one that cannot be
+    // framed closes the session.
+    void handle_fix_client(int client_fd) {
+        FixSession& session = fix_sessions[client_fd];
+        char buffer[BUFFER_SIZE * 16];
+        ssize_t bytes_read;
+        while ((bytes_read = read(client_fd, buffer, sizeof(buffer))) > 0) {
+            session.in.append(buffer, bytes_read);
+            std::string out;
+            size_t offset = 0;
+            bool valid = true;
+            while (offset < session.in.size()) {
+                size_t consumed;
+                uint64_t start = journal_now_ns();
+                FixStatus status = fix_parse(session.in.data() + offset, session.in.size() - offset,
+                                             fix_message, consumed, fix_scan);
+                fix_parse_ns += journal_now_ns() - start;
+                if (status == FixStatus::Incomplete) break;
+                if (status == FixStatus::Malformed) {
+                    valid = false;
+                    break;
                 }
-                perror("QUIC recvfrom");
-                break;
-            }
-            
-            if (bytes_received > 0) {
-                buffer[bytes_received] = '\0';
-                
-                // Basic QUIC packet handling - extract connection ID from first 4 bytes
-                uint32_t connection_id = 0;
-                if (bytes_received >= 4) {
-                    memcpy(&connection_id, buffer, sizeof(uint32_t));
-                    connection_id = ntohl(connection_id);
+                offset += consumed;
+                if (status == FixStatus::BadChecksum) {
+                    fix_checksum_errors++;
+                    continue;
                 }
-                
-                // Track or update connection
-                auto it = quic_connections_map.find(connection_id);
-                if (it == quic_connections_map.end()) {
-                    // New connection
-                    quic_connections_map.emplace(connection_id, QuicConnection(connection_id, client_addr));
-                    quic_connections++;
-                    if (quic_connections % 100 == 0) {
-                        std::cout << "QUIC connections: " << quic_connections << std::endl;
-                    }
-                } else {
-                    // Update existing connection
-                    it->second.last_activity = std::chrono::steady_clock::now();
+                fix_messages++;
+                size_t reply_start = out.size();
+                uint64_t sequence = handle_fix_message(client_fd, session, out);
+                if (out.size() > reply_start &&
+                    defer_reply(sequence, client_fd, nullptr, out.data() + reply_start, out.size() - reply_start)) {
+                    out.resize(reply_start);
                 }
-                
-                // Echo response with QUIC header
-                char response[BUFFER_SIZE];
-                memcpy(response, &connection_id, sizeof(uint32_t));
-                memcpy(response + sizeof(uint32_t), "QUIC Echo: ", 11);
-                memcpy(response + sizeof(uint32_t) + 11, buffer + sizeof(uint32_t), 
-                       std::min((size_t)(bytes_received - sizeof(uint32_t)), 
-                               (size_t)(BUFFER_SIZE - sizeof(uint32_t) - 11)));
-                
-                ssize_t response_size = sizeof(uint32_t) + 11 + (bytes_received - sizeof(uint32_t));
-                sendto(quic_fd, response, response_size, 0,
-                       (struct sockaddr*)&client_addr, client_len);
             }
+            session.in.erase(0, offset);
+
+            if (!send_stream(client_fd, out.data(), out.size())) {
+                close_client(client_fd);
+                return;
+            }
+            if (!valid || session.in.size() > FIX_MAX_MESSAGE) {
+                close_client(client_fd);
+                return;
+            }
+        }
+
+        if (bytes_read == 0 || (bytes_read == -1 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            close_client(client_fd);
         }
     }
 
-    void close_client(int client_fd) {
-        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_fd, nullptr);
-        close(client_fd);
-        tcp_connections--;
+    // Header of a reply to fix_message: CompIDs swapped, our own sequence
+    void start_fix_reply(FixSession& session, const char* msg_type) {
+        fix_builder.start(msg_type);
+        const FixField* sender = fix_message.get(FIX_TARGET_COMP_ID);
+        const FixField* target = fix_message.get(FIX_SENDER_COMP_ID);
+        fix_builder.add(FIX_SENDER_COMP_ID, sender ? sender->data : "SERVER", sender ? sender->length : 6);
+        fix_builder.add(FIX_TARGET_COMP_ID, target ? target->data : "CLIENT", target ? target->length : 6);
+        fix_builder.add_int(FIX_MSG_SEQ_NUM, session.next_out_sequence++);
+        fix_builder.add(FIX_SENDING_TIME, fix_timestamp());
     }
 
-    void cleanup() {
-        if (tcp_fd != -1) close(tcp_fd);
-        if (udp_fd != -1) close(udp_fd);
-        if (quic_fd != -1) close(quic_fd);
-        if (epoll_fd != -1) close(epoll_fd);
+    // UTC time as FIX's YYYYMMDD-HH:MM:SS, formatted once per second
+    const char* fix_timestamp() {
+        static char text[32];
+        static time_t formatted = 0;
+        time_t now = time(nullptr);
+        if (now != formatted) {
+            struct tm utc;
+            gmtime_r(&now, &utc);
+            strftime(text, sizeof(text), "%Y%m%d-%H:%M:%S", &utc);
+            formatted = now;
+        }
+        return text;
+    }
+
+    void reject_fix_message(FixSession& session, int reason, int tag, const char* text, std::string& out) {
+        fix_rejects++;
+        int64_t sequence = 0;
+        fix_message.get_int(FIX_MSG_SEQ_NUM, sequence);
+        start_fix_reply(session, "3");
+        fix_builder.add_int(FIX_REF_SEQ_NUM, sequence);
+        if (tag) fix_builder.add_int(FIX_REF_TAG_ID, tag);
+        fix_builder.add_int(FIX_SESSION_REJECT_REASON, reason);
+        fix_builder.add(FIX_TEXT, text);
+        fix_builder.finish(out);
+    }
+
+    // Appends the reply, if any, to out. Returns the journal sequence of the
+    // input the message was recorded as, 0 if none.
+    uint64_t handle_fix_message(int client_fd, FixSession& session, std::string& out) {
+        const FixField* type = fix_message.get(FIX_MSG_TYPE);
+        if (type->length == 1 && type->data[0] == 'D') {
+            return handle_new_order_single(client_fd, session, out);
+        } else if (fix_message.equals(FIX_MSG_TYPE, "F")) {
+            return handle_order_cancel_request(client_fd, session, out);
+        } else if (fix_message.equals(FIX_MSG_TYPE, "V")) {
+            handle_market_data_request(session, out);
+        } else if (fix_message.equals(FIX_MSG_TYPE, "A")) {
+            start_fix_reply(session, "A");
+            fix_builder.add(FIX_ENCRYPT_METHOD, "0");
+            const FixField* interval = fix_message.get(FIX_HEART_BT_INT);
+            fix_builder.add(FIX_HEART_BT_INT, interval ? interval->data : "30", interval ? interval->length : 2);
+            fix_builder.finish(out);
+        } else if (fix_message.equals(FIX_MSG_TYPE, "1")) {
+            start_fix_reply(session, "0");
+            const FixField* id = fix_message.get(FIX_TEST_REQ_ID);
+            if (id) fix_builder.add(FIX_TEST_REQ_ID, *id);
+            fix_builder.finish(out);
+        } else if (fix_message.equals(FIX_MSG_TYPE, "5")) {
+            start_fix_reply(session, "5");
+            fix_builder.finish(out);
+        } else if (!fix_message.equals(FIX_MSG_TYPE, "0")) {
+            reject_fix_message(session, FIX_REJECT_INVALID_MSG_TYPE, FIX_MSG_TYPE, "Unsupported MsgType", out);
+        }
+        return 0;
+    }
+
+    // Market (40=1) and limit (40=2) orders rest in the book; any other
+    // OrdType gets an ExecutionReport with ExecType Rejected
+    uint64_t handle_new_order_single(int client_fd, FixSession& session, std::string& out) {
+        static const int required[] = {FIX_CL_ORD_ID, FIX_SYMBOL, FIX_SIDE, FIX_ORDER_QTY, FIX_ORD_TYPE};
+        for (int tag : required) {
+            if (!fix_message.get(tag)) {
+                reject_fix_message(session, FIX_REJECT_REQUIRED_TAG_MISSING, tag, "Required tag missing", out);
+                return 0;
+            }
+        }
+        int64_t quantity = 0, price = 0;
+        bool limit = fix_message.equals(FIX_ORD_TYPE, "2");
+        if (!fix_message.equals(FIX_SIDE, "1") && !fix_message.equals(FIX_SIDE, "2")) {
+            reject_fix_message(session, FIX_REJECT_VALUE_INCORRECT, FIX_SIDE, "Side must be 1 or 2", out);
+            return 0;
+        }
+        if (!fix_message.get_int(FIX_ORDER_QTY, quantity) || quantity <= 0 || quantity > UINT32_MAX) {
+            reject_fix_message(session, FIX_REJECT_VALUE_INCORRECT, FIX_ORDER_QTY, "Bad OrderQty", out);
+            return 0;
+        }
+        if (!limit && !fix_message.equals(FIX_ORD_TYPE, "1")) {
+            reject_fix_order(session, quantity, "Unsupported OrdType", out);
+            return 0;
+        }
+        if (limit && !fix_message.get_price(FIX_PRICE, price)) {
+            reject_fix_message(session, FIX_REJECT_REQUIRED_TAG_MISSING, FIX_PRICE, "Limit order needs Price", out);
+            return 0;
+        }
+
+        const FixField* symbol = fix_message.get(FIX_SYMBOL);
+        uint64_t order_id = ++fix_next_order_id;  // Past every order the books have seen
+        MarketMessage order;
+        memset(&order, 0, sizeof(order));
+        order.magic = MARKET_MAGIC;
+        order.type = MARKET_NEW_ORDER;
+        order.side = fix_message.equals(FIX_SIDE, "1") ? SIDE_BUY : SIDE_SELL;
+        order.symbol = fix_symbol_id(*symbol);
+        order.order_id = order_id;
+        order.price = price;
+        order.quantity = (uint32_t)quantity;
+        uint64_t sequence = record_inbound(JOURNAL_TCP, client_fd, peer_of(client_fd), (const char*)&order, sizeof(order));
+        fix_orders++;
+        session.orders.emplace(order_id, order.symbol);
+        if (session.orders.size() >= session.orders_sweep_at) sweep_fix_orders(session);
+
+        start_fix_reply(session, "8");
+        fix_builder.add_int(FIX_ORDER_ID, order_id);
+        fix_builder.add(FIX_CL_ORD_ID, *fix_message.get(FIX_CL_ORD_ID));
+        fix_builder.add_int(FIX_EXEC_ID, ++fix_next_exec_id);
+        fix_builder.add(FIX_EXEC_TYPE, "0");
+        fix_builder.add(FIX_ORD_STATUS, "0");
+        fix_builder.add(FIX_SYMBOL, *symbol);
+        fix_builder.add(FIX_SIDE, *fix_message.get(FIX_SIDE));
+        fix_builder.add_int(FIX_ORDER_QTY, quantity);
+        if (limit) fix_builder.add_price(FIX_PRICE, price);
+        fix_builder.add_int(FIX_LEAVES_QTY, quantity);
+        fix_builder.add(FIX_CUM_QTY, "0");
+        fix_builder.add(FIX_AVG_PX, "0");
+        fix_builder.finish(out);
+        return sequence;
+    }
+
+    // An order refused at the application level: ExecutionReport with
+    // ExecType and OrdStatus Rejected, nothing recorded
+    void reject_fix_order(FixSession& session, int64_t quantity, const char* text, std::string& out) {
+        fix_order_rejects++;
+        start_fix_reply(session, "8");
+        fix_builder.add(FIX_ORDER_ID, "NONE");
+        fix_builder.add(FIX_CL_ORD_ID, *fix_message.get(FIX_CL_ORD_ID));
+        fix_builder.add_int(FIX_EXEC_ID, ++fix_next_exec_id);
+        fix_builder.add(FIX_EXEC_TYPE, "8");
+        fix_builder.add(FIX_ORD_STATUS, "8");
+        fix_builder.add(FIX_SYMBOL, *fix_message.get(FIX_SYMBOL));
+        fix_builder.add(FIX_SIDE, *fix_message.get(FIX_SIDE));
+        fix_builder.add_int(FIX_ORDER_QTY, quantity);
+        fix_builder.add(FIX_LEAVES_QTY, "0");
+        fix_builder.add(FIX_CUM_QTY, "0");
+        fix_builder.add(FIX_AVG_PX, "0");
+        fix_builder.add_int(FIX_ORD_REJ_REASON, FIX_ORD_REJ_UNSUPPORTED_ORDER_CHARACTERISTIC);
+        fix_builder.add(FIX_TEXT, text);
+        fix_builder.finish(out);
+    }
+
+    // Symbols map to book IDs by FNV-1a; colliding names share a book
+    static uint16_t fix_symbol_id(const FixField& symbol) {
+        uint32_t hash = 2166136261u;
+        for (uint32_t i = 0; i < symbol.length; i++) hash = (hash ^ (uint8_t)symbol.data[i]) * 16777619u;
+        return (uint16_t)(hash ^ (hash >> 16));
+    }
+
+    const OrderBook* fix_book(uint16_t symbol) const {
+        const MarketPartition& partition = partitions[symbol % partitions.size()];
+        auto it = partition.books.find(symbol);
+        return it == partition.books.end() ? nullptr : &it->second;
+    }
+
+    // Drops the session's orders that no book holds any more (filled or
+    // cancelled), so the record only grows with what still rests
+    void sweep_fix_orders(FixSession& session) {
+        for (auto it = session.orders.begin(); it != session.orders.end();) {
+            const OrderBook* book = fix_book(it->second);
+            if (book && book->orders.count(it->first)) ++it;
+            else it = session.orders.erase(it);
+        }
+        session.orders_sweep_at = std::max(FIX_ORDER_SWEEP_MIN, session.orders.size() * 2);
+    }
+
+    void reject_fix_cancel(FixSession& session, const char* reason, const char* text, std::string& out) {
+        fix_cancel_rejects++;
+        start_fix_reply(session, "9");
+        fix_builder.add(FIX_ORDER_ID, "NONE");
+        fix_builder.add(FIX_CL_ORD_ID, *fix_message.get(FIX_CL_ORD_ID));
+        fix_builder.add(FIX_ORIG_CL_ORD_ID, *fix_message.get(FIX_ORIG_CL_ORD_ID));
+        fix_builder.add(FIX_ORD_STATUS, "8");
+        fix_builder.add(FIX_CXL_REJ_RESPONSE_TO, "1");
+        fix_builder.add(FIX_CXL_REJ_REASON, reason);
+        fix_builder.add(FIX_TEXT, text);
+        fix_builder.finish(out);
+    }
+
+    // The order is named by OrderID (37): the server keeps no index of
+    // ClOrdIDs, and the book is what knows whether it is still resting. One
+    // that is not, or that another session placed, is unknown here; one whose
+    // Side differs is refused too. Both get an OrderCancelReject. Returns the
+    // journal sequence of the cancel, 0 if none was recorded.
+    uint64_t handle_order_cancel_request(int client_fd, FixSession& session, std::string& out) {
+        static const int required[] = {FIX_CL_ORD_ID, FIX_ORIG_CL_ORD_ID, FIX_SYMBOL, FIX_SIDE};
+        for (int tag : required) {
+            if (!fix_message.get(tag)) {
+                reject_fix_message(session, FIX_REJECT_REQUIRED_TAG_MISSING, tag, "Required tag missing", out);
+                return 0;
+            }
+        }
+        const FixField* symbol = fix_message.get(FIX_SYMBOL);
+        uint16_t symbol_id = fix_symbol_id(*symbol);
+        int64_t order_id = 0;
+        const OrderBook* book = fix_book(symbol_id);
+        const RestingOrder* resting = nullptr;
+        if (book && fix_message.get_int(FIX_ORDER_ID, order_id) && session.orders.count((uint64_t)order_id)) {
+            auto it = book->orders.find((uint64_t)order_id);
+            if (it != book->orders.end()) resting = &it->second;
+        }
+        if (!resting) {
+            reject_fix_cancel(session, "1", "Unknown order", out);
+            return 0;
+        }
+        if (!fix_message.equals(FIX_SIDE, resting->side == SIDE_BUY ? "1" : "2")) {
+            reject_fix_cancel(session, "99", "Side does not match order", out);
+            return 0;
+        }
+
+        MarketMessage cancel;
+        memset(&cancel, 0, sizeof(cancel));
+        cancel.magic = MARKET_MAGIC;
+        cancel.type = MARKET_CANCEL;
+        cancel.side = resting->side;
+        cancel.symbol = symbol_id;
+        cancel.order_id = (uint64_t)order_id;
+        session.orders.erase((uint64_t)order_id);
+        uint64_t sequence = record_inbound(JOURNAL_TCP, client_fd, peer_of(client_fd), (const char*)&cancel, sizeof(cancel));
+        fix_cancels++;
+
+        start_fix_reply(session, "8");
+        fix_builder.add_int(FIX_ORDER_ID, order_id);
+        fix_builder.add(FIX_CL_ORD_ID, *fix_message.get(FIX_CL_ORD_ID));
+        fix_builder.add(FIX_ORIG_CL_ORD_ID, *fix_message.get(FIX_ORIG_CL_ORD_ID));
+        fix_builder.add_int(FIX_EXEC_ID, ++fix_next_exec_id);
+        fix_builder.add(FIX_EXEC_TYPE, "4");
+        fix_builder.add(FIX_ORD_STATUS, "4");
+        fix_builder.add(FIX_SYMBOL, *symbol);
+        fix_builder.add(FIX_SIDE, *fix_message.get(FIX_SIDE));
+        fix_builder.add(FIX_LEAVES_QTY, "0");
+        fix_builder.add(FIX_CUM_QTY, "0");
+        fix_builder.add(FIX_AVG_PX, "0");
+        fix_builder.finish(out);
+        return sequence;
+    }
+
+    // One symbol per request (the parser keeps no repeating groups), answered
+    // with a MarketDataSnapshotFullRefresh of the best bid and offer. Snapshot
+    // and subscribe (263=0, 1) are answered alike: the book is not streamed.
+    void handle_market_data_request(FixSession& session, std::string& out) {
+        static const int required[] = {FIX_MD_REQ_ID, FIX_SUBSCRIPTION_REQUEST_TYPE, FIX_SYMBOL};
+        for (int tag : required) {
+            if (!fix_message.get(tag)) {
+                reject_fix_message(session, FIX_REJECT_REQUIRED_TAG_MISSING, tag, "Required tag missing", out);
+                return;
+            }
+        }
+        fix_md_requests++;
+        const FixField* symbol = fix_message.get(FIX_SYMBOL);
+        const OrderBook* book = fix_book(fix_symbol_id(*symbol));
+        bool bid = book && !book->bids.empty();
+        bool offer = book && !book->asks.empty();
+
+        start_fix_reply(session, "W");
+        fix_builder.add(FIX_MD_REQ_ID, *fix_message.get(FIX_MD_REQ_ID));
+        fix_builder.add(FIX_SYMBOL, *symbol);
+        fix_builder.add_int(FIX_NO_MD_ENTRIES, (int)bid + (int)offer);
+        if (bid) {
+            fix_builder.add(FIX_MD_ENTRY_TYPE, "0");
+            fix_builder.add_price(FIX_MD_ENTRY_PX, book->bids.begin()->first);
+            fix_builder.add_int(FIX_MD_ENTRY_SIZE, book->bids.begin()->second);
+        }
+        if (offer) {
+            fix_builder.add(FIX_MD_ENTRY_TYPE, "1");
+            fix_builder.add_price(FIX_MD_ENTRY_PX, book->asks.begin()->first);
+            fix_builder.add_int(FIX_MD_ENTRY_SIZE, book->asks.begin()->second);
+        }
+        fix_builder.finish(out);
+    }
+
+    void handle_ws_connection() {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int client_fd;
+        while ((client_fd = accept4(ws_fd, (struct sockaddr*)&client_addr, &client_len, SOCK_NONBLOCK)) != -1) {
+            struct epoll_event ev;
+            ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+            ev.data.fd = client_fd;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) == -1) {
+                perror("epoll_ctl WebSocket client");
+                close(client_fd);
+                continue;
+            }
+            tcp_peers[client_fd] = client_addr;
+            ws_connections[client_fd];
+            client_len = sizeof(client_addr);
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            perror("accept WebSocket");
+        }
+    }
+
+    void handle_ws_client(int client_fd, uint32_t event_mask) {
+        WsConnection& connection = ws_connections[client_fd];
+        if ((event_mask & EPOLLOUT) && !flush_ws(client_fd, connection)) {
+            close_ws(client_fd);
+            return;
+        }
+        if (event_mask & (EPOLLERR | EPOLLHUP)) {
+            close_ws(client_fd);
+            return;
+        }
+
+        char buffer[BUFFER_SIZE * 16];
+        ssize_t bytes_read;
+        while ((bytes_read = read(client_fd, buffer, sizeof(buffer))) > 0) {
+            connection.in.append(buffer, bytes_read);
+            if (!process_ws_input(client_fd, connection)) {
+                close_ws(client_fd);
+                return;
+            }
+        }
+        if (bytes_read == 0 || (bytes_read == -1 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            close_ws(client_fd);
+        }
+    }
+
+    // Answers the Upgrade, then unmasks and handles every complete frame.
+    // Data messages are recorded like TCP input and echoed in one frame
+    // each. Returns false when the connection should close.
+    bool process_ws_input(int client_fd, WsConnection& connection) {
+        if (!connection.upgraded) {
+            size_t head_end = connection.in.find("\r\n\r\n");
+            if (head_end == std::string::npos) {
+                return connection.in.size() <= WS_MAX_HANDSHAKE;
+            }
+            std::string response, path;
+            if (!ws_handshake(connection.in.substr(0, head_end + 4), response, path)) {
+                ws_handshake_failures++;
+                static const char bad_request[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n";
+                if (write(client_fd, bad_request, sizeof(bad_request) - 1) == -1) {}
+                return false;
+            }
+            connection.upgraded = true;
+            connection.in.erase(0, head_end + 4);
+            if (path == WS_FEED_PATH) {
+                connection.feed = true;
+                ws_feed.push_back(client_fd);
+                int opt = 1;
+                setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+            }
+            if (!send_ws(client_fd, connection, response.data(), response.size())) return false;
+        }
+
+        std::string out;
+        size_t offset = 0;
+        bool open = true;
+        while (open) {
+            WsFrame frame;
+            size_t consumed;
+            WsStatus status = ws_parse_frame(connection.in.data() + offset, connection.in.size() - offset,
+                                             frame, consumed);
+            if (status == WsStatus::Incomplete) break;
+            if (status == WsStatus::Malformed || !frame.masked) return false;  // Clients must mask
+
+            char* payload = &connection.in[offset + frame.header_length];
+            size_t length = frame.payload_length;
+            ws_mask(payload, length, frame.key, ws_unmask);
+            ws_unmasked_bytes += length;
+            offset += consumed;
+
+            switch (frame.opcode) {
+                case WS_TEXT:
+                case WS_BINARY:
+                    if (connection.message_opcode) return false;  // Interleaved with a fragmented message
+                    if (frame.fin) {
+                        handle_ws_message(client_fd, frame.opcode, payload, length, out);
+                    } else {
+                        connection.message_opcode = frame.opcode;
+                        connection.message.assign(payload, length);
+                    }
+                    break;
+                case WS_CONTINUATION:
+                    if (!connection.message_opcode ||
+                        connection.message.size() + length > WS_MAX_PAYLOAD) return false;
+                    connection.message.append(payload, length);
+                    if (frame.fin) {
+                        handle_ws_message(client_fd, connection.message_opcode, connection.message.data(),
+                                          connection.message.size(), out);
+                        connection.message_opcode = 0;
+                        connection.message.clear();
+                    }
+                    break;
+                case WS_PING:
+                    ws_append_frame(out, WS_PONG, payload, length);
+                    break;
+                case WS_CLOSE:
+                    ws_append_frame(out, WS_CLOSE, payload, std::min<size_t>(length, 2));  // Echo the status code
+                    open = false;
+                    break;
+                default:
+                    break;
+            }
+        }
+        connection.in.erase(0, offset);
+
+        if (!out.empty() && !send_ws(client_fd, connection, out.data(), out.size())) return false;
+        return open;
+    }
+
+    void handle_ws_message(int client_fd, uint8_t opcode, const char* data, size_t length, std::string& out) {
+        ws_messages++;
+        record_inbound(JOURNAL_TCP, client_fd, peer_of(client_fd), data, length);
+        ws_append_frame(out, opcode, data, length);
+    }
+
+    // Writes straight from data when nothing is queued ahead of it, and
+    // queues the rest as a shared block: a broadcast block is never copied
+    // per connection. Returns false when the connection failed or fell more
+    // than SUBSCRIBER_BUFFER_LIMIT behind.
+    bool send_ws(int client_fd, WsConnection& connection, const std::shared_ptr<const std::string>& block) {
+        size_t offset = 0;
+        if (connection.out.empty()) {
+            ssize_t written = write(client_fd, block->data(), block->size());
+            ws_writes++;
+            if (written == -1) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+                written = 0;
+            }
+            offset = written;
+            if (offset == block->size()) return true;
+        }
+        connection.out.push_back(WsChunk{block, offset});
+        connection.queued += block->size() - offset;
+        if (connection.queued > SUBSCRIBER_BUFFER_LIMIT) return false;
+        if (!connection.out_armed) {
+            connection.out_armed = true;
+            rearm_ws(client_fd, connection);
+        }
+        return true;
+    }
+
+    bool send_ws(int client_fd, WsConnection& connection, const char* data, size_t length) {
+        size_t offset = 0;
+        if (connection.out.empty()) {
+            ssize_t written = write(client_fd, data, length);
+            ws_writes++;
+            if (written == -1) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+                written = 0;
+            }
+            offset = written;
+            if (offset == length) return true;
+        }
+        return send_ws(client_fd, connection, std::make_shared<const std::string>(data + offset, length - offset));
+    }
+
+    void rearm_ws(int client_fd, const WsConnection& connection) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP | (connection.out_armed ? (uint32_t)EPOLLOUT : 0u);
+        ev.data.fd = client_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client_fd, &ev);
+    }
+
+    // Writes queued output, up to IOV_MAX_BATCH chunks per writev
+    bool flush_ws(int client_fd, WsConnection& connection) {
+        const int IOV_MAX_BATCH = 16;
+        while (!connection.out.empty()) {
+            struct iovec iov[IOV_MAX_BATCH];
+            int count = 0;
+            for (auto it = connection.out.begin(); it != connection.out.end() && count < IOV_MAX_BATCH; ++it) {
+                iov[count].iov_base = const_cast<char*>(it->data->data()) + it->offset;
+                iov[count].iov_len = it->data->size() - it->offset;
+                count++;
+            }
+            ssize_t written = writev(client_fd, iov, count);
+            ws_writes++;
+            if (written == -1) {
+                return errno == EAGAIN || errno == EWOULDBLOCK;
+            }
+            connection.queued -= written;
+            while (written > 0) {
+                WsChunk& chunk = connection.out.front();
+                size_t left = chunk.data->size() - chunk.offset;
+                if ((size_t)written < left) {
+                    chunk.offset += written;
+                    break;
+                }
+                written -= left;
+                connection.out.pop_front();
+            }
+        }
+        connection.out_armed = false;
+        rearm_ws(client_fd, connection);
+        return true;
+    }
+
+    // Sends this wakeup's broadcast frames to every feed connection
+    void flush_ws_broadcast() {
+        std::shared_ptr<const std::string> block = std::move(ws_broadcast);
+        ws_broadcast.reset();
+        ws_broadcast_blocks++;
+        std::vector<int> failed;
+        for (int fd : ws_feed) {
+            if (!send_ws(fd, ws_connections[fd], block)) failed.push_back(fd);
+        }
+        for (int fd : failed) {
+            ws_feed_disconnects++;
+            close_ws(fd);
+        }
+    }
+
+    void close_ws(int client_fd) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_fd, nullptr);
+        close(client_fd);
+        tcp_peers.erase(client_fd);
+        auto it = ws_connections.find(client_fd);
+        if (it != ws_connections.end() && it->second.feed) {
+            ws_feed.erase(std::find(ws_feed.begin(), ws_feed.end(), client_fd));
+        }
+        ws_connections.erase(client_fd);
+    }
+
+    // Decodes one block into codec_plain, counting bytes and time
+    bool decode_payload(LzDecoder& decoder, const char* block, size_t length) {
+        uint64_t start = journal_now_ns();
+        codec_plain.clear();
+        bool ok = decoder.decompress(block, length, codec_plain);
+        decompress_ns += journal_now_ns() - start;
+        if (!ok) {
+            compression_errors++;
+            return false;
+        }
+        compressed_messages++;
+        wire_bytes += length;
+        plain_bytes += codec_plain.size();
+        return true;
+    }
+
+    // Compresses codec_plain into codec_block
+    void encode_payload(LzEncoder& encoder) {
+        uint64_t start = journal_now_ns();
+        codec_block.clear();
+        encoder.compress(codec_plain.data(), codec_plain.size(), codec_block);
+        compress_ns += journal_now_ns() - start;
+        wire_bytes += codec_block.size();
+        plain_bytes += codec_plain.size();
+    }
+
+    // A compressed datagram is one LZ block against the dictionary. Loss and
+    // reordering rule out shared history, so UDP always uses message mode.
+    void handle_compressed_datagram(const char* block, size_t length, const struct sockaddr_in& client_addr) {
+        if (!decode_payload(*message_decoder, block, length)) return;
+        uint64_t sequence = record_inbound(JOURNAL_UDP, 0, &client_addr, codec_plain.data(), codec_plain.size());
+        encode_payload(*message_encoder);
+        if (defer_reply(sequence, udp_fd, &client_addr, codec_block.data(), codec_block.size())) {
+            return;
+        }
+        if (send_datagram(udp_fd, client_addr, codec_block.data(), codec_block.size())) {
+            udp_packets++;
+        }
+    }
+
+    void handle_udp_packet() {
+        // Drain the socket a batch of datagrams per syscall to handle high load
+        uint64_t now = journal_now_ns();
+        while (true) {
+            udp_batch.count = 0;
+            int received = udp_batch.receive(udp_fd);
+            echo_syscalls++;
+            if (received == 0) break;
+
+            for (int i = 0; i < received; i++) {
+                char* buffer = udp_batch.buffers[i];
+                ssize_t bytes_read = udp_batch.headers[i].msg_len;
+                struct sockaddr_in& client_addr = udp_batch.addrs[i];
+                uint32_t session_id;
+                if (is_log_datagram(buffer, bytes_read, session_id)) {
+                    handle_log_datagram(session_id, buffer, bytes_read, client_addr);
+                    continue;
+                }
+                if (!config.compression.empty()) {
+                    handle_compressed_datagram(buffer, bytes_read, client_addr);
+                    continue;
+                }
+                if (udp_packer) {
+                    handle_packed_datagram(*udp_packer, JOURNAL_UDP, buffer, bytes_read, client_addr, now);
+                    continue;
+                }
+
+                if (drop_datagram()) continue;
+                IdempotentHeader request;
+                bool idempotent = idempotency && parse_idempotent(buffer, bytes_read, request);
+                if (idempotent) {
+                    const IdempotencyCache::Entry* cached = nullptr;
+                    IdempotentLookup seen = idempotency->lookup(request, client_addr, cached);
+                    if (seen == IdempotentLookup::Stale) continue;
+                    if (seen == IdempotentLookup::Duplicate) {
+                        reply_from_cache(request, *cached, client_addr);
+                        continue;
+                    }
+                }
+                uint64_t sequence = record_inbound(JOURNAL_UDP, 0, &client_addr, buffer, bytes_read);
+                service_pause();
+                if (idempotent) {
+                    idempotency->store(request, client_addr, sequence, buffer + sizeof(request),
+                                       bytes_read - sizeof(request));
+                }
+                if (defer_reply(sequence, udp_fd, &client_addr, buffer, bytes_read)) {
+                    continue;
+                }
+
+                // Echo back the data
+                if (send_datagram(udp_fd, client_addr, buffer, bytes_read)) {
+                    udp_packets++;
+                    if (udp_packets % 1000 == 0) {
+                        std::cout << "UDP packets processed: " << udp_packets << std::endl;
+                    }
+                }
+            }
+        }
+
+        if (udp_packer) flush_packer(*udp_packer, udp_fd, journal_now_ns());
+
+        // Echo and send for every log session that heard from its peer
+        now = journal_now_ns();
+        for (LogSession* session : log_active) {
+            if (!pump_log_session(session, now)) {
+                log_sessions.erase(session->id);
+                delete session;
+            }
+        }
+        log_active.clear();
+    }
+
+    // A duplicate gets the original's response behind its own header, so
+    // the client can tell which transmission was answered. Under group
+    // commit it waits, like the original, until that input is durable.
+    void reply_from_cache(const IdempotentHeader& request, const IdempotencyCache::Entry& cached,
+                          const struct sockaddr_in& client_addr) {
+        cached_reply.assign((const char*)&request, sizeof(request));
+        cached_reply.append(cached.response);
+        if (defer_reply(cached.journal_sequence, udp_fd, &client_addr, cached_reply.data(), cached_reply.size())) {
+            return;
+        }
+        if (send_datagram(udp_fd, client_addr, cached_reply.data(), cached_reply.size())) {
+            udp_packets++;
+        }
+    }
+
+    // A new session ID opens a session while fewer than LOG_MAX_SESSIONS
+    // are open, counting only those that have heard from their peer within
+    // LOG_SESSION_IDLE_NS; otherwise the datagram is dropped.
+    void handle_log_datagram(uint32_t session_id, const char* data, size_t length,
+                             const struct sockaddr_in& peer) {
+        uint64_t now = journal_now_ns();
+        auto it = log_sessions.find(session_id);
+        LogSession* session = it == log_sessions.end() ? nullptr : it->second;
+        if (!session) {
+            if (log_sessions.size() >= LOG_MAX_SESSIONS) expire_log_sessions(now);
+            if (log_sessions.size() >= LOG_MAX_SESSIONS) {
+                log_sessions_refused++;
+                return;
+            }
+            session = new LogSession;
+            if (!session->init(session_id) || !start_log_timer()) {
+                delete session;
+                return;
+            }
+            session->peer = peer;
+            log_sessions[session_id] = session;
+        }
+
+        session->on_datagram(data, length, now);
+        if (std::find(log_active.begin(), log_active.end(), session) == log_active.end()) {
+            log_active.push_back(session);
+        }
+    }
+
+    // Echoes the messages the session's image has completed into its
+    // publication, stopping when the publication is out of window so back
+    // pressure reaches the peer, then sends whatever is due. Log messages go
+    // through record_inbound but are not held for group commit. Returns
+    // false when the peer sent a malformed frame and the session must go.
+    bool pump_log_session(LogSession* session, uint64_t now) {
+        session->image.poll([&](const char* message, uint32_t length) {
+            if (!session->publication.offer(message, length)) return false;
+            record_inbound(JOURNAL_UDP, 0, &session->peer, message, length);
+            log_messages++;
+            return true;
+        }, LOG_POLL_LIMIT);
+        if (session->image.broken) {
+            log_sessions_broken++;
+            return false;
+        }
+        session->send(udp_fd, &session->peer, now);
+        return true;
+    }
+
+    void expire_log_sessions(uint64_t now) {
+        for (auto it = log_sessions.begin(); it != log_sessions.end();) {
+            if (now - it->second->last_active_ns > LOG_SESSION_IDLE_NS) {
+                delete it->second;
+                it = log_sessions.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    bool start_log_timer() {
+        if (log_timer_fd != -1) return true;
+
+        log_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (log_timer_fd == -1) {
+            perror("timerfd_create");
+            return false;
+        }
+        struct itimerspec interval;
+        interval.it_interval.tv_sec = 0;
+        interval.it_interval.tv_nsec = LOG_TICK_US * 1000;
+        interval.it_value = interval.it_interval;
+        timerfd_settime(log_timer_fd, 0, &interval, nullptr);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = log_timer_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, log_timer_fd, &ev) == -1) {
+            perror("epoll_ctl log timer");
+            return false;
+        }
+        return true;
+    }
+
+    // Retransmits, status messages and heartbeats for every session, and
+    // expiry of sessions whose peer went quiet
+    void handle_log_timer() {
+        uint64_t expirations;
+        while (read(log_timer_fd, &expirations, sizeof(expirations)) > 0) {}
+
+        uint64_t now = journal_now_ns();
+        expire_log_sessions(now);
+        for (auto it = log_sessions.begin(); it != log_sessions.end();) {
+            if (pump_log_session(it->second, now)) {
+                ++it;
+                continue;
+            }
+            delete it->second;
+            it = log_sessions.erase(it);
+        }
+    }
+
+    void handle_quic_connection() {
+        if (config.quic_aead) {
+            handle_protected_quic();
+            return;
+        }
+        if (quic_packer) {
+            handle_packed_quic();
+            return;
+        }
+
+        char buffer[BUFFER_SIZE];
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        
+        while (true) {
+            ssize_t bytes_received = recvfrom(quic_fd, buffer, BUFFER_SIZE - 1, 0,
+                                            (struct sockaddr*)&client_addr, &client_len);
+            echo_syscalls++;
+            if (bytes_received == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;  // No more data
+                }
+                perror("QUIC recvfrom");
+                break;
+            }
+            
+            if (bytes_received > 0) {
+                buffer[bytes_received] = '\0';
+                
+                // Basic QUIC packet handling - extract connection ID from first 4 bytes
+                uint32_t connection_id = 0;
+                if (bytes_received >= 4) {
+                    memcpy(&connection_id, buffer, sizeof(uint32_t));
+                    connection_id = ntohl(connection_id);
+                }
+
+                if (drop_datagram()) continue;
+                uint64_t sequence = record_inbound(JOURNAL_QUIC, connection_id, &client_addr, buffer, bytes_received);
+                service_pause();
+                
+                // Echo response with QUIC header
+                char response[BUFFER_SIZE];
+                memcpy(response, &connection_id, sizeof(uint32_t));
+                memcpy(response + sizeof(uint32_t), "QUIC Echo: ", 11);
+                memcpy(response + sizeof(uint32_t) + 11, buffer + sizeof(uint32_t), 
+                       std::min((size_t)(bytes_received - sizeof(uint32_t)), 
+                               (size_t)(BUFFER_SIZE - sizeof(uint32_t) - 11)));
+                
+                ssize_t response_size = sizeof(uint32_t) + 11 + (bytes_received - sizeof(uint32_t));
+                if (defer_reply(sequence, quic_fd, &client_addr, response, response_size)) {
+                    continue;
+                }
+                send_datagram(quic_fd, client_addr, response, response_size);
+            }
+        }
+    }
+
+    // Packed QUIC: the datagram's channel is the connection ID, and every
+    // message in it is one QUIC payload
+    void handle_packed_quic() {
+        uint64_t now = journal_now_ns();
+        while (true) {
+            quic_batch.count = 0;
+            int received = quic_batch.receive(quic_fd);
+            echo_syscalls++;
+            if (received == 0) break;
+            for (int i = 0; i < received; i++) {
+                handle_packed_datagram(*quic_packer, JOURNAL_QUIC, quic_batch.buffers[i],
+                                       quic_batch.headers[i].msg_len, quic_batch.addrs[i], now);
+            }
+        }
+        flush_packer(*quic_packer, quic_fd, journal_now_ns());
+    }
+
+    // Echoes every message of a packed datagram into the packer, reading it
+    // in place in the receive slot
+    void handle_packed_datagram(DatagramPacker& packer, uint8_t protocol, const char* data, size_t length,
+                                const struct sockaddr_in& client_addr, uint64_t now) {
+        uint32_t channel;
+        if (!unpack_datagram(data, length, channel, pack_views)) {
+            pack_errors++;
+            return;
+        }
+        packed_datagrams_in++;
+        packed_messages_in += pack_views.size();
+
+        for (const PackedView& view : pack_views) {
+            record_inbound(protocol, channel, &client_addr, view.data, view.length);
+            if (protocol == JOURNAL_QUIC) {
+                char* reply = packer.reserve(client_addr, channel, view.length + 11, now);
+                if (!reply) {
+                    pack_errors++;
+                    continue;
+                }
+                memcpy(reply, "QUIC Echo: ", 11);
+                memcpy(reply + 11, view.data, view.length);
+            } else if (!packer.add(client_addr, channel, view.data, view.length, now)) {
+                pack_errors++;
+            } else {
+                udp_packets++;
+            }
+        }
+    }
+
+    // Sends what is full or due and re-arms the timer for whatever still waits
+    void flush_packer(DatagramPacker& packer, int fd, uint64_t now) {
+        uint64_t calls = packer.send_calls;
+        packer.flush(fd, now);
+        echo_syscalls += packer.send_calls - calls;
+        arm_pack_timer(now);
+    }
+
+    void arm_pack_timer(uint64_t now) {
+        uint64_t due = 0;
+        for (DatagramPacker* packer : {udp_packer.get(), quic_packer.get()}) {
+            uint64_t next = packer->next_deadline();
+            if (next && (!due || next < due)) due = next;
+        }
+        if (due == 0 || due == pack_timer_due) return;
+
+        struct itimerspec timer;
+        memset(&timer, 0, sizeof(timer));
+        uint64_t wait = due > now ? due - now : 1;
+        timer.it_value.tv_sec = wait / 1000000000ULL;
+        timer.it_value.tv_nsec = wait % 1000000000ULL;
+        timerfd_settime(pack_timer_fd, 0, &timer, nullptr);
+        echo_syscalls++;
+        pack_timer_due = due;
+    }
+
+    void handle_pack_timer() {
+        uint64_t expirations;
+        while (read(pack_timer_fd, &expirations, sizeof(expirations)) > 0) {}
+        echo_syscalls++;
+        pack_timer_due = 0;
+        uint64_t now = journal_now_ns();
+        flush_packer(*udp_packer, udp_fd, now);
+        flush_packer(*quic_packer, quic_fd, now);
+    }
+
+    // Protected QUIC, one batch per recvmmsg: open every packet, hand the
+    // plaintext to the normal echo path, then seal all replies back to back
+    // and send them with one sendmmsg. Open and seal time are measured per
+    // batch so the crypto cost per packet shows up in the stats.
+    void handle_protected_quic() {
+        QuicCryptoState* states[DATAGRAM_BATCH];
+        uint32_t wire_ids[DATAGRAM_BATCH];  // Connection IDs, network byte order
+        uint64_t sequences[DATAGRAM_BATCH];
+
+        while (true) {
+            quic_batch.count = 0;
+            int received = quic_batch.receive(quic_fd);
+            if (received == 0) break;
+
+            uint64_t open_start = journal_now_ns();
+            expire_quic_crypto(open_start);
+            for (int i = 0; i < received; i++) {
+                uint8_t* packet = (uint8_t*)quic_batch.buffers[i];
+                size_t length = quic_batch.headers[i].msg_len;
+                states[i] = nullptr;
+                if (length < QUIC_HEADER_SIZE + QUIC_TAG_SIZE) {
+                    quic_auth_failures++;
+                    continue;
+                }
+
+                // A new connection's keys are only kept once its first
+                // packet authenticates, so garbage leaves no state behind
+                uint32_t wire_id;
+                memcpy(&wire_id, packet + 1, sizeof(wire_id));
+                auto it = quic_crypto.find(wire_id);
+                QuicCryptoState fresh;
+                QuicCryptoState* state = &fresh;
+                if (it != quic_crypto.end()) {
+                    state = &it->second;
+                } else {
+                    quic_derive_keys(wire_id, fresh.keys);
+                    fresh.next_packet_number = quic_packet_number_floor;
+                }
+                uint32_t packet_number;
+                if (!quic_unprotect(state->keys.client, packet, length, packet_number)) {
+                    quic_auth_failures++;
+                    continue;
+                }
+                if (state == &fresh) it = quic_crypto.emplace(wire_id, fresh).first;
+                it->second.last_active_ns = open_start;
+                states[i] = &it->second;
+                quic_opened++;
+            }
+            quic_open_ns += journal_now_ns() - open_start;
+
+            // Rewrite each opened packet into the plain [connection ID][payload]
+            // layout in place, so journaling and replay see the same records
+            // as unprotected QUIC, and build the plaintext reply in its slot
+            quic_replies.count = 0;
+            for (int i = 0; i < received; i++) {
+                if (!states[i]) continue;
+                char* message = quic_batch.buffers[i] + QUIC_PN_OFFSET;
+                size_t length = quic_batch.headers[i].msg_len - QUIC_PN_OFFSET - QUIC_TAG_SIZE;
+                memcpy(message, quic_batch.buffers[i] + 1, sizeof(uint32_t));
+                uint32_t connection_id;
+                memcpy(&connection_id, message, sizeof(connection_id));
+                connection_id = ntohl(connection_id);
+
+                int r = quic_replies.count++;
+                states[r] = states[i];
+                memcpy(&wire_ids[r], message, sizeof(uint32_t));
+                sequences[r] = record_inbound(JOURNAL_QUIC, connection_id, &quic_batch.addrs[i], message, length);
+                quic_replies.addrs[r] = quic_batch.addrs[i];
+
+                char* reply = quic_replies.buffers[r] + QUIC_HEADER_SIZE;
+                size_t payload = std::min(length - sizeof(uint32_t),
+                                          DATAGRAM_SIZE - QUIC_HEADER_SIZE - QUIC_TAG_SIZE - 11);
+                memcpy(reply, "QUIC Echo: ", 11);
+                memcpy(reply + 11, message + sizeof(uint32_t), payload);
+                quic_replies.iovecs[r].iov_len = 11 + payload;
+            }
+
+            uint64_t seal_start = journal_now_ns();
+            for (int r = 0; r < quic_replies.count; r++) {
+                uint8_t* out = (uint8_t*)quic_replies.buffers[r];
+                quic_replies.iovecs[r].iov_len = quic_protect(
+                    states[r]->keys.server, wire_ids[r], states[r]->next_packet_number++,
+                    out + QUIC_HEADER_SIZE, quic_replies.iovecs[r].iov_len, out);
+            }
+            quic_seal_ns += journal_now_ns() - seal_start;
+            quic_sealed += quic_replies.count;
+
+            // Sealed replies still wait for group commit like the plain path;
+            // the rest go out together
+            int ready = 0;
+            for (int r = 0; r < quic_replies.count; r++) {
+                const char* out = quic_replies.buffers[r];
+                if (defer_reply(sequences[r], quic_fd, &quic_replies.addrs[r], out, quic_replies.iovecs[r].iov_len)) {
+                    continue;
+                }
+                if (ready != r) {
+                    memcpy(quic_replies.buffers[ready], out, quic_replies.iovecs[r].iov_len);
+                    quic_replies.iovecs[ready].iov_len = quic_replies.iovecs[r].iov_len;
+                    quic_replies.addrs[ready] = quic_replies.addrs[r];
+                }
+                ready++;
+            }
+            for (int r = 0; r < ready; r++) {
+                quic_replies.iovecs[r].iov_base = quic_replies.buffers[r];
+                memset(&quic_replies.headers[r].msg_hdr, 0, sizeof(quic_replies.headers[r].msg_hdr));
+                quic_replies.headers[r].msg_hdr.msg_name = &quic_replies.addrs[r];
+                quic_replies.headers[r].msg_hdr.msg_namelen = sizeof(quic_replies.addrs[r]);
+                quic_replies.headers[r].msg_hdr.msg_iov = &quic_replies.iovecs[r];
+                quic_replies.headers[r].msg_hdr.msg_iovlen = 1;
+            }
+            quic_replies.count = ready;
+            send_batch(quic_fd, quic_replies);
+        }
+    }
+
+    void expire_quic_crypto(uint64_t now) {
+        if (now - quic_crypto_swept_ns < QUIC_CRYPTO_SWEEP_NS) return;
+        quic_crypto_swept_ns = now;
+        for (auto it = quic_crypto.begin(); it != quic_crypto.end();) {
+            if (now - it->second.last_active_ns < QUIC_CRYPTO_IDLE_NS) {
+                ++it;
+                continue;
+            }
+            quic_packet_number_floor = std::max(quic_packet_number_floor, it->second.next_packet_number);
+            quic_crypto_expired++;
+            it = quic_crypto.erase(it);
+        }
+    }
+
+    // Single funnel for every inbound message: applies it to market state,
+    // assigns it a sequence number and journals it. Returns 0 when journaling
+    // is off or the journal is full.
+    uint64_t record_inbound(uint8_t protocol, uint32_t connection_id,
+                            const struct sockaddr_in* peer, const char* data, size_t length) {
+        // Live updates go through the same path replay and the standby use
+        input_sequence++;
+        if (protocol == JOURNAL_QUIC && peer) {
+            track_quic_connection(connection_id, *peer);
+        }
+        apply_market_state(protocol, data, length);
+        if (analytics) {
+            ingest_trades(protocol, data, length);
+        }
+        if (ticks) {
+            store_ticks(protocol, data, length);
+        }
+        if (!ws_feed.empty()) {
+            size_t payload_length = length;
+            const char* payload = market_payload(protocol, data, payload_length);
+            if (!ws_broadcast) ws_broadcast = std::make_shared<std::string>();
+            ws_append_frame(*ws_broadcast, WS_BINARY, payload, payload_length);
+            ws_broadcast_frames++;
+        }
+        if (replication_fd != -1) {
+            replicate(protocol, connection_id, peer, data, length);
+        }
+        if (!journaling) return 0;
+
+        uint64_t sequence = journal.append(protocol, connection_id, peer, data, length);
+        if (sequence != 0 && config.journal_policy == JournalPolicy::Sync) {
+            journal.commit();
+        }
+        return sequence;
+    }
+
+    // Queues one sequenced input for the standby; it is written out at the
+    // end of the current epoll wakeup.
+    void replicate(uint8_t protocol, uint32_t connection_id,
+                   const struct sockaddr_in* peer, const char* data, size_t length) {
+        if (replication_out.size() > REPLICATION_BUFFER_LIMIT) {
+            drop_replication("standby fell too far behind");
+            return;
+        }
+
+        JournalRecord record;
+        record.sequence = input_sequence;
+        record.timestamp_ns = journal_now_ns();
+        record.length = length;
+        record.connection_id = connection_id;
+        record.peer_addr = peer ? peer->sin_addr.s_addr : 0;
+        record.peer_port = peer ? peer->sin_port : 0;
+        record.protocol = protocol;
+        record.reserved = 0;
+        replication_out.append((const char*)&record, sizeof(record));
+        replication_out.append(data, length);
+    }
+
+    void send_heartbeat() {
+        uint64_t expirations;
+        while (read(heartbeat_fd, &expirations, sizeof(expirations)) > 0) {}
+        if (replication_fd == -1) return;
+
+        JournalRecord record;
+        memset(&record, 0, sizeof(record));
+        record.sequence = input_sequence;
+        record.timestamp_ns = journal_now_ns();
+        record.protocol = REPLICATION_HEARTBEAT;
+        replication_out.append((const char*)&record, sizeof(record));
+        flush_replication();
+    }
+
+    void flush_replication() {
+        if (replication_fd == -1) return;
+
+        size_t written = 0;
+        while (written < replication_out.size()) {
+            ssize_t n = write(replication_fd, replication_out.data() + written,
+                              replication_out.size() - written);
+            if (n == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                drop_replication(strerror(errno));
+                return;
+            }
+            written += n;
+        }
+        replication_out.erase(0, written);
+
+        // Only wait for EPOLLOUT while the socket buffer is full
+        bool want_out = !replication_out.empty();
+        if (want_out != replication_out_armed) {
+            struct epoll_event ev;
+            ev.events = EPOLLIN | EPOLLRDHUP | (want_out ? (uint32_t)EPOLLOUT : 0u);
+            ev.data.fd = replication_fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, replication_fd, &ev);
+            replication_out_armed = want_out;
+        }
+    }
+
+    void drop_replication(const char* reason) {
+        std::cerr << "Replication stopped: " << reason << std::endl;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, replication_fd, nullptr);
+        close(replication_fd);
+        replication_fd = -1;
+        replication_out.clear();
+        replication_out_armed = false;
+    }
+
+    void accept_primary() {
+        int fd = accept(standby_listen_fd, nullptr, nullptr);
+        if (fd == -1) return;
+        if (primary_fd != -1) {
+            // Only one primary at a time
+            close(fd);
+            return;
+        }
+
+        int flags = fcntl(fd, F_GETFL, 0);
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            perror("epoll_ctl primary");
+            close(fd);
+            return;
+        }
+
+        primary_fd = fd;
+        primary_seen = true;
+        last_primary_data = std::chrono::steady_clock::now();
+        std::cout << "Primary connected, applying its input stream" << std::endl;
+    }
+
+    // Standby side: apply every complete record from the primary exactly as
+    // the primary applied it, minus the replies.
+    void handle_replication_stream() {
+        char buffer[64 * 1024];
+        bool closed = false;
+
+        while (true) {
+            ssize_t n = read(primary_fd, buffer, sizeof(buffer));
+            if (n > 0) {
+                replication_in.insert(replication_in.end(), buffer, buffer + n);
+                continue;
+            }
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                closed = true;
+            }
+            break;
+        }
+        last_primary_data = std::chrono::steady_clock::now();
+
+        size_t offset = 0;
+        uint64_t now_ns = journal_now_ns();
+        while (replication_in.size() - offset >= sizeof(JournalRecord)) {
+            JournalRecord record;
+            memcpy(&record, replication_in.data() + offset, sizeof(record));
+            if (replication_in.size() - offset - sizeof(record) < record.length) break;
+            const char* payload = replication_in.data() + offset + sizeof(record);
+            offset += sizeof(record) + record.length;
+
+            input_sequence = record.sequence;
+            if (record.protocol == REPLICATION_HEARTBEAT) continue;
+
+            struct sockaddr_in peer;
+            memset(&peer, 0, sizeof(peer));
+            peer.sin_family = AF_INET;
+            peer.sin_addr.s_addr = record.peer_addr;
+            peer.sin_port = record.peer_port;
+
+            if (record.protocol == JOURNAL_QUIC) {
+                track_quic_connection(record.connection_id, peer);
+            }
+            apply_market_state(record.protocol, payload, record.length);
+            if (journaling) {
+                journal.append(record.protocol, record.connection_id, &peer, payload, record.length);
+            }
+
+            replicated_records++;
+            if (lag_samples_ns.size() < LAG_SAMPLE_CAPACITY) {
+                lag_samples_ns.push_back(now_ns - record.timestamp_ns);
+            } else {
+                lag_samples_ns[lag_sample_count % LAG_SAMPLE_CAPACITY] = now_ns - record.timestamp_ns;
+            }
+            lag_sample_count++;
+        }
+        replication_in.erase(replication_in.begin(), replication_in.begin() + offset);
+
+        if (closed) {
+            std::cout << "Primary disconnected" << std::endl;
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, primary_fd, nullptr);
+            close(primary_fd);
+            primary_fd = -1;
+            promote();
+        }
+    }
+
+    // Promotes after the primary has gone silent for failover_timeout_ms
+    void check_failover() {
+        if (!primary_seen) return;
+        if (primary_fd != -1) {
+            auto silence = std::chrono::steady_clock::now() - last_primary_data;
+            if (silence < std::chrono::milliseconds(config.failover_timeout_ms)) return;
+            std::cout << "Primary heartbeat timed out" << std::endl;
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, primary_fd, nullptr);
+            close(primary_fd);
+            primary_fd = -1;
+        }
+        promote();
+    }
+
+    // Opens the client ports. A hung primary may still hold them, in which
+    // case this is retried on the next standby tick.
+    void promote() {
+        if (!setup_client_sockets()) {
+            for (int* fd : {&tcp_fd, &udp_fd, &quic_fd, &ws_fd, &analytics_fd, &tick_query_fd}) {
+                if (*fd != -1) {
+                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, *fd, nullptr);
+                    close(*fd);
+                    *fd = -1;
+                }
+            }
+            return;
+        }
+
+        standby = false;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, standby_listen_fd, nullptr);
+        close(standby_listen_fd);
+        standby_listen_fd = -1;
+        std::cout << "Promoted to primary at sequence " << input_sequence << std::endl;
+    }
+
+    void handle_stats_request() {
+        int fd;
+        while ((fd = accept(stats_fd, nullptr, nullptr)) != -1) {
+            std::string snapshot = stats_snapshot();
+            ssize_t written = write(fd, snapshot.data(), snapshot.size());
+            (void)written;  // Small enough to fit the socket buffer
+            close(fd);
+        }
+    }
+
+    // One line of space separated key=value counters
+    std::string stats_snapshot() {
+        std::ostringstream out;
+        out << "role=" << (standby ? "standby" : "primary")
+            << " sequence=" << input_sequence
+            << " tcp_connections=" << tcp_connections
+            << " udp_packets=" << udp_packets
+            << " quic_connections=" << quic_connections
+            << " replicated=" << replicated_records
+            << " log_sessions=" << log_sessions.size()
+            << " log_sessions_refused=" << log_sessions_refused
+            << " log_sessions_broken=" << log_sessions_broken
+            << " log_messages=" << log_messages
+            << " echo_syscalls=" << echo_syscalls;
+        out << " service_requests=" << service_requests;
+        if (config.stall_every > 0) {
+            out << " service_stalls=" << service_stalls;
+        }
+        if (idempotency) {
+            out << " idempotent_requests=" << idempotency->requests
+                << " idempotent_duplicates=" << idempotency->duplicates
+                << " idempotent_stale=" << idempotency->stale << " idempotent_clients=" << idempotency->clients()
+                << " idempotent_evictions=" << idempotency->evictions
+                << " idempotent_restarts=" << idempotency->restarts;
+        }
+        if (config.drop_every > 0) {
+            out << " dropped_datagrams=" << dropped_datagrams;
+        }
+        auto tx_stats = [&](const char* name, const DatagramTxQueue& queue) {
+            out << " " << name << "_tx_sent=" << queue.sent << " " << name << "_tx_queued=" << queue.queued
+                << " " << name << "_tx_dropped=" << queue.dropped << " " << name << "_tx_errors=" << queue.send_errors
+                << " " << name << "_tx_depth=" << queue.size() << " " << name << "_tx_max_depth=" << queue.max_depth
+                << " " << name << "_tx_backlogs=" << queue.backlogs
+                << " " << name << "_tx_backlog_us=" << queue.backlog_ns / 1000
+                << " " << name << "_tx_longest_backlog_us=" << queue.longest_backlog_ns / 1000;
+        };
+        tx_stats("udp", udp_tx);
+        tx_stats("quic", quic_tx);
+        if (config.tx_saturate_every > 0) {
+            out << " tx_saturations=" << tx_saturations;
+        }
+        if (config.tcp_handler == TcpHandler::Coroutine) {
+            const FramePool& frames = FramePool::local();
+            out << " coro_handlers=" << coro.started << " coro_active=" << coro.active()
+                << " coro_resumes=" << coro.resumes << " coro_timeouts=" << coro.timeouts
+                << " coro_frames_allocated=" << frames.allocated << " coro_frames_reused=" << frames.reused
+                << " coro_frames_pooled=" << frames.pooled << " coro_frames_oversized=" << frames.oversized;
+        }
+        if (config.fix) {
+            out << " fix_messages=" << fix_messages << " fix_orders=" << fix_orders << " fix_cancels=" << fix_cancels
+                << " fix_cancel_rejects=" << fix_cancel_rejects << " fix_md_requests=" << fix_md_requests
+                << " fix_parse_ns_per_message=" << (fix_messages ? fix_parse_ns / fix_messages : 0)
+                << " fix_rejects=" << fix_rejects << " fix_order_rejects=" << fix_order_rejects
+                << " fix_checksum_errors=" << fix_checksum_errors;
+        }
+        if (analytics) {
+            out << " analytics_trades=" << analytics->trade_count << " analytics_symbols=" << analytics->symbols()
+                << " analytics_ingest_ns_per_trade="
+                << (analytics->trade_count ? analytics_ingest_ns / analytics->trade_count : 0)
+                << " analytics_bars=" << analytics_bars << " analytics_ticks=" << analytics_ticks
+                << " analytics_close_us_per_tick=" << (analytics_ticks ? analytics_close_ns / analytics_ticks / 1000 : 0)
+                << " analytics_subscribers=" << analytics_subscribers.size()
+                << " analytics_subscriber_drops=" << analytics_subscriber_drops;
+        }
+        if (ticks) {
+            uint64_t append_ns = tick_append_ns - std::min(tick_append_ns, ticks->partition_open_ns);
+            out << " tick_rows=" << ticks->rows_written << " tick_partitions=" << ticks->partition_count()
+                << " tick_append_ns_per_row=" << (ticks->rows_written ? append_ns / ticks->rows_written : 0)
+                << " tick_partition_opens=" << ticks->partitions_opened << " tick_partition_open_us="
+                << (ticks->partitions_opened ? ticks->partition_open_ns / ticks->partitions_opened / 1000 : 0)
+                << " tick_partition_closes=" << ticks->partitions_closed
+                << " tick_queries=" << tick_queries_served << " tick_query_rows=" << tick_query_rows
+                << " tick_query_bytes=" << tick_query_bytes << " tick_query_connections=" << tick_queries.size();
+        }
+        if (ws_fd != -1) {
+            out << " ws_connections=" << ws_connections.size() << " ws_feed=" << ws_feed.size()
+                << " ws_messages=" << ws_messages << " ws_unmasked_bytes=" << ws_unmasked_bytes
+                << " ws_broadcast_frames=" << ws_broadcast_frames << " ws_broadcast_blocks=" << ws_broadcast_blocks
+                << " ws_writes=" << ws_writes << " ws_handshake_failures=" << ws_handshake_failures
+                << " ws_feed_disconnects=" << ws_feed_disconnects;
+        }
+        if (udp_packer) {
+            out << " packed_datagrams_in=" << packed_datagrams_in << " packed_messages_in=" << packed_messages_in
+                << " packed_datagrams_out=" << udp_packer->datagrams + quic_packer->datagrams
+                << " packed_messages_out=" << udp_packer->messages + quic_packer->messages
+                << " pack_destinations=" << udp_packer->destination_count() + quic_packer->destination_count()
+                << " pack_destinations_evicted=" << udp_packer->evicted + quic_packer->evicted
+                << " pack_errors=" << pack_errors;
+        }
+        if (config.quic_aead) {
+            out << " quic_opened=" << quic_opened << " quic_sealed=" << quic_sealed
+                << " quic_open_ns_per_packet=" << (quic_opened ? quic_open_ns / quic_opened : 0)
+                << " quic_seal_ns_per_packet=" << (quic_sealed ? quic_seal_ns / quic_sealed : 0)
+                << " quic_auth_failures=" << quic_auth_failures
+                << " quic_crypto_connections=" << quic_crypto.size()
+                << " quic_crypto_expired=" << quic_crypto_expired;
+        }
+        if (!config.compression.empty()) {
+            out << " compressed_messages=" << compressed_messages << " plain_bytes=" << plain_bytes
+                << " wire_bytes=" << wire_bytes
+                << " compress_ns_per_message=" << (compressed_messages ? compress_ns / compressed_messages : 0)
+                << " decompress_ns_per_message=" << (compressed_messages ? decompress_ns / compressed_messages : 0)
+                << " compression_errors=" << compression_errors;
+        }
+
+        if (!lag_samples_ns.empty()) {
+            std::vector<uint64_t> sorted = lag_samples_ns;
+            std::sort(sorted.begin(), sorted.end());
+            auto pct = [&](double p) {
+                size_t index = std::min(sorted.size() - 1, (size_t)(sorted.size() * p));
+                return sorted[index] / 1000.0;
+            };
+            out << " lag_p50_us=" << pct(0.50) << " lag_p99_us=" << pct(0.99)
+                << " lag_p999_us=" << pct(0.999) << " lag_max_us=" << sorted.back() / 1000.0;
+        }
+        out << "\n";
+        return out.str();
+    }
+
+    // Under group commit, replies wait until their inbound message is durable.
+    // A TCP reply also waits behind any reply still held for its connection,
+    // so the byte stream keeps its order. Returns true if the reply was
+    // queued instead of being sent now.
+    bool defer_reply(uint64_t sequence, int fd, const struct sockaddr_in* addr,
+                     const char* data, size_t length) {
+        if (config.journal_policy != JournalPolicy::Group) return false;
+        bool behind = addr == nullptr && pending_stream_replies.count(fd);
+        if (!behind && (sequence == 0 || sequence <= journal.get_durable_sequence())) {
+            return false;
+        }
+
+        PendingReply reply;
+        reply.sequence = sequence;
+        reply.fd = fd;
+        reply.datagram = addr != nullptr;
+        if (addr) reply.addr = *addr;
+        reply.data.assign(data, length);
+        pending_replies.push_back(std::move(reply));
+        if (addr == nullptr) pending_stream_replies[fd]++;
+        return true;
+    }
+
+    void release_durable_replies() {
+        uint64_t counter;
+        while (read(journal_event_fd, &counter, sizeof(counter)) > 0) {}
+
+        uint64_t durable = journal.get_durable_sequence();
+        while (!pending_replies.empty() && pending_replies.front().sequence <= durable) {
+            PendingReply reply = std::move(pending_replies.front());
+            pending_replies.pop_front();
+            if (reply.datagram) {
+                send_datagram(reply.fd, reply.addr, reply.data.data(), reply.data.size());
+                continue;
+            }
+            auto held = pending_stream_replies.find(reply.fd);
+            if (held != pending_stream_replies.end() && --held->second == 0) pending_stream_replies.erase(held);
+            if (!send_stream(reply.fd, reply.data.data(), reply.data.size())) {
+                close_client(reply.fd);
+            }
+        }
+    }
+
+    // Writes to a TCP client behind whatever it has not taken yet. What the
+    // socket refuses is kept and EPOLLOUT armed. Returns false if the
+    // connection failed or fell STREAM_BACKLOG_LIMIT behind.
+    bool send_stream(int fd, const char* data, size_t length) {
+        auto backlog = stream_backlog.find(fd);
+        if (backlog != stream_backlog.end()) {
+            backlog->second.append(data, length);
+            return backlog->second.size() <= STREAM_BACKLOG_LIMIT;
+        }
+
+        size_t total_written = 0;
+        while (total_written < length) {
+            ssize_t bytes_written = write(fd, data + total_written, length - total_written);
+            if (bytes_written == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                if (errno != EPIPE && errno != ECONNRESET) perror("write");
+                return false;
+            }
+            total_written += bytes_written;
+        }
+        if (total_written == length) return true;
+
+        stream_backlog[fd].assign(data + total_written, length - total_written);
+        watch_stream_output(fd, true);
+        return true;
+    }
+
+    // EPOLLOUT on a TCP client: sends its backlog, disarming once it is gone
+    bool flush_stream(int fd) {
+        auto backlog = stream_backlog.find(fd);
+        if (backlog == stream_backlog.end()) return true;
+
+        std::string& pending = backlog->second;
+        size_t total_written = 0;
+        while (total_written < pending.size()) {
+            ssize_t bytes_written = write(fd, pending.data() + total_written, pending.size() - total_written);
+            if (bytes_written == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                if (errno != EPIPE && errno != ECONNRESET) perror("write");
+                return false;
+            }
+            total_written += bytes_written;
+        }
+        pending.erase(0, total_written);
+        if (pending.empty()) {
+            stream_backlog.erase(backlog);
+            watch_stream_output(fd, false);
+        }
+        return true;
+    }
+
+    // Coroutine connections keep EPOLLOUT armed for CoroConnection::write
+    void watch_stream_output(int fd, bool want_out) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP | (want_out || coro.owns(fd) ? (uint32_t)EPOLLOUT : 0u);
+        ev.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+    }
+
+    const struct sockaddr_in* peer_of(int client_fd) {
+        auto it = tcp_peers.find(client_fd);
+        return it == tcp_peers.end() ? nullptr : &it->second;
+    }
+
+    void close_client(int client_fd) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_fd, nullptr);
+        close(client_fd);
+        tcp_connections--;
+        tcp_peers.erase(client_fd);
+        compressed_connections.erase(client_fd);
+        stream_backlog.erase(client_fd);
+        fix_sessions.erase(client_fd);
+        coro.detach(client_fd);
+
+        // Drop held replies so they cannot leak onto a reused descriptor
+        pending_stream_replies.erase(client_fd);
+        for (auto it = pending_replies.begin(); it != pending_replies.end();) {
+            if (!it->datagram && it->fd == client_fd) {
+                it = pending_replies.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void cleanup() {
+        if (tcp_fd != -1) close(tcp_fd);
+        if (udp_fd != -1) close(udp_fd);
+        if (quic_fd != -1) close(quic_fd);
+        if (ws_fd != -1) close(ws_fd);
+        if (analytics_fd != -1) close(analytics_fd);
+        if (analytics_timer_fd != -1) close(analytics_timer_fd);
+        if (tick_query_fd != -1) close(tick_query_fd);
+        if (pack_timer_fd != -1) close(pack_timer_fd);
+        if (journal_event_fd != -1) close(journal_event_fd);
+        if (replication_fd != -1) close(replication_fd);
+        if (heartbeat_fd != -1) close(heartbeat_fd);
+        if (log_timer_fd != -1) close(log_timer_fd);
+        for (auto& entry : log_sessions) delete entry.second;
+        if (standby_listen_fd != -1) close(standby_listen_fd);
+        if (primary_fd != -1) close(primary_fd);
+        if (stats_fd != -1) close(stats_fd);
+        if (epoll_fd != -1) close(epoll_fd);
+    }
+};
+
+// One direction of a spliced TCP connection. Bytes move from `from` into the
+// pipe and from the pipe into `to` without passing through user space. EOF
+// on `from` is passed on as a shutdown of `to` once the pipe is empty, so
+// the other direction keeps flowing after a half-close.
+struct SpliceLink {
+    int from;
+    int to;
+    int pipe_read;
+    int pipe_write;
+    size_t buffered;
+    bool done;              // EOF passed on; nothing more moves this way
+
+    // Returns false once the connection should be closed
+    bool pump() {
+        while (!done) {
+            if (buffered > 0) {
+                ssize_t n = splice(pipe_read, nullptr, to, nullptr, buffered,
+                                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+                if (n > 0) {
+                    buffered -= n;
+                    continue;
+                }
+                return n == -1 && errno == EAGAIN;  // Destination full: wait for EPOLLOUT
+            }
+
+            ssize_t n = splice(from, nullptr, pipe_write, nullptr, SPLICE_CHUNK,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n > 0) {
+                buffered += n;
+                continue;
+            }
+            if (n == 0) {
+                shutdown(to, SHUT_WR);
+                done = true;
+                break;
+            }
+            return errno == EAGAIN;
+        }
+        return true;
+    }
+};
+
+struct ProxiedConnection {
+    int client_fd;
+    int backend_fd;
+    bool connecting;        // Backend connect not finished; the client is not read yet
+    SpliceLink upstream;    // client -> backend
+    SpliceLink downstream;  // backend -> client
+};
+
+// A UDP client flow gets its own upstream socket so backend replies can be
+// matched to the client without changing the payload
+struct UdpFlow {
+    int upstream_fd;
+    struct sockaddr_in client;
+    uint64_t last_active_ns;
+    std::vector<struct mmsghdr> outbound;  // This wakeup's requests, points into ingress
+};
+
+// Where replies for a QUIC connection ID go
+struct QuicClient {
+    struct sockaddr_in addr;
+    uint64_t last_active_ns;
+};
+
+struct ProxyBackend {
+    struct sockaddr_in tcp_addr;
+    struct sockaddr_in udp_addr;
+    struct sockaddr_in quic_addr;
+    int quic_fd;   // Shared upstream socket; replies carry the connection ID
+};
+
+// L4 proxy: clients use the normal TCP/UDP/QUIC ports and are spread over the
+// backend servers by consistent hashing on their source address (TCP, UDP)
+// or connection ID (QUIC). TCP is forwarded with splice, datagrams in
+// recvmmsg/sendmmsg batches.
+class ProxyServer {
+private:
+    ServerConfig config;
+    int epoll_fd;
+    int tcp_fd;
+    int udp_fd;
+    int quic_fd;
+    struct epoll_event events[MAX_EVENTS];
+
+    std::vector<ProxyBackend> backends;
+    ConsistentHashRing ring;
+
+    std::unordered_map<int, ProxiedConnection*> tcp_links;   // Both fds map to the link
+    std::unordered_map<uint64_t, UdpFlow*> udp_flows;         // Keyed by client addr:port
+    std::unordered_map<int, UdpFlow*> udp_flows_by_fd;
+    std::unordered_map<int, int> quic_backend_by_fd;
+    std::unordered_map<uint32_t, QuicClient> quic_clients;
+    int idle_timer_fd;
+
+    DatagramBatch ingress;
+    std::vector<UdpFlow*> udp_outbound;                       // Flows with requests this wakeup
+    std::vector<std::vector<struct mmsghdr>> quic_outbound;  // Per backend, points into ingress
+    DatagramBatch udp_replies;
+    DatagramBatch quic_replies;
+
+public:
+    explicit ProxyServer(const ServerConfig& cfg)
+        : config(cfg), epoll_fd(-1), tcp_fd(-1), udp_fd(-1), quic_fd(-1), idle_timer_fd(-1) {}
+
+    ~ProxyServer() {
+        for (auto& entry : tcp_links) {
+            if (entry.first == entry.second->client_fd) close_link(entry.second, false);
+        }
+        for (auto& entry : udp_flows) {
+            close(entry.second->upstream_fd);
+            delete entry.second;
+        }
+        for (auto& backend : backends) {
+            if (backend.quic_fd != -1) close(backend.quic_fd);
+        }
+        if (tcp_fd != -1) close(tcp_fd);
+        if (udp_fd != -1) close(udp_fd);
+        if (quic_fd != -1) close(quic_fd);
+        if (idle_timer_fd != -1) close(idle_timer_fd);
+        if (epoll_fd != -1) close(epoll_fd);
+    }
+
+    bool initialize() {
+        signal(SIGPIPE, SIG_IGN);
+
+        epoll_fd = epoll_create1(0);
+        if (epoll_fd == -1) {
+            perror("epoll_create1");
+            return false;
+        }
+
+        for (const auto& spec : config.proxy_backends) {
+            if (!add_backend(spec)) return false;
+        }
+
+        tcp_fd = open_server_socket(epoll_fd, SOCK_STREAM, config.tcp_port, "TCP");
+        udp_fd = open_server_socket(epoll_fd, SOCK_DGRAM, config.udp_port, "UDP");
+        quic_fd = open_server_socket(epoll_fd, SOCK_DGRAM, config.quic_port, "QUIC");
+        if (tcp_fd == -1 || udp_fd == -1 || quic_fd == -1) {
+            return false;
+        }
+        if (config.proxy_idle_ms > 0 && !setup_idle_timer()) {
+            return false;
+        }
+
+        std::cout << "Proxy listening on ports " << config.tcp_port << "/" << config.udp_port
+                  << "/" << config.quic_port << " for " << backends.size() << " backends" << std::endl;
+        return true;
+    }
+
+    void run() {
+        std::cout << "Proxy started. Press Ctrl+C to stop." << std::endl;
+
+        while (true) {
+            int nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+            if (nfds == -1) {
+                if (errno == EINTR) continue;
+                perror("epoll_wait");
+                break;
+            }
+
+            for (int i = 0; i < nfds; i++) {
+                int fd = events[i].data.fd;
+                if (fd == tcp_fd) {
+                    accept_clients();
+                } else if (fd == udp_fd) {
+                    forward_udp_requests();
+                } else if (fd == quic_fd) {
+                    forward_quic_requests();
+                } else if (fd == idle_timer_fd) {
+                    expire_idle();
+                } else if (quic_backend_by_fd.count(fd)) {
+                    collect_replies(fd, quic_replies, quic_fd, nullptr);
+                } else {
+                    auto flow = udp_flows_by_fd.find(fd);
+                    if (flow != udp_flows_by_fd.end()) {
+                        flow->second->last_active_ns = journal_now_ns();
+                        collect_replies(fd, udp_replies, udp_fd, flow->second);
+                    } else {
+                        handle_tcp_event(fd, events[i].events);
+                    }
+                }
+            }
+
+            // Replies gathered during this wakeup go out in one sendmmsg each
+            udp_replies.flush(udp_fd);
+            quic_replies.flush(quic_fd);
+        }
+    }
+
+private:
+    bool add_backend(const std::string& spec) {
+        size_t colon = spec.rfind(':');
+        if (colon == std::string::npos) {
+            std::cerr << "Bad backend address (want HOST:PORT_BASE): " << spec << std::endl;
+            return false;
+        }
+        std::string host = spec.substr(0, colon);
+        int port_base = atoi(spec.c_str() + colon + 1);
+
+        ProxyBackend backend;
+        memset(&backend, 0, sizeof(backend));
+        backend.tcp_addr.sin_family = AF_INET;
+        if (inet_pton(AF_INET, host.c_str(), &backend.tcp_addr.sin_addr) != 1) {
+            std::cerr << "Bad backend host: " << host << std::endl;
+            return false;
+        }
+        backend.udp_addr = backend.tcp_addr;
+        backend.quic_addr = backend.tcp_addr;
+        backend.tcp_addr.sin_port = htons(port_base);
+        backend.udp_addr.sin_port = htons(port_base + 1);
+        backend.quic_addr.sin_port = htons(port_base + 2);
+
+        backend.quic_fd = connected_datagram_socket(backend.quic_addr);
+        if (backend.quic_fd == -1) return false;
+
+        int index = backends.size();
+        quic_backend_by_fd[backend.quic_fd] = index;
+        backends.push_back(backend);
+        quic_outbound.emplace_back();
+        quic_outbound.back().reserve(DATAGRAM_BATCH);
+        ring.add_node(index);
+        return true;
+    }
+
+    int connected_datagram_socket(const struct sockaddr_in& addr) {
+        int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (fd == -1) {
+            perror("proxy upstream socket");
+            return -1;
+        }
+        int buf_size = 1024 * 1024;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size));
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            perror("proxy upstream connect");
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    static uint64_t source_key(const struct sockaddr_in& addr) {
+        return ((uint64_t)addr.sin_addr.s_addr << 16) | addr.sin_port;
+    }
+
+    void accept_clients() {
+        struct sockaddr_in client_addr;
+        socklen_t client_len = sizeof(client_addr);
+
+        while (true) {
+            client_len = sizeof(client_addr);
+            int client_fd = accept4(tcp_fd, (struct sockaddr*)&client_addr, &client_len, SOCK_NONBLOCK);
+            if (client_fd == -1) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) perror("proxy accept");
+                break;
+            }
+
+            // The connect finishes on EPOLLOUT, so a slow or dead backend
+            // holds up only its own clients
+            const ProxyBackend& backend = backends[ring.lookup(source_key(client_addr))];
+            int backend_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+            if (backend_fd == -1 ||
+                (connect(backend_fd, (const struct sockaddr*)&backend.tcp_addr, sizeof(backend.tcp_addr)) == -1 &&
+                 errno != EINPROGRESS)) {
+                perror("proxy backend connect");
+                if (backend_fd != -1) close(backend_fd);
+                close(client_fd);
+                continue;
+            }
+
+            int up[2];
+            int down[2];
+            if (pipe2(up, O_NONBLOCK) == -1) {
+                perror("pipe2");
+                close(backend_fd);
+                close(client_fd);
+                continue;
+            }
+            if (pipe2(down, O_NONBLOCK) == -1) {
+                perror("pipe2");
+                close(up[0]);
+                close(up[1]);
+                close(backend_fd);
+                close(client_fd);
+                continue;
+            }
+
+            ProxiedConnection* link = new ProxiedConnection;
+            link->client_fd = client_fd;
+            link->backend_fd = backend_fd;
+            link->connecting = true;
+            link->upstream = SpliceLink{client_fd, backend_fd, up[0], up[1], 0, false};
+            link->downstream = SpliceLink{backend_fd, client_fd, down[0], down[1], 0, false};
+            tcp_links[client_fd] = link;
+            tcp_links[backend_fd] = link;
+
+            // Until the backend is connected only errors on the client count
+            struct epoll_event ev;
+            ev.events = 0;
+            ev.data.fd = client_fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &ev);
+            ev.events = EPOLLOUT;
+            ev.data.fd = backend_fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, backend_fd, &ev);
+        }
+    }
+
+    void handle_tcp_event(int fd, uint32_t event_mask) {
+        auto it = tcp_links.find(fd);
+        if (it == tcp_links.end()) return;
+        ProxiedConnection* link = it->second;
+
+        if (link->connecting) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            if (fd == link->backend_fd) getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length);
+            if (fd == link->client_fd || error) {
+                if (error) {
+                    errno = error;
+                    perror("proxy backend connect");
+                }
+                close_link(link, true);
+                return;
+            }
+            link->connecting = false;
+        } else if (event_mask & EPOLLERR) {
+            close_link(link, true);
+            return;
+        }
+        // Pump both directions: readable data, or room after EPOLLOUT. The
+        // connection closes once both have passed their EOF on.
+        if (!link->upstream.pump() || !link->downstream.pump() ||
+            (link->upstream.done && link->downstream.done)) {
+            close_link(link, true);
+            return;
+        }
+        update_interest(link->client_fd, !link->upstream.done && link->upstream.buffered == 0,
+                        link->downstream.buffered > 0);
+        update_interest(link->backend_fd, !link->downstream.done && link->downstream.buffered == 0,
+                        link->upstream.buffered > 0);
+    }
+
+    // While a direction is backed up, stop reading its source and wait for
+    // its destination to drain; a source past EOF is not read again
+    void update_interest(int fd, bool want_in, bool want_out) {
+        struct epoll_event ev;
+        ev.events = (want_in ? (uint32_t)(EPOLLIN | EPOLLRDHUP) : 0u) | (want_out ? (uint32_t)EPOLLOUT : 0u);
+        ev.data.fd = fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+    }
+
+    void close_link(ProxiedConnection* link, bool erase) {
+        for (int fd : {link->client_fd, link->backend_fd}) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+            close(fd);
+        }
+        for (int fd : {link->upstream.pipe_read, link->upstream.pipe_write,
+                       link->downstream.pipe_read, link->downstream.pipe_write}) {
+            close(fd);
+        }
+        if (erase) {
+            tcp_links.erase(link->client_fd);
+            tcp_links.erase(link->backend_fd);
+        }
+        delete link;
+    }
+
+    // UDP datagrams are grouped per flow and sent with one sendmmsg each
+    void forward_udp_requests() {
+        while (ingress.receive(udp_fd) > 0) {
+            uint64_t now = journal_now_ns();
+            for (int i = 0; i < ingress.count; i++) {
+                UdpFlow* flow = udp_flow_for(ingress.addrs[i], now);
+                if (!flow) continue;
+                if (flow->outbound.empty()) udp_outbound.push_back(flow);
+
+                struct mmsghdr header;
+                memset(&header, 0, sizeof(header));
+                header.msg_hdr.msg_iov = &ingress.iovecs[i];
+                header.msg_hdr.msg_iovlen = 1;
+                flow->outbound.push_back(header);
+            }
+
+            for (UdpFlow* flow : udp_outbound) {
+                send_all(flow->upstream_fd, flow->outbound);
+                flow->outbound.clear();
+            }
+            udp_outbound.clear();
+            ingress.count = 0;
+        }
+    }
+
+    UdpFlow* udp_flow_for(const struct sockaddr_in& client, uint64_t now) {
+        uint64_t key = source_key(client);
+        auto it = udp_flows.find(key);
+        if (it != udp_flows.end()) {
+            it->second->last_active_ns = now;
+            return it->second;
+        }
+
+        const ProxyBackend& backend = backends[ring.lookup(key)];
+        int fd = connected_datagram_socket(backend.udp_addr);
+        if (fd == -1) return nullptr;
+
+        UdpFlow* flow = new UdpFlow{fd, client, now, {}};
+        udp_flows[key] = flow;
+        udp_flows_by_fd[fd] = flow;
+        return flow;
+    }
+
+    // Checks for idle flows a few times per idle period
+    bool setup_idle_timer() {
+        idle_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (idle_timer_fd == -1) {
+            perror("timerfd_create");
+            return false;
+        }
+        uint64_t period_ns = std::max(100, config.proxy_idle_ms / 4) * 1000000ULL;
+        struct itimerspec interval;
+        interval.it_interval.tv_sec = period_ns / 1000000000;
+        interval.it_interval.tv_nsec = period_ns % 1000000000;
+        interval.it_value = interval.it_interval;
+        timerfd_settime(idle_timer_fd, 0, &interval, nullptr);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = idle_timer_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, idle_timer_fd, &ev) == -1) {
+            perror("epoll_ctl idle timer");
+            return false;
+        }
+        return true;
+    }
+
+    // Closes UDP flows and forgets QUIC client addresses that have seen
+    // neither a request nor a reply for proxy_idle_ms
+    void expire_idle() {
+        uint64_t expirations;
+        while (read(idle_timer_fd, &expirations, sizeof(expirations)) > 0) {}
+
+        uint64_t now = journal_now_ns();
+        uint64_t idle_ns = config.proxy_idle_ms * 1000000ULL;
+        for (auto it = udp_flows.begin(); it != udp_flows.end();) {
+            UdpFlow* flow = it->second;
+            if (now - flow->last_active_ns < idle_ns) {
+                ++it;
+                continue;
+            }
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, flow->upstream_fd, nullptr);
+            close(flow->upstream_fd);
+            udp_flows_by_fd.erase(flow->upstream_fd);
+            delete flow;
+            it = udp_flows.erase(it);
+        }
+        for (auto it = quic_clients.begin(); it != quic_clients.end();) {
+            if (now - it->second.last_active_ns < idle_ns) ++it;
+            else it = quic_clients.erase(it);
+        }
+    }
+
+    // Sends the batch from where each sendmmsg stopped, like
+    // DatagramBatch::flush, until the socket refuses a datagram
+    static void send_all(int fd, std::vector<struct mmsghdr>& batch) {
+        size_t sent = 0;
+        while (sent < batch.size()) {
+            int n = sendmmsg(fd, batch.data() + sent, batch.size() - sent, 0);
+            if (n <= 0) break;
+            sent += n;
+        }
+    }
+
+    // QUIC datagrams are grouped per backend and sent with one sendmmsg each
+    void forward_quic_requests() {
+        while (ingress.receive(quic_fd) > 0) {
+            uint64_t now = journal_now_ns();
+            for (auto& batch : quic_outbound) batch.clear();
+
+            for (int i = 0; i < ingress.count; i++) {
+                uint32_t connection_id = 0;
+                if (ingress.iovecs[i].iov_len >= sizeof(uint32_t)) {
+                    memcpy(&connection_id, ingress.buffers[i], sizeof(uint32_t));
+                    connection_id = ntohl(connection_id);
+                }
+                quic_clients[connection_id] = QuicClient{ingress.addrs[i], now};
+
+                struct mmsghdr header;
+                memset(&header, 0, sizeof(header));
+                header.msg_hdr.msg_iov = &ingress.iovecs[i];
+                header.msg_hdr.msg_iovlen = 1;
+                quic_outbound[ring.lookup(connection_id)].push_back(header);
+            }
+
+            for (size_t b = 0; b < backends.size(); b++) {
+                if (!quic_outbound[b].empty()) send_all(backends[b].quic_fd, quic_outbound[b]);
+            }
+            ingress.count = 0;
+        }
+    }
+
+    // Reads backend replies straight into the outgoing reply batch. UDP
+    // replies go to the flow's client; QUIC replies are routed by the
+    // connection ID the backend echoes back (in host byte order).
+    void collect_replies(int upstream_fd, DatagramBatch& replies, int reply_fd, UdpFlow* flow) {
+        uint64_t now = journal_now_ns();
+        while (true) {
+            if (replies.count == DATAGRAM_BATCH) replies.flush(reply_fd);
+            int first = replies.count;
+            if (replies.receive(upstream_fd) == 0) break;
+
+            for (int i = first; i < replies.count; i++) {
+                if (flow) {
+                    replies.addrs[i] = flow->client;
+                    continue;
+                }
+                uint32_t connection_id = 0;
+                if (replies.iovecs[i].iov_len >= sizeof(uint32_t)) {
+                    memcpy(&connection_id, replies.buffers[i], sizeof(uint32_t));
+                }
+                auto client = quic_clients.find(connection_id);
+                if (client != quic_clients.end()) {
+                    replies.addrs[i] = client->second.addr;
+                    client->second.last_active_ns = now;
+                } else {
+                    // Unknown connection: drop by reusing the slot
+                    if (i != replies.count - 1) {
+                        memcpy(replies.buffers[i], replies.buffers[replies.count - 1], replies.iovecs[replies.count - 1].iov_len);
+                        replies.iovecs[i].iov_len = replies.iovecs[replies.count - 1].iov_len;
+                        replies.addrs[i] = replies.addrs[replies.count - 1];
+                        i--;
+                    }
+                    replies.count--;
+                }
+            }
+            for (int i = first; i < replies.count; i++) {
+                replies.headers[i].msg_hdr.msg_namelen = sizeof(replies.addrs[i]);
+            }
+        }
+    }
+};
+
+// Buffered non-blocking stream used by the gateway and pipeline stages
+struct FramedStream {
+    int fd = -1;
+    std::string in;
+    std::string out;
+    bool out_armed = false;
+    bool dirty = false;    // Queued for the end-of-wakeup flush
+};
+
+// Parses HOST:PORT into addr; reports and returns false when malformed
+bool parse_host_port(const std::string& spec, struct sockaddr_in& addr) {
+    size_t colon = spec.rfind(':');
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    if (colon == std::string::npos ||
+        inet_pton(AF_INET, spec.substr(0, colon).c_str(), &addr.sin_addr) != 1) {
+        std::cerr << "Bad address (want HOST:PORT): " << spec << std::endl;
+        return false;
+    }
+    addr.sin_port = htons(atoi(spec.c_str() + colon + 1));
+    return true;
+}
+
+// Epoll plumbing shared by the framed TCP modes. Output queued for a stream
+// during one wakeup is written with a single write at the end of it.
+class FramedReactor {
+protected:
+    int epoll_fd;
+    std::vector<FramedStream*> dirty;
+    std::vector<int> failed;
+
+    FramedReactor() : epoll_fd(-1) {}
+
+    ~FramedReactor() {
+        if (epoll_fd != -1) close(epoll_fd);
+    }
+
+    bool create_epoll() {
+        signal(SIGPIPE, SIG_IGN);
+        epoll_fd = epoll_create1(0);
+        if (epoll_fd == -1) {
+            perror("epoll_create1");
+            return false;
+        }
+        return true;
+    }
+
+    // Sets up a connected or accepted socket as a non-blocking stream
+    bool watch(FramedStream& stream, int fd, const char* label) {
+        int opt = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+        int flags = fcntl(fd, F_GETFL, 0);
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            perror((std::string("epoll_ctl ") + label).c_str());
+            close(fd);
+            return false;
+        }
+        stream.fd = fd;
+        return true;
+    }
+
+    // Blocking connect (loopback peers answer immediately), then watch
+    bool connect_stream(FramedStream& stream, const struct sockaddr_in& addr, const char* label) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd == -1 || connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            perror((std::string(label) + " connect").c_str());
+            if (fd != -1) close(fd);
+            return false;
+        }
+        return watch(stream, fd, label);
+    }
+
+    // Starts a non-blocking connect; the stream waits for EPOLLOUT, and
+    // finish_connect then sets it up like watch does
+    bool start_connect(FramedStream& stream, const struct sockaddr_in& addr, const char* label) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (fd == -1 || (connect(fd, (const struct sockaddr*)&addr, sizeof(addr)) == -1 && errno != EINPROGRESS)) {
+            perror((std::string(label) + " connect").c_str());
+            if (fd != -1) close(fd);
+            return false;
+        }
+        struct epoll_event ev;
+        ev.events = EPOLLOUT;
+        ev.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            perror((std::string("epoll_ctl ") + label).c_str());
+            close(fd);
+            return false;
+        }
+        stream.fd = fd;
+        return true;
+    }
+
+    // Returns false if the connect failed; the stream is then closed by the
+    // caller. Queued output goes out with the next flush.
+    bool finish_connect(FramedStream& stream, const char* label) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(stream.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        if (error) {
+            errno = error;
+            perror((std::string(label) + " connect").c_str());
+            return false;
+        }
+        int opt = 1;
+        setsockopt(stream.fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = stream.fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, stream.fd, &ev);
+        stream.out_armed = false;
+        return true;
+    }
+
+    void close_stream(FramedStream& stream) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, stream.fd, nullptr);
+        close(stream.fd);
+        stream.fd = -1;
+        stream.in.clear();
+        stream.out.clear();
+        stream.out_armed = false;
+        if (stream.dirty) {
+            dirty.erase(std::remove(dirty.begin(), dirty.end(), &stream), dirty.end());
+            stream.dirty = false;
+        }
+    }
+
+    // Reads everything available; returns false on EOF or error
+    bool read_available(FramedStream& stream) {
+        char buffer[64 * 1024];
+        while (true) {
+            ssize_t n = read(stream.fd, buffer, sizeof(buffer));
+            if (n > 0) {
+                stream.in.append(buffer, n);
+                continue;
+            }
+            return n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+    }
+
+    void mark_dirty(FramedStream& stream) {
+        if (!stream.dirty) {
+            stream.dirty = true;
+            dirty.push_back(&stream);
+        }
+    }
+
+    // Returns the fds of the streams whose write failed, for the caller to
+    // close once the pass is over
+    const std::vector<int>& flush_dirty() {
+        failed.clear();
+        for (FramedStream* stream : dirty) {
+            stream->dirty = false;
+            if (stream->fd != -1 && !flush(*stream)) failed.push_back(stream->fd);
+        }
+        dirty.clear();
+        return failed;
+    }
+
+    // EAGAIN waits for EPOLLOUT; any other write error returns false
+    bool flush(FramedStream& stream) {
+        size_t written = 0;
+        bool ok = true;
+        while (written < stream.out.size()) {
+            ssize_t n = write(stream.fd, stream.out.data() + written, stream.out.size() - written);
+            if (n == -1) {
+                ok = errno == EAGAIN || errno == EWOULDBLOCK;
+                break;
+            }
+            written += n;
+        }
+        stream.out.erase(0, written);
+        if (!ok) return false;
+
+        bool want_out = !stream.out.empty();
+        if (want_out != stream.out_armed) {
+            struct epoll_event ev;
+            ev.events = EPOLLIN | EPOLLRDHUP | (want_out ? (uint32_t)EPOLLOUT : 0u);
+            ev.data.fd = stream.fd;
+            epoll_ctl(epoll_fd, EPOLL_CTL_MOD, stream.fd, &ev);
+            stream.out_armed = want_out;
+        }
+        return true;
+    }
+};
+
+struct GatewayClient {
+    FramedStream stream;
+    uint64_t id;
+    uint32_t next_request = 0;
+    uint32_t in_flight = 0;        // Requests sent upstream and not yet answered
+};
+
+// A lost upstream is reconnected without blocking, first after
+// GATEWAY_RECONNECT_MIN_MS and backing off while the backend stays away
+struct GatewayUpstream {
+    FramedStream stream;
+    bool connecting = false;
+    uint64_t retry_at_ns = 0;      // Next connect attempt while closed
+    int backoff_ms = GATEWAY_RECONNECT_MIN_MS;
+};
+
+// Terminates many framed client connections and multiplexes their requests
+// over a few persistent upstream connections. Each request gets a
+// correlation ID whose top half is the client ID, so replies route back
+// without a lookup table; the backend only has to echo frames intact.
+// Clients more than SUBSCRIBER_BUFFER_LIMIT behind, in their own output or
+// their upstream's, are dropped.
+class GatewayServer : private FramedReactor {
+private:
+    ServerConfig config;
+    int tcp_fd;
+    struct epoll_event events[MAX_EVENTS];
+    struct sockaddr_in upstream_addr;
+
+    std::vector<GatewayUpstream> upstreams;
+    std::unordered_map<int, size_t> upstream_by_fd;
+    std::unordered_map<int, GatewayClient*> clients_by_fd;
+    std::unordered_map<uint64_t, GatewayClient*> clients_by_id;
+    uint64_t next_client_id;
+
+public:
+    explicit GatewayServer(const ServerConfig& cfg)
+        : config(cfg), tcp_fd(-1), next_client_id(1) {}
+
+    ~GatewayServer() {
+        for (auto& entry : clients_by_fd) {
+            close(entry.first);
+            delete entry.second;
+        }
+        for (auto& upstream : upstreams) {
+            if (upstream.stream.fd != -1) close(upstream.stream.fd);
+        }
+        if (tcp_fd != -1) close(tcp_fd);
+    }
+
+    bool initialize() {
+        if (!create_epoll() || !parse_host_port(config.gateway_upstream, upstream_addr)) {
+            return false;
+        }
+
+        upstreams.resize(std::max(1, config.upstream_connections));
+        for (size_t i = 0; i < upstreams.size(); i++) {
+            if (!connect_stream(upstreams[i].stream, upstream_addr, "gateway upstream")) return false;
+            upstream_by_fd[upstreams[i].stream.fd] = i;
+        }
+
+        tcp_fd = open_server_socket(epoll_fd, SOCK_STREAM, config.tcp_port, "TCP");
+        if (tcp_fd == -1) {
+            return false;
+        }
+
+        std::cout << "Gateway listening on port " << config.tcp_port << " with " << upstreams.size()
+                  << " upstream connections to " << config.gateway_upstream << std::endl;
+        return true;
+    }
+
+    void run() {
+        std::cout << "Gateway started. Press Ctrl+C to stop." << std::endl;
+
+        while (true) {
+            int nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, retry_timeout_ms());
+            if (nfds == -1) {
+                if (errno == EINTR) continue;
+                perror("epoll_wait");
+                break;
+            }
+
+            for (int i = 0; i < nfds; i++) {
+                int fd = events[i].data.fd;
+                if (fd == tcp_fd) {
+                    accept_clients();
+                    continue;
+                }
+
+                auto upstream = upstream_by_fd.find(fd);
+                if (upstream != upstream_by_fd.end()) {
+                    handle_upstream(upstream->second, events[i].events);
+                    continue;
+                }
+
+                auto client = clients_by_fd.find(fd);
+                if (client != clients_by_fd.end()) {
+                    handle_client(client->second, events[i].events);
+                }
+            }
+
+            for (int fd : flush_dirty()) {
+                auto upstream = upstream_by_fd.find(fd);
+                if (upstream != upstream_by_fd.end()) {
+                    upstream_lost(upstream->second);
+                    continue;
+                }
+                auto client = clients_by_fd.find(fd);
+                if (client != clients_by_fd.end()) close_client(client->second);
+            }
+            retry_upstreams();
+        }
+    }
+
+private:
+    // Until the earliest upstream retry, or -1 with none due
+    int retry_timeout_ms() const {
+        uint64_t earliest = 0;
+        for (const GatewayUpstream& upstream : upstreams) {
+            if (upstream.retry_at_ns && (!earliest || upstream.retry_at_ns < earliest)) earliest = upstream.retry_at_ns;
+        }
+        if (!earliest) return -1;
+        uint64_t now = journal_now_ns();
+        return earliest > now ? (int)((earliest - now + 999999) / 1000000) : 0;
+    }
+
+    void retry_upstreams() {
+        uint64_t now = journal_now_ns();
+        for (size_t i = 0; i < upstreams.size(); i++) {
+            GatewayUpstream& upstream = upstreams[i];
+            if (!upstream.retry_at_ns || upstream.retry_at_ns > now) continue;
+            upstream.retry_at_ns = 0;
+            if (!start_connect(upstream.stream, upstream_addr, "gateway upstream")) {
+                schedule_retry(upstream);
+                continue;
+            }
+            upstream.connecting = true;
+            upstream_by_fd[upstream.stream.fd] = i;
+        }
+    }
+
+    void schedule_retry(GatewayUpstream& upstream) {
+        upstream.retry_at_ns = journal_now_ns() + upstream.backoff_ms * 1000000ULL;
+        upstream.backoff_ms = std::min(GATEWAY_RECONNECT_MAX_MS, upstream.backoff_ms * 2);
+    }
+
+    // The requests in flight on a lost upstream fail: the backend may or may
+    // not have seen them, so their clients are closed rather than left
+    // waiting. The connection is retried after the backoff.
+    void upstream_lost(size_t index) {
+        GatewayUpstream& upstream = upstreams[index];
+        if (!upstream.connecting) std::cerr << "Gateway upstream " << index << " lost, reconnecting" << std::endl;
+        upstream_by_fd.erase(upstream.stream.fd);
+        close_stream(upstream.stream);
+        upstream.connecting = false;
+        schedule_retry(upstream);
+
+        std::vector<GatewayClient*> failed_clients;
+        for (auto& entry : clients_by_id) {
+            if (entry.first % upstreams.size() == index && entry.second->in_flight) {
+                failed_clients.push_back(entry.second);
+            }
+        }
+        for (GatewayClient* client : failed_clients) close_client(client);
+    }
+
+    void accept_clients() {
+        while (true) {
+            int fd = accept(tcp_fd, nullptr, nullptr);
+            if (fd == -1) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) perror("gateway accept");
+                break;
+            }
+
+            GatewayClient* client = new GatewayClient;
+            if (!watch(client->stream, fd, "gateway client")) {
+                delete client;
+                continue;
+            }
+            client->id = next_client_id++;
+            clients_by_fd[fd] = client;
+            clients_by_id[client->id] = client;
+        }
+    }
+
+    void handle_client(GatewayClient* client, uint32_t event_mask) {
+        if ((event_mask & EPOLLOUT) && !flush(client->stream)) {
+            close_client(client);
+            return;
+        }
+        if (!(event_mask & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) return;
+
+        bool open = read_available(client->stream);
+
+        // Requests from one client always use the same upstream, so its
+        // replies come back in order. While that upstream is down its
+        // requests fail.
+        GatewayUpstream& upstream = upstreams[client->id % upstreams.size()];
+        bool valid = consume_frames(client->stream.in, MAX_FRAME_SIZE, [&](char* payload, uint32_t length) {
+            if (upstream.stream.fd == -1) return false;
+            stamp_hop(payload, length);
+            uint32_t upstream_length = htonl(length + CORRELATION_SIZE);
+            uint64_t correlation_id = (client->id << 32) | client->next_request++;
+            upstream.stream.out.append((const char*)&upstream_length, sizeof(upstream_length));
+            upstream.stream.out.append((const char*)&correlation_id, sizeof(correlation_id));
+            upstream.stream.out.append(payload, length);
+            client->in_flight++;
+            if (!upstream.connecting) mark_dirty(upstream.stream);
+            return true;
+        });
+
+        if (upstream.stream.out.size() > SUBSCRIBER_BUFFER_LIMIT) {
+            std::cerr << "Dropping gateway client " << client->id << ": upstream more than "
+                      << SUBSCRIBER_BUFFER_LIMIT / (1024 * 1024) << "MB behind" << std::endl;
+            valid = false;
+        }
+        if (!open || !valid) close_client(client);
+    }
+
+    void handle_upstream(size_t index, uint32_t event_mask) {
+        GatewayUpstream& upstream = upstreams[index];
+        if (upstream.connecting) {
+            if (!finish_connect(upstream.stream, "gateway upstream")) {
+                upstream_lost(index);
+                return;
+            }
+            upstream.connecting = false;
+            upstream.backoff_ms = GATEWAY_RECONNECT_MIN_MS;
+            std::cerr << "Gateway upstream " << index << " reconnected" << std::endl;
+            if (!flush(upstream.stream)) upstream_lost(index);
+            return;
+        }
+        if ((event_mask & EPOLLOUT) && !flush(upstream.stream)) {
+            upstream_lost(index);
+            return;
+        }
+
+        bool open = read_available(upstream.stream);
+        std::vector<GatewayClient*> slow;
+        bool valid = consume_frames(upstream.stream.in, MAX_FRAME_SIZE + CORRELATION_SIZE,
+                                    [&](char* frame, uint32_t length) {
+            if (length < CORRELATION_SIZE) return false;
+            uint64_t correlation_id;
+            memcpy(&correlation_id, frame, sizeof(correlation_id));
+            auto client = clients_by_id.find(correlation_id >> 32);
+            if (client != clients_by_id.end()) {
+                // Client went away otherwise: the reply is dropped
+                GatewayClient* target = client->second;
+                append_frame(target->stream.out, frame + CORRELATION_SIZE, length - CORRELATION_SIZE);
+                target->in_flight--;
+                mark_dirty(target->stream);
+                if (target->stream.out.size() > SUBSCRIBER_BUFFER_LIMIT &&
+                    std::find(slow.begin(), slow.end(), target) == slow.end()) {
+                    slow.push_back(target);
+                }
+            }
+            return true;
+        });
+
+        for (GatewayClient* client : slow) {
+            std::cerr << "Dropping gateway client " << client->id << ": more than "
+                      << SUBSCRIBER_BUFFER_LIMIT / (1024 * 1024) << "MB behind" << std::endl;
+            close_client(client);
+        }
+        if (!open || !valid) upstream_lost(index);
+    }
+
+    void close_client(GatewayClient* client) {
+        clients_by_fd.erase(client->stream.fd);
+        clients_by_id.erase(client->id);
+        close_stream(client->stream);
+        delete client;
+    }
+};
+
+// One stage of the order pipeline (client -> gateway -> matching ->
+// publisher -> subscribers). Both roles stamp the hop trailer of every
+// message they handle.
+//  - matching: takes gateway upstream frames ([u32 length][u64 correlation]
+//    [payload]), applies the market messages to its books, acks each frame
+//    by echoing it, and forwards the payload to the publisher at --downstream.
+//  - publisher: fans every frame it receives out to all subscribers. A
+//    connection that sends frames is a producer; all others are subscribers.
+class PipelineStage : private FramedReactor {
+private:
+    ServerConfig config;
+    bool matching;
+    int tcp_fd;
+    struct epoll_event events[MAX_EVENTS];
+
+    std::unordered_map<int, FramedStream*> streams;
+    std::unordered_map<int, bool> producers;
+    FramedStream downstream;
+    MarketPartition book;
+    uint64_t messages;
+    uint64_t dropped_subscribers;
+
+    // Quote fan-out (quote.h)
+    QuoteDeltaEncoder quote_encoder;
+    std::vector<QuoteUpdate> quote_batch;
+    std::string quote_frame;
+
+public:
+    explicit PipelineStage(const ServerConfig& cfg)
+        : config(cfg), matching(cfg.pipeline_stage == "matching"), tcp_fd(-1),
+          messages(0), dropped_subscribers(0), quote_encoder(std::max(1, cfg.refresh_every)) {}
+
+    ~PipelineStage() {
+        for (auto& entry : streams) {
+            close(entry.first);
+            delete entry.second;
+        }
+        if (downstream.fd != -1) close(downstream.fd);
+        if (tcp_fd != -1) close(tcp_fd);
+    }
+
+    bool initialize() {
+        if (!matching && config.pipeline_stage != "publisher") {
+            std::cerr << "Unknown pipeline stage: " << config.pipeline_stage << std::endl;
+            return false;
+        }
+        if (!config.quote_encoding.empty() &&
+            (matching || (config.quote_encoding != "fixed" && config.quote_encoding != "delta"))) {
+            std::cerr << "--quote-encoding takes fixed|delta and needs the publisher stage" << std::endl;
+            return false;
+        }
+        if (!create_epoll()) {
+            return false;
+        }
+
+        if (matching) {
+            struct sockaddr_in addr;
+            if (config.downstream.empty()) {
+                std::cerr << "The matching stage needs --downstream=HOST:PORT" << std::endl;
+                return false;
+            }
+            if (!parse_host_port(config.downstream, addr) ||
+                !connect_stream(downstream, addr, "pipeline downstream")) {
+                return false;
+            }
+        }
+
+        tcp_fd = open_server_socket(epoll_fd, SOCK_STREAM, config.tcp_port, "TCP");
+        if (tcp_fd == -1) {
+            return false;
+        }
+
+        std::cout << "Pipeline " << config.pipeline_stage << " stage listening on port " << config.tcp_port;
+        if (matching) std::cout << ", publishing to " << config.downstream;
+        if (!config.quote_encoding.empty()) std::cout << ", " << config.quote_encoding << " quotes";
+        std::cout << std::endl;
+        return true;
+    }
+
+    void run() {
+        std::cout << "Pipeline stage started. Press Ctrl+C to stop." << std::endl;
+
+        while (true) {
+            int nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+            if (nfds == -1) {
+                if (errno == EINTR) continue;
+                perror("epoll_wait");
+                break;
+            }
+
+            for (int i = 0; i < nfds; i++) {
+                int fd = events[i].data.fd;
+                if (fd == tcp_fd) {
+                    accept_streams();
+                } else if (fd == downstream.fd) {
+                    if (((events[i].events & EPOLLOUT) && !flush(downstream)) || !read_available(downstream)) {
+                        std::cerr << "Pipeline downstream lost" << std::endl;
+                        return;
+                    }
+                    downstream.in.clear();  // Fan-out of our own messages
+                } else {
+                    auto stream = streams.find(fd);
+                    if (stream != streams.end()) handle_stream(stream->second, events[i].events);
+                }
+            }
+
+            for (int fd : flush_dirty()) {
+                if (fd == downstream.fd) {
+                    std::cerr << "Pipeline downstream lost" << std::endl;
+                    return;
+                }
+                auto stream = streams.find(fd);
+                if (stream != streams.end()) close_connection(stream->second);
+            }
+        }
+    }
+
+private:
+    void accept_streams() {
+        while (true) {
+            int fd = accept(tcp_fd, nullptr, nullptr);
+            if (fd == -1) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) perror("pipeline accept");
+                break;
+            }
+
+            FramedStream* stream = new FramedStream;
+            if (!watch(*stream, fd, "pipeline stream")) {
+                delete stream;
+                continue;
+            }
+            streams[fd] = stream;
+        }
+    }
+
+    void handle_stream(FramedStream* stream, uint32_t event_mask) {
+        if ((event_mask & EPOLLOUT) && !flush(*stream)) {
+            close_connection(stream);
+            return;
+        }
+        if (!(event_mask & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) return;
+
+        bool open = read_available(*stream);
+        bool valid;
+        if (matching) {
+            valid = consume_frames(stream->in, MAX_FRAME_SIZE + CORRELATION_SIZE,
+                                   [&](char* frame, uint32_t length) {
+                if (length < CORRELATION_SIZE) return false;
+                char* payload = frame + CORRELATION_SIZE;
+                uint32_t payload_length = length - CORRELATION_SIZE;
+                stamp_hop(payload, payload_length);
+                for_each_market_message(payload, payload_length,
+                                        [this](const MarketMessage& msg) { book.apply(msg); });
+                messages++;
+
+                append_frame(stream->out, frame, length);
+                mark_dirty(*stream);
+                append_frame(downstream.out, payload, payload_length);
+                mark_dirty(downstream);
+                return true;
+            });
+        } else {
+            valid = consume_frames(stream->in, MAX_FRAME_SIZE, [&](char* payload, uint32_t length) {
+                producers[stream->fd] = true;
+                if (!config.quote_encoding.empty()) return publish_quotes(payload, length);
+                stamp_hop(payload, length);
+                messages++;
+                publish(payload, length);
+                return true;
+            });
+        }
+
+        if (!open || !valid) close_connection(stream);
+    }
+
+    // A producer frame of QuoteUpdates goes out as is, or as one delta frame
+    bool publish_quotes(const char* payload, uint32_t length) {
+        if (length % sizeof(QuoteUpdate) != 0) return false;
+        size_t count = length / sizeof(QuoteUpdate);
+        messages += count;
+        if (config.quote_encoding == "fixed") {
+            publish(payload, length);
+            return true;
+        }
+
+        quote_batch.resize(count);
+        memcpy(quote_batch.data(), payload, length);
+        for (const QuoteUpdate& update : quote_batch) {
+            if (update.symbol >= QUOTE_MAX_SYMBOLS) return false;
+        }
+        quote_frame.clear();
+        quote_encoder.encode(quote_batch.data(), count, quote_frame);
+        if (!quote_frame.empty()) publish(quote_frame.data(), quote_frame.size());
+        return true;
+    }
+
+    void publish(const char* payload, uint32_t length) {
+        std::vector<FramedStream*> slow;
+        for (auto& entry : streams) {
+            if (producers.count(entry.first)) continue;
+            FramedStream* subscriber = entry.second;
+            append_frame(subscriber->out, payload, length);
+            mark_dirty(*subscriber);
+            if (subscriber->out.size() > SUBSCRIBER_BUFFER_LIMIT) slow.push_back(subscriber);
+        }
+
+        for (FramedStream* subscriber : slow) {
+            std::cerr << "Dropping subscriber " << subscriber->fd << ": more than "
+                      << SUBSCRIBER_BUFFER_LIMIT / (1024 * 1024) << "MB behind" << std::endl;
+            dropped_subscribers++;
+            close_connection(subscriber);
+        }
+    }
+
+    void close_connection(FramedStream* stream) {
+        streams.erase(stream->fd);
+        producers.erase(stream->fd);
+        close_stream(*stream);
+        delete stream;
+    }
+};
+
+struct ServerSession {
+    uint64_t id;
+    FramedStream* connection = nullptr;  // Null while the client is away
+    uint64_t detached_ns = 0;            // When the last connection went
+    uint64_t in_next = 1;                // Next client sequence expected
+    SessionResendStore store;            // Our outbound messages (echoes)
+
+    ServerSession(uint64_t session_id, size_t store_limit, size_t store_bytes)
+        : id(session_id), store(store_limit, store_bytes) {}
+};
+
+// Sequenced echo service (session.h): sessions outlive their TCP
+// connections, and a client logging back on gets everything it missed
+// replayed from the session's resend store. A session left without a
+// connection for session_idle_ms is dropped with its store; logging on to
+// it again starts a new one.
+class SessionServer : private FramedReactor {
+private:
+    ServerConfig config;
+    int tcp_fd;
+    int idle_timer_fd;
+    struct epoll_event events[MAX_EVENTS];
+
+    std::unordered_map<int, FramedStream*> connections;
+    std::unordered_map<int, ServerSession*> session_of_fd;
+    std::unordered_map<uint64_t, ServerSession*> sessions;
+
+public:
+    explicit SessionServer(const ServerConfig& cfg) : config(cfg), tcp_fd(-1), idle_timer_fd(-1) {}
+
+    ~SessionServer() {
+        for (auto& entry : connections) {
+            close(entry.first);
+            delete entry.second;
+        }
+        for (auto& entry : sessions) delete entry.second;
+        if (idle_timer_fd != -1) close(idle_timer_fd);
+        if (tcp_fd != -1) close(tcp_fd);
+    }
+
+    bool initialize() {
+        if (!create_epoll()) {
+            return false;
+        }
+        tcp_fd = open_server_socket(epoll_fd, SOCK_STREAM, config.tcp_port, "TCP");
+        if (tcp_fd == -1) {
+            return false;
+        }
+        if (config.session_idle_ms > 0 && !setup_idle_timer()) {
+            return false;
+        }
+        std::cout << "Session server listening on port " << config.tcp_port << " with a "
+                  << config.resend_store << " message, " << config.resend_store_mb
+                  << "MB resend store per session" << std::endl;
+        return true;
+    }
+
+    void run() {
+        std::cout << "Session server started. Press Ctrl+C to stop." << std::endl;
+
+        while (true) {
+            int nfds = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+            if (nfds == -1) {
+                if (errno == EINTR) continue;
+                perror("epoll_wait");
+                break;
+            }
+
+            for (int i = 0; i < nfds; i++) {
+                int fd = events[i].data.fd;
+                if (fd == tcp_fd) {
+                    accept_connections();
+                    continue;
+                }
+                if (fd == idle_timer_fd) {
+                    expire_sessions();
+                    continue;
+                }
+                auto connection = connections.find(fd);
+                if (connection != connections.end()) {
+                    handle_connection(connection->second, events[i].events);
+                }
+            }
+
+            for (int fd : flush_dirty()) {
+                auto connection = connections.find(fd);
+                if (connection != connections.end()) close_connection(connection->second);
+            }
+        }
+    }
+
+private:
+    // Checks for sessions to expire a few times per idle period
+    bool setup_idle_timer() {
+        idle_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (idle_timer_fd == -1) {
+            perror("timerfd_create");
+            return false;
+        }
+        uint64_t period_ns = std::max(100, config.session_idle_ms / 4) * 1000000ULL;
+        struct itimerspec interval;
+        interval.it_interval.tv_sec = period_ns / 1000000000;
+        interval.it_interval.tv_nsec = period_ns % 1000000000;
+        interval.it_value = interval.it_interval;
+        timerfd_settime(idle_timer_fd, 0, &interval, nullptr);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = idle_timer_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, idle_timer_fd, &ev) == -1) {
+            perror("epoll_ctl idle timer");
+            return false;
+        }
+        return true;
+    }
+
+    void expire_sessions() {
+        uint64_t expirations;
+        while (read(idle_timer_fd, &expirations, sizeof(expirations)) > 0) {}
+
+        uint64_t now = journal_now_ns();
+        uint64_t idle_ns = config.session_idle_ms * 1000000ULL;
+        for (auto it = sessions.begin(); it != sessions.end();) {
+            ServerSession* session = it->second;
+            if (session->connection || now - session->detached_ns < idle_ns) {
+                ++it;
+                continue;
+            }
+            delete session;
+            it = sessions.erase(it);
+        }
+    }
+
+    void accept_connections() {
+        while (true) {
+            int fd = accept(tcp_fd, nullptr, nullptr);
+            if (fd == -1) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) perror("session accept");
+                break;
+            }
+
+            FramedStream* connection = new FramedStream;
+            if (!watch(*connection, fd, "session connection")) {
+                delete connection;
+                continue;
+            }
+            connections[fd] = connection;
+        }
+    }
+
+    void handle_connection(FramedStream* connection, uint32_t event_mask) {
+        if ((event_mask & EPOLLOUT) && !flush(*connection)) {
+            close_connection(connection);
+            return;
+        }
+        if (!(event_mask & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) return;
+
+        bool open = read_available(*connection);
+        bool valid = consume_frames(connection->in, MAX_FRAME_SIZE, [&](char* body, uint32_t length) {
+            if (length == 0) return false;
+            if (body[0] == SESSION_LOGON && length >= sizeof(SessionLogon)) {
+                SessionLogon logon;
+                memcpy(&logon, body, sizeof(logon));
+                return logon_session(connection, logon);
+            }
+            if (body[0] == SESSION_DATA && length >= sizeof(SessionDataHeader)) {
+                SessionDataHeader header;
+                memcpy(&header, body, sizeof(header));
+                return handle_data(connection, header, body + sizeof(header), length - sizeof(header));
+            }
+            return false;
+        });
+
+        // A client that stops reading loses its connection, not its session
+        if (connection->out.size() > SUBSCRIBER_BUFFER_LIMIT) valid = false;
+        if (!open || !valid) close_connection(connection);
+    }
+
+    bool logon_session(FramedStream* connection, const SessionLogon& logon) {
+        if (session_of_fd.count(connection->fd)) return false;
+
+        ServerSession*& session = sessions[logon.session_id];
+        if (!session) {
+            session = new ServerSession(logon.session_id, config.resend_store,
+                                        (size_t)config.resend_store_mb * 1024 * 1024);
+        }
+        if (session->connection) close_connection(session->connection);  // Stale connection
+        session->connection = connection;
+        session_of_fd[connection->fd] = session;
+
+        // The client has everything before next_expected
+        session->store.trim(logon.next_expected);
+        uint64_t first = std::max(logon.next_expected, session->store.first_sequence());
+
+        SessionLogonAck ack;
+        memset(&ack, 0, sizeof(ack));
+        ack.type = SESSION_LOGON_ACK;
+        // Behind the store, or past it because the session expired
+        ack.flags = logon.next_expected < session->store.first_sequence() ||
+                    logon.next_expected > session->store.next_sequence() ? SESSION_FLAG_RESET : 0;
+        ack.next_expected = session->in_next;
+        ack.next_sequence = session->store.next_sequence();
+        ack.first_replayed = first;
+        append_frame(connection->out, (const char*)&ack, sizeof(ack));
+
+        for (uint64_t sequence = first; sequence < ack.next_sequence; sequence++) {
+            const std::string* message = session->store.find(sequence);
+            append_session_data(connection->out, sequence, session->in_next, message->data(), message->size());
+        }
+        mark_dirty(*connection);
+        return true;
+    }
+
+    bool handle_data(FramedStream* connection, const SessionDataHeader& header,
+                     const char* payload, size_t length) {
+        auto found = session_of_fd.find(connection->fd);
+        if (found == session_of_fd.end()) return false;
+        ServerSession* session = found->second;
+
+        session->store.trim(header.ack);
+        if (header.sequence < session->in_next) return true;   // Resent duplicate
+        if (header.sequence > session->in_next) return false;  // Gap: the client must log on again
+        session->in_next++;
+
+        uint64_t sequence = session->store.add(payload, length);
+        append_session_data(connection->out, sequence, session->in_next, payload, length);
+        mark_dirty(*connection);
+        return true;
+    }
+
+    void close_connection(FramedStream* connection) {
+        auto session = session_of_fd.find(connection->fd);
+        if (session != session_of_fd.end()) {
+            session->second->connection = nullptr;
+            session->second->detached_ns = journal_now_ns();
+            session_of_fd.erase(session);
+        }
+        connections.erase(connection->fd);
+        close_stream(*connection);
+        delete connection;
     }
 };
 
-int main() {
-    EpollServer server;
+void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --port-base=N            TCP on N, UDP on N+1, QUIC on N+2 (default " << TCP_PORT << ")\n"
+              << "  --journal=PATH           Journal inbound messages to PATH\n"
+              << "  --journal-policy=P       none|async|group|sync (default async when --journal is set)\n"
+              << "  --journal-size-mb=N      Preallocated journal size (default 1024)\n"
+              << "  --commit-every=N         Group commit after N messages (default 64)\n"
+              << "  --commit-interval-us=N   Group commit after N microseconds (default 200)\n"
+              << "  --replay                 Rebuild state from the journal before serving\n"
+              << "  --partitions=N           State partitions / replay threads (default: CPU count)\n"
+              << "  --replicate-to=HOST:PORT Stream sequenced input to a hot standby\n"
+              << "  --standby-port=N         Run as hot standby fed by a primary on port N\n"
+              << "  --failover-timeout-ms=N  Standby promotes after N ms without heartbeats (default 500)\n"
+              << "  --stats-port=N           Serve a line of key=value counters on TCP port N\n"
+              << "  --proxy=HOST:BASE[,...]  Run as an L4 proxy in front of these backend servers\n"
+              << "  --proxy-idle-ms=N        Proxy forgets UDP flows and QUIC clients idle this long, 0 never (default 30000)\n"
+              << "  --gateway=HOST:BASE      Run as a framed TCP gateway multiplexing onto this backend\n"
+              << "  --upstream-connections=N Gateway connections to the backend (default 4)\n"
+              << "  --pipeline-stage=S       Run as order pipeline stage matching|publisher\n"
+              << "  --downstream=HOST:PORT   Publisher the matching stage forwards to\n"
+              << "  --quote-encoding=E       Publisher fans out QuoteUpdate frames fixed|delta\n"
+              << "  --refresh-every=N        Delta quotes: full refresh per symbol every N updates (default: 256)\n"
+              << "  --sessions               Run the sequenced session echo service on the TCP port\n"
+              << "  --resend-store=N         Messages kept per session for replay (default 65536)\n"
+              << "  --resend-store-mb=N      Payload MB kept per session for replay (default 64)\n"
+              << "  --session-idle-ms=N      Drop sessions without a connection this long, 0 never (default 60000)\n"
+              << "  --quic-aead              AES-128-GCM packet and header protection on the QUIC port\n"
+              << "  --compress=MODE          LZ-compressed TCP frames and UDP datagrams: message|stream\n"
+              << "  --compress-level=N       Compression effort 1-9 (default 1)\n"
+              << "  --dictionary=PATH        Dictionary shared with clients for --compress\n"
+              << "  --pack-mtu[=N]           Pack UDP and QUIC echo messages into datagrams of up to N bytes (default " << PACK_DEFAULT_MTU << ")\n"
+              << "  --pack-deadline-us=N     Longest a partial packed datagram waits for more messages (default 50)\n"
+              << "  --fix                    FIX 4.4 order entry on the TCP port: NewOrderSingle gets an ExecutionReport,\n"
+              << "                           OrderCancelRequest cancels by OrderID, MarketDataRequest gets the top of book\n"
+              << "  --fix-scan=S             FIX delimiter scan scalar|sse2|avx2 (default: best available)\n"
+              << "  --ws-port=N              WebSocket echo on port N; connections to " << WS_FEED_PATH << " get every inbound message\n"
+              << "  --ws-unmask=S            WebSocket payload unmask scalar|sse2|avx2 (default: best available)\n"
+              << "  --analytics              Per-symbol VWAP, OHLC bars and volume profile over inbound trades\n"
+              << "  --bar-intervals-ms=N[,N...] Analytics bar intervals, up to " << ANALYTICS_LANES << " (default 1000,10000,60000)\n"
+              << "  --analytics-port=N       Publish closed bars to subscribers on TCP port N\n"
+              << "  --analytics-update=S     Analytics bar update scalar|avx2 (default: best available)\n"
+              << "  --tick-store=DIR         Persist inbound trades as per-symbol, per-day column files under DIR\n"
+              << "  --tick-query-port=N      Serve time-range tick queries from the store on TCP port N\n"
+              << "  --tick-send=S            Tick query replies by sendfile|copy (default sendfile)\n"
+              << "  --service-time-us=N      Sleep N us per echoed request, to make this replica slow\n"
+              << "  --stall-every=N          Stall every Nth echoed request by --stall-us, to give this replica a tail\n"
+              << "  --stall-us=N             Length of those stalls (default 0)\n"
+              << "  --drop-every=N           Ignore every Nth UDP/QUIC echo request, as if lost\n"
+              << "  --dedupe=on|off          Answer duplicate idempotent UDP requests from a cache (default on)\n"
+              << "  --tx-queue=N             Replies queued per UDP/QUIC socket while it is full, 0 to drop (default " << TX_QUEUE_DEFAULT << ")\n"
+              << "  --tx-drop=P              Full transmit queue drops the newest|oldest reply (default oldest)\n"
+              << "  --tx-saturate-every=N    Treat the socket as full on every Nth UDP/QUIC reply, until EPOLLOUT\n"
+              << "  --tcp-handler=H          TCP echo connections served by callback|coroutine (default callback)\n"
+              << "  --tcp-idle-timeout-ms=N  Coroutine handler: close TCP connections idle this long (default 0, never)\n";
+}
+
+bool parse_args(int argc, char* argv[], ServerConfig& config) {
+    bool policy_set = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        std::string key = arg.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+        if (key == "--help") {
+            return false;
+        } else if (key == "--port-base") {
+            config.tcp_port = atoi(value.c_str());
+            config.udp_port = config.tcp_port + 1;
+            config.quic_port = config.tcp_port + 2;
+        } else if (key == "--journal") {
+            config.journal_path = value;
+        } else if (key == "--journal-policy") {
+            if (!parse_journal_policy(value, config.journal_policy)) {
+                std::cerr << "Unknown journal policy: " << value << std::endl;
+                return false;
+            }
+            policy_set = true;
+        } else if (key == "--journal-size-mb") {
+            config.journal_size_mb = strtoull(value.c_str(), nullptr, 10);
+        } else if (key == "--commit-every") {
+            config.commit_every = atoi(value.c_str());
+        } else if (key == "--commit-interval-us") {
+            config.commit_interval_us = atoi(value.c_str());
+        } else if (key == "--replay") {
+            config.replay = true;
+        } else if (key == "--partitions") {
+            config.partitions = std::max(1, atoi(value.c_str()));
+        } else if (key == "--replicate-to") {
+            config.replicate_to = value;
+        } else if (key == "--standby-port") {
+            config.standby_port = atoi(value.c_str());
+        } else if (key == "--failover-timeout-ms") {
+            config.failover_timeout_ms = atoi(value.c_str());
+        } else if (key == "--stats-port") {
+            config.stats_port = atoi(value.c_str());
+        } else if (key == "--proxy") {
+            std::stringstream list(value);
+            std::string backend;
+            while (std::getline(list, backend, ',')) {
+                if (!backend.empty()) config.proxy_backends.push_back(backend);
+            }
+        } else if (key == "--proxy-idle-ms") {
+            config.proxy_idle_ms = atoi(value.c_str());
+        } else if (key == "--gateway") {
+            config.gateway_upstream = value;
+        } else if (key == "--upstream-connections") {
+            config.upstream_connections = atoi(value.c_str());
+        } else if (key == "--pipeline-stage") {
+            config.pipeline_stage = value;
+        } else if (key == "--downstream") {
+            config.downstream = value;
+        } else if (key == "--quote-encoding") {
+            config.quote_encoding = value;
+        } else if (key == "--refresh-every") {
+            config.refresh_every = atoi(value.c_str());
+        } else if (key == "--sessions") {
+            config.sessions = true;
+        } else if (key == "--resend-store") {
+            config.resend_store = atoi(value.c_str());
+        } else if (key == "--resend-store-mb") {
+            config.resend_store_mb = std::max(1, atoi(value.c_str()));
+        } else if (key == "--session-idle-ms") {
+            config.session_idle_ms = atoi(value.c_str());
+        } else if (key == "--quic-aead") {
+            config.quic_aead = true;
+        } else if (key == "--compress") {
+            LzMode mode;
+            if (!parse_lz_mode(value, mode)) {
+                std::cerr << "Unknown compression mode: " << value << std::endl;
+                return false;
+            }
+            config.compression = value;
+        } else if (key == "--compress-level") {
+            config.compression_level = atoi(value.c_str());
+        } else if (key == "--dictionary") {
+            config.dictionary_path = value;
+        } else if (key == "--fix") {
+            config.fix = true;
+        } else if (key == "--fix-scan") {
+            config.fix_scan = value;
+        } else if (key == "--analytics") {
+            config.analytics = true;
+        } else if (key == "--bar-intervals-ms") {
+            config.bar_intervals_ms.clear();
+            std::stringstream list(value);
+            std::string item;
+            while (std::getline(list, item, ',')) {
+                config.bar_intervals_ms.push_back(atoi(item.c_str()));
+            }
+        } else if (key == "--analytics-port") {
+            config.analytics_port = atoi(value.c_str());
+        } else if (key == "--service-time-us") {
+            config.service_time_us = atoi(value.c_str());
+        } else if (key == "--stall-every") {
+            config.stall_every = atoi(value.c_str());
+        } else if (key == "--stall-us") {
+            config.stall_us = atoi(value.c_str());
+        } else if (key == "--drop-every") {
+            config.drop_every = atoi(value.c_str());
+        } else if (key == "--dedupe") {
+            if (value != "on" && value != "off") {
+                std::cerr << "Unknown dedupe setting: " << value << std::endl;
+                return false;
+            }
+            config.dedupe = value == "on";
+        } else if (key == "--tx-queue") {
+            config.tx_queue = strtoul(value.c_str(), nullptr, 10);
+        } else if (key == "--tx-drop") {
+            if (value == "newest") {
+                config.tx_drop = TxDropPolicy::Newest;
+            } else if (value == "oldest") {
+                config.tx_drop = TxDropPolicy::Oldest;
+            } else {
+                std::cerr << "Unknown tx drop policy: " << value << std::endl;
+                return false;
+            }
+        } else if (key == "--tx-saturate-every") {
+            config.tx_saturate_every = atoi(value.c_str());
+        } else if (key == "--tcp-handler") {
+            if (value == "callback") {
+                config.tcp_handler = TcpHandler::Callback;
+            } else if (value == "coroutine") {
+                config.tcp_handler = TcpHandler::Coroutine;
+            } else {
+                std::cerr << "Unknown TCP handler: " << value << std::endl;
+                return false;
+            }
+        } else if (key == "--tcp-idle-timeout-ms") {
+            config.tcp_idle_timeout_ms = atoi(value.c_str());
+        } else if (key == "--tick-store") {
+            config.tick_store = value;
+        } else if (key == "--tick-query-port") {
+            config.tick_query_port = atoi(value.c_str());
+        } else if (key == "--tick-send") {
+            if (value != "sendfile" && value != "copy") {
+                std::cerr << "Unknown tick send: " << value << std::endl;
+                return false;
+            }
+            config.tick_send_copy = value == "copy";
+        } else if (key == "--analytics-update") {
+            config.analytics_update = value;
+        } else if (key == "--ws-port") {
+            config.ws_port = atoi(value.c_str());
+        } else if (key == "--ws-unmask") {
+            config.ws_unmask = value;
+        } else if (key == "--pack-mtu") {
+            config.pack_mtu = value.empty() ? (int)PACK_DEFAULT_MTU : atoi(value.c_str());
+        } else if (key == "--pack-deadline-us") {
+            config.pack_deadline_us = atoi(value.c_str());
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return false;
+        }
+    }
+
+    if (!config.journal_path.empty() && !policy_set) {
+        config.journal_policy = JournalPolicy::Async;
+    }
+    // The coroutine handler runs the plain echo and never reaches handle_tcp_client
+    if (config.tcp_handler == TcpHandler::Coroutine && (config.fix || !config.compression.empty())) {
+        std::cerr << "--tcp-handler=coroutine does not combine with --fix or --compress" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    ServerConfig config;
+    if (!parse_args(argc, argv, config)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (!config.proxy_backends.empty()) {
+        ProxyServer proxy(config);
+        if (!proxy.initialize()) {
+            std::cerr << "Failed to initialize proxy" << std::endl;
+            return 1;
+        }
+        proxy.run();
+        return 0;
+    }
+
+    if (!config.gateway_upstream.empty()) {
+        GatewayServer gateway(config);
+        if (!gateway.initialize()) {
+            std::cerr << "Failed to initialize gateway" << std::endl;
+            return 1;
+        }
+        gateway.run();
+        return 0;
+    }
+
+    if (!config.pipeline_stage.empty()) {
+        PipelineStage stage(config);
+        if (!stage.initialize()) {
+            std::cerr << "Failed to initialize pipeline stage" << std::endl;
+            return 1;
+        }
+        stage.run();
+        return 0;
+    }
+
+    if (config.sessions) {
+        SessionServer sessions(config);
+        if (!sessions.initialize()) {
+            std::cerr << "Failed to initialize session server" << std::endl;
+            return 1;
+        }
+        sessions.run();
+        return 0;
+    }
+
+    EpollServer server(config);
     
     if (!server.initialize()) {
         std::cerr << "Failed to initialize server" << std::endl;
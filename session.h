@@ -0,0 +1,109 @@
+#pragma once
+
+// Sequenced session layer over TCP. Both sides number their outbound DATA
+// messages and keep them in a bounded resend store until the peer's
+// cumulative ack covers them. After a reconnect the client logs on with the
+// next sequence it expects; the server answers with the next sequence it
+// expects from the client, and each side resends everything after that from
+// its store. Frames use the gateway framing ([u32 length][body], length in
+// network byte order); bodies are host byte order (same-box traffic).
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string.h>
+#include <deque>
+#include <string>
+
+enum SessionMessageType : uint8_t {
+    SESSION_LOGON = 1,      // Client -> server: start or resume a session
+    SESSION_LOGON_ACK = 2,  // Server -> client, followed by the replay
+    SESSION_DATA = 3
+};
+
+const uint8_t SESSION_FLAG_RESET = 1;  // Requested messages already left the store
+
+struct SessionLogon {
+    uint8_t type;
+    uint8_t reserved[7];
+    uint64_t session_id;
+    uint64_t next_expected;   // First server sequence the client has not seen
+};
+
+struct SessionLogonAck {
+    uint8_t type;
+    uint8_t flags;            // SESSION_FLAG_RESET
+    uint8_t reserved[6];
+    uint64_t next_expected;   // First client sequence the server has not seen
+    uint64_t next_sequence;   // Sequence of the next new server message; the replay ends before it
+    uint64_t first_replayed;  // Where the replay starts
+};
+
+// Followed by the payload
+struct SessionDataHeader {
+    uint8_t type;
+    uint8_t reserved[7];
+    uint64_t sequence;
+    uint64_t ack;             // Cumulative: every sequence below this was received
+};
+
+// Outbound messages that may still have to be resent, oldest first.
+// Sequences start at 1. When more than `limit` messages or `byte_limit`
+// payload bytes are held, the oldest are dropped (the newest is always
+// kept) and a peer asking for them has to accept a reset.
+class SessionResendStore {
+private:
+    std::deque<std::string> messages;
+    uint64_t first;
+    size_t limit;
+    size_t byte_limit;
+    size_t bytes = 0;
+
+    void pop_front() {
+        bytes -= messages.front().size();
+        messages.pop_front();
+        first++;
+    }
+
+public:
+    explicit SessionResendStore(size_t max_messages = 65536, size_t max_bytes = SIZE_MAX)
+        : first(1), limit(max_messages), byte_limit(max_bytes) {}
+
+    // Stores the payload under the next sequence and returns that sequence
+    uint64_t add(const char* payload, size_t length) {
+        messages.emplace_back(payload, length);
+        bytes += length;
+        while (messages.size() > limit || (bytes > byte_limit && messages.size() > 1)) pop_front();
+        return first + messages.size() - 1;
+    }
+
+    // Forgets everything below sequence (the peer acknowledged it)
+    void trim(uint64_t sequence) {
+        while (first < sequence && !messages.empty()) pop_front();
+    }
+
+    const std::string* find(uint64_t sequence) const {
+        if (sequence < first || sequence >= first + messages.size()) return nullptr;
+        return &messages[sequence - first];
+    }
+
+    uint64_t first_sequence() const {
+        return first;
+    }
+
+    uint64_t next_sequence() const {
+        return first + messages.size();
+    }
+};
+
+inline void append_session_data(std::string& out, uint64_t sequence, uint64_t ack,
+                                const char* payload, size_t length) {
+    SessionDataHeader header;
+    memset(&header, 0, sizeof(header));
+    header.type = SESSION_DATA;
+    header.sequence = sequence;
+    header.ack = ack;
+    uint32_t prefix = htonl(sizeof(header) + length);
+    out.append((const char*)&prefix, sizeof(prefix));
+    out.append((const char*)&header, sizeof(header));
+    out.append(payload, length);
+}
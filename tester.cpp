@@ -12,6 +12,7 @@
 #include <iostream>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <string.h>
@@ -27,6 +28,36 @@
 #include <fstream>
 #include <iomanip>
 #include <sstream>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <map>
+#include <functional>
+#include <memory>
+
+#include "aead.h"
+#include "analytics.h"
+#include "balancer.h"
+#include "client.h"
+#include "compress.h"
+#include "feed.h"
+#include "fix.h"
+#include "hash_ring.h"
+#include "hedge.h"
+#include "idempotency.h"
+#include "journal.h"
+#include "logbuffer.h"
+#include "market.h"
+#include "packing.h"
+#include "pipeline.h"
+#include "quote.h"
+#include "rto.h"
+#include "script.h"
+#include "session.h"
+#include "tickstore.h"
+#include "txqueue.h"
+#include "ws.h"
 
 
 const int TCP_PORT = 8080;
@@ -41,7 +72,249 @@ const int MAX_CLIENTS = 500;  // Reduce max to avoid resource exhaustion
 const int TEST_DURATION_SEC = 15;  // Duration for each client count test
 const int RAMP_UP_DURATION_SEC = 5;  // Gradual ramp-up per test
 
+// Replay test configuration
+const int REPLAY_SYMBOLS = 10000;
+const uint64_t REPLAY_LIVE_ORDERS = 100000;  // Resting orders before cancels catch up
+const int REPLAY_QUIC_EVERY = 1000;          // Every Nth record is a QUIC message
+
+// Transport comparison (logbuffer scenario)
+const uint32_t STREAM_MAGIC = 0x314D5453;     // "STM1"
+const size_t TCP_STREAM_WINDOW = 64 * 1024;   // Echo bytes a TCP stream may have outstanding
+const uint64_t STREAM_MAX_WAIT_NS = 1000000;  // Longest a stream worker sleeps in ppoll
+const uint64_t STREAM_TICK_NS = 20000;        // Messages falling due within a tick go out together
+const int STREAM_RECV_BATCH = 64;
+const size_t STREAM_DATAGRAM_SIZE = 2048;     // Receive slot of the UDP and QUIC streams
+
+// QUIC crypto scenario: the larger payload tried besides the short text
+// message; it still fits the unprotected path's 1 KB buffers
+const size_t QUIC_LARGE_PAYLOAD = 1000;
+
+// Compression scenario: feed messages the dictionary is trained on
+const int COMPRESSION_TRAINING_SAMPLES = 2000;
+
+// Quote encoding scenario
+const int QUOTE_SYMBOLS = 256;
+const size_t QUOTE_BATCH = 64;             // Most updates the producer puts in one frame
+const size_t QUOTE_CODEC_UPDATES = 1000000;
+const uint64_t QUOTE_FEED_SEED = 7;        // Subscribers replay the producer's feed to check what they decode
+const uint64_t QUOTE_LATENCY_SAMPLE = 16;  // Subscribers time every Nth update
+const size_t FIX_PARSE_MESSAGES = 200000;  // Offline parser benchmark
+const uint64_t FIX_WINDOW = 32;            // Orders each FIX client keeps in flight
+const int FIX_SYMBOLS = 64;
+const char FIX_TEST_TIME[] = "20240102-09:30:00.000";
+const int SCRIPT_SUBSCRIPTIONS = 50;                     // Symbols each scripted trader subscribes to
+const uint64_t SCRIPT_RAMP_NS = 1000000000ULL;           // Scripted sessions start spread over this long
+const uint64_t SCRIPT_STEP_TIMEOUT_NS = 5000000000ULL;   // Before a script step is failed
+const int HANDLER_ROUNDS = 2;                            // Handlers scenario: callback/coroutine alternations
+const uint64_t WS_FEED_MAGIC = 0x5753464545444d47ull;  // Marks the websocket scenario's feed messages
+const uint64_t WS_LATENCY_SAMPLE = 16;                 // Feed subscribers time every Nth message
+const char WS_CLIENT_KEY[] = "dGhlIHNhbXBsZSBub25jZQ==";
+const int ANALYTICS_SYMBOLS = 10000;
+const size_t ANALYTICS_OFFLINE_TRADES = 10000000;
+const size_t ANALYTICS_BATCH = 64;                  // Trades per producer datagram
+const char ANALYTICS_TEST_INTERVALS_MS[] = "100,1000";
+const int TICK_SYMBOLS = 100;
+const int64_t TICK_TEST_START_NS = 1704153600LL * 1000000000LL;  // 2024-01-02 00:00 UTC
+const int TICK_TEST_DAYS = 2;
+const int SHARD_SYMBOLS = 10000;
+const int SHARD_BATCH = 32;              // Messages per client round trip, each routed by its symbol
+const int SHARD_PORT_STRIDE = 10;        // Shard k listens from port_base + 100 + k * SHARD_PORT_STRIDE
+const int SHARD_REBALANCE_SHARDS = 4;    // Shards before the rebalance run adds one and kills one
+const int SHARD_SAMPLE_MS = 50;          // Throughput timeline resolution of the rebalance run
+const size_t BALANCE_REQUEST_SIZE = 64;
+const int BALANCE_THINK_US = 100;        // Pause between a client's requests
+const uint64_t UDP_FIXED_RTO_NS = 5000000000ULL;      // --rto=fixed: before a UDP request is sent again
+const uint64_t UDP_GIVE_UP_NS = 15000000000ULL;       // Three fixed timeouts
+const uint64_t QUIC_FIXED_RTO_NS = 1000000000ULL;     // --rto=fixed: the give-up, so QUIC never retransmits
+const uint64_t QUIC_GIVE_UP_NS = 1000000000ULL;
+const uint64_t TCP_REPLY_TIMEOUT_NS = 5000000000ULL;   // Before a TCP connection is given up
+const uint64_t WORKER_CONNECT_TIMEOUT_NS = 1000000000ULL;  // Before a TCP worker gives up on connecting
+
+// Command line options: an optional scenario name followed by --key=value flags
+struct TesterOptions {
+    std::string scenario = "scalability";
+    std::string server_binary = "./build/server";
+    int port_base = 9000;            // Base port for servers spawned by scenarios
+    int clients = 100;               // Client count for single-point scenarios
+    int duration_sec = TEST_DURATION_SEC;
+    std::string journal_path = "/tmp/nettest-journal.bin";
+    std::string tick_dir = "/tmp/nettest-ticks";  // Tickstore scenario: store directory, removed afterwards
+    uint64_t tick_rows = 200000000;               // Tickstore scenario: rows written offline
+    std::vector<uint64_t> replay_messages = {10000000, 100000000};
+    int upstream_connections = 4;    // Gateway scenario: connections from gateway to backend
+    int subscribers = 4;             // Pipeline scenario: market data subscribers
+    int streams = 1;                 // Logbuffer scenario: concurrent message streams
+    uint64_t message_rate = 1000000; // Logbuffer and session scenarios: messages per second over all streams
+    int disconnect_every_ms = 1000;  // Session scenario: time between injected disconnects
+    int outage_ms = 50;              // Session scenario: how long the link stalls before the reset
+    std::vector<int> compression_levels = {1, 3, 6, 9};
+    std::string dictionary_path = "/tmp/nettest-dictionary.bin";
+    size_t dictionary_size = 4096;
+    int refresh_every = 256;         // Quotes scenario: delta encoding full refresh interval
+    size_t pack_mtu = PACK_DEFAULT_MTU;
+    std::vector<int> pack_deadlines_us = {20, 100, 500};
+    int ws_port = 0;                 // WebSocket port of the server under test; the sweep adds WS when set
+    std::vector<int> shard_counts = {1, 2, 4, 8};  // Shards scenario: cluster sizes swept
+    int vnodes = 128;                // Shards scenario: virtual nodes per shard on the ring
+    int replicas = 3;                // Balance scenario: equivalent servers
+    int service_us = 50;             // Balance scenario: service time of every replica
+    int slow_service_us = 1000;      // Balance scenario: service time of the slowed replica
+    int stall_every = 100;           // Hedge and dedupe scenarios: servers stall every Nth request...
+    int stall_us = 2000;             // ...for this long
+    int drop_every = 100;            // RTO and dedupe scenarios: the server ignores every Nth datagram
+    int tx_saturate_every = 100;     // Txqueue scenario: the server's socket acts full on every Nth reply...
+    int tx_queue = 2;                // ...and the queue size both drop policies are compared at
+    int sdk_connections = 4;         // SDK scenario: connections or sockets in the client pool...
+    int sdk_pipeline = 16;           // ...and requests in flight on each
+    int script_sessions = 2000;      // Script scenario: scripted FIX traders...
+    int script_threads = 1;          // ...over this many client threads
+    int script_orders = 20;          // Orders each trader sends...
+    int script_order_rate = 20;      // ...at this many per second
+};
+
+// Which shard owns each symbol, and where the shards listen. Replaced as a
+// whole when the cluster changes; clients pick up the new one by version.
+struct ShardRouting {
+    ConsistentHashRing ring;
+    std::map<int, int> ports;        // Shard -> TCP port
+
+    explicit ShardRouting(int vnodes) : ring(vnodes) {}
+};
+
+// What one balanced client saw
+struct BalanceClientStats {
+    uint64_t failures = 0;
+    std::vector<double> latencies_us;
+};
+
+// What one shard client saw
+struct ShardClientStats {
+    uint64_t messages = 0;
+    uint64_t failures = 0;           // Messages on a connection that failed
+    std::map<int, uint64_t> per_shard;
+    std::vector<double> latencies_us;  // Per batch round trip
+};
+
+// What one quote subscriber saw
+struct QuoteSubscriberStats {
+    uint64_t updates = 0;
+    uint64_t wire_bytes = 0;      // Frames including their length prefix
+    uint64_t decode_ns = 0;
+    uint64_t skipped = 0;         // Deltas for symbols with no refresh seen yet
+    uint64_t mismatches = 0;      // Decoded updates differing from the producer's feed
+    double sync_ms = 0;           // Connect to the last skipped delta
+    std::vector<double> latencies_us;
+    bool failed = false;
+};
+
+// What one WebSocket feed subscriber saw
+struct WsFeedStats {
+    uint64_t messages = 0;
+    uint64_t frames_bytes = 0;    // Wire bytes, frame headers included
+    uint64_t gaps = 0;            // Messages missing from the sequence
+    std::vector<double> latencies_us;
+    bool failed = false;
+};
+
+// What the analytics scenario's bar subscriber saw
+struct AnalyticsSubscriberStats {
+    uint64_t frames = 0;
+    uint64_t bars = 0;
+    uint64_t invalid = 0;         // Bars whose OHLC/VWAP do not hold together
+    std::vector<double> latencies_us;  // Bar boundary to frame arrival
+    bool failed = false;
+};
+
+// Feed message the websocket scenario sends as one UDP datagram
+struct WsFeedMessage {
+    uint64_t magic;
+    uint64_t sequence;
+    uint64_t sent_ns;
+    uint64_t reserved;
+};
+
+// What one FIX order entry client saw
+struct FixClientStats {
+    uint64_t orders = 0;
+    uint64_t reports = 0;         // ExecutionReports received
+    uint64_t rejects = 0;
+    uint64_t parsed = 0;          // Messages parsed, session messages included
+    uint64_t parse_ns = 0;
+    uint64_t errors = 0;          // Unparseable or unexpected replies
+    std::vector<double> latencies_us;
+    bool failed = false;
+};
+
+// Small message sent by the transport comparison streams and echoed back.
+// send_ns is when the message was due, not when it got out, so time spent
+// blocked on flow control counts as latency.
+struct StreamMessage {
+    uint64_t send_ns;
+    uint64_t sequence;
+    uint32_t stream;
+    uint32_t magic;
+    uint64_t reserved;
+};
+
+struct StreamStats {
+    std::vector<double> latencies_us;
+    uint64_t messages = 0;
+
+    // Session streams
+    uint64_t reconnects = 0;
+    uint64_t replayed = 0;          // Messages received while resyncing
+    uint64_t resent = 0;            // Our messages sent again after a logon
+    uint64_t duplicates = 0;
+    uint64_t gaps = 0;              // Echoes missing from the sequence: must stay 0
+    uint64_t resets = 0;            // Logons the server could not fully replay
+    std::vector<double> resync_ms;  // Reconnect to replay complete
+    double replay_seconds = 0;
+
+    // UDP and QUIC streams
+    uint64_t sent = 0;
+    uint64_t syscalls = 0;
+    uint64_t datagrams = 0;         // Datagrams we sent
+
+    uint64_t naks_sent = 0;
+    uint64_t naks_received = 0;
+    uint64_t retransmitted_bytes = 0;
+    bool failed = false;
+};
+
+// One closed-loop run of the client SDK (client.h)
+struct SdkRunResult {
+    std::vector<double> latencies_ms;   // Completed requests, sorted
+    ClientCounters counters;
+    double seconds = 0;
+    uint64_t longest_gap_ns = 0;        // Longest time without a completion
+};
+
+// Steps of the scripted FIX trader, in order
+enum ScriptStep { SCRIPT_CONNECT, SCRIPT_LOGON, SCRIPT_SUBSCRIBE, SCRIPT_ORDER, SCRIPT_CANCEL, SCRIPT_LOGOUT, SCRIPT_STEPS };
+const char* const SCRIPT_STEP_NAMES[SCRIPT_STEPS] = {"connect", "logon", "subscribe", "order", "cancel", "logout"};
+
+// Shared by the scripted sessions of one thread. Messages are built into
+// out and sent at once; a parsed message is valid until its session next
+// suspends.
+struct ScriptContext {
+    struct sockaddr_in server;
+    FeedGenerator names{QUOTE_FEED_SEED, FIX_SYMBOLS};
+    FixScan scan = fix_best_scan();
+    FixMessage message;
+    FixBuilder builder;
+    std::string out;
+    int orders = 0;                     // Per session
+    uint64_t order_interval_ns = 0;
+    uint64_t sent = 0;                  // Messages
+    uint64_t received = 0;
+    uint64_t rejects = 0;               // Session and cancel rejects
+    uint64_t completed = 0;             // Sessions that logged out
+    uint64_t failures[SCRIPT_STEPS] = {};
+    std::vector<double> latencies_us[SCRIPT_STEPS];
+};
+
 struct ScalabilityResult {
+    std::string protocol;  // Protocol or scenario label written to the log
     int client_count;
     std::string timestamp;
     double throughput_mbps;
@@ -53,8 +326,125 @@ struct ScalabilityResult {
     int successful_requests;
 };
 
+// A build/server child process for scenarios that need a specific server
+// configuration. Its stdout goes to /dev/null; stderr is left attached.
+class ServerProcess {
+private:
+    pid_t pid;
+    int ready_port;
+
+public:
+    ServerProcess() : pid(-1), ready_port(0) {}
+
+    ~ServerProcess() {
+        stop();
+    }
+
+    // Returns once the server accepts TCP connections on port (its TCP port,
+    // or for a standby, its stats port)
+    bool start(const std::string& binary, const std::vector<std::string>& args, int port,
+               int ready_timeout_ms = 10000) {
+        ready_port = port;
+        pid = fork();
+        if (pid == -1) {
+            perror("fork");
+            return false;
+        }
+
+        if (pid == 0) {
+            int devnull = open("/dev/null", O_WRONLY);
+            if (devnull != -1) dup2(devnull, STDOUT_FILENO);
+
+            std::vector<char*> argv;
+            argv.push_back(const_cast<char*>(binary.c_str()));
+            for (const auto& arg : args) argv.push_back(const_cast<char*>(arg.c_str()));
+            argv.push_back(nullptr);
+            execv(binary.c_str(), argv.data());
+            perror("execv");
+            _exit(127);
+        }
+
+        return wait_ready(ready_timeout_ms);
+    }
+
+    // Polls the ready port until the server accepts connections
+    bool wait_ready(int timeout_ms) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while (std::chrono::steady_clock::now() < deadline) {
+            int status;
+            if (waitpid(pid, &status, WNOHANG) == pid) {
+                std::cerr << "Server process exited during startup" << std::endl;
+                pid = -1;
+                return false;
+            }
+
+            int sock = socket(AF_INET, SOCK_STREAM, 0);
+            struct sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(ready_port);
+            inet_pton(AF_INET, SERVER_IP, &addr.sin_addr);
+            bool ready = connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+            close(sock);
+            if (ready) return true;
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        std::cerr << "Server on port " << ready_port << " did not become ready" << std::endl;
+        return false;
+    }
+
+    void stop(int sig = SIGTERM) {
+        if (pid <= 0) return;
+        kill(pid, sig);
+        waitpid(pid, nullptr, 0);
+        pid = -1;
+    }
+
+    pid_t get_pid() const {
+        return pid;
+    }
+};
+
 class ScalabilityTester {
 private:
+    TesterOptions options;
+    int tcp_port = TCP_PORT;
+    int udp_port = UDP_PORT;
+    int quic_port = QUIC_PORT;
+    int ws_port = 0;
+    bool think_time = true;  // false: clients send back to back for maximum throughput
+    bool quic_aead = false;  // QUIC clients protect packets like a --quic-aead server expects
+    size_t quic_payload = 0; // QUIC payload bytes; 0 sends the short text message
+    std::atomic<long long> quic_crypto_ns{0};       // Client time in quic_protect/quic_unprotect
+    std::atomic<long long> quic_crypto_packets{0};
+    std::string compression;  // Feed clients: "", "message" or "stream", as the server's --compress
+    int compression_level = 1;
+    std::string dictionary;
+    std::atomic<long long> codec_ns{0};        // Client time compressing and decompressing
+    std::atomic<long long> codec_messages{0};
+    std::atomic<long long> plain_bytes{0};     // Feed payload bytes before compression, both ways
+    std::shared_ptr<const ShardRouting> shard_routing;  // Read with std::atomic_load
+    std::mutex shard_mutex;                             // Serialises routing changes
+    std::atomic<uint64_t> shard_version{0};
+    std::atomic<uint64_t> shard_delivered{0};
+    std::atomic<uint64_t> shard_removed_ns{0};          // When a failed shard left the ring
+    bool shard_by_symbol = true;                        // false: a client's messages all go to its own shard
+    bool slow_replica_running = false;                  // Balance scenario: replica 0 restarted slow
+    std::unique_ptr<HedgeTrigger> hedge;  // Set: TCP, UDP and QUIC clients hedge their requests (hedge.h)
+    int hedge_port_base = 0;              // Replica hedges go to; 0 hedges over a second path to the same server
+    bool fixed_rto = false;               // UDP and QUIC clients retransmit after a fixed timeout, not the RTO (rto.h)
+    std::atomic<long long> retransmits{0};
+    std::atomic<long long> spurious_retransmits{0};  // Answered by an earlier send than the last
+    std::vector<double> recovery_latencies;          // Ms of requests answered only after a retransmission, under results_mutex
+    std::atomic<long long> request_timeouts{0};      // Given up on
+    std::atomic<long long> srtt_ns{0};               // Final SRTT of every socket with samples, summed
+    std::atomic<long long> srtt_sockets{0};
+    std::atomic<long long> codec_errors{0};    // Echoes that did not decode to what was sent
+    bool datagram_quic = false;   // Datagram streams: QUIC port instead of UDP
+    size_t pack_mtu = 0;          // Datagram streams: pack messages up to this size, 0 for one per datagram
+    uint64_t pack_deadline_ns = 0;
+    std::function<void()> steady_state_probe;  // Run once all clients are up, before stopping
     std::atomic<int> connections{0};
     std::atomic<int> active_connections{0};
     std::atomic<int> peak_connections{0};
@@ -62,12 +452,13 @@ private:
     std::atomic<bool> stop_test{false};
     std::mutex results_mutex;
     std::vector<double> latencies;
+    size_t ramped_requests = 0;  // latencies.size() once every client had started
     std::mt19937 rng{std::random_device{}()};
     std::ofstream log_file;
     std::string log_filename;  // Store the filename for later reference
 
 public:
-    ScalabilityTester() {
+    explicit ScalabilityTester(const TesterOptions& opts) : options(opts), ws_port(opts.ws_port) {
         // Generate timestamped filename
         auto now = std::chrono::system_clock::now();
         auto time_t = std::chrono::system_clock::to_time_t(now);
@@ -100,329 +491,5037 @@ public:
         run_tcp_scalability();
         run_udp_scalability();
         run_quic_scalability();
+        if (ws_port > 0) {
+            run_ws_scalability();
+        }
         
         std::cout << "Scalability tests completed. Results logged to " << log_filename << std::endl;
     }
 
-private:
-    void write_log_header() {
-        if (!log_file.is_open()) return;
-        
-        log_file << "\n=== SCALABILITY TEST STARTED ===\n";
-        log_file << "Timestamp: " << get_timestamp() << "\n";
-        log_file << "Format: Protocol,ClientCount,Timestamp,ThroughputMBps,ConnectionsPerSec,PeakConcurrent,SuccessRate,TotalReqs,SuccessfulReqs,P1,P2,...,P100\n\n";
-        log_file.flush();
+    // Measures the latency cost of each journal durability policy against a
+    // server with journaling disabled, for TCP and UDP echo traffic.
+    void run_journal_tests() {
+        std::cout << "Starting journal durability tests with " << options.clients << " clients..." << std::endl;
+        write_log_header();
+
+        const char* policies[] = {"none", "async", "group", "sync"};
+        const char* protocols[] = {"TCP", "UDP"};
+
+        for (const char* policy : policies) {
+            std::cout << "\n=== Journal policy: " << policy << " ===" << std::endl;
+            unlink(options.journal_path.c_str());
+
+            std::vector<std::string> args;
+            args.push_back("--port-base=" + std::to_string(options.port_base));
+            if (strcmp(policy, "none") != 0) {
+                args.push_back("--journal=" + options.journal_path);
+                args.push_back(std::string("--journal-policy=") + policy);
+                args.push_back("--journal-size-mb=256");
+            }
+
+            ServerProcess server;
+            if (!server.start(options.server_binary, args, options.port_base)) {
+                std::cerr << "Skipping journal policy " << policy << std::endl;
+                continue;
+            }
+            use_port_base(options.port_base);
+
+            for (const char* protocol : protocols) {
+                std::cout << "Testing " << protocol << " with journal policy " << policy << "..." << std::endl;
+                auto result = test_with_client_count(protocol, options.clients);
+                result.protocol = std::string(protocol) + "+journal:" + policy;
+                log_result(result);
+                std::this_thread::sleep_for(std::chrono::seconds(2));
+            }
+
+            server.stop();
+        }
+
+        unlink(options.journal_path.c_str());
+        std::cout << "Journal tests completed. Results logged to " << log_filename << std::endl;
     }
-    
-    void run_tcp_scalability() {
-        std::cout << "\n=== TCP Scalability Test ===" << std::endl;
-        
-        // Generate client count sequence matching MAX_CLIENTS = 500
-        std::vector<int> client_counts = {10, 20, 50, 100, 200, 500};
-        
-        for (int client_count : client_counts) {
-            std::cout << "Testing TCP with " << client_count << " clients..." << std::endl;
-            
-            auto result = test_with_client_count("TCP", client_count);
-            log_result(result);
-            
-            // Brief pause between tests
-            std::this_thread::sleep_for(std::chrono::seconds(2));
+
+    // Compares clients talking to a backend directly with clients going through
+    // the L4 proxy, first with think time (latency) and then back to back
+    // (maximum throughput).
+    void run_proxy_tests() {
+        std::cout << "Starting L4 proxy tests with " << options.clients << " clients..." << std::endl;
+
+        int proxy_base = options.port_base;
+        int backend_bases[] = {options.port_base + 100, options.port_base + 200};
+        ServerProcess backends[2];
+        std::string backend_list;
+        for (int i = 0; i < 2; i++) {
+            if (!backends[i].start(options.server_binary,
+                                   {"--port-base=" + std::to_string(backend_bases[i])}, backend_bases[i])) {
+                return;
+            }
+            backend_list += (i ? ",127.0.0.1:" : "127.0.0.1:") + std::to_string(backend_bases[i]);
+        }
+        ServerProcess proxy;
+        if (!proxy.start(options.server_binary,
+                         {"--port-base=" + std::to_string(proxy_base), "--proxy=" + backend_list},
+                         proxy_base)) {
+            return;
+        }
+
+        write_log_header();
+        const char* protocols[] = {"TCP", "UDP", "QUIC"};
+        for (bool max_rate : {false, true}) {
+            think_time = !max_rate;
+            for (const char* protocol : protocols) {
+                for (bool via_proxy : {false, true}) {
+                    use_port_base(via_proxy ? proxy_base : backend_bases[0]);
+                    std::cout << "Testing " << protocol << (via_proxy ? " through the proxy" : " direct")
+                              << (max_rate ? " at maximum rate" : "") << "..." << std::endl;
+
+                    auto result = test_with_client_count(protocol, options.clients);
+                    result.protocol = std::string(protocol) + (via_proxy ? "+proxy" : "-direct") +
+                                      (max_rate ? "-max" : "");
+                    log_result(result);
+                    std::this_thread::sleep_for(std::chrono::seconds(2));
+                }
+            }
         }
+        think_time = true;
+
+        std::cout << "Proxy tests completed. Results logged to " << log_filename << std::endl;
     }
-    
-    void run_udp_scalability() {
-        std::cout << "\n=== UDP Scalability Test ===" << std::endl;
-        
-        // Same client count sequence for UDP
-        std::vector<int> client_counts = {10, 20, 50, 100, 200, 500};
-        
-        for (int client_count : client_counts) {
-            std::cout << "Testing UDP with " << client_count << " clients..." << std::endl;
-            
-            auto result = test_with_client_count("UDP", client_count);
+
+    // Runs framed TCP clients against a backend directly and through the
+    // multiplexing gateway, and compares latency with the connection count and
+    // resident memory the backend needs to serve them.
+    void run_gateway_tests() {
+        std::cout << "Starting gateway tests with " << options.clients << " clients..." << std::endl;
+
+        int gateway_base = options.port_base;
+        int backend_base = options.port_base + 100;
+        int backend_stats_port = backend_base + 3;
+        ServerProcess backend;
+        if (!backend.start(options.server_binary,
+                           {"--port-base=" + std::to_string(backend_base),
+                            "--stats-port=" + std::to_string(backend_stats_port)},
+                           backend_base)) {
+            return;
+        }
+        ServerProcess gateway;
+        if (!gateway.start(options.server_binary,
+                           {"--port-base=" + std::to_string(gateway_base),
+                            "--gateway=127.0.0.1:" + std::to_string(backend_base),
+                            "--upstream-connections=" + std::to_string(options.upstream_connections)},
+                           gateway_base)) {
+            return;
+        }
+
+        struct Footprint {
+            std::string backend_connections;
+            long backend_rss_kb = 0;
+            long gateway_rss_kb = 0;
+        } footprints[2];
+
+        write_log_header();
+        for (bool via_gateway : {false, true}) {
+            use_port_base(via_gateway ? gateway_base : backend_base);
+            std::cout << "Testing framed TCP " << (via_gateway ? "through the gateway" : "direct") << "..." << std::endl;
+
+            Footprint& footprint = footprints[via_gateway];
+            steady_state_probe = [&] {
+                footprint.backend_connections = query_stats(backend_stats_port)["tcp_connections"];
+                footprint.backend_rss_kb = resident_kb(backend.get_pid());
+                if (via_gateway) footprint.gateway_rss_kb = resident_kb(gateway.get_pid());
+            };
+            auto result = test_with_client_count("FRAMED", options.clients);
+            steady_state_probe = nullptr;
+            result.protocol = via_gateway ? "FRAMED+gateway" : "FRAMED-direct";
             log_result(result);
-            
-            // Brief pause between tests
             std::this_thread::sleep_for(std::chrono::seconds(2));
         }
+
+        write_section_header("GATEWAY FOOTPRINT", "Route,Clients,BackendConnections,BackendRssKB,GatewayRssKB");
+        for (bool via_gateway : {false, true}) {
+            const Footprint& footprint = footprints[via_gateway];
+            const char* route = via_gateway ? "gateway" : "direct";
+            std::cout << route << ": backend connections " << footprint.backend_connections
+                      << ", backend RSS " << footprint.backend_rss_kb << " KB, gateway RSS "
+                      << footprint.gateway_rss_kb << " KB" << std::endl;
+            if (log_file.is_open()) {
+                log_file << "GATEWAY," << route << "," << options.clients << ","
+                         << footprint.backend_connections << "," << footprint.backend_rss_kb << ","
+                         << footprint.gateway_rss_kb << "\n";
+            }
+        }
+        log_file.flush();
+
+        std::cout << "Gateway tests completed. Results logged to " << log_filename << std::endl;
     }
-    
-    void run_quic_scalability() {
-        std::cout << "\n=== QUIC Scalability Test ===" << std::endl;
-        
-        // Same client count sequence for QUIC
-        std::vector<int> client_counts = {10, 20, 50, 100, 200, 500};
-        
-        for (int client_count : client_counts) {
-            std::cout << "Testing QUIC with " << client_count << " clients..." << std::endl;
-            
-            auto result = test_with_client_count("QUIC", client_count);
+
+    // Chains gateway -> matching -> publisher servers, drives order clients
+    // into the gateway and has subscribers take the hop-timestamp trailer
+    // apart, giving per-hop and tick-to-subscriber latency.
+    void run_pipeline_tests() {
+        std::cout << "Starting pipeline test with " << options.clients << " order clients and "
+                  << options.subscribers << " subscribers..." << std::endl;
+
+        int gateway_port = options.port_base;
+        int matching_port = options.port_base + 100;
+        int publisher_port = options.port_base + 200;
+        ServerProcess publisher;
+        if (!publisher.start(options.server_binary,
+                             {"--port-base=" + std::to_string(publisher_port), "--pipeline-stage=publisher"},
+                             publisher_port)) {
+            return;
+        }
+        ServerProcess matching;
+        if (!matching.start(options.server_binary,
+                            {"--port-base=" + std::to_string(matching_port), "--pipeline-stage=matching",
+                             "--downstream=127.0.0.1:" + std::to_string(publisher_port)},
+                            matching_port)) {
+            return;
+        }
+        ServerProcess gateway;
+        if (!gateway.start(options.server_binary,
+                           {"--port-base=" + std::to_string(gateway_port),
+                            "--gateway=127.0.0.1:" + std::to_string(matching_port),
+                            "--upstream-connections=" + std::to_string(options.upstream_connections)},
+                           gateway_port)) {
+            return;
+        }
+
+        // Hops 0..PIPELINE_HOPS-2 are per-hop latencies, the last slot is end to end
+        std::vector<std::vector<double>> hop_latencies(PIPELINE_HOPS);
+        std::mutex hop_mutex;
+        std::atomic<bool> subscribers_done{false};
+        std::vector<std::thread> subscribers;
+        for (int i = 0; i < options.subscribers; i++) {
+            subscribers.emplace_back([&] {
+                subscriber_worker(publisher_port, subscribers_done, hop_latencies, hop_mutex);
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+        write_log_header();
+        use_port_base(gateway_port);
+        auto result = test_with_client_count("ORDER", options.clients);
+        result.protocol = "ORDER+pipeline-ack";
+        log_result(result);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));  // Drain in-flight market data
+        subscribers_done = true;
+        for (auto& subscriber : subscribers) subscriber.join();
+
+        write_section_header("PIPELINE LATENCY", "Hop,Samples,P50Us,P99Us,P999Us,P9999Us,MaxUs");
+        for (int hop = 0; hop < PIPELINE_HOPS; hop++) {
+            std::vector<double>& samples = hop_latencies[hop];
+            std::sort(samples.begin(), samples.end());
+            std::string name = hop < PIPELINE_HOPS - 1
+                ? std::string(pipeline_hop_name(hop)) + "->" + pipeline_hop_name(hop + 1)
+                : "end-to-end";
+
+            std::cout << std::left << std::setw(22) << name << std::right << " samples " << samples.size()
+                      << std::fixed << std::setprecision(1)
+                      << ", P50 " << percentile_of(samples, 0.50) << "us, P99 " << percentile_of(samples, 0.99)
+                      << "us, P99.9 " << percentile_of(samples, 0.999) << "us, max "
+                      << (samples.empty() ? 0.0 : samples.back()) << "us" << std::endl;
+            if (log_file.is_open()) {
+                log_file << "PIPELINE," << name << "," << samples.size() << std::fixed << std::setprecision(3)
+                         << "," << percentile_of(samples, 0.50) << "," << percentile_of(samples, 0.99)
+                         << "," << percentile_of(samples, 0.999) << "," << percentile_of(samples, 0.9999)
+                         << "," << (samples.empty() ? 0.0 : samples.back()) << "\n";
+            }
+        }
+        log_file.flush();
+
+        std::cout << "Pipeline test completed. Results logged to " << log_filename << std::endl;
+    }
+
+    // Streams small messages at a fixed rate through the TCP echo port and
+    // through the log-buffer transport on the UDP port, and compares achieved
+    // throughput and tail latency (P99.99) of the echoes.
+    void run_logbuffer_tests() {
+        std::cout << "Starting transport comparison: " << options.streams << " streams, "
+                  << options.message_rate << " messages/s..." << std::endl;
+
+        ServerProcess server;
+        if (!server.start(options.server_binary, {"--port-base=" + std::to_string(options.port_base)},
+                          options.port_base)) {
+            return;
+        }
+        use_port_base(options.port_base);
+
+        struct Row {
+            std::string transport;
+            double rate;
+            StreamStats stats;
+        };
+        std::vector<Row> rows;
+
+        write_log_header();
+        for (const char* transport : {"TCP", "LOG"}) {
+            std::cout << "Testing " << transport << " stream..." << std::endl;
+            Row row;
+            row.transport = transport;
+            row.rate = run_stream_test(transport, row.stats);
+
+            ScalabilityResult result;
+            result.protocol = std::string(transport) + "-stream";
+            result.client_count = options.streams;
+            result.timestamp = get_timestamp();
+            result.throughput_mbps = row.rate * 2 * sizeof(StreamMessage) / (1024.0 * 1024.0);
+            result.connections_per_second = 0;
+            result.peak_concurrent_connections = options.streams;
+            result.total_requests = row.stats.messages;
+            result.successful_requests = row.stats.messages;
+            result.success_rate = row.stats.failed ? 0.0 : 100.0;
+            std::vector<double> latencies_ms;
+            latencies_ms.reserve(row.stats.latencies_us.size());
+            for (double us : row.stats.latencies_us) latencies_ms.push_back(us / 1000.0);
+            result.percentiles = calculate_all_percentiles(latencies_ms);
             log_result(result);
-            
-            // Brief pause between tests
-            std::this_thread::sleep_for(std::chrono::seconds(2));
+
+            std::sort(row.stats.latencies_us.begin(), row.stats.latencies_us.end());
+            rows.push_back(std::move(row));
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+
+        write_section_header("TRANSPORT COMPARISON",
+                             "Transport,Streams,TargetRate,MessagesPerSec,P50Us,P99Us,P9999Us,MaxUs,"
+                             "NaksSent,NaksReceived,RetransmittedBytes");
+        for (const Row& row : rows) {
+            const std::vector<double>& sorted = row.stats.latencies_us;
+            double max_us = sorted.empty() ? 0.0 : sorted.back();
+            std::cout << row.transport << ": " << std::fixed << std::setprecision(0) << row.rate << " msg/s"
+                      << std::setprecision(1) << ", P50 " << percentile_of(sorted, 0.50) << "us, P99 "
+                      << percentile_of(sorted, 0.99) << "us, P99.99 " << percentile_of(sorted, 0.9999)
+                      << "us, max " << max_us << "us, NAKs " << row.stats.naks_sent << "/"
+                      << row.stats.naks_received << (row.stats.failed ? " (FAILED)" : "") << std::endl;
+            if (log_file.is_open()) {
+                log_file << "TRANSPORT," << row.transport << "," << options.streams << ","
+                         << options.message_rate << "," << std::fixed << std::setprecision(0) << row.rate
+                         << std::setprecision(3) << "," << percentile_of(sorted, 0.50) << ","
+                         << percentile_of(sorted, 0.99) << "," << percentile_of(sorted, 0.9999) << ","
+                         << max_us << "," << row.stats.naks_sent << "," << row.stats.naks_received << ","
+                         << row.stats.retransmitted_bytes << "\n";
+            }
         }
+        log_file.flush();
+
+        std::cout << "Transport comparison completed. Results logged to " << log_filename << std::endl;
     }
-    
-    ScalabilityResult test_with_client_count(const std::string& protocol, int client_count) {
-        reset_counters();
-        latencies.reserve(client_count * 100);  // Estimate requests per client
-        
-        auto start_time = std::chrono::high_resolution_clock::now();
-        
-        // Start monitoring thread
-        std::thread monitor_thread(&ScalabilityTester::connection_monitor, this);
-        
-        // Start client threads with staggered connections
-        std::vector<std::thread> threads;
-        threads.reserve(client_count);
-        
-        for (int i = 0; i < client_count; ++i) {
-            if (protocol == "TCP") {
-                threads.emplace_back(&ScalabilityTester::tcp_client_worker, this, i);
-            } else if (protocol == "UDP") {
-                threads.emplace_back(&ScalabilityTester::udp_client_worker, this, i);
-            } else if (protocol == "QUIC") {
-                threads.emplace_back(&ScalabilityTester::quic_client_worker, this, i);
+
+    // Streams paced messages through the session layer while the client
+    // keeps breaking its TCP connection (a read stall, then a reset),
+    // and measures how long each resync takes and how fast the replay runs.
+    void run_session_tests() {
+        std::cout << "Starting session resync test: " << options.streams << " streams, "
+                  << options.message_rate << " messages/s, disconnect every " << options.disconnect_every_ms
+                  << "ms for " << options.outage_ms << "ms..." << std::endl;
+
+        ServerProcess server;
+        if (!server.start(options.server_binary,
+                          {"--port-base=" + std::to_string(options.port_base), "--sessions"},
+                          options.port_base)) {
+            return;
+        }
+        use_port_base(options.port_base);
+
+        write_log_header();
+        StreamStats stats;
+        double rate = run_stream_test("SESSION", stats);
+
+        ScalabilityResult result;
+        result.protocol = "SESSION-stream";
+        result.client_count = options.streams;
+        result.timestamp = get_timestamp();
+        result.throughput_mbps = rate * 2 * sizeof(StreamMessage) / (1024.0 * 1024.0);
+        result.connections_per_second = stats.reconnects / (double)options.duration_sec;
+        result.peak_concurrent_connections = options.streams;
+        result.total_requests = stats.messages;
+        result.successful_requests = stats.messages;
+        result.success_rate = stats.failed || stats.gaps ? 0.0 : 100.0;
+        std::vector<double> latencies_ms;
+        latencies_ms.reserve(stats.latencies_us.size());
+        for (double us : stats.latencies_us) latencies_ms.push_back(us / 1000.0);
+        result.percentiles = calculate_all_percentiles(latencies_ms);
+        log_result(result);
+
+        std::sort(stats.resync_ms.begin(), stats.resync_ms.end());
+        double replay_rate = stats.replay_seconds > 0 ? stats.replayed / stats.replay_seconds : 0.0;
+        double resync_max = stats.resync_ms.empty() ? 0.0 : stats.resync_ms.back();
+        std::cout << "Reconnects " << stats.reconnects << ", resync P50 " << std::fixed << std::setprecision(3)
+                  << percentile_of(stats.resync_ms, 0.50) << "ms, max " << resync_max << "ms, replayed "
+                  << stats.replayed << " at " << std::setprecision(0) << replay_rate << " msg/s, resent "
+                  << stats.resent << ", duplicates " << stats.duplicates << ", gaps " << stats.gaps
+                  << ", resets " << stats.resets << std::endl;
+
+        write_section_header("SESSION RESYNC",
+                             "Streams,Rate,Reconnects,ResyncP50Ms,ResyncMaxMs,Replayed,ReplayMsgPerSec,"
+                             "Resent,Duplicates,Gaps,Resets");
+        if (log_file.is_open()) {
+            log_file << "SESSION," << options.streams << "," << options.message_rate << "," << stats.reconnects
+                     << std::fixed << std::setprecision(3) << "," << percentile_of(stats.resync_ms, 0.50) << ","
+                     << resync_max << "," << stats.replayed << "," << std::setprecision(0) << replay_rate << ","
+                     << stats.resent << "," << stats.duplicates << "," << stats.gaps << "," << stats.resets << "\n";
+            log_file.flush();
+        }
+
+        std::cout << "Session test completed. Results logged to " << log_filename << std::endl;
+    }
+
+    // Compares plain QUIC echo with AES-128-GCM protected QUIC for a short
+    // and a large payload, with think time and back to back, and reports what
+    // the crypto costs per packet on both sides next to the throughput change.
+    void run_quic_crypto_tests() {
+        std::cout << "Starting QUIC packet protection test with " << options.clients << " clients..." << std::endl;
+
+        int stats_port = options.port_base + 3;
+        struct CryptoRun {
+            size_t payload;
+            bool aead;
+            double max_mbps = 0;
+            int max_requests = 0;
+            std::map<std::string, std::string> server_stats;
+            double client_ns = 0;
+        };
+        std::vector<CryptoRun> runs;
+        std::vector<bool> protections = {false};
+        if (aead_supported()) {
+            protections.push_back(true);
+        } else {
+            std::cout << "This CPU lacks AES-NI or PCLMULQDQ: measuring plain QUIC only" << std::endl;
+        }
+        for (size_t payload : {(size_t)0, QUIC_LARGE_PAYLOAD}) {
+            for (bool aead : protections) {
+                CryptoRun run;
+                run.payload = payload;
+                run.aead = aead;
+                runs.push_back(run);
+            }
+        }
+
+        write_log_header();
+        for (CryptoRun& run : runs) {
+            std::vector<std::string> args = {"--port-base=" + std::to_string(options.port_base),
+                                             "--stats-port=" + std::to_string(stats_port)};
+            if (run.aead) args.push_back("--quic-aead");
+            ServerProcess server;
+            if (!server.start(options.server_binary, args, options.port_base)) {
+                return;
+            }
+            use_port_base(options.port_base);
+            quic_aead = run.aead;
+            quic_payload = run.payload;
+            quic_crypto_ns = 0;
+            quic_crypto_packets = 0;
+
+            std::string label = std::string(run.aead ? "QUIC+aead" : "QUIC-plain") +
+                                (run.payload ? "-" + std::to_string(run.payload) + "B" : "");
+            for (bool max_rate : {false, true}) {
+                think_time = !max_rate;
+                std::cout << "Testing " << label << (max_rate ? " at maximum rate" : "") << "..." << std::endl;
+                auto result = test_with_client_count("QUIC", options.clients);
+                result.protocol = label + (max_rate ? "-max" : "");
+                log_result(result);
+                if (max_rate) {
+                    run.max_mbps = result.throughput_mbps;
+                    run.max_requests = result.total_requests;
+                }
+                std::this_thread::sleep_for(std::chrono::seconds(2));
+            }
+            run.server_stats = query_stats(stats_port);
+            run.client_ns = quic_crypto_packets ? (double)quic_crypto_ns / quic_crypto_packets : 0.0;
+            server.stop();
+        }
+        think_time = true;
+        quic_aead = false;
+        quic_payload = 0;
+
+        write_section_header("QUIC CRYPTO",
+                             "Payload,Protection,MaxRequests,MaxMBps,ThroughputChangePct,ServerOpenNsPerPacket,"
+                             "ServerSealNsPerPacket,ClientCryptoNsPerPacket,AuthFailures");
+        for (size_t i = 0; i < runs.size(); i++) {
+            CryptoRun& run = runs[i];
+            const CryptoRun& plain = runs[i & ~(size_t)1];  // Same payload, unprotected
+            double change = plain.max_requests ? 100.0 * (run.max_requests - plain.max_requests) / plain.max_requests : 0.0;
+            std::string open_ns = run.aead ? run.server_stats["quic_open_ns_per_packet"] : "0";
+            std::string seal_ns = run.aead ? run.server_stats["quic_seal_ns_per_packet"] : "0";
+            std::string failures = run.aead ? run.server_stats["quic_auth_failures"] : "0";
+            const char* payload = run.payload ? "large" : "short";
+            std::cout << payload << " payload, " << (run.aead ? "AES-128-GCM" : "plain") << ": " << run.max_requests
+                      << " requests at maximum rate (" << std::fixed << std::setprecision(1) << change
+                      << "%), server open " << open_ns << "ns seal " << seal_ns << "ns per packet, client "
+                      << std::setprecision(0) << run.client_ns << "ns per packet" << std::endl;
+            if (log_file.is_open()) {
+                log_file << "QUIC_CRYPTO," << (run.payload ? std::to_string(run.payload) : "short") << "," << (run.aead ? "aes128gcm" : "none")
+                         << "," << run.max_requests << std::fixed << std::setprecision(2) << "," << run.max_mbps
+                         << "," << change << "," << open_ns << "," << seal_ns << "," << std::setprecision(0)
+                         << run.client_ns << "," << failures << "\n";
+            }
+        }
+        log_file.flush();
+
+        std::cout << "QUIC crypto tests completed. Results logged to " << log_filename << std::endl;
+    }
+
+    // Sweeps payload compression over generated feed messages: none, then
+    // per-message and per-stream LZ at each level, both against a dictionary
+    // trained on a separate sample of the feed. For TCP and UDP it reports
+    // bytes on the wire, codec time on both ends, server CPU per message and
+    // latency. UDP has no stream mode (datagrams share no history).
+    void run_compression_tests() {
+        FeedGenerator sampler(0x5eed);
+        std::vector<std::string> samples(COMPRESSION_TRAINING_SAMPLES);
+        for (std::string& sample : samples) sampler.next(sample);
+        std::string trained = lz_train_dictionary(samples, options.dictionary_size);
+        std::ofstream file(options.dictionary_path, std::ios::binary | std::ios::trunc);
+        file.write(trained.data(), trained.size());
+        file.close();
+        if (!file) {
+            std::cerr << "Failed to write dictionary " << options.dictionary_path << std::endl;
+            return;
+        }
+        std::cout << "Starting compression sweep with " << options.clients << " clients, "
+                  << trained.size() << " byte dictionary trained on " << samples.size() << " messages..." << std::endl;
+
+        std::vector<std::pair<std::string, int>> configs = {{"", 0}};
+        for (const char* mode : {"message", "stream"}) {
+            for (int level : options.compression_levels) configs.push_back({mode, level});
+        }
+
+        struct Row {
+            std::string protocol, mode;
+            int level;
+            long long messages;
+            double plain_per_message, wire_per_message, client_codec_ns, server_codec_ns, server_cpu_us;
+            double p50, p99;
+            long long errors;
+        };
+        std::vector<Row> rows;
+        int stats_port = options.port_base + 3;
+
+        write_log_header();
+        for (const auto& config : configs) {
+            for (const char* protocol : {"TCP", "UDP"}) {
+                if (config.first == "stream" && strcmp(protocol, "UDP") == 0) continue;
+
+                std::vector<std::string> args = {"--port-base=" + std::to_string(options.port_base),
+                                                 "--stats-port=" + std::to_string(stats_port)};
+                if (!config.first.empty()) {
+                    args.push_back("--compress=" + config.first);
+                    args.push_back("--compress-level=" + std::to_string(config.second));
+                    args.push_back("--dictionary=" + options.dictionary_path);
+                }
+                ServerProcess server;
+                if (!server.start(options.server_binary, args, options.port_base)) {
+                    return;
+                }
+                use_port_base(options.port_base);
+                compression = config.first;
+                compression_level = config.second;
+                dictionary = trained;
+                codec_ns = 0;
+                codec_messages = 0;
+                plain_bytes = 0;
+                codec_errors = 0;
+
+                std::string label = std::string(protocol) + "-feed-" +
+                                    (config.first.empty() ? "none" : config.first + "-L" + std::to_string(config.second));
+                std::cout << "Testing " << label << "..." << std::endl;
+                long long cpu_before = cpu_time_us(server.get_pid());
+                auto result = test_with_client_count(strcmp(protocol, "TCP") == 0 ? "FEED_TCP" : "FEED_UDP",
+                                                     options.clients);
+                long long cpu_after = cpu_time_us(server.get_pid());
+                auto stats = query_stats(stats_port);
+                server.stop();
+                result.protocol = label;
+                log_result(result);
+
+                Row row;
+                row.protocol = protocol;
+                row.mode = config.first.empty() ? "none" : config.first;
+                row.level = config.second;
+                row.messages = result.total_requests;
+                double messages = std::max<long long>(1, row.messages);
+                row.plain_per_message = plain_bytes / messages;
+                row.wire_per_message = total_bytes / messages;
+                row.client_codec_ns = codec_messages ? (double)codec_ns / codec_messages : 0.0;
+                row.server_codec_ns = atof(stats["compress_ns_per_message"].c_str()) +
+                                      atof(stats["decompress_ns_per_message"].c_str());
+                row.server_cpu_us = (cpu_after - cpu_before) / messages;
+                row.p50 = result.percentiles[49];
+                row.p99 = result.percentiles[98];
+                row.errors = codec_errors + atoll(stats["compression_errors"].c_str());
+                rows.push_back(row);
+                std::this_thread::sleep_for(std::chrono::seconds(2));
+            }
+        }
+        compression.clear();
+
+        write_section_header("COMPRESSION",
+                             "Protocol,Mode,Level,Messages,PlainBytesPerMsg,WireBytesPerMsg,Ratio,"
+                             "ClientCodecNsPerMsg,ServerCodecNsPerMsg,ServerCpuUsPerMsg,P50Ms,P99Ms,Errors");
+        for (const Row& row : rows) {
+            double ratio = row.wire_per_message > 0 ? row.plain_per_message / row.wire_per_message : 0.0;
+            std::cout << row.protocol << " " << row.mode << " L" << row.level << ": " << std::fixed
+                      << std::setprecision(1) << row.wire_per_message << " wire bytes per round trip (ratio "
+                      << std::setprecision(2) << ratio << "), codec " << std::setprecision(0)
+                      << row.client_codec_ns << "ns client / " << row.server_codec_ns << "ns server, server CPU "
+                      << std::setprecision(2) << row.server_cpu_us << "us/msg, P50 " << std::setprecision(3)
+                      << row.p50 << "ms, P99 " << row.p99 << "ms, errors " << row.errors << std::endl;
+            if (log_file.is_open()) {
+                log_file << "COMPRESSION," << row.protocol << "," << row.mode << "," << row.level << ","
+                         << row.messages << std::fixed << std::setprecision(1) << "," << row.plain_per_message
+                         << "," << row.wire_per_message << std::setprecision(3) << "," << ratio
+                         << std::setprecision(0) << "," << row.client_codec_ns << "," << row.server_codec_ns
+                         << std::setprecision(3) << "," << row.server_cpu_us << "," << row.p50 << "," << row.p99
+                         << "," << row.errors << "\n";
+            }
+        }
+        log_file.flush();
+
+        std::cout << "Compression tests completed. Results logged to " << log_filename << std::endl;
+    }
+
+    // Quote fan-out encodings (quote.h). Offline, it times fixed layout and
+    // delta encoding over the same generated quote feed, decoding the deltas
+    // both with the scalar and with the SIMD varint decoder. Live, it runs a
+    // publisher stage per encoding with one paced producer and
+    // options.subscribers subscribers, the last of which joins halfway
+    // through and has to wait for refreshes, and reports wire bytes, decode
+    // cost and producer-to-subscriber latency.
+    void run_quote_tests() {
+        std::cout << "Starting quote encoding test: " << QUOTE_SYMBOLS << " symbols, refresh every "
+                  << options.refresh_every << " updates, " << options.subscribers << " subscribers at "
+                  << options.message_rate << " updates/s..." << std::endl;
+        write_log_header();
+
+        FeedGenerator feed(QUOTE_FEED_SEED, QUOTE_SYMBOLS);
+        std::vector<QuoteUpdate> updates(QUOTE_CODEC_UPDATES);
+        for (QuoteUpdate& update : updates) update = make_quote(feed.next_quote());
+
+        write_section_header("QUOTE CODEC",
+                             "Encoding,Updates,BytesPerMsg,ReductionPct,EncodeNsPerMsg,DecodeNsPerMsg,Mismatches");
+        struct Codec {
+            const char* name;
+            bool delta;
+            bool simd;
+        };
+        std::vector<Codec> codecs = {{"fixed", false, false}, {"delta-scalar", true, false}};
+        if (varint_simd_supported()) codecs.push_back({"delta-simd", true, true});
+        for (const Codec& codec : codecs) {
+            std::vector<std::string> frames;
+            frames.reserve(updates.size() / QUOTE_BATCH + 1);
+            QuoteDeltaEncoder encoder(std::max(1, options.refresh_every));
+            uint64_t start = journal_now_ns();
+            for (size_t i = 0; i < updates.size(); i += QUOTE_BATCH) {
+                size_t count = std::min(QUOTE_BATCH, updates.size() - i);
+                frames.emplace_back();
+                if (codec.delta) {
+                    encoder.encode(&updates[i], count, frames.back());
+                } else {
+                    frames.back().assign((const char*)&updates[i], count * sizeof(QuoteUpdate));
+                }
+            }
+            uint64_t encode_ns = journal_now_ns() - start;
+
+            QuoteDeltaDecoder decoder(codec.simd);
+            std::vector<QuoteUpdate> decoded;
+            decoded.reserve(updates.size());
+            bool ok = true;
+            start = journal_now_ns();
+            for (const std::string& frame : frames) {
+                if (codec.delta) {
+                    ok = decoder.decode(frame.data(), frame.size(), decoded) && ok;
+                } else {
+                    size_t have = decoded.size();
+                    decoded.resize(have + frame.size() / sizeof(QuoteUpdate));
+                    memcpy(&decoded[have], frame.data(), frame.size());
+                }
+            }
+            uint64_t decode_ns = journal_now_ns() - start;
+
+            uint64_t bytes = 0;
+            for (const std::string& frame : frames) bytes += frame.size();
+            uint64_t mismatches = ok && decoded.size() == updates.size() ? 0 : updates.size();
+            for (size_t i = 0; mismatches == 0 && i < updates.size(); i++) {
+                if (!same_quote(decoded[i], updates[i], true)) mismatches++;
+            }
+            double per_message = (double)bytes / updates.size();
+            double reduction = 100.0 * (1.0 - per_message / sizeof(QuoteUpdate));
+            double encode_per = (double)encode_ns / updates.size();
+            double decode_per = (double)decode_ns / updates.size();
+
+            std::cout << std::left << std::setw(13) << codec.name << std::right << std::fixed
+                      << std::setprecision(2) << per_message << " bytes/msg (" << std::setprecision(1)
+                      << reduction << "% smaller than fixed), encode " << encode_per << "ns/msg, decode "
+                      << decode_per << "ns/msg, mismatches " << mismatches << std::endl;
+            if (log_file.is_open()) {
+                log_file << "QUOTE_CODEC," << codec.name << "," << updates.size() << std::fixed
+                         << std::setprecision(3) << "," << per_message << "," << reduction << "," << encode_per
+                         << "," << decode_per << "," << mismatches << "\n";
+            }
+        }
+        log_file.flush();
+
+        struct Row {
+            std::string encoding;
+            uint64_t produced, updates;
+            double wire_per_message, decode_ns, server_cpu_us, p50, p99, p999;
+            uint64_t late_skipped, mismatches;
+            double late_sync_ms;
+            bool failed;
+        };
+        std::vector<Row> rows;
+        for (const char* encoding : {"fixed", "delta"}) {
+            ServerProcess publisher;
+            if (!publisher.start(options.server_binary,
+                                 {"--port-base=" + std::to_string(options.port_base), "--pipeline-stage=publisher",
+                                  std::string("--quote-encoding=") + encoding,
+                                  "--refresh-every=" + std::to_string(options.refresh_every)},
+                                 options.port_base)) {
+                return;
+            }
+            std::cout << "Testing " << encoding << " quotes..." << std::endl;
+            bool delta = strcmp(encoding, "delta") == 0;
+            std::atomic<bool> done{false};
+            std::vector<QuoteSubscriberStats> stats(std::max(1, options.subscribers));
+            std::vector<std::thread> subscribers;
+            for (size_t i = 0; i + 1 < stats.size(); i++) {
+                subscribers.emplace_back(&ScalabilityTester::quote_subscriber_worker, this, options.port_base,
+                                         delta, std::ref(done), std::ref(stats[i]));
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+            stop_test = false;
+            uint64_t produced = 0;
+            long long cpu_before = cpu_time_us(publisher.get_pid());
+            std::thread producer(&ScalabilityTester::quote_producer_worker, this, options.port_base,
+                                 options.message_rate, std::ref(produced));
+            std::this_thread::sleep_for(std::chrono::milliseconds(options.duration_sec * 500));
+            subscribers.emplace_back(&ScalabilityTester::quote_subscriber_worker, this, options.port_base,
+                                     delta, std::ref(done), std::ref(stats.back()));
+            std::this_thread::sleep_for(std::chrono::milliseconds(options.duration_sec * 500));
+            stop_test = true;
+            producer.join();
+            long long cpu_after = cpu_time_us(publisher.get_pid());
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));  // Drain the fan-out
+            done = true;
+            for (auto& subscriber : subscribers) subscriber.join();
+            publisher.stop();
+
+            Row row;
+            row.encoding = encoding;
+            row.produced = produced;
+            row.updates = 0;
+            row.mismatches = 0;
+            row.failed = false;
+            uint64_t wire_bytes = 0;
+            uint64_t decode_ns = 0;
+            std::vector<double> latencies;
+            for (const QuoteSubscriberStats& s : stats) {
+                row.updates += s.updates;
+                row.mismatches += s.mismatches;
+                row.failed = row.failed || s.failed;
+                wire_bytes += s.wire_bytes;
+                decode_ns += s.decode_ns;
+                latencies.insert(latencies.end(), s.latencies_us.begin(), s.latencies_us.end());
+            }
+            std::sort(latencies.begin(), latencies.end());
+            double updates_received = std::max<uint64_t>(1, row.updates);
+            row.wire_per_message = wire_bytes / updates_received;
+            row.decode_ns = decode_ns / updates_received;
+            row.server_cpu_us = (cpu_after - cpu_before) / (double)std::max<uint64_t>(1, produced);
+            row.p50 = percentile_of(latencies, 0.50);
+            row.p99 = percentile_of(latencies, 0.99);
+            row.p999 = percentile_of(latencies, 0.999);
+            row.late_skipped = stats.back().skipped;
+            row.late_sync_ms = stats.back().sync_ms;
+            rows.push_back(row);
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+
+        write_section_header("QUOTES",
+                             "Encoding,RefreshEvery,Rate,Produced,Received,WireBytesPerMsg,DecodeNsPerMsg,"
+                             "PublisherCpuUsPerMsg,P50Us,P99Us,P999Us,LateSkipped,LateSyncMs,Mismatches");
+        for (const Row& row : rows) {
+            std::cout << row.encoding << ": " << row.produced << " produced, " << row.updates << " received, "
+                      << std::fixed << std::setprecision(2) << row.wire_per_message << " wire bytes/msg, decode "
+                      << std::setprecision(1) << row.decode_ns << "ns/msg, publisher CPU " << std::setprecision(3)
+                      << row.server_cpu_us << "us/msg, P50 " << std::setprecision(1) << row.p50 << "us, P99 "
+                      << row.p99 << "us, P99.9 " << row.p999 << "us, late joiner skipped " << row.late_skipped
+                      << " (synced after " << row.late_sync_ms << "ms), mismatches " << row.mismatches
+                      << (row.failed ? ", FAILED" : "") << std::endl;
+            if (log_file.is_open()) {
+                log_file << "QUOTES," << row.encoding << "," << options.refresh_every << "," << options.message_rate
+                         << "," << row.produced << "," << row.updates << std::fixed << std::setprecision(3) << ","
+                         << row.wire_per_message << "," << row.decode_ns << "," << row.server_cpu_us << ","
+                         << row.p50 << "," << row.p99 << "," << row.p999 << "," << row.late_skipped << ","
+                         << row.late_sync_ms << "," << row.mismatches << "\n";
+            }
+        }
+        log_file.flush();
+
+        std::cout << "Quote tests completed. Results logged to " << log_filename << std::endl;
+    }
+
+    // WebSocket port (ws.h). Offline, it times payload unmasking per
+    // implementation. Live, it runs TCP and WebSocket echo clients against
+    // the same server, with think time and at maximum rate, and then
+    // options.subscribers feed subscribers receiving a paced UDP stream
+    // through the pre-encoded broadcast.
+    void run_websocket_tests() {
+        std::cout << "Starting WebSocket tests with " << options.clients << " clients and "
+                  << options.subscribers << " feed subscribers..." << std::endl;
+        write_log_header();
+
+        write_section_header("WS UNMASK", "Unmask,PayloadBytes,NsPerFrame,GBPerSec");
+        std::vector<WsUnmask> unmasks;
+        for (const char* name : {"scalar", "sse2", "avx2"}) {
+            WsUnmask unmask;
+            if (parse_ws_unmask(name, unmask)) unmasks.push_back(unmask);
+        }
+        const uint8_t key[4] = {0x37, 0xfa, 0x21, 0x3d};
+        for (size_t size : {64, 1024, 65536}) {
+            std::vector<char> payload(size, 'A');
+            for (WsUnmask unmask : unmasks) {
+                size_t frames = std::max<size_t>(1000, (256u << 20) / size);
+                uint64_t start = journal_now_ns();
+                for (size_t i = 0; i < frames; i++) {
+                    ws_mask(payload.data(), size, key, unmask);
+                    __asm__ __volatile__("" : : "r"(payload.data()) : "memory");
+                }
+                double per_frame = (double)(journal_now_ns() - start) / frames;
+                std::cout << std::left << std::setw(7) << ws_unmask_name(unmask) << std::right << std::setw(6)
+                          << size << " bytes: " << std::fixed << std::setprecision(1) << per_frame << "ns/frame, "
+                          << std::setprecision(2) << size / per_frame << " GB/s" << std::endl;
+                if (log_file.is_open()) {
+                    log_file << "WS_UNMASK," << ws_unmask_name(unmask) << "," << size << std::fixed
+                             << std::setprecision(3) << "," << per_frame << "," << size / per_frame << "\n";
+                }
+            }
+        }
+        log_file.flush();
+
+        int stats_port = options.port_base + 3;
+        int websocket_port = options.port_base + 4;
+        ServerProcess server;
+        if (!server.start(options.server_binary,
+                          {"--port-base=" + std::to_string(options.port_base),
+                           "--ws-port=" + std::to_string(websocket_port),
+                           "--stats-port=" + std::to_string(stats_port)},
+                          options.port_base)) {
+            return;
+        }
+        use_port_base(options.port_base);
+        ws_port = websocket_port;
+
+        std::vector<ScalabilityResult> results;
+        for (bool max_rate : {false, true}) {
+            think_time = !max_rate;
+            for (const char* protocol : {"TCP", "WS"}) {
+                std::cout << "Testing " << protocol << " echo" << (max_rate ? " at maximum rate" : "") << "..."
+                          << std::endl;
+                auto result = test_with_client_count(protocol, options.clients);
+                result.protocol = std::string(protocol) + (max_rate ? "-max" : "");
+                log_result(result);
+                results.push_back(result);
+                std::this_thread::sleep_for(std::chrono::seconds(2));
+            }
+        }
+        think_time = true;
+        for (const ScalabilityResult& result : results) {
+            std::cout << std::left << std::setw(8) << result.protocol << std::right << std::fixed
+                      << std::setprecision(2) << result.throughput_mbps << " MB/s, " << result.total_requests
+                      << " requests, P50 " << std::setprecision(3) << result.percentiles[49] << "ms, P99 "
+                      << result.percentiles[98] << "ms" << std::endl;
+        }
+
+        std::cout << "Testing the WebSocket feed..." << std::endl;
+        std::atomic<bool> done{false};
+        std::vector<WsFeedStats> stats(std::max(1, options.subscribers));
+        std::vector<std::thread> subscribers;
+        for (WsFeedStats& subscriber : stats) {
+            subscribers.emplace_back(&ScalabilityTester::ws_feed_worker, this, websocket_port, std::ref(done),
+                                     std::ref(subscriber));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        auto before = query_stats(stats_port);
+        stop_test = false;
+        uint64_t produced = 0;
+        long long cpu_before = cpu_time_us(server.get_pid());
+        std::thread producer(&ScalabilityTester::ws_feed_producer, this, options.message_rate, std::ref(produced));
+        std::this_thread::sleep_for(std::chrono::seconds(options.duration_sec));
+        stop_test = true;
+        producer.join();
+        long long cpu_after = cpu_time_us(server.get_pid());
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));  // Drain the fan-out
+        done = true;
+        for (auto& subscriber : subscribers) subscriber.join();
+        auto after = query_stats(stats_port);
+        server.stop();
+        ws_port = options.ws_port;
+
+        uint64_t delivered = 0, gaps = 0, bytes = 0;
+        bool failed = false;
+        std::vector<double> latencies;
+        for (const WsFeedStats& s : stats) {
+            delivered += s.messages;
+            gaps += s.gaps;
+            bytes += s.frames_bytes;
+            failed = failed || s.failed;
+            latencies.insert(latencies.end(), s.latencies_us.begin(), s.latencies_us.end());
+        }
+        std::sort(latencies.begin(), latencies.end());
+        auto counter = [&](const char* name) {
+            return strtoull(after[name].c_str(), nullptr, 10) - strtoull(before[name].c_str(), nullptr, 10);
+        };
+        uint64_t frames = counter("ws_broadcast_frames");
+        uint64_t blocks = counter("ws_broadcast_blocks");
+        uint64_t writes = counter("ws_writes");
+        uint64_t disconnects = counter("ws_feed_disconnects");
+        double per_delivered_cpu = (cpu_after - cpu_before) / (double)std::max<uint64_t>(1, delivered);
+        double frames_per_block = (double)frames / std::max<uint64_t>(1, blocks);
+        double writes_per_block = (double)writes / std::max<uint64_t>(1, blocks);
+        double wire_per_message = (double)bytes / std::max<uint64_t>(1, delivered);
+        uint64_t expected = produced * stats.size();
+        uint64_t lost = expected > delivered ? expected - delivered : 0;
+
+        write_section_header("WS FEED",
+                             "Subscribers,Rate,Produced,Delivered,Lost,Gaps,WireBytesPerMsg,FramesPerBlock,"
+                             "WritesPerBlock,ServerCpuUsPerDelivered,P50Us,P99Us,P999Us,Disconnects");
+        std::cout << stats.size() << " subscribers: " << produced << " produced, " << delivered << " delivered, "
+                  << lost << " lost, " << std::fixed << std::setprecision(1) << wire_per_message
+                  << " wire bytes/msg, " << frames_per_block << " frames per broadcast block, " << writes_per_block
+                  << " writes per block, server CPU " << std::setprecision(3) << per_delivered_cpu
+                  << "us per delivered message, P50 " << std::setprecision(1) << percentile_of(latencies, 0.50)
+                  << "us, P99 " << percentile_of(latencies, 0.99) << "us, P99.9 " << percentile_of(latencies, 0.999)
+                  << "us, disconnects " << disconnects << (failed ? ", FAILED" : "") << std::endl;
+        if (log_file.is_open()) {
+            log_file << "WS_FEED," << stats.size() << "," << options.message_rate << "," << produced << ","
+                     << delivered << "," << lost << "," << gaps << std::fixed << std::setprecision(3) << ","
+                     << wire_per_message << "," << frames_per_block << "," << writes_per_block << ","
+                     << per_delivered_cpu << "," << percentile_of(latencies, 0.50) << ","
+                     << percentile_of(latencies, 0.99) << "," << percentile_of(latencies, 0.999) << ","
+                     << disconnects << "\n";
+        }
+        log_file.flush();
+
+        std::cout << "WebSocket tests completed. Results logged to " << log_filename << std::endl;
+    }
+
+    // Trade analytics (analytics.h). Offline, it feeds uniformly random
+    // trades over ANALYTICS_SYMBOLS symbols through each bar update and times
+    // closing a lane of bars. Live, it runs the server's --analytics stage
+    // once per update with a paced UDP trade stream and one bar subscriber,
+    // and reports ingest cost and bar publish latency.
+    void run_analytics_tests() {
+        std::cout << "Starting analytics test: " << ANALYTICS_SYMBOLS << " symbols, " << options.message_rate
+                  << " trades/s..." << std::endl;
+        write_log_header();
+
+        std::vector<AnalyticsUpdate> updates;
+        for (const char* name : {"scalar", "avx2"}) {
+            AnalyticsUpdate update;
+            if (parse_analytics_update(name, update)) updates.push_back(update);
+        }
+
+        write_section_header("ANALYTICS INGEST", "Update,Symbols,Trades,NsPerTrade,MTradesPerSec,CloseUsPerLane");
+        for (AnalyticsUpdate update : updates) {
+            TradeAnalytics analytics(update, ANALYTICS_SYMBOLS);
+            std::mt19937_64 rng(1);
+            std::vector<uint16_t> symbols(1 << 16);
+            std::vector<int64_t> prices(symbols.size());
+            for (size_t i = 0; i < symbols.size(); i++) {
+                symbols[i] = (uint16_t)(rng() % ANALYTICS_SYMBOLS);
+                prices[i] = 1000000 + symbols[i] * 100 + (int64_t)(rng() % 1000) - 500;
+            }
+            uint64_t start = journal_now_ns();
+            for (size_t i = 0; i < ANALYTICS_OFFLINE_TRADES; i++) {
+                size_t at = i & (symbols.size() - 1);
+                analytics.add_trade(symbols[at], prices[at], 1 + (uint32_t)(i & 63));
+            }
+            double per_trade = (double)(journal_now_ns() - start) / ANALYTICS_OFFLINE_TRADES;
+
+            std::vector<AnalyticsBar> bars;
+            bars.reserve(ANALYTICS_SYMBOLS * ANALYTICS_LANES);
+            start = journal_now_ns();
+            for (int lane = 0; lane < ANALYTICS_LANES; lane++) analytics.close_bars(lane, start, bars);
+            double close_us = (journal_now_ns() - start) / 1000.0 / ANALYTICS_LANES;
+
+            std::cout << std::left << std::setw(7) << analytics_update_name(update) << std::right << std::fixed
+                      << std::setprecision(1) << per_trade << "ns/trade, " << std::setprecision(2)
+                      << 1000.0 / per_trade << " Mtrades/s, closing " << bars.size() / ANALYTICS_LANES
+                      << " bars " << std::setprecision(0) << close_us << "us per lane" << std::endl;
+            if (log_file.is_open()) {
+                log_file << "ANALYTICS_INGEST," << analytics_update_name(update) << "," << ANALYTICS_SYMBOLS << ","
+                         << ANALYTICS_OFFLINE_TRADES << std::fixed << std::setprecision(3) << "," << per_trade << ","
+                         << 1000.0 / per_trade << "," << close_us << "\n";
+            }
+        }
+        log_file.flush();
+
+        write_section_header("ANALYTICS", "Update,Rate,Sent,Ingested,ServerNsPerTrade,ServerCpuUsPerTrade,Bars,"
+                                          "Invalid,CloseUsPerTick,P50Us,P99Us,MaxUs");
+        int stats_port = options.port_base + 3;
+        int analytics_port = options.port_base + 4;
+        for (AnalyticsUpdate update : updates) {
+            ServerProcess server;
+            if (!server.start(options.server_binary,
+                              {"--port-base=" + std::to_string(options.port_base), "--analytics",
+                               "--analytics-update=" + std::string(analytics_update_name(update)),
+                               "--bar-intervals-ms=" + std::string(ANALYTICS_TEST_INTERVALS_MS),
+                               "--analytics-port=" + std::to_string(analytics_port),
+                               "--stats-port=" + std::to_string(stats_port)},
+                              options.port_base)) {
+                return;
+            }
+            use_port_base(options.port_base);
+
+            std::atomic<bool> done{false};
+            AnalyticsSubscriberStats stats;
+            std::thread subscriber(&ScalabilityTester::analytics_subscriber, this, analytics_port, std::ref(done),
+                                   std::ref(stats));
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            stop_test = false;
+            uint64_t sent = 0;
+            long long cpu_before = cpu_time_us(server.get_pid());
+            std::thread producer(&ScalabilityTester::trade_producer, this, options.message_rate, std::ref(sent));
+            std::this_thread::sleep_for(std::chrono::seconds(options.duration_sec));
+            stop_test = true;
+            producer.join();
+            long long cpu_after = cpu_time_us(server.get_pid());
+            std::this_thread::sleep_for(std::chrono::milliseconds(1100));  // Let the longest bar close
+            done = true;
+            subscriber.join();
+            auto after = query_stats(stats_port);
+            server.stop();
+
+            uint64_t ingested = strtoull(after["analytics_trades"].c_str(), nullptr, 10);
+            double cpu_per_trade = (cpu_after - cpu_before) / (double)std::max<uint64_t>(1, ingested);
+            std::sort(stats.latencies_us.begin(), stats.latencies_us.end());
+            double max_us = stats.latencies_us.empty() ? 0 : stats.latencies_us.back();
+            std::cout << std::left << std::setw(7) << analytics_update_name(update) << std::right << sent
+                      << " sent, " << ingested << " ingested, server " << after["analytics_ingest_ns_per_trade"]
+                      << "ns ingest and " << std::fixed << std::setprecision(3) << cpu_per_trade
+                      << "us CPU per trade, " << stats.bars << " bars (" << stats.invalid << " invalid) in "
+                      << stats.frames << " frames, close " << after["analytics_close_us_per_tick"]
+                      << "us per tick, publish P50 " << std::setprecision(1) << percentile_of(stats.latencies_us, 0.50)
+                      << "us, P99 " << percentile_of(stats.latencies_us, 0.99) << "us, max " << max_us << "us"
+                      << (stats.failed ? ", FAILED" : "") << std::endl;
+            if (log_file.is_open()) {
+                log_file << "ANALYTICS," << analytics_update_name(update) << "," << options.message_rate << ","
+                         << sent << "," << ingested << "," << after["analytics_ingest_ns_per_trade"] << std::fixed
+                         << std::setprecision(3) << "," << cpu_per_trade << "," << stats.bars << "," << stats.invalid
+                         << "," << after["analytics_close_us_per_tick"] << ","
+                         << percentile_of(stats.latencies_us, 0.50) << "," << percentile_of(stats.latencies_us, 0.99)
+                         << "," << max_us << "\n";
+            }
+            log_file.flush();
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+
+        std::cout << "Analytics tests completed. Results logged to " << log_filename << std::endl;
+    }
+
+    // Client-side load balancing over equivalent replicas (balancer.h).
+    // options.replicas servers with --service-time-us=options.service_us
+    // serve options.streams closed-loop clients sharing one balancer. First
+    // all replicas are healthy; then replica 0 is restarted with
+    // options.slow_service_us and every policy runs again, reporting P99 and
+    // the share of requests the slow replica still got.
+    void run_balance_tests() {
+        std::cout << "Starting balance tests: " << options.replicas << " replicas, " << options.streams
+                  << " clients, service " << options.service_us << "us, slow replica " << options.slow_service_us
+                  << "us..." << std::endl;
+        write_log_header();
+        write_section_header("BALANCE",
+                             "Policy,SlowReplicaUs,Requests,ReqPerSec,P50Us,P99Us,P999Us,SlowSharePct,Failures");
+
+        std::vector<std::unique_ptr<ServerProcess>> servers(std::max(1, options.replicas));
+        std::vector<int> ports;
+        auto start_replica = [&](int replica, int service_us) {
+            int port = options.port_base + 100 + replica * SHARD_PORT_STRIDE;
+            servers[replica].reset(new ServerProcess());
+            return servers[replica]->start(options.server_binary,
+                                           {"--port-base=" + std::to_string(port),
+                                            "--service-time-us=" + std::to_string(service_us)},
+                                           port);
+        };
+        for (int replica = 0; replica < (int)servers.size(); replica++) {
+            if (!start_replica(replica, options.service_us)) return;
+            ports.push_back(options.port_base + 100 + replica * SHARD_PORT_STRIDE);
+        }
+
+        struct Run {
+            BalancePolicy policy;
+            bool slow;
+        };
+        std::vector<Run> runs = {{BalancePolicy::RoundRobin, false}, {BalancePolicy::RoundRobin, true},
+                                 {BalancePolicy::LeastOutstanding, true}, {BalancePolicy::PowerOfTwo, true}};
+        for (const Run& run : runs) {
+            if (run.slow && servers[0]->get_pid() > 0 && !slow_replica_running) {
+                servers[0]->stop();
+                if (!start_replica(0, options.slow_service_us)) return;
+                slow_replica_running = true;
+            }
+            ReplicaBalancer balancer(ports.size(), run.policy);
+            std::vector<BalanceClientStats> stats(std::max(1, options.streams));
+            std::vector<std::thread> clients;
+            stop_test = false;
+            for (size_t i = 0; i < stats.size(); i++) {
+                clients.emplace_back(&ScalabilityTester::balance_client_worker, this, (int)i, std::cref(ports),
+                                     std::ref(balancer), std::ref(stats[i]));
+            }
+            std::this_thread::sleep_for(std::chrono::seconds(options.duration_sec));
+            stop_test = true;
+            for (auto& client : clients) client.join();
+
+            std::vector<double> latencies;
+            uint64_t failures = 0;
+            for (const BalanceClientStats& client : stats) {
+                latencies.insert(latencies.end(), client.latencies_us.begin(), client.latencies_us.end());
+                failures += client.failures;
+            }
+            std::sort(latencies.begin(), latencies.end());
+            uint64_t requests = 0;
+            for (size_t r = 0; r < balancer.size(); r++) requests += balancer.requests(r);
+            double slow_share = 100.0 * balancer.requests(0) / std::max<uint64_t>(1, requests);
+            int slow_us = run.slow ? options.slow_service_us : options.service_us;
+            std::string label = std::string(balance_policy_name(run.policy)) + (run.slow ? "" : " (healthy)");
+            std::cout << std::left << std::setw(22) << label << std::right << latencies.size() << " requests, "
+                      << std::fixed << std::setprecision(0) << latencies.size() / (double)options.duration_sec
+                      << " req/s, P50 " << std::setprecision(1) << percentile_of(latencies, 0.50) << "us, P99 "
+                      << percentile_of(latencies, 0.99) << "us, P99.9 " << percentile_of(latencies, 0.999)
+                      << "us, replica 0 got " << slow_share << "%" << (failures ? ", failures " : "")
+                      << (failures ? std::to_string(failures) : "") << std::endl;
+            if (log_file.is_open()) {
+                log_file << "BALANCE," << label << "," << slow_us << "," << latencies.size() << std::fixed
+                         << std::setprecision(3) << "," << latencies.size() / (double)options.duration_sec << ","
+                         << percentile_of(latencies, 0.50) << "," << percentile_of(latencies, 0.99) << ","
+                         << percentile_of(latencies, 0.999) << "," << slow_share << "," << failures << "\n";
+            }
+            log_file.flush();
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        }
+        slow_replica_running = false;
+        for (auto& server : servers) server->stop();
+
+        std::cout << "Balance tests completed. Results logged to " << log_filename << std::endl;
+    }
+
+    // Hedged requests (hedge.h) over two replicas that both stall every
+    // options.stall_every-th request for options.stall_us, as a collection
+    // pause or page fault would. Odd clients use replica 1 as their primary
+    // and hedge to replica 0. TCP, UDP and QUIC each run options.clients
+    // clients with hedging off, then on, reporting the tail against the
+    // extra requests the replicas served.
+    void run_hedge_tests() {
+        std::cout << "Starting hedge tests: 2 replicas stalling " << options.stall_us << "us every "
+                  << options.stall_every << " requests, " << options.clients << " clients..." << std::endl;
+        write_log_header();
+        write_section_header("HEDGE", "Protocol,Hedging,Requests,P50Ms,P99Ms,P999Ms,HedgeDelayUs,Hedges,HedgeWins,"
+                                      "HedgePct,ReplicaRequests,ExtraLoadPct");
+
+        ServerProcess replicas[2];
+        int ports[2];
+        for (int replica = 0; replica < 2; replica++) {
+            ports[replica] = options.port_base + 100 + replica * SHARD_PORT_STRIDE;
+            if (!replicas[replica].start(options.server_binary,
+                                         {"--port-base=" + std::to_string(ports[replica]),
+                                          "--stats-port=" + std::to_string(ports[replica] + 3),
+                                          "--stall-every=" + std::to_string(options.stall_every),
+                                          "--stall-us=" + std::to_string(options.stall_us)},
+                                         ports[replica])) {
+                return;
+            }
+        }
+        use_port_base(ports[0]);
+        hedge_port_base = ports[1];
+        auto served = [&]() {
+            uint64_t total = 0;
+            for (int port : ports) total += strtoull(query_stats(port + 3)["service_requests"].c_str(), nullptr, 10);
+            return total;
+        };
+
+        for (const char* protocol : {"TCP", "UDP", "QUIC"}) {
+            for (bool hedging : {false, true}) {
+                hedge.reset(hedging ? new HedgeTrigger() : nullptr);
+                uint64_t served_before = served();
+                ScalabilityResult result = test_with_client_count(protocol, options.clients);
+                uint64_t replica_requests = served() - served_before;
+
+                std::vector<double> sorted = latencies;
+                std::sort(sorted.begin(), sorted.end());
+                uint64_t requests = sorted.size();
+                uint64_t hedges = hedge ? hedge->hedges() : 0;
+                uint64_t wins = hedge ? hedge->hedge_wins() : 0;
+                uint32_t delay_us = hedge ? hedge->delay_us() : 0;
+                double hedge_pct = 100.0 * hedges / std::max<uint64_t>(1, hedge ? hedge->requests() : 0);
+                double extra_pct = 100.0 * ((double)replica_requests / std::max<uint64_t>(1, requests) - 1.0);
+                std::cout << std::left << std::setw(5) << protocol << std::setw(4) << (hedging ? "on" : "off")
+                          << std::right << requests << " requests, P50 " << std::fixed << std::setprecision(3)
+                          << percentile_of(sorted, 0.50) << "ms, P99 " << percentile_of(sorted, 0.99) << "ms, P99.9 "
+                          << percentile_of(sorted, 0.999) << "ms, replicas served " << std::setprecision(1)
+                          << std::showpos << extra_pct << std::noshowpos << "%";
+                if (hedging) {
+                    std::cout << ", hedged " << hedge_pct << "% after " << delay_us << "us, " << wins << " won";
+                }
+                std::cout << std::endl;
+                if (log_file.is_open()) {
+                    log_file << "HEDGE," << protocol << "," << (hedging ? "on" : "off") << "," << requests << std::fixed
+                             << std::setprecision(3) << "," << percentile_of(sorted, 0.50) << ","
+                             << percentile_of(sorted, 0.99) << "," << percentile_of(sorted, 0.999) << "," << delay_us
+                             << "," << hedges << "," << wins << "," << hedge_pct << "," << replica_requests << ","
+                             << extra_pct << "\n";
+                }
+                log_file.flush();
+                std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            }
+        }
+        hedge.reset();
+        hedge_port_base = 0;
+        for (ServerProcess& replica : replicas) replica.stop();
+
+        std::cout << "Hedge tests completed. Results logged to " << log_filename << std::endl;
+    }
+
+    // Loss recovery of the UDP and QUIC clients (rto.h). The server ignores
+    // every options.drop_every-th echo datagram; each protocol runs
+    // options.clients clients with the fixed timeouts (UDP 5 s, QUIC 1 s
+    // with no retransmission) and then with the adaptive RTO, reporting the
+    // tail, the latency of requests answered by a retransmission against
+    // the measured SRTT, spurious retransmissions and requests given up.
+    void run_rto_tests() {
+        std::cout << "Starting RTO tests: server drops every " << options.drop_every << "th datagram, "
+                  << options.clients << " clients..." << std::endl;
+        write_log_header();
+        write_section_header("RTO", "Protocol,Timer,Requests,GivenUp,P50Ms,P99Ms,P999Ms,MaxMs,Retransmits,"
+                                    "Spurious,Recovered,RecoveryP50Ms,RecoveryMaxMs,SrttUs,Dropped");
+
+        ServerProcess server;
+        int port = options.port_base;
+        if (!server.start(options.server_binary,
+                          {"--port-base=" + std::to_string(port), "--stats-port=" + std::to_string(port + 3),
+                           "--drop-every=" + std::to_string(options.drop_every)},
+                          port)) {
+            return;
+        }
+        use_port_base(port);
+        auto dropped = [&]() { return strtoull(query_stats(port + 3)["dropped_datagrams"].c_str(), nullptr, 10); };
+
+        for (const char* protocol : {"UDP", "QUIC"}) {
+            for (bool fixed : {true, false}) {
+                fixed_rto = fixed;
+                uint64_t dropped_before = dropped();
+                test_with_client_count(protocol, options.clients);
+                uint64_t dropped_during = dropped() - dropped_before;
+
+                std::vector<double> sorted = latencies;
+                std::sort(sorted.begin(), sorted.end());
+                double max_ms = sorted.empty() ? 0.0 : sorted.back();
+                std::vector<double> recovery = recovery_latencies;
+                std::sort(recovery.begin(), recovery.end());
+                double recovery_max_ms = recovery.empty() ? 0.0 : recovery.back();
+                double srtt_us = srtt_sockets ? srtt_ns / 1e3 / srtt_sockets : 0.0;
+                const char* timer = fixed ? "fixed" : "adaptive";
+                std::cout << std::left << std::setw(5) << protocol << std::setw(9) << timer << std::right
+                          << sorted.size() << " requests, " << request_timeouts << " given up, P50 " << std::fixed
+                          << std::setprecision(3) << percentile_of(sorted, 0.50) << "ms, P99 "
+                          << percentile_of(sorted, 0.99) << "ms, P99.9 " << percentile_of(sorted, 0.999)
+                          << "ms, max " << max_ms << "ms, " << retransmits << " retransmits (" << spurious_retransmits
+                          << " spurious), " << recovery.size() << " recovered in P50 " << percentile_of(recovery, 0.50)
+                          << "ms max " << recovery_max_ms << "ms at SRTT " << std::setprecision(1) << srtt_us
+                          << "us, " << dropped_during << " dropped" << std::endl;
+                if (log_file.is_open()) {
+                    log_file << "RTO," << protocol << "," << timer << "," << sorted.size() << "," << request_timeouts
+                             << std::fixed << std::setprecision(3) << "," << percentile_of(sorted, 0.50) << ","
+                             << percentile_of(sorted, 0.99) << "," << percentile_of(sorted, 0.999) << "," << max_ms
+                             << "," << retransmits << "," << spurious_retransmits << "," << recovery.size() << ","
+                             << percentile_of(recovery, 0.50) << "," << recovery_max_ms << "," << srtt_us << ","
+                             << dropped_during << "\n";
+                }
+                log_file.flush();
+                std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            }
+        }
+        fixed_rto = false;
+        server.stop();
+
+        std::cout << "RTO tests completed. Results logged to " << log_filename << std::endl;
+    }
+
+    // Server-side idempotency cache (idempotency.h). One server drops every
+    // options.drop_every-th datagram and stalls options.stall_us every
+    // options.stall_every requests, so UDP clients retransmit, some of them
+    // spuriously, and hedge over a second path to the same server. The run
+    // with --dedupe=off shows how many copies the server processed as new
+    // work; with --dedupe=on, how many it answered from the cache instead.
+    void run_dedupe_tests() {
+        std::cout << "Starting dedupe tests: server drops every " << options.drop_every << "th datagram, stalls "
+                  << options.stall_us << "us every " << options.stall_every << " requests, " << options.clients
+                  << " clients..." << std::endl;
+        write_log_header();
+        write_section_header("DEDUPE", "Dedupe,Requests,Processed,ReprocessedPct,Duplicates,DuplicatePct,Stale,"
+                                       "Retransmits,Hedges,P50Ms,P99Ms,P999Ms");
+
+        int port = options.port_base;
+        for (const char* dedupe : {"off", "on"}) {
+            ServerProcess server;
+            if (!server.start(options.server_binary,
+                              {"--port-base=" + std::to_string(port), "--stats-port=" + std::to_string(port + 3),
+                               "--drop-every=" + std::to_string(options.drop_every),
+                               "--stall-every=" + std::to_string(options.stall_every),
+                               "--stall-us=" + std::to_string(options.stall_us), std::string("--dedupe=") + dedupe},
+                              port)) {
+                return;
+            }
+            use_port_base(port);
+            hedge.reset(new HedgeTrigger());
+            auto before = query_stats(port + 3);
+            test_with_client_count("UDP", options.clients);
+            auto after = query_stats(port + 3);
+            server.stop();
+
+            auto counter = [&](const char* name) {
+                return strtoull(after[name].c_str(), nullptr, 10) - strtoull(before[name].c_str(), nullptr, 10);
+            };
+            std::vector<double> sorted = latencies;
+            std::sort(sorted.begin(), sorted.end());
+            uint64_t requests = sorted.size();
+            uint64_t processed = counter("service_requests");
+            uint64_t duplicates = counter("idempotent_duplicates");
+            uint64_t stale = counter("idempotent_stale");
+            uint64_t arrived = counter("idempotent_requests");
+            double reprocessed_pct = 100.0 * ((double)processed / std::max<uint64_t>(1, requests) - 1.0);
+            double duplicate_pct = 100.0 * duplicates / std::max<uint64_t>(1, arrived);
+            std::cout << "dedupe " << std::left << std::setw(4) << dedupe << std::right << requests << " requests, "
+                      << processed << " processed (" << std::fixed << std::setprecision(1) << std::showpos
+                      << reprocessed_pct << std::noshowpos << "%), " << duplicates << " answered from cache ("
+                      << duplicate_pct << "%), " << stale << " stale, " << retransmits << " retransmits, "
+                      << hedge->hedges() << " hedges, P50 " << std::setprecision(3) << percentile_of(sorted, 0.50)
+                      << "ms, P99 " << percentile_of(sorted, 0.99) << "ms, P99.9 " << percentile_of(sorted, 0.999)
+                      << "ms" << std::endl;
+            if (log_file.is_open()) {
+                log_file << "DEDUPE," << dedupe << "," << requests << "," << processed << std::fixed
+                         << std::setprecision(3) << "," << reprocessed_pct << "," << duplicates << "," << duplicate_pct
+                         << "," << stale << "," << retransmits << "," << hedge->hedges() << ","
+                         << percentile_of(sorted, 0.50) << "," << percentile_of(sorted, 0.99) << ","
+                         << percentile_of(sorted, 0.999) << "\n";
+            }
+            log_file.flush();
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        }
+        hedge.reset();
+
+        std::cout << "Dedupe tests completed. Results logged to " << log_filename << std::endl;
+    }
+
+    // Server transmit queues (txqueue.h). The server's UDP and QUIC sockets
+    // act full on every options.tx_saturate_every-th reply until the next
+    // EPOLLOUT. Each protocol runs options.clients clients against no queue
+    // (refused replies are dropped, as before), the default queue, and a
+    // queue of options.tx_queue replies under each drop policy, reporting
+    // replies queued and dropped, how deep and how long the backlogs got,
+    // and what the clients saw: retransmissions and the tail.
+    void run_txqueue_tests() {
+        std::cout << "Starting txqueue tests: server socket full on every " << options.tx_saturate_every
+                  << "th reply, " << options.clients << " clients..." << std::endl;
+        write_log_header();
+        write_section_header("TXQUEUE", "Protocol,Queue,Drop,Requests,Saturations,Queued,Dropped,MaxDepth,Backlogs,"
+                                        "MeanBacklogUs,LongestBacklogUs,Retransmits,GivenUp,P50Ms,P99Ms,P999Ms");
+
+        struct QueueSetup {
+            size_t size;
+            const char* drop;
+        };
+        const QueueSetup setups[] = {{0, "newest"}, {TX_QUEUE_DEFAULT, "oldest"},
+                                     {(size_t)options.tx_queue, "newest"}, {(size_t)options.tx_queue, "oldest"}};
+        int port = options.port_base;
+        for (const char* protocol : {"UDP", "QUIC"}) {
+            std::string prefix = protocol == std::string("UDP") ? "udp" : "quic";
+            for (const QueueSetup& setup : setups) {
+                ServerProcess server;
+                if (!server.start(options.server_binary,
+                                  {"--port-base=" + std::to_string(port), "--stats-port=" + std::to_string(port + 3),
+                                   "--tx-saturate-every=" + std::to_string(options.tx_saturate_every),
+                                   "--tx-queue=" + std::to_string(setup.size), std::string("--tx-drop=") + setup.drop},
+                                  port)) {
+                    return;
+                }
+                use_port_base(port);
+                auto before = query_stats(port + 3);
+                test_with_client_count(protocol, options.clients);
+                auto after = query_stats(port + 3);
+                server.stop();
+
+                auto counter = [&](const std::string& name) {
+                    return strtoull(after[name].c_str(), nullptr, 10) - strtoull(before[name].c_str(), nullptr, 10);
+                };
+                std::vector<double> sorted = latencies;
+                std::sort(sorted.begin(), sorted.end());
+                uint64_t saturations = counter("tx_saturations");
+                uint64_t queued = counter(prefix + "_tx_queued");
+                uint64_t dropped = counter(prefix + "_tx_dropped");
+                uint64_t backlogs = counter(prefix + "_tx_backlogs");
+                uint64_t max_depth = strtoull(after[prefix + "_tx_max_depth"].c_str(), nullptr, 10);
+                uint64_t longest_us = strtoull(after[prefix + "_tx_longest_backlog_us"].c_str(), nullptr, 10);
+                double mean_backlog_us = (double)counter(prefix + "_tx_backlog_us") / std::max<uint64_t>(1, backlogs);
+                std::string queue = setup.size ? std::to_string(setup.size) : "off";
+                const char* drop = setup.size ? setup.drop : "-";
+                std::cout << std::left << std::setw(5) << protocol << "queue " << std::setw(5) << queue << std::setw(7)
+                          << drop << std::right << sorted.size() << " requests, " << saturations << " saturations, "
+                          << queued << " queued, " << dropped << " dropped, max depth " << max_depth << ", "
+                          << backlogs << " backlogs mean " << std::fixed << std::setprecision(1) << mean_backlog_us
+                          << "us longest " << longest_us << "us, " << retransmits << " retransmits, "
+                          << request_timeouts << " given up, P50 " << std::setprecision(3)
+                          << percentile_of(sorted, 0.50) << "ms, P99 " << percentile_of(sorted, 0.99) << "ms, P99.9 "
+                          << percentile_of(sorted, 0.999) << "ms" << std::endl;
+                if (log_file.is_open()) {
+                    log_file << "TXQUEUE," << protocol << "," << queue << "," << drop << "," << sorted.size() << ","
+                             << saturations << "," << queued << "," << dropped << "," << max_depth << "," << backlogs
+                             << std::fixed << std::setprecision(3) << "," << mean_backlog_us << "," << longest_us
+                             << "," << retransmits << "," << request_timeouts << "," << percentile_of(sorted, 0.50)
+                             << "," << percentile_of(sorted, 0.99) << "," << percentile_of(sorted, 0.999) << "\n";
+                }
+                log_file.flush();
+                std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            }
+        }
+
+        std::cout << "Txqueue tests completed. Results logged to " << log_filename << std::endl;
+    }
+
+    // One pipelined SDK client (client.h) against the blocking workers, a
+    // thread each with one SDK request outstanding. Each protocol runs the
+    // workers with options.sdk_connections * options.sdk_pipeline
+    // threads sending back to back, then one thread driving the SDK with a
+    // pool of options.sdk_connections and options.sdk_pipeline requests in
+    // flight on each, so both keep the same number of requests outstanding.
+    // Then the SDK runs over TCP while the server restarts halfway through,
+    // showing reconnects, the requests failed and the longest gap between
+    // completions, and over UDP against a server that ignores every
+    // options.drop_every-th datagram, showing retransmissions.
+    void run_sdk_tests() {
+        int concurrency = options.sdk_connections * options.sdk_pipeline;
+        std::cout << "Starting SDK tests: " << options.sdk_connections << " connections x " << options.sdk_pipeline
+                  << " in flight against " << concurrency << " blocking clients..." << std::endl;
+        write_log_header();
+        write_section_header("SDK", "Protocol,Client,Concurrency,Requests,RequestsPerSec,P50Ms,P99Ms,P999Ms,"
+                                    "Timeouts,Failures,Retransmits,Reconnects,LongestGapMs");
+
+        ServerProcess server;
+        int port = options.port_base;
+        std::vector<std::string> args = {"--port-base=" + std::to_string(port)};
+        if (!server.start(options.server_binary, args, port)) return;
+        use_port_base(port);
+
+        const ClientProtocol protocols[] = {ClientProtocol::Tcp, ClientProtocol::Udp, ClientProtocol::Quic};
+        const char* names[] = {"TCP", "UDP", "QUIC"};
+        for (int p = 0; p < 3; p++) {
+            // The workers' rate counts what completed after the ramp-up
+            size_t steady_requests = 0;
+            think_time = false;
+            steady_state_probe = [&]() {
+                std::lock_guard<std::mutex> lock(results_mutex);
+                steady_requests = latencies.size() - ramped_requests;
+            };
+            test_with_client_count(names[p], concurrency);
+            steady_state_probe = nullptr;
+            think_time = true;
+            SdkRunResult blocking;
+            blocking.latencies_ms = latencies;
+            std::sort(blocking.latencies_ms.begin(), blocking.latencies_ms.end());
+            blocking.seconds = options.duration_sec * (double)blocking.latencies_ms.size() / std::max<size_t>(1, steady_requests);
+            blocking.counters.timeouts = request_timeouts;
+            blocking.counters.retransmits = retransmits;
+            report_sdk_run(names[p], "blocking", concurrency, blocking);
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+            report_sdk_run(names[p], "sdk", concurrency, run_sdk_client(protocols[p], port + p));
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        }
+
+        std::thread restarter([&]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(options.duration_sec * 500));
+            server.stop();
+            server.start(options.server_binary, args, port);
+        });
+        SdkRunResult restarted = run_sdk_client(ClientProtocol::Tcp, port);
+        restarter.join();
+        report_sdk_run("TCP", "sdk-restart", concurrency, restarted);
+        server.stop();
+
+        args.push_back("--drop-every=" + std::to_string(options.drop_every));
+        if (!server.start(options.server_binary, args, port)) return;
+        report_sdk_run("UDP", "sdk-loss", concurrency, run_sdk_client(ClientProtocol::Udp, port + 1));
+        server.stop();
+
+        std::cout << "SDK tests completed. Results logged to " << log_filename << std::endl;
+    }
+
+    // Keeps options.sdk_connections * options.sdk_pipeline requests of the
+    // blocking workers' size outstanding on one SDK client for
+    // options.duration_sec, each completion sending the next
+    SdkRunResult run_sdk_client(ClientProtocol protocol, int port) {
+        SdkRunResult result;
+        ClientLoop loop;
+        ClientOptions client_options;
+        client_options.protocol = protocol;
+        client_options.host = SERVER_IP;
+        client_options.port = port;
+        client_options.connections = options.sdk_connections;
+        client_options.pipeline = options.sdk_pipeline;
+        Client client(loop, client_options);
+        if (!loop.ok() || !client.open()) return result;
+
+        // The same payloads as tcp_client_worker, udp_client_worker (less
+        // the header the SDK adds) and quic_client_worker
+        size_t size = protocol == ClientProtocol::Tcp ? BUFFER_SIZE
+                    : protocol == ClientProtocol::Udp ? BUFFER_SIZE - sizeof(IdempotentHeader) : 32;
+        std::string payload(size, 'A');
+        uint64_t start = journal_now_ns();
+        uint64_t end = start + options.duration_sec * 1000000000ULL;
+        uint64_t last_completion = start;
+        std::function<void()> issue = [&]() {
+            client.request(payload.data(), payload.size(), [&](ClientReply& reply) {
+                uint64_t now = journal_now_ns();
+                if (reply.status == ClientStatus::Ok) {
+                    result.latencies_ms.push_back(reply.latency_ns / 1e6);
+                    result.longest_gap_ns = std::max(result.longest_gap_ns, now - last_completion);
+                    last_completion = now;
+                }
+                if (now < end) issue();
+            });
+        };
+        for (int i = 0; i < options.sdk_connections * options.sdk_pipeline; i++) issue();
+        loop.run_until([&]() { return client.outstanding() == 0 && journal_now_ns() >= end; });
+
+        result.seconds = (journal_now_ns() - start) / 1e9;
+        result.counters = client.counters;
+        std::sort(result.latencies_ms.begin(), result.latencies_ms.end());
+        return result;
+    }
+
+    void report_sdk_run(const char* protocol, const char* client, int concurrency, const SdkRunResult& run) {
+        const std::vector<double>& sorted = run.latencies_ms;
+        double rate = sorted.size() / std::max(1e-9, run.seconds);
+        std::cout << std::left << std::setw(5) << protocol << std::setw(12) << client << std::right << sorted.size()
+                  << " requests, " << std::fixed << std::setprecision(0) << rate << "/s, P50 "
+                  << std::setprecision(3) << percentile_of(sorted, 0.50) << "ms, P99 " << percentile_of(sorted, 0.99)
+                  << "ms, P99.9 " << percentile_of(sorted, 0.999) << "ms, " << run.counters.timeouts << " timeouts, "
+                  << run.counters.failures << " failed, " << run.counters.retransmits << " retransmits, "
+                  << run.counters.reconnects << " reconnects, longest gap " << run.longest_gap_ns / 1e6 << "ms"
+                  << std::endl;
+        if (log_file.is_open()) {
+            log_file << "SDK," << protocol << "," << client << "," << concurrency << "," << sorted.size()
+                     << std::fixed << std::setprecision(3) << "," << rate << "," << percentile_of(sorted, 0.50) << ","
+                     << percentile_of(sorted, 0.99) << "," << percentile_of(sorted, 0.999) << ","
+                     << run.counters.timeouts << "," << run.counters.failures << "," << run.counters.retransmits
+                     << "," << run.counters.reconnects << "," << run.longest_gap_ns / 1e6 << "\n";
+        }
+        log_file.flush();
+    }
+
+    // Scripted FIX traders (script.h) against the server's --fix endpoint:
+    // options.script_sessions coroutine sessions, split over
+    // options.script_threads client threads of one event loop each, every
+    // one running fix_trader_script. Reports how many sessions completed,
+    // the most connections open at once, messages per second and client CPU
+    // per message, then latency per script step.
+    void run_script_tests() {
+        int sessions = std::max(1, options.script_sessions);
+        int threads = std::min(sessions, std::max(1, options.script_threads));
+        std::cout << "Starting script test: " << sessions << " scripted FIX traders on " << threads
+                  << " thread(s), " << options.script_orders << " orders each at " << options.script_order_rate
+                  << "/s..." << std::endl;
+        write_log_header();
+
+        int stats_port = options.port_base + 3;
+        ServerProcess server;
+        if (!server.start(options.server_binary,
+                          {"--port-base=" + std::to_string(options.port_base), "--fix",
+                           "--stats-port=" + std::to_string(stats_port)},
+                          options.port_base)) {
+            return;
+        }
+
+        std::vector<std::unique_ptr<ScriptContext>> contexts;
+        std::vector<size_t> peaks(threads, 0);
+        std::vector<uint64_t> cpu_ns(threads, 0);
+        std::vector<std::thread> workers;
+        auto start = std::chrono::steady_clock::now();
+        for (int t = 0; t < threads; t++) {
+            contexts.emplace_back(new ScriptContext());
+            ScriptContext& context = *contexts.back();
+            memset(&context.server, 0, sizeof(context.server));
+            context.server.sin_family = AF_INET;
+            context.server.sin_port = htons(options.port_base);
+            inet_pton(AF_INET, SERVER_IP, &context.server.sin_addr);
+            context.orders = options.script_orders;
+            context.order_interval_ns = 1000000000ULL / std::max(1, options.script_order_rate);
+            uint32_t first = (uint32_t)((uint64_t)sessions * t / threads);
+            size_t count = (size_t)((uint64_t)sessions * (t + 1) / threads) - first;
+            workers.emplace_back(&ScalabilityTester::script_thread, first, count, std::ref(context),
+                                 std::ref(peaks[t]), std::ref(cpu_ns[t]));
+        }
+        for (auto& worker : workers) worker.join();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        auto server_stats = query_stats(stats_port);
+        server.stop();
+
+        uint64_t completed = 0, sent = 0, received = 0, rejects = 0, cpu = 0;
+        size_t peak = 0;
+        uint64_t failures[SCRIPT_STEPS] = {};
+        std::vector<double> latencies[SCRIPT_STEPS];
+        for (int t = 0; t < threads; t++) {
+            const ScriptContext& context = *contexts[t];
+            completed += context.completed;
+            sent += context.sent;
+            received += context.received;
+            rejects += context.rejects;
+            cpu += cpu_ns[t];
+            peak += peaks[t];
+            for (int step = 0; step < SCRIPT_STEPS; step++) {
+                failures[step] += context.failures[step];
+                latencies[step].insert(latencies[step].end(), context.latencies_us[step].begin(),
+                                       context.latencies_us[step].end());
+            }
+        }
+        double rate = (sent + received) / std::max(1e-9, seconds);
+        double cpu_per_message = cpu / 1000.0 / std::max<uint64_t>(1, sent + received);
+
+        write_section_header("SCRIPT SESSIONS", "Sessions,Threads,Completed,Failed,Seconds,PeakOpen,MessagesSent,"
+                                                "MessagesReceived,MessagesPerSec,ClientCpuUsPerMsg,ServerOrders,"
+                                                "ServerCancels,ServerMdRequests,Rejects");
+        std::cout << sessions << " sessions on " << threads << " thread(s): " << completed << " completed, "
+                  << sessions - completed << " failed in " << std::fixed << std::setprecision(2) << seconds
+                  << "s, " << peak << " open at once, " << sent << " messages sent, " << received
+                  << " received, " << std::setprecision(0) << rate << " messages/s, client CPU "
+                  << std::setprecision(3) << cpu_per_message << "us/msg, server orders "
+                  << server_stats["fix_orders"] << ", cancels " << server_stats["fix_cancels"]
+                  << ", market data requests " << server_stats["fix_md_requests"] << ", rejects " << rejects
+                  << std::endl;
+        if (log_file.is_open()) {
+            log_file << "SCRIPT_SESSIONS," << sessions << "," << threads << "," << completed << ","
+                     << sessions - completed << std::fixed << std::setprecision(3) << "," << seconds << "," << peak
+                     << "," << sent << "," << received << "," << rate << "," << cpu_per_message << ","
+                     << server_stats["fix_orders"] << "," << server_stats["fix_cancels"] << ","
+                     << server_stats["fix_md_requests"] << "," << rejects << "\n";
+        }
+
+        write_section_header("SCRIPT STEPS", "Step,Completed,Failed,P50Us,P99Us,P999Us,MaxUs");
+        for (int step = 0; step < SCRIPT_STEPS; step++) {
+            std::vector<double>& sorted = latencies[step];
+            std::sort(sorted.begin(), sorted.end());
+            double max = sorted.empty() ? 0 : sorted.back();
+            std::cout << std::left << std::setw(10) << SCRIPT_STEP_NAMES[step] << std::right << sorted.size()
+                      << " completed, " << failures[step] << " failed, P50 " << std::fixed << std::setprecision(1)
+                      << percentile_of(sorted, 0.50) << "us, P99 " << percentile_of(sorted, 0.99) << "us, P99.9 "
+                      << percentile_of(sorted, 0.999) << "us, max " << max << "us" << std::endl;
+            if (log_file.is_open()) {
+                log_file << "SCRIPT_STEP," << SCRIPT_STEP_NAMES[step] << "," << sorted.size() << ","
+                         << failures[step] << std::fixed << std::setprecision(3) << ","
+                         << percentile_of(sorted, 0.50) << "," << percentile_of(sorted, 0.99) << ","
+                         << percentile_of(sorted, 0.999) << "," << max << "\n";
+            }
+        }
+        log_file.flush();
+
+        std::cout << "Script tests completed. Results logged to " << log_filename << std::endl;
+    }
+
+    // One client thread of the script scenario: count traders numbered from
+    // first on one loop, run until every script has ended
+    static void script_thread(uint32_t first, size_t count, ScriptContext& context, size_t& peak_open,
+                              uint64_t& cpu_ns) {
+        ClientLoop loop;
+        if (!loop.ok()) return;
+        ScriptScheduler scheduler(loop);
+        for (size_t i = 0; i < count; i++) {
+            ScriptSession& session = scheduler.spawn();
+            session.start(fix_trader_script(session, context, first + (uint32_t)i));
+        }
+        loop.run_until([&]() { return scheduler.running() == 0; });
+        peak_open = scheduler.peak_open_sockets;
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        cpu_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    // The server's TCP echo served by callbacks against a coroutine per
+    // connection (handler.h), HANDLER_ROUNDS times in alternation to show
+    // the run-to-run spread. Each server runs options.clients blocking
+    // workers back to back, then the SDK client pipelining over
+    // options.sdk_connections connections (new ones, so coroutine frames
+    // come from the pool). Reports requests per second, latency and server
+    // CPU per request, and for coroutines the frames allocated and reused.
+    void run_handler_tests() {
+        std::cout << "Starting handler test: callback against coroutine TCP echo, " << options.clients
+                  << " blocking clients and an SDK pool of " << options.sdk_connections << " x "
+                  << options.sdk_pipeline << "..." << std::endl;
+        write_log_header();
+
+        struct Row {
+            std::string handler, client;
+            int round, concurrency;
+            size_t requests;
+            double rate, p50, p99, p999, server_cpu_us;
+        };
+        std::vector<Row> rows;
+        std::vector<std::string> frame_rows;
+        int port = options.port_base;
+        int stats_port = port + 3;
+        for (int round = 1; round <= HANDLER_ROUNDS; round++) {
+            for (const char* handler : {"callback", "coroutine"}) {
+                ServerProcess server;
+                if (!server.start(options.server_binary,
+                                  {"--port-base=" + std::to_string(port), "--stats-port=" + std::to_string(stats_port),
+                                   std::string("--tcp-handler=") + handler},
+                                  port)) {
+                    return;
+                }
+                use_port_base(port);
+                std::cout << "Round " << round << ", " << handler << " handlers..." << std::endl;
+
+                size_t steady_requests = 0;
+                think_time = false;
+                steady_state_probe = [&]() {
+                    std::lock_guard<std::mutex> lock(results_mutex);
+                    steady_requests = latencies.size() - ramped_requests;
+                };
+                long long cpu_before = cpu_time_us(server.get_pid());
+                test_with_client_count("TCP", options.clients);
+                long long cpu_after = cpu_time_us(server.get_pid());
+                steady_state_probe = nullptr;
+                think_time = true;
+                std::vector<double> blocking = latencies;
+                std::sort(blocking.begin(), blocking.end());
+                Row row;
+                row.handler = handler;
+                row.client = "blocking";
+                row.round = round;
+                row.concurrency = options.clients;
+                row.requests = blocking.size();
+                row.rate = (double)steady_requests / options.duration_sec;
+                row.p50 = percentile_of(blocking, 0.50);
+                row.p99 = percentile_of(blocking, 0.99);
+                row.p999 = percentile_of(blocking, 0.999);
+                row.server_cpu_us = (cpu_after - cpu_before) / (double)std::max<size_t>(1, blocking.size());
+                rows.push_back(row);
+                std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+                cpu_before = cpu_time_us(server.get_pid());
+                SdkRunResult sdk = run_sdk_client(ClientProtocol::Tcp, port);
+                cpu_after = cpu_time_us(server.get_pid());
+                row.client = "sdk";
+                row.concurrency = options.sdk_connections * options.sdk_pipeline;
+                row.requests = sdk.latencies_ms.size();
+                row.rate = row.requests / std::max(1e-9, sdk.seconds);
+                row.p50 = percentile_of(sdk.latencies_ms, 0.50);
+                row.p99 = percentile_of(sdk.latencies_ms, 0.99);
+                row.p999 = percentile_of(sdk.latencies_ms, 0.999);
+                row.server_cpu_us = (cpu_after - cpu_before) / (double)std::max<size_t>(1, row.requests);
+                rows.push_back(row);
+
+                if (strcmp(handler, "coroutine") == 0) {
+                    auto stats = query_stats(stats_port);
+                    frame_rows.push_back(std::to_string(round) + "," + stats["coro_handlers"] + "," +
+                                         stats["coro_resumes"] + "," + stats["coro_frames_allocated"] + "," +
+                                         stats["coro_frames_reused"] + "," + stats["coro_frames_oversized"]);
+                    std::cout << "Round " << round << " coroutine frames: " << stats["coro_handlers"]
+                              << " handlers, " << stats["coro_frames_allocated"] << " allocated, "
+                              << stats["coro_frames_reused"] << " reused, " << stats["coro_frames_oversized"]
+                              << " oversized, " << stats["coro_resumes"] << " resumes" << std::endl;
+                }
+                server.stop();
+                std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            }
+        }
+
+        write_section_header("HANDLERS", "Handler,Round,Client,Concurrency,Requests,RequestsPerSec,P50Ms,P99Ms,"
+                                         "P999Ms,ServerCpuUsPerRequest");
+        for (const Row& row : rows) {
+            std::cout << std::left << std::setw(10) << row.handler << "round " << row.round << " " << std::setw(9)
+                      << row.client << std::right << row.requests << " requests, " << std::fixed
+                      << std::setprecision(0) << row.rate << "/s, P50 " << std::setprecision(3) << row.p50
+                      << "ms, P99 " << row.p99 << "ms, P99.9 " << row.p999 << "ms, server CPU " << row.server_cpu_us
+                      << "us/request" << std::endl;
+            if (log_file.is_open()) {
+                log_file << "HANDLERS," << row.handler << "," << row.round << "," << row.client << ","
+                         << row.concurrency << "," << row.requests << std::fixed << std::setprecision(3) << ","
+                         << row.rate << "," << row.p50 << "," << row.p99 << "," << row.p999 << ","
+                         << row.server_cpu_us << "\n";
+            }
+        }
+        write_section_header("HANDLER FRAMES", "Round,Handlers,Resumes,FramesAllocated,FramesReused,FramesOversized");
+        if (log_file.is_open()) {
+            for (const std::string& line : frame_rows) log_file << "HANDLER_FRAMES," << line << "\n";
+        }
+        log_file.flush();
+
+        std::cout << "Handler tests completed. Results logged to " << log_filename << std::endl;
+    }
+
+    // Closed loop: pick a replica, send one request, wait for its echo,
+    // report the latency to the balancer, pause BALANCE_THINK_US
+    void balance_client_worker(int id, const std::vector<int>& ports, ReplicaBalancer& balancer,
+                               BalanceClientStats& stats) {
+        std::vector<int> sockets;
+        for (int port : ports) {
+            int sock = connect_tcp(port);
+            if (sock != -1) {
+                int opt = 1;
+                setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+            }
+            sockets.push_back(sock);
+        }
+        std::mt19937_64 rng(id + 1);
+        char request[BALANCE_REQUEST_SIZE];
+        char reply[BALANCE_REQUEST_SIZE];
+        memset(request, 'b', sizeof(request));
+        while (!stop_test) {
+            size_t replica = balancer.pick(rng());
+            if (sockets[replica] == -1) {
+                stats.failures++;
+                continue;
+            }
+            balancer.start(replica);
+            uint64_t start = journal_now_ns();
+            bool ok = send_all(sockets[replica], request, sizeof(request)) &&
+                      recv_all(sockets[replica], reply, sizeof(reply));
+            uint64_t latency = journal_now_ns() - start;
+            balancer.finish(replica, latency);
+            if (!ok) {
+                stats.failures++;
+                close(sockets[replica]);
+                sockets[replica] = -1;
+                continue;
+            }
+            stats.latencies_us.push_back(latency / 1000.0);
+            struct timespec pause = {0, BALANCE_THINK_US * 1000L};
+            nanosleep(&pause, nullptr);
+        }
+        for (int sock : sockets) {
+            if (sock != -1) close(sock);
+        }
+    }
+
+    // Sharded cluster with client-side consistent-hash routing (hash_ring.h).
+    // Offline, it compares ring balance and the share of symbols moved when a
+    // shard joins or leaves against modulo hashing. Live, options.streams
+    // clients send SHARD_BATCH quotes per round trip, each to the shard owning
+    // its symbol, over each cluster size in options.shard_counts. Last, a
+    // SHARD_REBALANCE_SHARDS cluster gains a shard a third of the way in and
+    // loses one to SIGKILL at two thirds, and the throughput timeline shows
+    // the disruption.
+    void run_shard_tests() {
+        std::cout << "Starting shard tests: " << options.streams << " clients, " << options.vnodes
+                  << " virtual nodes per shard..." << std::endl;
+        write_log_header();
+
+        write_section_header("SHARD RING", "VNodes,Shards,MaxOverMean,MovedOnAddPct,MovedOnRemovePct,"
+                                           "ModuloMovedOnAddPct,LookupNs");
+        for (int vnodes : {16, options.vnodes, 1024}) {
+            for (int shards : options.shard_counts) {
+                ConsistentHashRing ring(vnodes), grown(vnodes), shrunk(vnodes);
+                for (int node = 0; node < shards; node++) {
+                    ring.add_node(node);
+                    grown.add_node(node);
+                    if (node > 0) shrunk.add_node(node);
+                }
+                grown.add_node(shards);
+                std::vector<int> load(shards, 0);
+                int moved_add = 0, moved_remove = 0, modulo_moved = 0;
+                uint64_t start = journal_now_ns();
+                for (int symbol = 0; symbol < SHARD_SYMBOLS; symbol++) load[ring.lookup(symbol)]++;
+                double lookup_ns = (double)(journal_now_ns() - start) / SHARD_SYMBOLS;
+                for (int symbol = 0; symbol < SHARD_SYMBOLS; symbol++) {
+                    int owner = ring.lookup(symbol);
+                    if (grown.lookup(symbol) != owner) moved_add++;
+                    if (shards > 1 && shrunk.lookup(symbol) != owner) moved_remove++;
+                    if (hash_mix64(symbol) % shards != hash_mix64(symbol) % (shards + 1)) modulo_moved++;
+                }
+                double max_over_mean = *std::max_element(load.begin(), load.end()) / ((double)SHARD_SYMBOLS / shards);
+                double add_pct = 100.0 * moved_add / SHARD_SYMBOLS;
+                double remove_pct = 100.0 * moved_remove / SHARD_SYMBOLS;
+                double modulo_pct = 100.0 * modulo_moved / SHARD_SYMBOLS;
+                std::cout << std::setw(5) << vnodes << " vnodes, " << shards << " shards: max/mean load "
+                          << std::fixed << std::setprecision(2) << max_over_mean << ", moved on add "
+                          << std::setprecision(1) << add_pct << "% (ideal " << 100.0 / (shards + 1)
+                          << "%, modulo " << modulo_pct << "%), on remove " << remove_pct << "%, lookup "
+                          << lookup_ns << "ns" << std::endl;
+                if (log_file.is_open()) {
+                    log_file << "SHARD_RING," << vnodes << "," << shards << std::fixed << std::setprecision(3) << ","
+                             << max_over_mean << "," << add_pct << "," << remove_pct << "," << modulo_pct << ","
+                             << lookup_ns << "\n";
+                }
+            }
+        }
+        log_file.flush();
+
+        write_section_header("SHARD SCALING", "Key,Shards,Clients,MsgPerSec,P50Us,P99Us,MaxOverMeanLoad,Failures");
+        unsigned cores = std::thread::hardware_concurrency();
+        if ((int)cores < *std::max_element(options.shard_counts.begin(), options.shard_counts.end())) {
+            std::cout << "Note: " << cores << " CPU(s) for up to "
+                      << *std::max_element(options.shard_counts.begin(), options.shard_counts.end())
+                      << " shards plus clients; shards share cores, so larger clusters show routing cost, not scaling"
+                      << std::endl;
+        }
+        int largest = std::max(SHARD_REBALANCE_SHARDS + 1,
+                               *std::max_element(options.shard_counts.begin(), options.shard_counts.end()));
+        std::vector<std::unique_ptr<ServerProcess>> servers;
+        auto shard_port = [&](int shard) { return options.port_base + 100 + shard * SHARD_PORT_STRIDE; };
+        auto ensure_servers = [&](int count) {
+            while ((int)servers.size() < count) {
+                int port = shard_port((int)servers.size());
+                servers.emplace_back(new ServerProcess());
+                if (!servers.back()->start(options.server_binary, {"--port-base=" + std::to_string(port)}, port)) {
+                    return false;
+                }
+            }
+            return true;
+        };
+        for (bool by_symbol : {true, false}) {
+          shard_by_symbol = by_symbol;
+          const char* key = by_symbol ? "symbol" : "connection";
+          for (int shards : options.shard_counts) {
+            if (!ensure_servers(shards)) return;
+            std::shared_ptr<ShardRouting> routing(new ShardRouting(options.vnodes));
+            for (int shard = 0; shard < shards; shard++) {
+                routing->ring.add_node(shard);
+                routing->ports[shard] = shard_port(shard);
+            }
+            std::vector<ShardClientStats> stats = run_shard_clients(routing, options.duration_sec, nullptr);
+
+            uint64_t messages = 0, failures = 0;
+            std::map<int, uint64_t> per_shard;
+            std::vector<double> latencies;
+            for (const ShardClientStats& client : stats) {
+                messages += client.messages;
+                failures += client.failures;
+                for (const auto& entry : client.per_shard) per_shard[entry.first] += entry.second;
+                latencies.insert(latencies.end(), client.latencies_us.begin(), client.latencies_us.end());
+            }
+            std::sort(latencies.begin(), latencies.end());
+            uint64_t busiest = 0;
+            for (const auto& entry : per_shard) busiest = std::max(busiest, entry.second);
+            double max_over_mean = busiest / std::max(1.0, (double)messages / shards);
+            double rate = (double)messages / options.duration_sec;
+            std::cout << std::left << std::setw(11) << key << std::right << shards << " shards: " << std::fixed
+                      << std::setprecision(0) << rate << " msg/s, batch P50 "
+                      << std::setprecision(1) << percentile_of(latencies, 0.50) << "us, P99 "
+                      << percentile_of(latencies, 0.99) << "us, busiest shard " << std::setprecision(2)
+                      << max_over_mean << "x mean, " << failures << " failures" << std::endl;
+            if (log_file.is_open()) {
+                log_file << "SHARD_SCALING," << key << "," << shards << "," << options.streams << std::fixed
+                         << std::setprecision(3) << "," << rate << "," << percentile_of(latencies, 0.50) << ","
+                         << percentile_of(latencies, 0.99) << "," << max_over_mean << "," << failures << "\n";
+            }
+            log_file.flush();
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+          }
+        }
+        shard_by_symbol = true;
+
+        write_section_header("SHARD REBALANCE",
+                             "Event,ShardsBefore,ShardsAfter,MovedPct,FailedMessages,DetectMs,DipPct,RecoveryMs");
+        if (!ensure_servers(largest)) return;
+        std::shared_ptr<ShardRouting> routing(new ShardRouting(options.vnodes));
+        for (int shard = 0; shard < SHARD_REBALANCE_SHARDS; shard++) {
+            routing->ring.add_node(shard);
+            routing->ports[shard] = shard_port(shard);
+        }
+        uint64_t add_ns = 0, kill_ns = 0;
+        double add_moved = 0, remove_moved = 0;
+        uint64_t rebalance_failures = 0;
+        std::vector<uint64_t> timeline;  // Messages per SHARD_SAMPLE_MS
+        std::vector<uint64_t> sample_ns;
+        std::function<void()> driver = [&]() {
+            uint64_t start = journal_now_ns();
+            uint64_t last = shard_delivered.load();
+            uint64_t end = start + (uint64_t)options.duration_sec * 1000000000ULL;
+            bool added = false, killed = false;
+            while (journal_now_ns() < end) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(SHARD_SAMPLE_MS));
+                uint64_t now = journal_now_ns();
+                uint64_t delivered = shard_delivered.load();
+                timeline.push_back(delivered - last);
+                sample_ns.push_back(now);
+                last = delivered;
+                if (!added && now - start >= (end - start) / 3) {
+                    added = true;
+                    std::lock_guard<std::mutex> lock(shard_mutex);
+                    std::shared_ptr<const ShardRouting> current = std::atomic_load(&shard_routing);
+                    std::shared_ptr<ShardRouting> next(new ShardRouting(*current));
+                    next->ring.add_node(SHARD_REBALANCE_SHARDS);
+                    next->ports[SHARD_REBALANCE_SHARDS] = shard_port(SHARD_REBALANCE_SHARDS);
+                    add_moved = moved_share(current->ring, next->ring);
+                    std::atomic_store(&shard_routing, std::shared_ptr<const ShardRouting>(next));
+                    add_ns = journal_now_ns();
+                    shard_version++;
+                } else if (!killed && now - start >= (end - start) * 2 / 3) {
+                    killed = true;
+                    {
+                        std::lock_guard<std::mutex> lock(shard_mutex);
+                        std::shared_ptr<const ShardRouting> current = std::atomic_load(&shard_routing);
+                        ShardRouting without(*current);
+                        without.ring.remove_node(0);
+                        remove_moved = moved_share(current->ring, without.ring);
+                    }
+                    kill_ns = journal_now_ns();
+                    servers[0]->stop(SIGKILL);
+                }
+            }
+        };
+        std::vector<ShardClientStats> stats = run_shard_clients(routing, 0, &driver);
+        for (const ShardClientStats& client : stats) rebalance_failures += client.failures;
+
+        // Baseline: the second before each event; dip: the worst window in the second after it
+        auto disruption = [&](uint64_t event_ns, double& dip_pct, double& recovery_ms) {
+            double baseline = 0;
+            int baseline_samples = 0;
+            double worst = -1;
+            recovery_ms = 0;
+            bool recovered = false;
+            for (size_t i = 0; i < timeline.size(); i++) {
+                if (sample_ns[i] <= event_ns && sample_ns[i] + 1000000000ULL > event_ns) {
+                    baseline += timeline[i];
+                    baseline_samples++;
+                }
+            }
+            baseline /= std::max(1, baseline_samples);
+            for (size_t i = 0; i < timeline.size(); i++) {
+                if (sample_ns[i] <= event_ns || sample_ns[i] > event_ns + 1000000000ULL) continue;
+                if (worst < 0 || timeline[i] < worst) worst = timeline[i];
+                if (!recovered && timeline[i] >= 0.9 * baseline) {
+                    recovered = true;
+                    recovery_ms = (sample_ns[i] - event_ns) / 1e6;
+                }
+            }
+            dip_pct = baseline > 0 && worst >= 0 ? 100.0 * (1.0 - worst / baseline) : 0;
+            if (dip_pct < 0) dip_pct = 0;
+            if (!recovered) recovery_ms = -1;
+        };
+        double add_dip, add_recovery, kill_dip, kill_recovery;
+        disruption(add_ns, add_dip, add_recovery);
+        disruption(kill_ns, kill_dip, kill_recovery);
+        uint64_t removed = shard_removed_ns.load();
+        double detect_ms = removed > kill_ns ? (removed - kill_ns) / 1e6 : -1;
+
+        auto recovery_text = [](double ms) {
+            std::ostringstream text;
+            if (ms < 0) {
+                text << "not back to 90% within 1s";
+            } else {
+                text << "back to 90% in " << std::fixed << std::setprecision(1) << ms << "ms";
+            }
+            return text.str();
+        };
+        std::cout << "Add shard " << SHARD_REBALANCE_SHARDS << " -> " << SHARD_REBALANCE_SHARDS + 1 << ": "
+                  << std::fixed << std::setprecision(1) << add_moved << "% of symbols moved, dip " << add_dip
+                  << "%, " << recovery_text(add_recovery) << std::endl;
+        std::cout << "Kill shard " << SHARD_REBALANCE_SHARDS + 1 << " -> " << SHARD_REBALANCE_SHARDS << ": "
+                  << remove_moved << "% of symbols moved, " << rebalance_failures << " messages failed, detected in "
+                  << detect_ms << "ms, dip " << kill_dip << "%, " << recovery_text(kill_recovery) << std::endl;
+        if (log_file.is_open()) {
+            log_file << std::fixed << std::setprecision(3) << "SHARD_REBALANCE,add," << SHARD_REBALANCE_SHARDS << ","
+                     << SHARD_REBALANCE_SHARDS + 1 << "," << add_moved << ",0,0," << add_dip << "," << add_recovery
+                     << "\n";
+            log_file << "SHARD_REBALANCE,kill," << SHARD_REBALANCE_SHARDS + 1 << "," << SHARD_REBALANCE_SHARDS
+                     << "," << remove_moved << "," << rebalance_failures << "," << detect_ms << "," << kill_dip
+                     << "," << kill_recovery << "\n";
+        }
+        log_file.flush();
+        for (auto& server : servers) server->stop();
+
+        std::cout << "Shard tests completed. Results logged to " << log_filename << std::endl;
+    }
+
+    static double moved_share(const ConsistentHashRing& before, const ConsistentHashRing& after) {
+        int moved = 0;
+        for (int symbol = 0; symbol < SHARD_SYMBOLS; symbol++) {
+            if (before.lookup(symbol) != after.lookup(symbol)) moved++;
+        }
+        return 100.0 * moved / SHARD_SYMBOLS;
+    }
+
+    // Publishes routing, runs options.streams shard clients for duration_sec
+    // (or while driver runs, when given) and returns what each saw
+    std::vector<ShardClientStats> run_shard_clients(std::shared_ptr<ShardRouting> routing, int duration_sec,
+                                                    std::function<void()>* driver) {
+        std::atomic_store(&shard_routing, std::shared_ptr<const ShardRouting>(routing));
+        shard_version++;
+        shard_delivered = 0;
+        shard_removed_ns = 0;
+        stop_test = false;
+        std::vector<ShardClientStats> stats(std::max(1, options.streams));
+        std::vector<std::thread> clients;
+        for (size_t i = 0; i < stats.size(); i++) {
+            clients.emplace_back(&ScalabilityTester::shard_client_worker, this, (int)i, std::ref(stats[i]));
+        }
+        if (driver) {
+            (*driver)();
+        } else {
+            std::this_thread::sleep_for(std::chrono::seconds(duration_sec));
+        }
+        stop_test = true;
+        for (auto& client : clients) client.join();
+        return stats;
+    }
+
+    // Takes a failed shard out of the ring, once, on behalf of every client
+    void report_shard_failure(int shard) {
+        std::lock_guard<std::mutex> lock(shard_mutex);
+        std::shared_ptr<const ShardRouting> current = std::atomic_load(&shard_routing);
+        if (!current->ports.count(shard)) return;
+        std::shared_ptr<ShardRouting> next(new ShardRouting(*current));
+        next->ring.remove_node(shard);
+        next->ports.erase(shard);
+        std::atomic_store(&shard_routing, std::shared_ptr<const ShardRouting>(next));
+        shard_removed_ns = journal_now_ns();
+        shard_version++;
+    }
+
+    // Sends SHARD_BATCH quotes per round trip, each to the shard that owns
+    // its symbol (or all to the shard owning the client's ID), and waits for
+    // every shard's echo
+    void shard_client_worker(int id, ShardClientStats& stats) {
+        std::mt19937_64 rng(id + 1);
+        std::shared_ptr<const ShardRouting> routing;
+        uint64_t version = 0;
+        std::map<int, int> sockets;  // Shard -> connection
+        std::map<int, std::vector<MarketMessage>> batch;
+        std::vector<MarketMessage> echo;
+        uint64_t order_id = (uint64_t)id << 40;
+        while (!stop_test) {
+            if (shard_version.load() != version) {
+                version = shard_version.load();
+                routing = std::atomic_load(&shard_routing);
+                for (auto it = sockets.begin(); it != sockets.end();) {
+                    if (!routing->ports.count(it->first)) {
+                        close(it->second);
+                        it = sockets.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+
+            for (auto& part : batch) part.second.clear();
+            for (int i = 0; i < SHARD_BATCH; i++) {
+                uint64_t r = rng();
+                MarketMessage msg;
+                memset(&msg, 0, sizeof(msg));
+                msg.magic = MARKET_MAGIC;
+                msg.type = MARKET_QUOTE;
+                msg.side = (uint8_t)(r & 1);
+                msg.symbol = (uint16_t)((r >> 8) % SHARD_SYMBOLS);
+                msg.order_id = order_id++;
+                msg.price = 1000000 + (int64_t)((r >> 24) % 1000);
+                msg.quantity = 100;
+                batch[routing->ring.lookup(shard_by_symbol ? msg.symbol : (uint64_t)id)].push_back(msg);
+            }
+
+            uint64_t start = journal_now_ns();
+            std::vector<int> failed;
+            for (auto& part : batch) {
+                if (part.second.empty()) continue;
+                auto found = sockets.find(part.first);
+                if (found == sockets.end()) {
+                    int sock = connect_tcp(routing->ports.at(part.first));
+                    if (sock == -1) {
+                        failed.push_back(part.first);
+                        continue;
+                    }
+                    int opt = 1;
+                    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+                    struct timeval timeout = {1, 0};
+                    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                    found = sockets.emplace(part.first, sock).first;
+                }
+                if (!send_all(found->second, (const char*)part.second.data(),
+                              part.second.size() * sizeof(MarketMessage))) {
+                    failed.push_back(part.first);
+                }
+            }
+            for (auto& part : batch) {
+                if (part.second.empty() || std::find(failed.begin(), failed.end(), part.first) != failed.end()) {
+                    continue;
+                }
+                echo.resize(part.second.size());
+                if (!recv_all(sockets[part.first], (char*)echo.data(), echo.size() * sizeof(MarketMessage))) {
+                    failed.push_back(part.first);
+                    continue;
+                }
+                stats.messages += part.second.size();
+                stats.per_shard[part.first] += part.second.size();
+                shard_delivered += part.second.size();
+            }
+            for (int shard : failed) {
+                stats.failures += batch[shard].size();
+                auto found = sockets.find(shard);
+                if (found != sockets.end()) {
+                    close(found->second);
+                    sockets.erase(found);
+                }
+                report_shard_failure(shard);
+            }
+            if (failed.empty()) stats.latencies_us.push_back((journal_now_ns() - start) / 1000.0);
+        }
+        for (auto& entry : sockets) close(entry.second);
+    }
+
+    // Columnar tick store (tickstore.h). Offline, it writes options.tick_rows
+    // rows over TICK_SYMBOLS symbols and TICK_TEST_DAYS days and times the
+    // appends and the sync. Then the server serves that store once per send
+    // mode and queries of 1k to 1M rows are timed to first byte and to the
+    // end of the reply. Last, a live run stores a paced UDP trade stream.
+    void run_tickstore_tests() {
+        std::cout << "Starting tick store test: " << options.tick_rows << " rows over " << TICK_SYMBOLS
+                  << " symbols in " << options.tick_dir << "..." << std::endl;
+        write_log_header();
+
+        write_section_header("TICK STORE WRITE", "Rows,Symbols,Partitions,WriteSec,MRowsPerSec,MBPerSec,SyncSec");
+        remove_tick_store(options.tick_dir);
+        int64_t span_ns = TICK_TEST_DAYS * TICK_NS_PER_DAY;
+        double row_spacing = (double)span_ns / std::max<uint64_t>(1, options.tick_rows);
+        {
+            TickStore store;
+            if (!store.open(options.tick_dir)) return;
+            std::vector<int64_t> prices(TICK_SYMBOLS);
+            for (int symbol = 0; symbol < TICK_SYMBOLS; symbol++) prices[symbol] = 1000000 + symbol * 100;
+            std::mt19937_64 rng(3);
+            uint64_t start = journal_now_ns();
+            for (uint64_t row = 0; row < options.tick_rows; row++) {
+                uint16_t symbol = (uint16_t)(row % TICK_SYMBOLS);
+                uint64_t r = rng();
+                prices[symbol] += (int64_t)(r & 7) - 3;
+                if (!store.append(symbol, TICK_TEST_START_NS + (int64_t)(row * row_spacing), prices[symbol],
+                                  1 + (uint32_t)((r >> 8) % 1000))) {
+                    return;
+                }
+            }
+            double write_sec = (journal_now_ns() - start) / 1e9;
+            start = journal_now_ns();
+            store.sync();
+            double sync_sec = (journal_now_ns() - start) / 1e9;
+            double row_bytes = 2 * sizeof(int64_t) + sizeof(uint32_t);
+            std::cout << options.tick_rows << " rows in " << store.partition_count() << " partitions: "
+                      << std::fixed << std::setprecision(2) << write_sec << "s, "
+                      << options.tick_rows / write_sec / 1e6 << " Mrows/s, " << std::setprecision(0)
+                      << options.tick_rows * row_bytes / write_sec / 1e6 << " MB/s; sync " << std::setprecision(2)
+                      << sync_sec << "s" << std::endl;
+            if (log_file.is_open()) {
+                log_file << "TICK_STORE_WRITE," << options.tick_rows << "," << TICK_SYMBOLS << ","
+                         << store.partition_count() << std::fixed << std::setprecision(3) << "," << write_sec << ","
+                         << options.tick_rows / write_sec / 1e6 << "," << options.tick_rows * row_bytes / write_sec / 1e6
+                         << "," << sync_sec << "\n";
+            }
+            log_file.flush();
+        }
+
+        write_section_header("TICK QUERY",
+                             "Send,RowsPerQuery,Queries,Invalid,FirstByteP50Us,FirstByteP99Us,TotalP50Us,TotalP99Us,MBPerSec,"
+                             "ServerCpuUsPerMB");
+        int stats_port = options.port_base + 3;
+        int query_port = options.port_base + 4;
+        int64_t symbol_row_ns = (int64_t)(row_spacing * TICK_SYMBOLS);
+        for (const char* send : {"sendfile", "copy"}) {
+            ServerProcess server;
+            if (!server.start(options.server_binary,
+                              {"--port-base=" + std::to_string(options.port_base),
+                               "--tick-store=" + options.tick_dir, "--tick-query-port=" + std::to_string(query_port),
+                               std::string("--tick-send=") + send, "--stats-port=" + std::to_string(stats_port)},
+                              options.port_base)) {
+                break;
+            }
+            int sock = connect_tcp(query_port);
+            if (sock == -1) {
+                perror("connect tick query");
+                server.stop();
+                break;
+            }
+            std::mt19937_64 rng(4);
+            for (uint64_t rows : {1000ull, 100000ull, 1000000ull}) {
+                if (rows * 2 > options.tick_rows / TICK_SYMBOLS) continue;  // Ranges must fit in the data
+                int queries = rows >= 1000000 ? 10 : rows >= 100000 ? 50 : 500;
+                std::vector<double> first_byte, total;
+                uint64_t invalid = 0, bytes = 0;
+                double busy_ns = 0;
+                long long cpu_before = cpu_time_us(server.get_pid());
+                for (int q = 0; q < queries; q++) {
+                    TickQuery query;
+                    query.magic = TICK_QUERY_MAGIC;
+                    query.symbol = (uint16_t)(rng() % TICK_SYMBOLS);
+                    query.reserved = 0;
+                    int64_t length_ns = (int64_t)rows * symbol_row_ns;
+                    query.from_ns = TICK_TEST_START_NS + (int64_t)(rng() % (uint64_t)std::max<int64_t>(1, span_ns - length_ns));
+                    query.to_ns = query.from_ns + length_ns;
+                    uint64_t received = 0;
+                    double first_us = 0;
+                    uint64_t start = journal_now_ns();
+                    if (!run_tick_query(sock, query, received, bytes, first_us, invalid)) {
+                        invalid++;
+                        break;
+                    }
+                    uint64_t elapsed = journal_now_ns() - start;
+                    busy_ns += elapsed;
+                    first_byte.push_back(first_us);
+                    total.push_back(elapsed / 1000.0);
+                    // The spacing is exact, so every query returns rows or rows +- 1
+                    if (received + 1 < rows || received > rows + 1) invalid++;
+                }
+                double cpu_per_mb = (cpu_time_us(server.get_pid()) - cpu_before) / std::max(1e-9, bytes / 1e6);
+                std::sort(first_byte.begin(), first_byte.end());
+                std::sort(total.begin(), total.end());
+                double mb_per_sec = bytes / std::max(1.0, busy_ns) * 1e3;
+                std::cout << std::left << std::setw(9) << send << std::right << std::setw(8) << rows
+                          << " rows: " << total.size() << " queries, " << invalid << " invalid, first byte P50 "
+                          << std::fixed << std::setprecision(1) << percentile_of(first_byte, 0.50) << "us, total P50 "
+                          << percentile_of(total, 0.50) << "us, P99 " << percentile_of(total, 0.99) << "us, "
+                          << std::setprecision(0) << mb_per_sec << " MB/s, server CPU " << cpu_per_mb << "us/MB"
+                          << std::endl;
+                if (log_file.is_open()) {
+                    log_file << "TICK_QUERY," << send << "," << rows << "," << total.size() << "," << invalid
+                             << std::fixed << std::setprecision(3) << "," << percentile_of(first_byte, 0.50) << ","
+                             << percentile_of(first_byte, 0.99) << "," << percentile_of(total, 0.50) << ","
+                             << percentile_of(total, 0.99) << "," << mb_per_sec << "," << cpu_per_mb << "\n";
+                }
+                log_file.flush();
+            }
+            close(sock);
+            server.stop();
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+        remove_tick_store(options.tick_dir);
+
+        write_section_header("TICK STORE LIVE",
+                             "Rate,Sent,Stored,Partitions,ServerNsPerRow,PartitionOpenUs,ServerCpuUsPerTrade");
+        ServerProcess server;
+        if (server.start(options.server_binary,
+                         {"--port-base=" + std::to_string(options.port_base), "--tick-store=" + options.tick_dir,
+                          "--stats-port=" + std::to_string(stats_port)},
+                         options.port_base)) {
+            use_port_base(options.port_base);
+            // Warm-up: every symbol's first trade creates its partition
+            stop_test = false;
+            uint64_t warmup_sent = 0;
+            std::thread warmup(&ScalabilityTester::trade_producer, this, options.message_rate, std::ref(warmup_sent));
+            std::this_thread::sleep_for(std::chrono::seconds(3));
+            stop_test = true;
+            warmup.join();
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            auto before = query_stats(stats_port);
+            std::cout << "Warm-up: " << before["tick_partition_opens"] << " partitions opened at "
+                      << before["tick_partition_open_us"] << "us each, " << before["tick_rows"] << " of "
+                      << warmup_sent << " trades stored" << std::endl;
+
+            stop_test = false;
+            uint64_t sent = 0;
+            long long cpu_before = cpu_time_us(server.get_pid());
+            std::thread producer(&ScalabilityTester::trade_producer, this, options.message_rate, std::ref(sent));
+            std::this_thread::sleep_for(std::chrono::seconds(options.duration_sec));
+            stop_test = true;
+            producer.join();
+            long long cpu_after = cpu_time_us(server.get_pid());
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            auto after = query_stats(stats_port);
+            server.stop();
+
+            uint64_t stored = strtoull(after["tick_rows"].c_str(), nullptr, 10) -
+                              strtoull(before["tick_rows"].c_str(), nullptr, 10);
+            double cpu_per_trade = (cpu_after - cpu_before) / (double)std::max<uint64_t>(1, stored);
+            std::cout << options.message_rate << " trades/s: " << sent << " sent, " << stored << " stored in "
+                      << after["tick_partitions"] << " partitions, server " << after["tick_append_ns_per_row"]
+                      << "ns append plus " << after["tick_partition_open_us"] << "us per partition opened, "
+                      << std::fixed << std::setprecision(3) << cpu_per_trade
+                      << "us CPU per trade" << std::endl;
+            if (log_file.is_open()) {
+                log_file << "TICK_STORE_LIVE," << options.message_rate << "," << sent << "," << stored << ","
+                         << after["tick_partitions"] << "," << after["tick_append_ns_per_row"] << ","
+                         << after["tick_partition_open_us"] << std::fixed
+                         << std::setprecision(3) << "," << cpu_per_trade << "\n";
+            }
+            log_file.flush();
+        }
+        remove_tick_store(options.tick_dir);
+
+        std::cout << "Tick store tests completed. Results logged to " << log_filename << std::endl;
+    }
+
+    // Sends one query and reads the reply to its terminator, checking that
+    // every timestamp is in range and in order
+    static bool run_tick_query(int sock, const TickQuery& query, uint64_t& rows, uint64_t& bytes, double& first_us,
+                               uint64_t& invalid) {
+        uint64_t start = journal_now_ns();
+        if (!send_all(sock, (const char*)&query, sizeof(query))) return false;
+        std::vector<int64_t> timestamps;
+        std::vector<char> rest;
+        rows = 0;
+        int64_t previous = query.from_ns;
+        while (true) {
+            TickSegment segment;
+            if (!recv_all(sock, (char*)&segment, sizeof(segment))) return false;
+            if (rows == 0 && timestamps.empty()) first_us = (journal_now_ns() - start) / 1000.0;
+            bytes += sizeof(segment);
+            if (segment.magic != TICK_QUERY_MAGIC) return false;
+            if (segment.rows == 0) return true;
+            timestamps.resize(segment.rows);
+            rest.resize(segment.rows * (sizeof(int64_t) + sizeof(uint32_t)));
+            if (!recv_all(sock, (char*)timestamps.data(), segment.rows * sizeof(int64_t)) ||
+                !recv_all(sock, rest.data(), rest.size())) {
+                return false;
+            }
+            for (int64_t timestamp : timestamps) {
+                if (timestamp < previous || timestamp >= query.to_ns) {
+                    invalid++;
+                    break;
+                }
+                previous = timestamp;
+            }
+            rows += segment.rows;
+            bytes += segment.rows * (2 * sizeof(int64_t) + sizeof(uint32_t));
+        }
+    }
+
+    static void remove_tick_store(const std::string& dir) {
+        DIR* days = opendir(dir.c_str());
+        if (!days) return;
+        while (struct dirent* day = readdir(days)) {
+            if (day->d_name[0] == '.') continue;
+            std::string day_dir = dir + "/" + day->d_name;
+            if (DIR* files = opendir(day_dir.c_str())) {
+                while (struct dirent* file = readdir(files)) {
+                    if (file->d_name[0] != '.') unlink((day_dir + "/" + file->d_name).c_str());
+                }
+                closedir(files);
+            }
+            rmdir(day_dir.c_str());
+        }
+        closedir(days);
+        rmdir(dir.c_str());
+    }
+
+    // Paced MARKET_TRADE batches of ANALYTICS_BATCH to the UDP echo port,
+    // uniformly over ANALYTICS_SYMBOLS symbols
+    void trade_producer(uint64_t rate, uint64_t& sent) {
+        int sock = socket(AF_INET, SOCK_DGRAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(udp_port);
+        inet_pton(AF_INET, SERVER_IP, &addr.sin_addr);
+
+        std::mt19937_64 rng(2);
+        MarketMessage batch[ANALYTICS_BATCH];
+        char echo[sizeof(batch)];
+        uint64_t start = journal_now_ns();
+        while (!stop_test) {
+            uint64_t due = (uint64_t)((journal_now_ns() - start) * (rate / 1e9));
+            if (sent + ANALYTICS_BATCH > due) {
+                while (recv(sock, echo, sizeof(echo), MSG_DONTWAIT) > 0) {}  // Echoes are not needed
+                struct timespec pause = {0, (long)STREAM_TICK_NS};
+                nanosleep(&pause, nullptr);
+                continue;
+            }
+            while (sent + ANALYTICS_BATCH <= due) {
+                for (MarketMessage& msg : batch) {
+                    uint64_t r = rng();
+                    memset(&msg, 0, sizeof(msg));
+                    msg.magic = MARKET_MAGIC;
+                    msg.type = MARKET_TRADE;
+                    msg.symbol = (uint16_t)(r % ANALYTICS_SYMBOLS);
+                    msg.order_id = sent;
+                    msg.price = 1000000 + msg.symbol * 100 + (int64_t)((r >> 20) % 1000) - 500;
+                    msg.quantity = 1 + (uint32_t)((r >> 40) % 100);
+                }
+                sendto(sock, batch, sizeof(batch), 0, (struct sockaddr*)&addr, sizeof(addr));
+                sent += ANALYTICS_BATCH;
+            }
+        }
+        close(sock);
+    }
+
+    // Reads [u32 length][AnalyticsBar...] frames, checks each bar and times
+    // the frame against the latest bar boundary in it
+    void analytics_subscriber(int port, std::atomic<bool>& done, AnalyticsSubscriberStats& stats) {
+        int sock = connect_tcp(port);
+        if (sock == -1) {
+            perror("connect analytics");
+            stats.failed = true;
+            return;
+        }
+        struct timeval timeout = {0, 100000};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        std::string in;
+        char buffer[64 * 1024];
+        while (!done) {
+            ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+            if (n == 0) break;
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
+                break;
+            }
+            uint64_t arrived = journal_now_ns();
+            in.append(buffer, n);
+            size_t offset = 0;
+            while (in.size() - offset >= 4) {
+                uint32_t length;
+                memcpy(&length, in.data() + offset, 4);
+                length = ntohl(length);
+                if (in.size() - offset - 4 < length) break;
+                uint64_t end_ns = 0;
+                for (size_t at = offset + 4; at + sizeof(AnalyticsBar) <= offset + 4 + length;
+                     at += sizeof(AnalyticsBar)) {
+                    AnalyticsBar bar;
+                    memcpy(&bar, in.data() + at, sizeof(bar));
+                    bool valid = bar.low <= bar.open && bar.open <= bar.high && bar.low <= bar.close &&
+                                 bar.close <= bar.high && bar.low <= bar.vwap && bar.vwap <= bar.high &&
+                                 bar.volume > 0 && bar.trades > 0;
+                    if (!valid) stats.invalid++;
+                    end_ns = std::max(end_ns, bar.end_ns);
+                    stats.bars++;
+                }
+                stats.frames++;
+                if (end_ns) stats.latencies_us.push_back((arrived - end_ns) / 1000.0);
+                offset += 4 + length;
+            }
+            in.erase(0, offset);
+        }
+        close(sock);
+    }
+
+    // FIX order entry (fix.h). Offline, it parses a stream of generated
+    // NewOrderSingle messages with each delimiter scan. Live, it runs the
+    // server's --fix endpoint once per scan with options.streams clients,
+    // each keeping FIX_WINDOW orders in flight, and reports messages per
+    // second, order-to-ExecutionReport latency and parse cost on both ends.
+    void run_fix_tests() {
+        std::cout << "Starting FIX test: " << options.streams << " clients, " << FIX_WINDOW
+                  << " orders in flight each..." << std::endl;
+        write_log_header();
+
+        std::vector<FixScan> scans;
+        for (const char* name : {"scalar", "sse2", "avx2"}) {
+            FixScan scan;
+            if (parse_fix_scan(name, scan)) scans.push_back(scan);
+        }
+
+        std::string stream;
+        {
+            FixBuilder builder;
+            FeedGenerator names(QUOTE_FEED_SEED, FIX_SYMBOLS);
+            std::mt19937_64 rng(QUOTE_FEED_SEED);
+            for (uint64_t n = 1; n <= FIX_PARSE_MESSAGES; n++) {
+                make_fix_order(builder, "CLIENT0", n, n, names, rng, stream);
+            }
+        }
+        write_section_header("FIX PARSER", "Scan,Messages,BytesPerMsg,NsPerMsg,MBPerSec,Errors");
+        for (FixScan scan : scans) {
+            FixMessage message;
+            uint64_t parsed = 0, errors = 0;
+            size_t offset = 0;
+            uint64_t start = journal_now_ns();
+            while (offset < stream.size()) {
+                size_t consumed;
+                FixStatus status = fix_parse(stream.data() + offset, stream.size() - offset, message, consumed, scan);
+                if (status != FixStatus::Ok) {
+                    errors++;
+                    break;
+                }
+                if (message.get(FIX_CL_ORD_ID)) parsed++;
+                offset += consumed;
+            }
+            uint64_t elapsed = journal_now_ns() - start;
+            errors += FIX_PARSE_MESSAGES - parsed;
+            double per_message = (double)elapsed / FIX_PARSE_MESSAGES;
+            double bytes = (double)stream.size() / FIX_PARSE_MESSAGES;
+            double mb_per_sec = stream.size() / (1024.0 * 1024.0) / (elapsed / 1e9);
+
+            std::cout << std::left << std::setw(7) << fix_scan_name(scan) << std::right << std::fixed
+                      << std::setprecision(1) << bytes << " bytes/msg, " << per_message << "ns/msg, "
+                      << std::setprecision(0) << mb_per_sec << " MB/s, errors " << errors << std::endl;
+            if (log_file.is_open()) {
+                log_file << "FIX_PARSER," << fix_scan_name(scan) << "," << FIX_PARSE_MESSAGES << std::fixed
+                         << std::setprecision(3) << "," << bytes << "," << per_message << "," << mb_per_sec << ","
+                         << errors << "\n";
+            }
+        }
+        log_file.flush();
+
+        struct Row {
+            std::string scan;
+            double rate, p50, p99, p999, client_parse_ns, server_parse_ns, server_cpu_us;
+            uint64_t orders, reports, rejects, errors;
+            bool failed;
+        };
+        std::vector<Row> rows;
+        int stats_port = options.port_base + 3;
+        for (FixScan scan : scans) {
+            ServerProcess server;
+            if (!server.start(options.server_binary,
+                              {"--port-base=" + std::to_string(options.port_base), "--fix",
+                               std::string("--fix-scan=") + fix_scan_name(scan),
+                               "--stats-port=" + std::to_string(stats_port)},
+                              options.port_base)) {
+                return;
+            }
+            std::cout << "Testing " << fix_scan_name(scan) << " server parsing..." << std::endl;
+            stop_test = false;
+            std::vector<FixClientStats> stats(std::max(1, options.streams));
+            std::vector<std::thread> clients;
+            long long cpu_before = cpu_time_us(server.get_pid());
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < stats.size(); i++) {
+                clients.emplace_back(&ScalabilityTester::fix_client_worker, this, options.port_base, (int)i,
+                                     std::ref(stats[i]));
+            }
+            std::this_thread::sleep_for(std::chrono::seconds(options.duration_sec));
+            stop_test = true;
+            for (auto& client : clients) client.join();
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            long long cpu_after = cpu_time_us(server.get_pid());
+            auto server_stats = query_stats(stats_port);
+            server.stop();
+
+            Row row;
+            row.scan = fix_scan_name(scan);
+            row.orders = row.reports = row.rejects = row.errors = 0;
+            row.failed = false;
+            uint64_t parsed = 0, parse_ns = 0;
+            std::vector<double> latencies;
+            for (const FixClientStats& s : stats) {
+                row.orders += s.orders;
+                row.reports += s.reports;
+                row.rejects += s.rejects;
+                row.errors += s.errors;
+                row.failed = row.failed || s.failed;
+                parsed += s.parsed;
+                parse_ns += s.parse_ns;
+                latencies.insert(latencies.end(), s.latencies_us.begin(), s.latencies_us.end());
+            }
+            std::sort(latencies.begin(), latencies.end());
+            uint64_t server_messages = strtoull(server_stats["fix_messages"].c_str(), nullptr, 10);
+            row.rate = row.reports / seconds;
+            row.p50 = percentile_of(latencies, 0.50);
+            row.p99 = percentile_of(latencies, 0.99);
+            row.p999 = percentile_of(latencies, 0.999);
+            row.client_parse_ns = (double)parse_ns / std::max<uint64_t>(1, parsed);
+            row.server_parse_ns = atof(server_stats["fix_parse_ns_per_message"].c_str());
+            row.server_cpu_us = (cpu_after - cpu_before) / (double)std::max<uint64_t>(1, server_messages);
+            row.rejects += strtoull(server_stats["fix_rejects"].c_str(), nullptr, 10);
+            row.errors += strtoull(server_stats["fix_checksum_errors"].c_str(), nullptr, 10);
+            rows.push_back(row);
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+
+        write_section_header("FIX ORDER ENTRY",
+                             "ServerScan,Clients,Window,Orders,Reports,MessagesPerSec,P50Us,P99Us,P999Us,"
+                             "ClientParseNsPerMsg,ServerParseNsPerMsg,ServerCpuUsPerMsg,Rejects,Errors");
+        for (const Row& row : rows) {
+            std::cout << row.scan << ": " << std::fixed << std::setprecision(0) << row.rate << " orders/s, P50 "
+                      << std::setprecision(1) << row.p50 << "us, P99 " << row.p99 << "us, P99.9 " << row.p999
+                      << "us, parse " << row.client_parse_ns << "ns/msg client, " << row.server_parse_ns
+                      << "ns/msg server, server CPU " << std::setprecision(3) << row.server_cpu_us
+                      << "us/msg, rejects " << row.rejects << ", errors " << row.errors
+                      << (row.failed ? ", FAILED" : "") << std::endl;
+            if (log_file.is_open()) {
+                log_file << "FIX_ORDER_ENTRY," << row.scan << "," << options.streams << "," << FIX_WINDOW << ","
+                         << row.orders << "," << row.reports << std::fixed << std::setprecision(3) << ","
+                         << row.rate << "," << row.p50 << "," << row.p99 << "," << row.p999 << ","
+                         << row.client_parse_ns << "," << row.server_parse_ns << "," << row.server_cpu_us << ","
+                         << row.rejects << "," << row.errors << "\n";
+            }
+        }
+        log_file.flush();
+
+        std::cout << "FIX tests completed. Results logged to " << log_filename << std::endl;
+    }
+
+    // Streams small messages at options.message_rate through the UDP and QUIC
+    // echo ports, one message per datagram and then packed up to the MTU at
+    // each deadline in options.pack_deadlines_us (client and server use the
+    // same one). Reports datagrams per second from the kernel's UDP counters,
+    // syscalls per message on both ends, and what the deadline costs in
+    // latency.
+    void run_packing_tests() {
+        std::cout << "Starting packing test: " << options.streams << " streams, " << options.message_rate
+                  << " messages/s, " << options.pack_mtu << " byte datagrams..." << std::endl;
+
+        struct Row {
+            std::string protocol;
+            int deadline_us;  // -1: unpacked
+            double rate, datagram_rate, messages_per_datagram;
+            double client_syscalls, server_syscalls, server_cpu_us;
+            uint64_t lost, errors;
+            StreamStats stats;
+        };
+        std::vector<Row> rows;
+        std::vector<int> deadlines = {-1};
+        deadlines.insert(deadlines.end(), options.pack_deadlines_us.begin(), options.pack_deadlines_us.end());
+        int stats_port = options.port_base + 3;
+
+        write_log_header();
+        for (const char* protocol : {"UDP", "QUIC"}) {
+            for (int deadline : deadlines) {
+                std::vector<std::string> args = {"--port-base=" + std::to_string(options.port_base),
+                                                 "--stats-port=" + std::to_string(stats_port)};
+                if (deadline >= 0) {
+                    args.push_back("--pack-mtu=" + std::to_string(options.pack_mtu));
+                    args.push_back("--pack-deadline-us=" + std::to_string(deadline));
+                }
+                ServerProcess server;
+                if (!server.start(options.server_binary, args, options.port_base)) {
+                    return;
+                }
+                use_port_base(options.port_base);
+                datagram_quic = strcmp(protocol, "QUIC") == 0;
+                pack_mtu = deadline >= 0 ? options.pack_mtu : 0;
+                pack_deadline_ns = deadline >= 0 ? (uint64_t)deadline * 1000 : 0;
+
+                std::string label = std::string(protocol) + (deadline < 0 ? "-single" : "-packed-" + std::to_string(deadline) + "us");
+                std::cout << "Testing " << label << "..." << std::endl;
+                Row row;
+                row.protocol = protocol;
+                row.deadline_us = deadline;
+                long long cpu_before = cpu_time_us(server.get_pid());
+                uint64_t datagrams_before = udp_out_datagrams();
+                auto start = std::chrono::steady_clock::now();
+                row.rate = run_stream_test("DATAGRAM", row.stats);
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                uint64_t datagrams = udp_out_datagrams() - datagrams_before;
+                long long cpu_after = cpu_time_us(server.get_pid());
+                auto stats = query_stats(stats_port);
+                server.stop();
+
+                uint64_t echoed = std::max<uint64_t>(1, row.stats.messages);
+                row.datagram_rate = datagrams / seconds;
+                row.messages_per_datagram = datagrams ? (double)(row.stats.sent + row.stats.messages) / datagrams : 0.0;
+                row.client_syscalls = (double)row.stats.syscalls / std::max<uint64_t>(1, row.stats.sent);
+                row.server_syscalls = atof(stats["echo_syscalls"].c_str()) / echoed;
+                row.server_cpu_us = (double)(cpu_after - cpu_before) / echoed;
+                row.lost = row.stats.sent > row.stats.messages ? row.stats.sent - row.stats.messages : 0;
+                row.errors = atoll(stats["pack_errors"].c_str()) + (row.stats.failed ? 1 : 0);
+
+                ScalabilityResult result;
+                result.protocol = label;
+                result.client_count = options.streams;
+                result.timestamp = get_timestamp();
+                result.throughput_mbps = row.rate * 2 * sizeof(StreamMessage) / (1024.0 * 1024.0);
+                result.connections_per_second = 0;
+                result.peak_concurrent_connections = options.streams;
+                result.total_requests = row.stats.sent;
+                result.successful_requests = row.stats.messages;
+                result.success_rate = 100.0 * row.stats.messages / std::max<uint64_t>(1, row.stats.sent);
+                std::vector<double> latencies_ms;
+                latencies_ms.reserve(row.stats.latencies_us.size());
+                for (double us : row.stats.latencies_us) latencies_ms.push_back(us / 1000.0);
+                result.percentiles = calculate_all_percentiles(latencies_ms);
+                log_result(result);
+
+                std::sort(row.stats.latencies_us.begin(), row.stats.latencies_us.end());
+                rows.push_back(std::move(row));
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+            }
+        }
+        pack_mtu = 0;
+        datagram_quic = false;
+
+        write_section_header("PACKING",
+                             "Protocol,DeadlineUs,TargetRate,MessagesPerSec,DatagramsPerSec,MessagesPerDatagram,"
+                             "ClientSyscallsPerMsg,ServerSyscallsPerMsg,ServerCpuUsPerMsg,P50Us,P99Us,P999Us,Lost,Errors");
+        for (const Row& row : rows) {
+            const std::vector<double>& sorted = row.stats.latencies_us;
+            std::string deadline = row.deadline_us < 0 ? "single" : std::to_string(row.deadline_us);
+            std::cout << row.protocol << " " << (row.deadline_us < 0 ? "single" : deadline + "us") << ": "
+                      << std::fixed << std::setprecision(0) << row.rate << " msg/s, " << row.datagram_rate
+                      << " datagrams/s (" << std::setprecision(1) << row.messages_per_datagram
+                      << " msg/datagram), syscalls/msg " << std::setprecision(3) << row.client_syscalls
+                      << " client / " << row.server_syscalls << " server, server CPU " << row.server_cpu_us
+                      << "us/msg, P50 " << std::setprecision(1) << percentile_of(sorted, 0.50) << "us, P99 "
+                      << percentile_of(sorted, 0.99) << "us, P99.9 " << percentile_of(sorted, 0.999)
+                      << "us, lost " << row.lost << ", errors " << row.errors << std::endl;
+            if (log_file.is_open()) {
+                log_file << "PACKING," << row.protocol << "," << deadline << "," << options.message_rate
+                         << std::fixed << std::setprecision(0) << "," << row.rate << "," << row.datagram_rate
+                         << std::setprecision(3) << "," << row.messages_per_datagram << "," << row.client_syscalls
+                         << "," << row.server_syscalls << "," << row.server_cpu_us << ","
+                         << percentile_of(sorted, 0.50) << "," << percentile_of(sorted, 0.99) << ","
+                         << percentile_of(sorted, 0.999) << "," << row.lost << "," << row.errors << "\n";
+            }
+        }
+        log_file.flush();
+
+        std::cout << "Packing tests completed. Results logged to " << log_filename << std::endl;
+    }
+
+    // Runs options.streams workers of the given transport for the test
+    // duration; returns the echoed messages per second over all streams
+    double run_stream_test(const std::string& transport, StreamStats& total) {
+        reset_counters();
+        uint64_t rate = std::max<uint64_t>(1, options.message_rate / std::max(1, options.streams));
+        std::vector<StreamStats> stats(options.streams);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < options.streams; i++) {
+            if (transport == "TCP") {
+                threads.emplace_back(&ScalabilityTester::tcp_stream_worker, this, i, rate, std::ref(stats[i]));
+            } else if (transport == "DATAGRAM") {
+                threads.emplace_back(&ScalabilityTester::datagram_stream_worker, this, i, rate, std::ref(stats[i]));
+            } else if (transport == "SESSION") {
+                threads.emplace_back(&ScalabilityTester::session_stream_worker, this, i, rate, std::ref(stats[i]));
+            } else {
+                threads.emplace_back(&ScalabilityTester::log_stream_worker, this, i, rate, std::ref(stats[i]));
+            }
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(std::chrono::seconds(options.duration_sec));
+        stop_test = true;
+        for (auto& thread : threads) thread.join();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        for (StreamStats& s : stats) {
+            total.latencies_us.insert(total.latencies_us.end(), s.latencies_us.begin(), s.latencies_us.end());
+            total.messages += s.messages;
+            total.sent += s.sent;
+            total.syscalls += s.syscalls;
+            total.datagrams += s.datagrams;
+            total.naks_sent += s.naks_sent;
+            total.naks_received += s.naks_received;
+            total.retransmitted_bytes += s.retransmitted_bytes;
+            total.failed = total.failed || s.failed;
+            total.reconnects += s.reconnects;
+            total.replayed += s.replayed;
+            total.resent += s.resent;
+            total.duplicates += s.duplicates;
+            total.gaps += s.gaps;
+            total.resets += s.resets;
+            total.resync_ms.insert(total.resync_ms.end(), s.resync_ms.begin(), s.resync_ms.end());
+            total.replay_seconds += s.replay_seconds;
+        }
+        return total.messages / seconds;
+    }
+
+    // Runs a primary replicating to a hot standby, measures replication lag
+    // under UDP load, then kills the primary and measures how long UDP and
+    // TCP clients go unserved until the standby takes over.
+    void run_failover_tests() {
+        std::cout << "Starting hot-standby failover test with " << options.clients << " clients..." << std::endl;
+
+        int base = options.port_base;
+        int replication_port = base + 50;
+        int primary_stats_port = base + 3;
+        int standby_stats_port = base + 4;
+
+        ServerProcess standby_server;
+        if (!standby_server.start(options.server_binary,
+                                  {"--port-base=" + std::to_string(base),
+                                   "--standby-port=" + std::to_string(replication_port),
+                                   "--stats-port=" + std::to_string(standby_stats_port)},
+                                  standby_stats_port)) {
+            return;
+        }
+        ServerProcess primary_server;
+        if (!primary_server.start(options.server_binary,
+                                  {"--port-base=" + std::to_string(base),
+                                   "--replicate-to=127.0.0.1:" + std::to_string(replication_port),
+                                   "--stats-port=" + std::to_string(primary_stats_port)},
+                                  base)) {
+            return;
+        }
+        use_port_base(base);
+
+        // Replication lag under load
+        write_log_header();
+        auto result = test_with_client_count("UDP", options.clients);
+        result.protocol = "UDP+replication";
+        log_result(result);
+
+        auto stats = query_stats(standby_stats_port);
+        write_section_header("REPLICATION LAG", "Protocol,Clients,Records,LagP50Us,LagP99Us,LagP999Us,LagMaxUs");
+        std::cout << "Replicated " << stats["replicated"] << " records, lag P50: " << stats["lag_p50_us"]
+                  << "us, P99: " << stats["lag_p99_us"] << "us, P99.9: " << stats["lag_p999_us"] << "us" << std::endl;
+        if (log_file.is_open()) {
+            log_file << "REPLICATION," << options.clients << "," << stats["replicated"] << ","
+                     << stats["lag_p50_us"] << "," << stats["lag_p99_us"] << ","
+                     << stats["lag_p999_us"] << "," << stats["lag_max_us"] << "\n";
+            log_file.flush();
+        }
+
+        // Failover: probes run continuously across the kill
+        std::atomic<long long> kill_time_ns{0};
+        std::atomic<bool> probes_done{false};
+        std::atomic<int> probes_finished{0};
+        double udp_failover_ms = -1;
+        double tcp_failover_ms = -1;
+        std::thread udp_probe([&] {
+            udp_failover_ms = probe_until_served("UDP", kill_time_ns, probes_done);
+            probes_finished++;
+        });
+        std::thread tcp_probe([&] {
+            tcp_failover_ms = probe_until_served("TCP", kill_time_ns, probes_done);
+            probes_finished++;
+        });
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        kill_time_ns = steady_now_ns();
+        primary_server.stop(SIGKILL);
+
+        // Give up on a probe that is still unserved after 10 seconds
+        auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (probes_finished < 2 && std::chrono::steady_clock::now() < give_up) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        probes_done = true;
+        udp_probe.join();
+        tcp_probe.join();
+
+        write_section_header("FAILOVER", "Protocol,Probe,FailoverMs");
+        for (auto probe : {std::make_pair("UDP", udp_failover_ms), std::make_pair("TCP", tcp_failover_ms)}) {
+            std::cout << probe.first << " clients served by standby after "
+                      << std::fixed << std::setprecision(3) << probe.second << " ms" << std::endl;
+            if (log_file.is_open()) {
+                log_file << "FAILOVER," << probe.first << "," << std::fixed
+                         << std::setprecision(3) << probe.second << "\n";
+            }
+        }
+        log_file.flush();
+
+        standby_server.stop();
+        std::cout << "Failover test completed. Results logged to " << log_filename << std::endl;
+    }
+
+    // Measures server startup time when rebuilding state from a journal of
+    // market messages, with the journal cold (evicted) and warm in page cache.
+    void run_replay_tests() {
+        std::cout << "Starting journal replay tests..." << std::endl;
+        write_section_header("JOURNAL REPLAY TEST",
+                             "Protocol,Messages,Partitions,Cache,StartupMs,MessagesPerSec");
+
+        std::vector<int> partition_counts = {1};
+        int cpus = std::thread::hardware_concurrency();
+        if (cpus > 1) partition_counts.push_back(cpus);
+
+        for (uint64_t messages : options.replay_messages) {
+            std::cout << "\nGenerating journal with " << messages << " messages..." << std::endl;
+            if (!generate_replay_journal(options.journal_path, messages)) {
+                std::cerr << "Failed to generate journal" << std::endl;
+                continue;
+            }
+
+            for (const char* cache : {"cold", "warm"}) {
+                for (int partitions : partition_counts) {
+                    if (strcmp(cache, "cold") == 0) {
+                        evict_from_page_cache(options.journal_path);
+                    }
+
+                    std::vector<std::string> args = {
+                        "--port-base=" + std::to_string(options.port_base),
+                        "--journal=" + options.journal_path,
+                        "--replay",
+                        "--partitions=" + std::to_string(partitions)
+                    };
+
+                    auto start = std::chrono::steady_clock::now();
+                    ServerProcess server;
+                    bool ready = server.start(options.server_binary, args, options.port_base, 30 * 60 * 1000);
+                    double startup_ms = std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - start).count() / 1000.0;
+                    server.stop();
+                    if (!ready) continue;
+
+                    double rate = messages / (startup_ms / 1000.0);
+                    std::cout << "Messages: " << messages << ", Partitions: " << partitions
+                              << ", Cache: " << cache << ", Startup: " << std::fixed
+                              << std::setprecision(1) << startup_ms << " ms" << std::endl;
+                    if (log_file.is_open()) {
+                        log_file << "REPLAY," << messages << "," << partitions << "," << cache << ","
+                                 << std::fixed << std::setprecision(3) << startup_ms << ","
+                                 << std::setprecision(0) << rate << "\n";
+                        log_file.flush();
+                    }
+                }
+            }
+        }
+
+        unlink(options.journal_path.c_str());
+        std::cout << "Replay tests completed. Results logged to " << log_filename << std::endl;
+    }
+
+private:
+    void use_port_base(int port_base) {
+        tcp_port = port_base;
+        udp_port = port_base + 1;
+        quic_port = port_base + 2;
+    }
+
+    static long long steady_now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static long resident_kb(pid_t pid) {
+        std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.compare(0, 6, "VmRSS:") == 0) return atol(line.c_str() + 6);
+        }
+        return 0;
+    }
+
+    // User plus system CPU time of a process
+    static long long cpu_time_us(pid_t pid) {
+        std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+        std::string line;
+        std::getline(stat, line);
+        size_t end = line.rfind(')');
+        if (end == std::string::npos) return 0;
+        std::istringstream fields(line.substr(end + 2));
+        std::string field;
+        long long utime = 0, stime = 0;
+        for (int i = 3; i <= 15 && fields >> field; i++) {
+            if (i == 14) utime = atoll(field.c_str());
+            if (i == 15) stime = atoll(field.c_str());
+        }
+        return (utime + stime) * 1000000 / sysconf(_SC_CLK_TCK);
+    }
+
+    // Datagrams sent by every UDP socket in the network namespace
+    // (OutDatagrams in /proc/net/snmp), both ends of a loopback test
+    static uint64_t udp_out_datagrams() {
+        std::ifstream snmp("/proc/net/snmp");
+        std::string names, values;
+        while (std::getline(snmp, names) && std::getline(snmp, values)) {
+            if (names.compare(0, 4, "Udp:") != 0) continue;
+            std::istringstream name_fields(names), value_fields(values);
+            std::string name, value;
+            while (name_fields >> name && value_fields >> value) {
+                if (name == "OutDatagrams") return strtoull(value.c_str(), nullptr, 10);
+            }
+        }
+        return 0;
+    }
+
+    static bool send_all(int sock, const char* data, size_t length) {
+        while (length > 0) {
+            ssize_t n = send(sock, data, length, MSG_NOSIGNAL);
+            if (n <= 0) return false;
+            data += n;
+            length -= n;
+        }
+        return true;
+    }
+
+    static bool recv_all(int sock, char* data, size_t length) {
+        while (length > 0) {
+            ssize_t n = recv(sock, data, length, 0);
+            if (n <= 0) return false;
+            data += n;
+            length -= n;
+        }
+        return true;
+    }
+
+    // Reads the key=value line served on a server's --stats-port
+    std::map<std::string, std::string> query_stats(int port) {
+        std::map<std::string, std::string> stats;
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        inet_pton(AF_INET, SERVER_IP, &addr.sin_addr);
+
+        if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+            std::string line;
+            char buffer[BUFFER_SIZE];
+            ssize_t n;
+            while ((n = recv(sock, buffer, sizeof(buffer), 0)) > 0) {
+                line.append(buffer, n);
+            }
+
+            std::stringstream tokens(line);
+            std::string token;
+            while (tokens >> token) {
+                size_t eq = token.find('=');
+                if (eq != std::string::npos) stats[token.substr(0, eq)] = token.substr(eq + 1);
+            }
+        }
+        close(sock);
+        return stats;
+    }
+
+    // Sends request after request (reconnecting for TCP) and returns the time
+    // from kill_time_ns to the first reply to a request sent after it.
+    double probe_until_served(const std::string& protocol, std::atomic<long long>& kill_time_ns,
+                              std::atomic<bool>& done) {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(protocol == "UDP" ? udp_port : tcp_port);
+        inet_pton(AF_INET, SERVER_IP, &addr.sin_addr);
+
+        char request[64];
+        char reply[BUFFER_SIZE];
+        memset(request, 'P', sizeof(request));
+        int sock = -1;
+
+        while (!done) {
+            long long sent_at = steady_now_ns();
+            bool served = false;
+
+            if (protocol == "UDP") {
+                if (sock == -1) sock = socket(AF_INET, SOCK_DGRAM, 0);
+                sendto(sock, request, sizeof(request), 0, (struct sockaddr*)&addr, sizeof(addr));
+                struct pollfd pfd = {sock, POLLIN, 0};
+                if (poll(&pfd, 1, 1) == 1) {
+                    served = recv(sock, reply, sizeof(reply), 0) > 0;
+                }
+            } else {
+                if (sock == -1) {
+                    sock = socket(AF_INET, SOCK_STREAM, 0);
+                    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+                        close(sock);
+                        sock = -1;
+                        std::this_thread::sleep_for(std::chrono::microseconds(100));
+                        continue;
+                    }
+                }
+                served = send(sock, request, sizeof(request), MSG_NOSIGNAL) > 0 &&
+                         recv(sock, reply, sizeof(reply), 0) > 0;
+                if (!served) {
+                    close(sock);
+                    sock = -1;
+                }
+            }
+
+            long long killed_at = kill_time_ns;
+            if (served && killed_at != 0 && sent_at > killed_at) {
+                if (sock != -1) close(sock);
+                return (steady_now_ns() - killed_at) / 1e6;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+
+        if (sock != -1) close(sock);
+        return -1;
+    }
+
+    // Header for scenarios whose rows do not follow the percentile format
+    void write_section_header(const std::string& title, const std::string& format) {
+        if (!log_file.is_open()) return;
+
+        log_file << "\n=== " << title << " STARTED ===\n";
+        log_file << "Timestamp: " << get_timestamp() << "\n";
+        log_file << "Format: " << format << "\n\n";
+        log_file.flush();
+    }
+
+    // Writes a journal of quotes, trades, new orders and cancels spread over
+    // REPLAY_SYMBOLS symbols, with a bounded number of resting orders.
+    bool generate_replay_journal(const std::string& path, uint64_t messages) {
+        unlink(path.c_str());
+        Journal journal;
+        size_t capacity = messages * journal_record_size(sizeof(uint32_t) + sizeof(MarketMessage));
+        if (!journal.open(path, capacity)) return false;
+
+        struct sockaddr_in peer;
+        memset(&peer, 0, sizeof(peer));
+        peer.sin_family = AF_INET;
+        inet_pton(AF_INET, SERVER_IP, &peer.sin_addr);
+
+        std::mt19937 gen(42);
+        std::vector<uint16_t> order_symbols(REPLAY_LIVE_ORDERS);
+        uint64_t next_order = 1;
+        uint64_t next_cancel = 1;
+
+        char payload[sizeof(uint32_t) + sizeof(MarketMessage)];
+        MarketMessage msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.magic = MARKET_MAGIC;
+
+        for (uint64_t i = 0; i < messages; i++) {
+            msg.symbol = gen() % REPLAY_SYMBOLS;
+            msg.side = (gen() & 1) ? SIDE_BUY : SIDE_SELL;
+            msg.price = 1000000 + (gen() % 10000);
+            msg.quantity = 1 + gen() % 1000;
+            msg.order_id = 0;
+
+            int kind = i % 10;
+            if (kind < 4) {
+                msg.type = MARKET_QUOTE;
+            } else if (kind < 6) {
+                msg.type = MARKET_TRADE;
+            } else if (kind < 8 || next_cancel == next_order) {
+                msg.type = MARKET_NEW_ORDER;
+                msg.order_id = next_order++;
+                order_symbols[msg.order_id % REPLAY_LIVE_ORDERS] = msg.symbol;
+            } else {
+                msg.type = MARKET_CANCEL;
+                msg.order_id = next_cancel++;
+                msg.symbol = order_symbols[msg.order_id % REPLAY_LIVE_ORDERS];
+            }
+            // Keep the number of resting orders bounded
+            if (next_order - next_cancel >= REPLAY_LIVE_ORDERS) {
+                msg.type = MARKET_CANCEL;
+                msg.order_id = next_cancel++;
+                msg.symbol = order_symbols[msg.order_id % REPLAY_LIVE_ORDERS];
+            }
+
+            if (i % REPLAY_QUIC_EVERY == 0) {
+                uint32_t connection_id = 1000 + (i / REPLAY_QUIC_EVERY) % MAX_CLIENTS;
+                uint32_t wire_id = htonl(connection_id);
+                memcpy(payload, &wire_id, sizeof(wire_id));
+                memcpy(payload + sizeof(wire_id), &msg, sizeof(msg));
+                peer.sin_port = htons(40000 + connection_id % 20000);
+                journal.append(JOURNAL_QUIC, connection_id, &peer, payload, sizeof(payload));
+            } else {
+                peer.sin_port = htons(50000);
+                journal.append(JOURNAL_UDP, 0, &peer, (const char*)&msg, sizeof(msg));
+            }
+        }
+
+        journal.close();
+        return true;
+    }
+
+    void evict_from_page_cache(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) return;
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+
+    void write_log_header() {
+        if (!log_file.is_open()) return;
+        
+        log_file << "\n=== SCALABILITY TEST STARTED ===\n";
+        log_file << "Timestamp: " << get_timestamp() << "\n";
+        log_file << "Format: Protocol,ClientCount,Timestamp,ThroughputMBps,ConnectionsPerSec,PeakConcurrent,SuccessRate,TotalReqs,SuccessfulReqs,P1,P2,...,P100\n\n";
+        log_file.flush();
+    }
+    
+    void run_tcp_scalability() {
+        std::cout << "\n=== TCP Scalability Test ===" << std::endl;
+        
+        // Generate client count sequence matching MAX_CLIENTS = 500
+        std::vector<int> client_counts = {10, 20, 50, 100, 200, 500};
+        
+        for (int client_count : client_counts) {
+            std::cout << "Testing TCP with " << client_count << " clients..." << std::endl;
+            
+            auto result = test_with_client_count("TCP", client_count);
+            log_result(result);
+            
+            // Brief pause between tests
+            std::this_thread::sleep_for(std::chrono::seconds(2));
+        }
+    }
+    
+    void run_udp_scalability() {
+        std::cout << "\n=== UDP Scalability Test ===" << std::endl;
+        
+        // Same client count sequence for UDP
+        std::vector<int> client_counts = {10, 20, 50, 100, 200, 500};
+        
+        for (int client_count : client_counts) {
+            std::cout << "Testing UDP with " << client_count << " clients..." << std::endl;
+            
+            auto result = test_with_client_count("UDP", client_count);
+            log_result(result);
+            
+            // Brief pause between tests
+            std::this_thread::sleep_for(std::chrono::seconds(2));
+        }
+    }
+    
+    void run_quic_scalability() {
+        std::cout << "\n=== QUIC Scalability Test ===" << std::endl;
+        
+        // Same client count sequence for QUIC
+        std::vector<int> client_counts = {10, 20, 50, 100, 200, 500};
+        
+        for (int client_count : client_counts) {
+            std::cout << "Testing QUIC with " << client_count << " clients..." << std::endl;
+            
+            auto result = test_with_client_count("QUIC", client_count);
+            log_result(result);
+            
+            // Brief pause between tests
+            std::this_thread::sleep_for(std::chrono::seconds(2));
+        }
+    }
+    
+    void run_ws_scalability() {
+        std::cout << "\n=== WebSocket Scalability Test ===" << std::endl;
+
+        // Same client count sequence, same payload as TCP, framed and masked
+        std::vector<int> client_counts = {10, 20, 50, 100, 200, 500};
+
+        for (int client_count : client_counts) {
+            std::cout << "Testing WS with " << client_count << " clients..." << std::endl;
+
+            auto result = test_with_client_count("WS", client_count);
+            log_result(result);
+
+            // Brief pause between tests
+            std::this_thread::sleep_for(std::chrono::seconds(2));
+        }
+    }
+
+    ScalabilityResult test_with_client_count(const std::string& protocol, int client_count) {
+        reset_counters();
+        latencies.reserve(client_count * 100);  // Estimate requests per client
+        
+        auto start_time = std::chrono::high_resolution_clock::now();
+        
+        // Start monitoring thread
+        std::thread monitor_thread(&ScalabilityTester::connection_monitor, this);
+        
+        // Start client threads with staggered connections
+        std::vector<std::thread> threads;
+        threads.reserve(client_count);
+        
+        for (int i = 0; i < client_count; ++i) {
+            if (protocol == "TCP") {
+                threads.emplace_back(&ScalabilityTester::tcp_client_worker, this, i);
+            } else if (protocol == "UDP") {
+                threads.emplace_back(&ScalabilityTester::udp_client_worker, this, i);
+            } else if (protocol == "QUIC") {
+                threads.emplace_back(&ScalabilityTester::quic_client_worker, this, i);
+            } else if (protocol == "FRAMED") {
+                threads.emplace_back(&ScalabilityTester::framed_client_worker, this, i);
+            } else if (protocol == "WS") {
+                threads.emplace_back(&ScalabilityTester::ws_client_worker, this, i);
+            } else if (protocol == "ORDER") {
+                threads.emplace_back(&ScalabilityTester::order_client_worker, this, i);
+            } else if (protocol == "FEED_TCP") {
+                threads.emplace_back(&ScalabilityTester::feed_tcp_worker, this, i);
+            } else if (protocol == "FEED_UDP") {
+                threads.emplace_back(&ScalabilityTester::feed_udp_worker, this, i);
+            }
+            
+            // Stagger connection attempts
+            if (i < client_count - 1) {
+                int delay_ms = (RAMP_UP_DURATION_SEC * 1000) / client_count;
+                std::this_thread::sleep_for(std::chrono::milliseconds(std::max(1, delay_ms)));
+            }
+        }
+        
+        {
+            std::lock_guard<std::mutex> lock(results_mutex);
+            ramped_requests = latencies.size();
+        }
+
+        // Let the test run
+        std::this_thread::sleep_for(std::chrono::seconds(options.duration_sec));
+        if (steady_state_probe) steady_state_probe();
+        
+        // Signal threads to stop
+        stop_test = true;
+        
+        // Wait for all threads
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        monitor_thread.join();
+        
+        auto end_time = std::chrono::high_resolution_clock::now();
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+        
+        // Calculate result
+        ScalabilityResult result;
+        result.protocol = protocol;
+        result.client_count = client_count;
+        result.timestamp = get_timestamp();
+        result.total_requests = latencies.size();
+        result.successful_requests = latencies.size();
+        result.success_rate = result.total_requests > 0 ? 100.0 : 0.0;
+        result.connections_per_second = (double)connections / (duration.count() / 1000.0);
+        result.peak_concurrent_connections = peak_connections;
+        
+        // Calculate throughput
+        double duration_seconds = duration.count() / 1000.0;
+        double megabytes = total_bytes / (1024.0 * 1024.0);
+        result.throughput_mbps = megabytes / duration_seconds;
+        
+        // Calculate all percentiles P1 to P100
+        result.percentiles = calculate_all_percentiles(latencies);
+        
+        return result;
+    }
+    
+    void reset_counters() {
+        connections = 0;
+        active_connections = 0;
+        peak_connections = 0;
+        total_bytes = 0;
+        stop_test = false;
+        latencies.clear();
+        retransmits = 0;
+        spurious_retransmits = 0;
+        recovery_latencies.clear();
+        request_timeouts = 0;
+        srtt_ns = 0;
+        srtt_sockets = 0;
+    }
+    
+    void connection_monitor() {
+        while (!stop_test) {
+            int current = active_connections.load();
+            if (current > peak_connections) {
+                peak_connections = current;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+    
+    void tcp_client_worker(int client_id) {
+        // Random delay for realistic connection pattern
+        std::uniform_int_distribution<int> delay_dist(0, 500);
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay_dist(rng)));
+        
+        ClientLoop loop;
+        Client client(loop, worker_client_options(ClientProtocol::Tcp, client_id, tcp_port, TCP_REPLY_TIMEOUT_NS, 0));
+        if (!loop.ok() || !client.open()) return;
+        uint64_t give_up = journal_now_ns() + WORKER_CONNECT_TIMEOUT_NS;
+        loop.run_until([&]() { return client.connected() > 0 || stop_test || journal_now_ns() >= give_up; });
+        if (!client.connected()) return;
+        
+        connections++;
+        active_connections++;
+        
+        std::string payload(BUFFER_SIZE, 'A');
+        ClientReply reply;
+        uint64_t accounted = 0;
+        std::uniform_int_distribution<int> interval_dist(20, 150);
+        
+        while (!stop_test) {
+            if (!worker_request(loop, client, payload, reply) || reply.status != ClientStatus::Ok) break;
+            {
+                std::lock_guard<std::mutex> lock(results_mutex);
+                latencies.push_back(reply.latency_ns / 1e6);
+            }
+            record_bytes(client, accounted);
+            
+            if (think_time) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(interval_dist(rng)));
+            }
+        }
+        
+        record_client(client);
+        active_connections--;
+    }
+    
+    // The ports of a client's two paths: the server under test, and where its
+    // hedges go. With a hedge replica, odd clients make it their primary so
+    // both replicas carry the same load whether or not hedging is on.
+    void hedge_paths(int client_id, int port, int ports[2]) const {
+        ports[0] = port;
+        ports[1] = hedge_port_base ? hedge_port_base + (port - tcp_port) : port;
+        if (hedge_port_base && client_id % 2) std::swap(ports[0], ports[1]);
+    }
+    
+    // A worker's client (client.h): one member on the path under test with
+    // one request in flight, and with hedging a twin on the path hedges go
+    ClientOptions worker_client_options(ClientProtocol protocol, int client_id, int port, uint64_t timeout_ns,
+                                        uint64_t fixed_rto_ns) const {
+        int ports[2];
+        hedge_paths(client_id, port, ports);
+        ClientOptions client_options;
+        client_options.protocol = protocol;
+        client_options.host = SERVER_IP;
+        client_options.port = ports[0];
+        client_options.connections = 1;
+        client_options.pipeline = 1;
+        client_options.timeout_ns = timeout_ns;
+        client_options.fixed_rto_ns = fixed_rto ? fixed_rto_ns : 0;
+        client_options.quic_aead = protocol == ClientProtocol::Quic && quic_aead;
+        client_options.hedge = hedge.get();
+        client_options.hedge_port = ports[1];
+        return client_options;
+    }
+    
+    // Sends one request and runs the worker's loop until it completes.
+    // Returns false if the test stopped first.
+    bool worker_request(ClientLoop& loop, Client& client, const std::string& payload, ClientReply& reply) {
+        bool completed = false;
+        client.request(payload.data(), payload.size(), [&](ClientReply& done) {
+            reply = std::move(done);
+            completed = true;
+        });
+        loop.run_until([&]() { return completed || stop_test; });
+        return completed;
+    }
+    
+    // Loss recovery of a datagram worker's request: given up, answered by an
+    // earlier transmission than the last, or answered only after a resend
+    void record_datagram_reply(const ClientReply& reply) {
+        if (reply.status == ClientStatus::Timeout) {
+            request_timeouts++;
+            return;
+        }
+        if (reply.status != ClientStatus::Ok) return;
+        if (reply.attempt < reply.attempts - 1) spurious_retransmits++;
+        if (reply.attempt > 0) {
+            std::lock_guard<std::mutex> lock(results_mutex);
+            recovery_latencies.push_back(reply.latency_ns / 1e6);
+        }
+    }
+    
+    // Adds what a worker's client moved on the wire since the last call
+    void record_bytes(const Client& client, uint64_t& accounted) {
+        uint64_t moved = client.counters.bytes_sent + client.counters.bytes_received;
+        total_bytes += moved - accounted;
+        accounted = moved;
+    }
+    
+    // Adds a worker's retransmissions, final SRTTs and QUIC crypto time to
+    // the run's totals
+    void record_client(const Client& client) {
+        uint64_t srtt_total;
+        size_t sockets;
+        client.srtt(srtt_total, sockets);
+        srtt_ns += srtt_total;
+        srtt_sockets += sockets;
+        retransmits += client.counters.retransmits;
+        quic_crypto_ns += client.counters.crypto_ns;
+        quic_crypto_packets += client.counters.crypto_packets;
+    }
+    
+    // Blocking TCP connection to SERVER_IP:port. Returns the socket, or -1.
+    static int connect_tcp(int port) {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock == -1) return -1;
+        struct sockaddr_in server_addr;
+        memset(&server_addr, 0, sizeof(server_addr));
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_port = htons(port);
+        inet_pton(AF_INET, SERVER_IP, &server_addr.sin_addr);
+        if (connect(sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
+            close(sock);
+            return -1;
+        }
+        return sock;
+    }
+
+    // Connects to a WebSocket port and completes the Upgrade for path.
+    // Returns the socket, or -1.
+    static int ws_connect(int port, const char* path) {
+        int sock = connect_tcp(port);
+        if (sock == -1) return -1;
+
+        std::string request = std::string("GET ") + path + " HTTP/1.1\r\nHost: " + SERVER_IP +
+                              "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: " +
+                              WS_CLIENT_KEY + "\r\nSec-WebSocket-Version: 13\r\n\r\n";
+        if (!send_all(sock, request.data(), request.size())) {
+            close(sock);
+            return -1;
+        }
+        // A byte at a time, so no frame that follows the response is consumed
+        std::string response;
+        char c;
+        while (response.size() < WS_MAX_HANDSHAKE && response.find("\r\n\r\n") == std::string::npos) {
+            if (recv(sock, &c, 1, 0) != 1) {
+                close(sock);
+                return -1;
+            }
+            response.push_back(c);
+        }
+        if (response.compare(0, 12, "HTTP/1.1 101") != 0 ||
+            ws_header(response, "Sec-WebSocket-Accept") != ws_accept_key(WS_CLIENT_KEY)) {
+            std::cerr << "WebSocket handshake refused" << std::endl;
+            close(sock);
+            return -1;
+        }
+        return sock;
+    }
+
+    // Reads one (unmasked, server) frame into payload
+    static bool ws_read_frame(int sock, uint8_t& opcode, std::string& payload) {
+        uint8_t header[8];
+        if (!recv_all(sock, (char*)header, 2)) return false;
+        if (header[1] & 0x80) return false;
+        opcode = header[0] & 0x0F;
+        uint64_t length = header[1] & 0x7F;
+        if (length >= 126) {
+            size_t extended = length == 126 ? 2 : 8;
+            if (!recv_all(sock, (char*)header, extended)) return false;
+            length = 0;
+            for (size_t i = 0; i < extended; i++) length = (length << 8) | header[i];
+        }
+        if (length > WS_MAX_PAYLOAD) return false;
+        payload.resize(length);
+        return length == 0 || recv_all(sock, &payload[0], length);
+    }
+
+    // The TCP worker's request loop over WebSocket: the same payload as one
+    // masked binary frame each way
+    void ws_client_worker(int /*client_id*/) {
+        std::uniform_int_distribution<int> delay_dist(0, 500);
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay_dist(rng)));
+
+        int sock = ws_connect(ws_port, "/");
+        if (sock == -1) return;
+
+        connections++;
+        active_connections++;
+
+        char payload[BUFFER_SIZE];
+        memset(payload, 'A', sizeof(payload));
+        WsUnmask unmask = ws_best_unmask();
+        std::mt19937 key_rng(std::random_device{}());
+        std::string frame;
+        std::string reply;
+        uint8_t opcode;
+
+        std::uniform_int_distribution<int> interval_dist(20, 150);
+
+        while (!stop_test) {
+            auto request_start = std::chrono::high_resolution_clock::now();
+
+            uint32_t mask = key_rng();
+            frame.clear();
+            ws_append_masked_frame(frame, WS_BINARY, payload, sizeof(payload), (const uint8_t*)&mask, unmask);
+            if (!send_all(sock, frame.data(), frame.size()) || !ws_read_frame(sock, opcode, reply) ||
+                opcode != WS_BINARY || reply.size() != sizeof(payload)) {
+                break;
+            }
+            auto request_end = std::chrono::high_resolution_clock::now();
+            auto latency = std::chrono::duration_cast<std::chrono::microseconds>(request_end - request_start).count() / 1000.0;
+
+            {
+                std::lock_guard<std::mutex> lock(results_mutex);
+                latencies.push_back(latency);
+            }
+
+            total_bytes += sizeof(payload) * 2;
+
+            if (think_time) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(interval_dist(rng)));
+            }
+        }
+
+        active_connections--;
+        close(sock);
+    }
+
+    // Paced WsFeedMessage datagrams to the UDP echo port, which the server
+    // also broadcasts to its WebSocket feed
+    void ws_feed_producer(uint64_t rate, uint64_t& produced) {
+        int sock = socket(AF_INET, SOCK_DGRAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(udp_port);
+        inet_pton(AF_INET, SERVER_IP, &addr.sin_addr);
+
+        char echo[sizeof(WsFeedMessage)];
+        uint64_t start = journal_now_ns();
+        while (!stop_test) {
+            uint64_t now = journal_now_ns();
+            uint64_t due = (uint64_t)((now - start) * (rate / 1e9));
+            if (produced >= due) {
+                while (recv(sock, echo, sizeof(echo), MSG_DONTWAIT) > 0) {}  // Echoes are not needed
+                struct timespec pause = {0, (long)STREAM_TICK_NS};
+                nanosleep(&pause, nullptr);
+                continue;
+            }
+            while (produced < due) {
+                WsFeedMessage message;
+                message.magic = WS_FEED_MAGIC;
+                message.sequence = produced++;
+                message.sent_ns = journal_now_ns();
+                message.reserved = 0;
+                sendto(sock, &message, sizeof(message), 0, (struct sockaddr*)&addr, sizeof(addr));
+            }
+        }
+        close(sock);
+    }
+
+    // A feed subscriber: every broadcast frame carries one inbound message
+    void ws_feed_worker(int port, std::atomic<bool>& done, WsFeedStats& stats) {
+        int sock = ws_connect(port, WS_FEED_PATH);
+        if (sock == -1) {
+            stats.failed = true;
+            return;
+        }
+        struct timeval timeout = {0, 100000};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        std::string in;
+        char buffer[64 * 1024];
+        bool started = false;
+        uint64_t next_sequence = 0;
+        while (!done) {
+            ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+            if (n == 0) break;
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
+                break;
+            }
+            uint64_t arrival_ns = journal_now_ns();
+            in.append(buffer, n);
+
+            size_t offset = 0;
+            while (true) {
+                WsFrame frame;
+                size_t consumed;
+                WsStatus status = ws_parse_frame(in.data() + offset, in.size() - offset, frame, consumed);
+                if (status == WsStatus::Incomplete) break;
+                if (status == WsStatus::Malformed || frame.masked) {
+                    std::cerr << "WebSocket feed got a malformed frame" << std::endl;
+                    stats.failed = true;
+                    done = true;
+                    break;
+                }
+                const char* payload = in.data() + offset + frame.header_length;
+                offset += consumed;
+                WsFeedMessage message;
+                if (frame.payload_length != sizeof(message)) continue;
+                memcpy(&message, payload, sizeof(message));
+                if (message.magic != WS_FEED_MAGIC) continue;
+
+                stats.messages++;
+                stats.frames_bytes += consumed;
+                if (started && message.sequence > next_sequence) stats.gaps += message.sequence - next_sequence;
+                started = true;
+                next_sequence = message.sequence + 1;
+                if (message.sequence % WS_LATENCY_SAMPLE == 0) {
+                    stats.latencies_us.push_back((arrival_ns - message.sent_ns) / 1000.0);
+                }
+            }
+            in.erase(0, offset);
+        }
+        close(sock);
+    }
+
+    // TCP client speaking the gateway's framing: [u32 length][payload], with
+    // the reply framed the same way (the echo server returns it unchanged)
+    void framed_client_worker(int /*client_id*/) {
+        std::uniform_int_distribution<int> delay_dist(0, 500);
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay_dist(rng)));
+
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock == -1) return;
+
+        struct sockaddr_in server_addr;
+        memset(&server_addr, 0, sizeof(server_addr));
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_port = htons(tcp_port);
+        inet_pton(AF_INET, SERVER_IP, &server_addr.sin_addr);
+
+        if (connect(sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
+            close(sock);
+            return;
+        }
+
+        connections++;
+        active_connections++;
+
+        char send_buffer[sizeof(uint32_t) + BUFFER_SIZE];
+        char recv_buffer[sizeof(uint32_t) + BUFFER_SIZE];
+        uint32_t length = htonl(BUFFER_SIZE);
+        memcpy(send_buffer, &length, sizeof(length));
+        memset(send_buffer + sizeof(length), 'A', BUFFER_SIZE);
+
+        std::uniform_int_distribution<int> interval_dist(20, 150);
+
+        while (!stop_test) {
+            auto request_start = std::chrono::high_resolution_clock::now();
+
+            if (!send_all(sock, send_buffer, sizeof(send_buffer)) ||
+                !recv_all(sock, recv_buffer, sizeof(recv_buffer)) ||
+                memcmp(recv_buffer, send_buffer, sizeof(uint32_t)) != 0) {
+                break;
+            }
+
+            auto request_end = std::chrono::high_resolution_clock::now();
+            auto latency = std::chrono::duration_cast<std::chrono::microseconds>(request_end - request_start).count() / 1000.0;
+            {
+                std::lock_guard<std::mutex> lock(results_mutex);
+                latencies.push_back(latency);
+            }
+            total_bytes += 2 * sizeof(send_buffer);
+
+            if (think_time) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(interval_dist(rng)));
+            }
+        }
+
+        active_connections--;
+        close(sock);
+    }
+
+    // Framed order entry client for the pipeline: alternates a NewOrder with
+    // the cancel of that order, each carrying a hop trailer stamped at send,
+    // and waits for the matching stage's ack before the next one
+    void order_client_worker(int client_id) {
+        std::uniform_int_distribution<int> delay_dist(0, 500);
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay_dist(rng)));
+
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock == -1) return;
+
+        struct sockaddr_in server_addr;
+        memset(&server_addr, 0, sizeof(server_addr));
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_port = htons(tcp_port);
+        inet_pton(AF_INET, SERVER_IP, &server_addr.sin_addr);
+
+        if (connect(sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
+            close(sock);
+            return;
+        }
+        int opt = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+        connections++;
+        active_connections++;
+
+        const uint32_t payload_size = sizeof(MarketMessage) + sizeof(HopTrailer);
+        char send_buffer[sizeof(uint32_t) + payload_size];
+        char recv_buffer[sizeof(uint32_t) + payload_size];
+        uint32_t length = htonl(payload_size);
+        memcpy(send_buffer, &length, sizeof(length));
+
+        std::uniform_int_distribution<int> interval_dist(20, 150);
+        std::uniform_int_distribution<int> symbol_dist(0, 999);
+        MarketMessage order;
+        memset(&order, 0, sizeof(order));
+        order.magic = MARKET_MAGIC;
+
+        for (uint64_t n = 0; !stop_test; n++) {
+            if (n % 2 == 0) {
+                order.type = MARKET_NEW_ORDER;
+                order.order_id = ((uint64_t)client_id << 32) | n;
+                order.side = n % 4 == 0 ? SIDE_BUY : SIDE_SELL;
+                order.symbol = symbol_dist(rng);
+                order.price = 1000000 + symbol_dist(rng);
+                order.quantity = 100;
+            } else {
+                order.type = MARKET_CANCEL;
+            }
+            memcpy(send_buffer + sizeof(uint32_t), &order, sizeof(order));
+
+            HopTrailer trailer;
+            memset(&trailer, 0, sizeof(trailer));
+            trailer.magic = HOP_TRAILER_MAGIC;
+            trailer.count = 1;
+            trailer.stamps_ns[HOP_CLIENT] = journal_now_ns();
+            memcpy(send_buffer + sizeof(uint32_t) + sizeof(order), &trailer, sizeof(trailer));
+
+            auto request_start = std::chrono::high_resolution_clock::now();
+            if (!send_all(sock, send_buffer, sizeof(send_buffer)) ||
+                !recv_all(sock, recv_buffer, sizeof(recv_buffer))) {
+                break;
+            }
+
+            auto request_end = std::chrono::high_resolution_clock::now();
+            auto latency = std::chrono::duration_cast<std::chrono::microseconds>(request_end - request_start).count() / 1000.0;
+            {
+                std::lock_guard<std::mutex> lock(results_mutex);
+                latencies.push_back(latency);
+            }
+            total_bytes += 2 * sizeof(send_buffer);
+
+            if (think_time) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(interval_dist(rng)));
+            }
+        }
+
+        active_connections--;
+        close(sock);
+    }
+
+    // Market data subscriber for the pipeline: stamps each message on
+    // arrival and records the gap between consecutive hop stamps (us)
+    void subscriber_worker(int port, std::atomic<bool>& done,
+                           std::vector<std::vector<double>>& hop_latencies, std::mutex& hop_mutex) {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        inet_pton(AF_INET, SERVER_IP, &addr.sin_addr);
+        if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            perror("subscriber connect");
+            close(sock);
+            return;
+        }
+        struct timeval timeout = {0, 100000};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        std::vector<std::vector<double>> local(PIPELINE_HOPS);
+        std::string in;
+        char buffer[64 * 1024];
+        while (!done) {
+            ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+            if (n == 0) break;
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
+                break;
+            }
+            uint64_t arrival_ns = journal_now_ns();
+            in.append(buffer, n);
+
+            size_t offset = 0;
+            while (in.size() - offset >= sizeof(uint32_t)) {
+                uint32_t length;
+                memcpy(&length, in.data() + offset, sizeof(length));
+                length = ntohl(length);
+                if (in.size() - offset - sizeof(uint32_t) < length) break;
+
+                HopTrailer trailer;
+                if (read_hop_trailer(in.data() + offset + sizeof(uint32_t), length, trailer) &&
+                    trailer.count == HOP_SUBSCRIBER) {
+                    trailer.stamps_ns[HOP_SUBSCRIBER] = arrival_ns;
+                    for (int hop = 0; hop < HOP_SUBSCRIBER; hop++) {
+                        local[hop].push_back((trailer.stamps_ns[hop + 1] - trailer.stamps_ns[hop]) / 1000.0);
+                    }
+                    local[PIPELINE_HOPS - 1].push_back((arrival_ns - trailer.stamps_ns[HOP_CLIENT]) / 1000.0);
+                }
+                offset += sizeof(uint32_t) + length;
+            }
+            in.erase(0, offset);
+        }
+        close(sock);
+
+        std::lock_guard<std::mutex> lock(hop_mutex);
+        for (int hop = 0; hop < PIPELINE_HOPS; hop++) {
+            hop_latencies[hop].insert(hop_latencies[hop].end(), local[hop].begin(), local[hop].end());
+        }
+    }
+
+    static QuoteUpdate make_quote(const FeedEvent& event) {
+        QuoteUpdate update;
+        update.symbol = event.symbol;
+        update.bid_size = event.bid_size;
+        update.ask_size = event.ask_size;
+        update.reserved = 0;
+        update.sequence = event.sequence;
+        update.timestamp_ns = event.timestamp_ns;
+        update.bid_price = event.bid_price;
+        update.ask_price = event.ask_price;
+        return update;
+    }
+
+    static bool same_quote(const QuoteUpdate& a, const QuoteUpdate& b, bool compare_time) {
+        return a.symbol == b.symbol && a.sequence == b.sequence && a.bid_price == b.bid_price &&
+               a.ask_price == b.ask_price && a.bid_size == b.bid_size && a.ask_size == b.ask_size &&
+               (!compare_time || a.timestamp_ns == b.timestamp_ns);
+    }
+
+    // Sends the quote feed to a publisher stage at rate updates/s, in frames
+    // of whatever fell due (at most QUOTE_BATCH), stamped with the send time
+    // Appends a limit NewOrderSingle with ClOrdID order_id to out
+    static void make_fix_order(FixBuilder& builder, const std::string& sender, uint64_t sequence, uint64_t order_id,
+                               const FeedGenerator& names, std::mt19937_64& rng, std::string& out) {
+        builder.start("D");
+        builder.add(FIX_SENDER_COMP_ID, sender.data(), sender.size());
+        builder.add(FIX_TARGET_COMP_ID, "SERVER");
+        builder.add_int(FIX_MSG_SEQ_NUM, sequence);
+        builder.add(FIX_SENDING_TIME, FIX_TEST_TIME);
+        builder.add_int(FIX_CL_ORD_ID, order_id);
+        const std::string& symbol = names.symbol_name(rng() % names.symbol_count());
+        builder.add(FIX_SYMBOL, symbol.data(), symbol.size());
+        builder.add(FIX_SIDE, rng() % 2 ? "1" : "2");
+        builder.add(FIX_TRANSACT_TIME, FIX_TEST_TIME);
+        builder.add_int(FIX_ORDER_QTY, (1 + rng() % 20) * 100);
+        builder.add(FIX_ORD_TYPE, "2");
+        builder.add_price(FIX_PRICE, (int64_t)(5 + rng() % 500) * FIX_PRICE_SCALE + (rng() % 100) * 100);
+        builder.finish(out);
+    }
+
+    // One FIX session: Logon, then NewOrderSingle with FIX_WINDOW in flight
+    // until stop_test, timing each order to its ExecutionReport
+    void fix_client_worker(int port, int client, FixClientStats& stats) {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        inet_pton(AF_INET, SERVER_IP, &addr.sin_addr);
+        if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            perror("fix client connect");
+            close(sock);
+            stats.failed = true;
+            return;
+        }
+        int opt = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+        struct timeval timeout = {2, 0};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        std::string sender = "CLIENT" + std::to_string(client);
+        FixBuilder builder;
+        FixMessage message;
+        FeedGenerator names(client + 1, FIX_SYMBOLS);
+        std::mt19937_64 rng(client + 1);
+        std::string out, in;
+        uint64_t sequence = 1;
+        builder.start("A");
+        builder.add(FIX_SENDER_COMP_ID, sender.data(), sender.size());
+        builder.add(FIX_TARGET_COMP_ID, "SERVER");
+        builder.add_int(FIX_MSG_SEQ_NUM, sequence++);
+        builder.add(FIX_SENDING_TIME, FIX_TEST_TIME);
+        builder.add(FIX_ENCRYPT_METHOD, "0");
+        builder.add(FIX_HEART_BT_INT, "30");
+        builder.finish(out);
+
+        std::vector<uint64_t> sent_ns(FIX_WINDOW);
+        uint64_t next_order = 0, answered = 0;
+        bool logged_on = false;
+        char buffer[65536];
+        while (!stats.failed) {
+            if (logged_on && !stop_test) {
+                uint64_t now = journal_now_ns();
+                while (next_order - answered < FIX_WINDOW) {
+                    sent_ns[next_order % FIX_WINDOW] = now;
+                    make_fix_order(builder, sender, sequence++, next_order++, names, rng, out);
+                    stats.orders++;
+                }
+            }
+            if (!out.empty() && !send_all(sock, out.data(), out.size())) {
+                perror("fix client send");
+                stats.failed = true;
+                break;
+            }
+            out.clear();
+            if (logged_on && answered == next_order) break;  // Stopping and drained
+
+            ssize_t n = read(sock, buffer, sizeof(buffer));
+            if (n <= 0) {
+                stats.failed = true;
+                break;
+            }
+            in.append(buffer, n);
+            size_t offset = 0;
+            while (offset < in.size()) {
+                size_t consumed;
+                uint64_t start = journal_now_ns();
+                FixStatus status = fix_parse(in.data() + offset, in.size() - offset, message, consumed,
+                                             fix_best_scan());
+                uint64_t parsed_at = journal_now_ns();
+                if (status == FixStatus::Incomplete) break;
+                if (status != FixStatus::Ok) {
+                    stats.errors++;
+                    stats.failed = true;
+                    break;
+                }
+                offset += consumed;
+                stats.parsed++;
+                stats.parse_ns += parsed_at - start;
+
+                int64_t order_id;
+                if (message.equals(FIX_MSG_TYPE, "A")) {
+                    logged_on = true;
+                } else if (message.equals(FIX_MSG_TYPE, "8") && message.get_int(FIX_CL_ORD_ID, order_id) &&
+                           (uint64_t)order_id == answered) {
+                    stats.latencies_us.push_back((parsed_at - sent_ns[answered % FIX_WINDOW]) / 1000.0);
+                    stats.reports++;
+                    answered++;
+                } else if (message.equals(FIX_MSG_TYPE, "3")) {
+                    stats.rejects++;
+                    answered++;
+                } else {
+                    stats.errors++;
+                }
+            }
+            in.erase(0, offset);
+        }
+
+        builder.start("5");
+        builder.add(FIX_SENDER_COMP_ID, sender.data(), sender.size());
+        builder.add(FIX_TARGET_COMP_ID, "SERVER");
+        builder.add_int(FIX_MSG_SEQ_NUM, sequence++);
+        builder.add(FIX_SENDING_TIME, FIX_TEST_TIME);
+        builder.finish(out);
+        send_all(sock, out.data(), out.size());
+        close(sock);
+    }
+
+    // A FIX trader as a script: connect, Logon, subscribe to
+    // SCRIPT_SUBSCRIPTIONS symbols, send context.orders limit orders at the
+    // context's interval, cancel every other one, Logout. Each step is timed
+    // from its send to the last reply it needs.
+    static ScriptTask fix_trader_script(ScriptSession& session, ScriptContext& context, uint32_t number) {
+        std::minstd_rand rng((number + 1) * 2654435761u);  // minstd's first draw grows with the seed
+        co_await session.sleep_until(client_now_ns() + rng() % SCRIPT_RAMP_NS);
+        uint64_t start = client_now_ns();
+        if (!co_await session.connect(context.server, start + SCRIPT_STEP_TIMEOUT_NS)) {
+            context.failures[SCRIPT_CONNECT]++;
+            co_return;
+        }
+        context.latencies_us[SCRIPT_CONNECT].push_back((client_now_ns() - start) / 1000.0);
+
+        std::string sender = "TRADER" + std::to_string(number);
+        uint64_t sequence = 1;
+        size_t consumed = 0;
+        bool ok = false;
+        FixBuilder& builder = context.builder;
+
+        start_script_message(context, "A", sender, sequence);
+        builder.add(FIX_ENCRYPT_METHOD, "0");
+        builder.add(FIX_HEART_BT_INT, "30");
+        builder.finish(context.out);
+        co_await script_step(session, context, SCRIPT_LOGON, "A", 1, consumed, ok);
+        if (!ok) co_return;
+
+        int first_symbol = rng() % FIX_SYMBOLS;
+        for (int i = 0; i < SCRIPT_SUBSCRIPTIONS; i++) {
+            const std::string& symbol = context.names.symbol_name((first_symbol + i) % FIX_SYMBOLS);
+            start_script_message(context, "V", sender, sequence);
+            builder.add_int(FIX_MD_REQ_ID, i);
+            builder.add(FIX_SUBSCRIPTION_REQUEST_TYPE, "1");
+            builder.add(FIX_MARKET_DEPTH, "1");
+            builder.add(FIX_NO_RELATED_SYM, "1");
+            builder.add(FIX_SYMBOL, symbol.data(), symbol.size());
+            builder.finish(context.out);
+        }
+        co_await script_step(session, context, SCRIPT_SUBSCRIBE, "W", SCRIPT_SUBSCRIPTIONS, consumed, ok);
+        if (!ok) co_return;
+
+        // Order i is for subscribed symbol i, buying or selling in pairs
+        std::vector<int64_t> order_ids;
+        uint64_t trading = client_now_ns();
+        for (int i = 0; i < context.orders; i++) {
+            co_await session.sleep_until(trading + i * context.order_interval_ns);
+            const std::string& symbol =
+                context.names.symbol_name((first_symbol + i % SCRIPT_SUBSCRIPTIONS) % FIX_SYMBOLS);
+            start_script_message(context, "D", sender, sequence);
+            builder.add_int(FIX_CL_ORD_ID, i);
+            builder.add(FIX_SYMBOL, symbol.data(), symbol.size());
+            builder.add(FIX_SIDE, i / 2 % 2 ? "2" : "1");
+            builder.add(FIX_TRANSACT_TIME, FIX_TEST_TIME);
+            builder.add_int(FIX_ORDER_QTY, (1 + rng() % 20) * 100);
+            builder.add(FIX_ORD_TYPE, "2");
+            builder.add_price(FIX_PRICE, (int64_t)(5 + rng() % 500) * FIX_PRICE_SCALE);
+            builder.finish(context.out);
+            co_await script_step(session, context, SCRIPT_ORDER, "8", 1, consumed, ok);
+            int64_t order_id = 0;
+            if (!ok || !context.message.get_int(FIX_ORDER_ID, order_id)) co_return;
+            order_ids.push_back(order_id);
+        }
+
+        for (int i = 0; i < context.orders; i += 2) {
+            const std::string& symbol =
+                context.names.symbol_name((first_symbol + i % SCRIPT_SUBSCRIPTIONS) % FIX_SYMBOLS);
+            start_script_message(context, "F", sender, sequence);
+            builder.add_int(FIX_CL_ORD_ID, context.orders + i);
+            builder.add_int(FIX_ORIG_CL_ORD_ID, i);
+            builder.add_int(FIX_ORDER_ID, order_ids[i]);
+            builder.add(FIX_SYMBOL, symbol.data(), symbol.size());
+            builder.add(FIX_SIDE, i / 2 % 2 ? "2" : "1");
+            builder.add(FIX_TRANSACT_TIME, FIX_TEST_TIME);
+            builder.finish(context.out);
+            co_await script_step(session, context, SCRIPT_CANCEL, "8", 1, consumed, ok);
+            if (!ok) co_return;
+        }
+
+        start_script_message(context, "5", sender, sequence);
+        builder.finish(context.out);
+        co_await script_step(session, context, SCRIPT_LOGOUT, "5", 1, consumed, ok);
+        if (!ok) co_return;
+        session.close();
+        context.completed++;
+    }
+
+    static void start_script_message(ScriptContext& context, const char* type, const std::string& sender,
+                                     uint64_t& sequence) {
+        context.builder.start(type);
+        context.builder.add(FIX_SENDER_COMP_ID, sender.data(), sender.size());
+        context.builder.add(FIX_TARGET_COMP_ID, "SERVER");
+        context.builder.add_int(FIX_MSG_SEQ_NUM, sequence++);
+        context.builder.add(FIX_SENDING_TIME, FIX_TEST_TIME);
+        context.sent++;
+    }
+
+    // Sends context.out and reads replies messages of reply_type, leaving
+    // the last in context.message; records the step's latency, or its failure
+    static ScriptTask script_step(ScriptSession& session, ScriptContext& context, ScriptStep step,
+                                  const char* reply_type, int replies, size_t& consumed, bool& ok) {
+        uint64_t start = client_now_ns();
+        uint64_t deadline = start + SCRIPT_STEP_TIMEOUT_NS;
+        auto sent = session.write(context.out, deadline);
+        context.out.clear();  // Copied: other sessions build into it while this one waits
+        ok = co_await sent;
+        for (int i = 0; ok && i < replies; i++) {
+            co_await read_script_message(session, context, reply_type, deadline, consumed, ok);
+        }
+        if (ok) {
+            context.latencies_us[step].push_back((client_now_ns() - start) / 1000.0);
+        } else {
+            context.failures[step]++;
+        }
+    }
+
+    // Parses the next message of session.in past consumed into
+    // context.message, skipping heartbeats. ok is false on timeout, closure,
+    // a corrupt stream, a reject or any other message type.
+    static ScriptTask read_script_message(ScriptSession& session, ScriptContext& context, const char* type,
+                                          uint64_t deadline_ns, size_t& consumed, bool& ok) {
+        ok = false;
+        for (;;) {
+            size_t length;
+            FixStatus status = fix_parse(session.in.data() + consumed, session.in.size() - consumed,
+                                         context.message, length, context.scan);
+            if (status == FixStatus::Incomplete) {
+                session.in.erase(0, consumed);
+                consumed = 0;
+                if (!co_await session.receive(deadline_ns)) co_return;
+                continue;
+            }
+            if (status != FixStatus::Ok) co_return;
+            consumed += length;
+            context.received++;
+            if (context.message.equals(FIX_MSG_TYPE, type)) {
+                ok = true;
+                co_return;
+            }
+            if (context.message.equals(FIX_MSG_TYPE, "3") || context.message.equals(FIX_MSG_TYPE, "9")) {
+                context.rejects++;
+                co_return;
+            }
+            if (!context.message.equals(FIX_MSG_TYPE, "0")) co_return;
+        }
+    }
+
+    void quote_producer_worker(int port, uint64_t rate, uint64_t& produced) {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        inet_pton(AF_INET, SERVER_IP, &addr.sin_addr);
+        if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            perror("quote producer connect");
+            close(sock);
+            return;
+        }
+        int opt = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+        FeedGenerator feed(QUOTE_FEED_SEED, QUOTE_SYMBOLS);
+        std::vector<QuoteUpdate> batch;
+        std::string frame;
+        uint64_t start = journal_now_ns();
+        while (!stop_test) {
+            uint64_t now = journal_now_ns();
+            uint64_t due = (uint64_t)((now - start) * (rate / 1e9));
+            if (produced >= due) {
+                struct timespec pause = {0, (long)STREAM_TICK_NS};
+                nanosleep(&pause, nullptr);
+                continue;
+            }
+            while (produced < due) {
+                batch.clear();
+                while (produced < due && batch.size() < QUOTE_BATCH) {
+                    QuoteUpdate update = make_quote(feed.next_quote());
+                    update.timestamp_ns = now;
+                    batch.push_back(update);
+                    produced++;
+                }
+                uint32_t prefix = htonl(batch.size() * sizeof(QuoteUpdate));
+                frame.assign((const char*)&prefix, sizeof(prefix));
+                frame.append((const char*)batch.data(), batch.size() * sizeof(QuoteUpdate));
+                if (!send_all(sock, frame.data(), frame.size())) {
+                    perror("quote producer send");
+                    close(sock);
+                    return;
+                }
+            }
+        }
+        close(sock);
+    }
+
+    // Quote subscriber: decodes fixed or delta frames, checks every update
+    // against its own copy of the producer's feed and samples latency from
+    // the producer's send stamp
+    void quote_subscriber_worker(int port, bool delta, std::atomic<bool>& done, QuoteSubscriberStats& stats) {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        inet_pton(AF_INET, SERVER_IP, &addr.sin_addr);
+        if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            perror("quote subscriber connect");
+            close(sock);
+            stats.failed = true;
+            return;
+        }
+        struct timeval timeout = {0, 100000};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        uint64_t connected_ns = journal_now_ns();
+
+        FeedGenerator feed(QUOTE_FEED_SEED, QUOTE_SYMBOLS);
+        QuoteUpdate expected = make_quote(feed.next_quote());
+        QuoteDeltaDecoder decoder;
+        std::vector<QuoteUpdate> updates;
+        std::string in;
+        char buffer[64 * 1024];
+        while (!done) {
+            ssize_t n = recv(sock, buffer, sizeof(buffer), 0);
+            if (n == 0) break;
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
+                break;
+            }
+            uint64_t arrival_ns = journal_now_ns();
+            in.append(buffer, n);
+
+            size_t offset = 0;
+            while (in.size() - offset >= sizeof(uint32_t)) {
+                uint32_t length;
+                memcpy(&length, in.data() + offset, sizeof(length));
+                length = ntohl(length);
+                if (in.size() - offset - sizeof(uint32_t) < length) break;
+                const char* frame = in.data() + offset + sizeof(uint32_t);
+                offset += sizeof(uint32_t) + length;
+                stats.wire_bytes += sizeof(uint32_t) + length;
+
+                updates.clear();
+                uint64_t skipped_before = decoder.awaiting_refresh;
+                uint64_t start = journal_now_ns();
+                bool ok;
+                if (delta) {
+                    ok = decoder.decode(frame, length, updates);
+                } else {
+                    ok = length % sizeof(QuoteUpdate) == 0;
+                    updates.resize(length / sizeof(QuoteUpdate));
+                    if (ok) memcpy(updates.data(), frame, length);
+                }
+                stats.decode_ns += journal_now_ns() - start;
+                if (!ok) {
+                    std::cerr << "Quote subscriber got a malformed frame" << std::endl;
+                    stats.failed = true;
+                    break;
+                }
+                if (decoder.awaiting_refresh != skipped_before) {
+                    stats.skipped = decoder.awaiting_refresh;
+                    stats.sync_ms = (arrival_ns - connected_ns) / 1e6;
+                }
+
+                for (const QuoteUpdate& update : updates) {
+                    while (expected.sequence < update.sequence) expected = make_quote(feed.next_quote());
+                    if (!same_quote(update, expected, false)) stats.mismatches++;
+                    if (update.sequence % QUOTE_LATENCY_SAMPLE == 0) {
+                        stats.latencies_us.push_back((arrival_ns - update.timestamp_ns) / 1000.0);
+                    }
+                }
+                stats.updates += updates.size();
+            }
+            in.erase(0, offset);
+            if (stats.failed) break;
+        }
+        close(sock);
+    }
+
+    // Fills message slot `sequence` of a stream paced at rate messages/s
+    static StreamMessage make_stream_message(int stream, uint64_t sequence, uint64_t start_ns, uint64_t rate) {
+        StreamMessage message;
+        message.send_ns = start_ns + (uint64_t)(sequence * (1e9 / rate));
+        message.sequence = sequence;
+        message.stream = stream;
+        message.magic = STREAM_MAGIC;
+        message.reserved = 0;
+        return message;
+    }
+
+    // Waits for the socket to become readable (or writable) for wait_ns,
+    // rounded up to one pacing tick, giving the CPU to the server meanwhile
+    static void wait_socket(int sock, bool want_write, uint64_t wait_ns) {
+        struct pollfd pfd = {sock, (short)(POLLIN | (want_write ? POLLOUT : 0)), 0};
+        struct timespec timeout = {0, (long)std::min(std::max(wait_ns, STREAM_TICK_NS), STREAM_MAX_WAIT_NS)};
+        ppoll(&pfd, 1, &timeout, nullptr);
+    }
+
+    // Paced message stream over the TCP echo port with at most
+    // TCP_STREAM_WINDOW bytes awaiting their echo
+    void tcp_stream_worker(int stream, uint64_t rate, StreamStats& stats) {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(tcp_port);
+        inet_pton(AF_INET, SERVER_IP, &addr.sin_addr);
+        if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            perror("stream connect");
+            close(sock);
+            stats.failed = true;
+            return;
+        }
+        int opt = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+        std::string out;
+        std::string in;
+        char buffer[64 * 1024];
+        size_t outstanding = 0;
+        uint64_t next = 0;
+        uint64_t expected = 0;
+        uint64_t start = journal_now_ns();
+
+        while (!stop_test && !stats.failed) {
+            uint64_t now = journal_now_ns();
+            uint64_t due = (uint64_t)((now - start) * (rate / 1e9));
+            bool blocked = false;
+            while (next < due) {
+                if (outstanding + sizeof(StreamMessage) > TCP_STREAM_WINDOW) {
+                    blocked = true;
+                    break;
+                }
+                StreamMessage message = make_stream_message(stream, next++, start, rate);
+                out.append((const char*)&message, sizeof(message));
+                outstanding += sizeof(message);
+            }
+
+            if (!out.empty()) {
+                ssize_t n = send(sock, out.data(), out.size(), 0);
+                if (n > 0) out.erase(0, n);
+            }
+
+            ssize_t n;
+            bool received = false;
+            while ((n = recv(sock, buffer, sizeof(buffer), 0)) > 0) {
+                in.append(buffer, n);
+                received = true;
+            }
+            if (n == 0) break;
+
+            size_t offset = 0;
+            uint64_t arrival = journal_now_ns();
+            for (; offset + sizeof(StreamMessage) <= in.size(); offset += sizeof(StreamMessage)) {
+                StreamMessage message;
+                memcpy(&message, in.data() + offset, sizeof(message));
+                if (message.magic != STREAM_MAGIC || message.sequence != expected) {
+                    std::cerr << "TCP stream " << stream << " desynchronized at message " << expected
+                              << ": the server dropped echo bytes" << std::endl;
+                    stats.failed = true;
+                    break;
+                }
+                expected++;
+                stats.latencies_us.push_back((arrival - message.send_ns) / 1000.0);
+                stats.messages++;
+            }
+            in.erase(0, offset);
+            outstanding -= offset;
+
+            if (!received) {
+                uint64_t next_due = start + (uint64_t)(next * (1e9 / rate));
+                uint64_t now_after = journal_now_ns();
+                wait_socket(sock, !out.empty(),
+                            blocked ? STREAM_MAX_WAIT_NS : (next_due > now_after ? next_due - now_after : 0));
+            }
+        }
+        close(sock);
+    }
+
+    // Connects to the TCP port and logs on to session_id; returns the socket
+    // (non-blocking) or -1
+    int session_logon(uint64_t session_id, uint64_t next_expected) {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(tcp_port);
+        inet_pton(AF_INET, SERVER_IP, &addr.sin_addr);
+        if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            close(sock);
+            return -1;
+        }
+        int opt = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+        SessionLogon logon;
+        memset(&logon, 0, sizeof(logon));
+        logon.type = SESSION_LOGON;
+        logon.session_id = session_id;
+        logon.next_expected = next_expected;
+        uint32_t prefix = htonl(sizeof(logon));
+        if (!send_all(sock, (const char*)&prefix, sizeof(prefix)) ||
+            !send_all(sock, (const char*)&logon, sizeof(logon))) {
+            close(sock);
+            return -1;
+        }
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+        return sock;
+    }
+
+    // Paced message stream over the session layer. Every
+    // options.disconnect_every_ms the link stalls: the client keeps sending
+    // but stops reading for options.outage_ms, then resets the connection
+    // (SO_LINGER 0, so unread echoes die in the kernel) and logs back on.
+    // The server replays what was lost and this side resends what the
+    // server never got.
+    void session_stream_worker(int stream, uint64_t rate, StreamStats& stats) {
+        uint64_t session_id = ((uint64_t)std::uniform_int_distribution<uint32_t>()(rng) << 32) | stream;
+        SessionResendStore store(SIZE_MAX);
+        const uint64_t window = TCP_STREAM_WINDOW / sizeof(StreamMessage);
+        uint64_t in_next = 1;
+        uint64_t send_next = 1;        // Next stored message to put on the wire
+        uint64_t highest_sent = 0;
+        uint64_t expected_payload = 0;
+        uint64_t next = 0;
+
+        bool awaiting_ack = true;
+        bool resyncing = true;
+        uint64_t replay_end = 0;
+        uint64_t resync_start = journal_now_ns();
+        int sock = session_logon(session_id, in_next);
+        if (sock == -1) {
+            perror("session connect");
+            stats.failed = true;
+            return;
+        }
+
+        std::string out;
+        std::string in;
+        char buffer[64 * 1024];
+        uint64_t start = journal_now_ns();
+        uint64_t next_disconnect = start + options.disconnect_every_ms * 1000000ULL;
+        uint64_t stall_start = 0;
+
+        while (!stop_test && !stats.failed) {
+            uint64_t now = journal_now_ns();
+
+            // Inject a fault once the previous resync has finished: stop
+            // reading for outage_ms, then reset the connection
+            if (!resyncing && now >= next_disconnect && stall_start == 0) {
+                stall_start = now;
+            }
+            if (stall_start != 0 && now - stall_start >= options.outage_ms * 1000000ULL) {
+                struct linger abortive = {1, 0};
+                setsockopt(sock, SOL_SOCKET, SO_LINGER, &abortive, sizeof(abortive));
+                close(sock);
+                out.clear();
+                in.clear();
+                stall_start = 0;
+
+                stats.reconnects++;
+                resync_start = journal_now_ns();
+                sock = session_logon(session_id, in_next);
+                if (sock == -1) {
+                    perror("session reconnect");
+                    stats.failed = true;
+                    break;
+                }
+                awaiting_ack = true;
+                resyncing = true;
+                next_disconnect = journal_now_ns() + options.disconnect_every_ms * 1000000ULL;
+                continue;
             }
-            
-            // Stagger connection attempts
-            if (i < client_count - 1) {
-                int delay_ms = (RAMP_UP_DURATION_SEC * 1000) / client_count;
-                std::this_thread::sleep_for(std::chrono::milliseconds(std::max(1, delay_ms)));
+
+            // New messages go into the store; flow control is the store size
+            uint64_t due = (uint64_t)((now - start) * (rate / 1e9));
+            bool blocked = false;
+            while (next < due) {
+                if (store.next_sequence() - store.first_sequence() >= window) {
+                    blocked = true;
+                    break;
+                }
+                StreamMessage message = make_stream_message(stream, next++, start, rate);
+                store.add((const char*)&message, sizeof(message));
+            }
+
+            if (!awaiting_ack) {
+                for (; send_next < store.next_sequence() && out.size() < TCP_STREAM_WINDOW; send_next++) {
+                    const std::string* message = store.find(send_next);
+                    append_session_data(out, send_next, in_next, message->data(), message->size());
+                    if (send_next <= highest_sent) stats.resent++;
+                    highest_sent = std::max(highest_sent, send_next);
+                }
+            }
+            if (!out.empty()) {
+                ssize_t n = send(sock, out.data(), out.size(), 0);
+                if (n > 0) out.erase(0, n);
+            }
+
+            ssize_t n = -1;
+            bool received = false;
+            while (stall_start == 0 && (n = recv(sock, buffer, sizeof(buffer), 0)) > 0) {
+                in.append(buffer, n);
+                received = true;
+            }
+
+            uint64_t arrival = journal_now_ns();
+            consume_session_frames(in, [&](const char* body, uint32_t length) {
+                if (body[0] == SESSION_LOGON_ACK && length >= sizeof(SessionLogonAck)) {
+                    SessionLogonAck ack;
+                    memcpy(&ack, body, sizeof(ack));
+                    if (ack.flags & SESSION_FLAG_RESET) stats.resets++;
+                    in_next = std::max(in_next, ack.first_replayed);
+                    store.trim(ack.next_expected);
+                    send_next = ack.next_expected;
+                    replay_end = ack.next_sequence;
+                    awaiting_ack = false;
+                } else if (body[0] == SESSION_DATA && length >= sizeof(SessionDataHeader)) {
+                    SessionDataHeader header;
+                    memcpy(&header, body, sizeof(header));
+                    store.trim(header.ack);
+                    if (header.sequence < in_next) {
+                        stats.duplicates++;
+                        return;
+                    }
+                    in_next = header.sequence + 1;
+                    if (resyncing) stats.replayed++;
+
+                    StreamMessage message;
+                    memcpy(&message, body + sizeof(header), sizeof(message));
+                    if (message.sequence != expected_payload) stats.gaps++;
+                    expected_payload = message.sequence + 1;
+                    stats.latencies_us.push_back((arrival - message.send_ns) / 1000.0);
+                    stats.messages++;
+                }
+            });
+
+            if (resyncing && !awaiting_ack && in_next >= replay_end) {
+                resyncing = false;
+                if (stats.reconnects > 0) {
+                    double seconds = (journal_now_ns() - resync_start) / 1e9;
+                    stats.resync_ms.push_back(seconds * 1000.0);
+                    stats.replay_seconds += seconds;
+                }
+            }
+
+            if (n == 0) {
+                // The server dropped us; the next injected disconnect reconnects
+                next_disconnect = 0;
+                continue;
+            }
+            if (!received) {
+                uint64_t next_due = start + (uint64_t)(next * (1e9 / rate));
+                uint64_t now_after = journal_now_ns();
+                wait_socket(sock, !out.empty(),
+                            blocked ? STREAM_MAX_WAIT_NS : (next_due > now_after ? next_due - now_after : 0));
             }
         }
-        
-        // Let the test run
-        std::this_thread::sleep_for(std::chrono::seconds(TEST_DURATION_SEC));
-        
-        // Signal threads to stop
-        stop_test = true;
-        
-        // Wait for all threads
-        for (auto& thread : threads) {
-            thread.join();
+        close(sock);
+    }
+
+    // Calls fn(body, length) for each complete session frame and drops them
+    template <typename Fn>
+    static void consume_session_frames(std::string& in, Fn fn) {
+        size_t offset = 0;
+        while (in.size() - offset >= sizeof(uint32_t)) {
+            uint32_t length;
+            memcpy(&length, in.data() + offset, sizeof(length));
+            length = ntohl(length);
+            if (in.size() - offset - sizeof(uint32_t) < length) break;
+            if (length > 0) fn(in.data() + offset + sizeof(uint32_t), length);
+            offset += sizeof(uint32_t) + length;
         }
-        monitor_thread.join();
-        
-        auto end_time = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
-        
-        // Calculate result
-        ScalabilityResult result;
-        result.client_count = client_count;
-        result.timestamp = get_timestamp();
-        result.total_requests = latencies.size();
-        result.successful_requests = latencies.size();
-        result.success_rate = result.total_requests > 0 ? 100.0 : 0.0;
-        result.connections_per_second = (double)connections / (duration.count() / 1000.0);
-        result.peak_concurrent_connections = peak_connections;
-        
-        // Calculate throughput
-        double duration_seconds = duration.count() / 1000.0;
-        double megabytes = total_bytes / (1024.0 * 1024.0);
-        result.throughput_mbps = megabytes / duration_seconds;
-        
-        // Calculate all percentiles P1 to P100
-        result.percentiles = calculate_all_percentiles(latencies);
-        
-        return result;
+        in.erase(0, offset);
     }
-    
-    void reset_counters() {
-        connections = 0;
-        active_connections = 0;
-        peak_connections = 0;
-        total_bytes = 0;
-        stop_test = false;
-        latencies.clear();
+
+    // Paced message stream over the log-buffer transport on the UDP port
+    void log_stream_worker(int stream, uint64_t rate, StreamStats& stats) {
+        int sock = socket(AF_INET, SOCK_DGRAM, 0);
+        int buf_size = 4 * 1024 * 1024;
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
+        setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(udp_port);
+        inet_pton(AF_INET, SERVER_IP, &addr.sin_addr);
+        if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            perror("stream connect");
+            close(sock);
+            stats.failed = true;
+            return;
+        }
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+        std::unique_ptr<LogSession> session(new LogSession);
+        uint32_t session_id = (std::uniform_int_distribution<uint32_t>(1, UINT32_MAX)(rng) & ~0xFFu) | stream;
+        if (!session->init(session_id)) {
+            close(sock);
+            stats.failed = true;
+            return;
+        }
+
+        std::vector<char> buffers(STREAM_RECV_BATCH * LOG_DATAGRAM_SIZE);
+        struct mmsghdr headers[STREAM_RECV_BATCH];
+        struct iovec iovecs[STREAM_RECV_BATCH];
+        for (int i = 0; i < STREAM_RECV_BATCH; i++) {
+            iovecs[i].iov_base = &buffers[i * LOG_DATAGRAM_SIZE];
+            iovecs[i].iov_len = LOG_DATAGRAM_SIZE;
+            memset(&headers[i].msg_hdr, 0, sizeof(headers[i].msg_hdr));
+            headers[i].msg_hdr.msg_iov = &iovecs[i];
+            headers[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        uint64_t next = 0;
+        uint64_t start = journal_now_ns();
+        while (!stop_test) {
+            uint64_t now = journal_now_ns();
+            uint64_t due = (uint64_t)((now - start) * (rate / 1e9));
+            bool blocked = false;
+            while (next < due) {
+                StreamMessage message = make_stream_message(stream, next, start, rate);
+                if (!session->publication.offer((const char*)&message, sizeof(message))) {
+                    blocked = true;
+                    break;
+                }
+                next++;
+            }
+
+            int received = recvmmsg(sock, headers, STREAM_RECV_BATCH, MSG_DONTWAIT, nullptr);
+            for (int i = 0; i < received; i++) {
+                session->on_datagram((const char*)iovecs[i].iov_base, headers[i].msg_len, now);
+            }
+
+            uint64_t arrival = journal_now_ns();
+            session->image.poll([&](const char* data, uint32_t length) {
+                StreamMessage message;
+                if (length == sizeof(message)) {
+                    memcpy(&message, data, sizeof(message));
+                    stats.latencies_us.push_back((arrival - message.send_ns) / 1000.0);
+                    stats.messages++;
+                }
+                return true;
+            }, INT32_MAX);
+            session->send(sock, nullptr, arrival);
+
+            if (received <= 0) {
+                uint64_t next_due = start + (uint64_t)(next * (1e9 / rate));
+                uint64_t now_after = journal_now_ns();
+                wait_socket(sock, false,
+                            blocked ? STREAM_MAX_WAIT_NS : (next_due > now_after ? next_due - now_after : 0));
+            }
+        }
+
+        stats.naks_sent = session->image.naks_sent;
+        stats.naks_received = session->publication.naks_received;
+        stats.retransmitted_bytes = session->publication.retransmitted_bytes;
+        close(sock);
     }
-    
-    void connection_monitor() {
+
+    // Paced message stream over the UDP or QUIC echo port (datagram_quic),
+    // one message per send, or packed (packing.h) when pack_mtu is set
+    void datagram_stream_worker(int stream, uint64_t rate, StreamStats& stats) {
+        int sock = socket(AF_INET, SOCK_DGRAM, 0);
+        int buf_size = 4 * 1024 * 1024;
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &buf_size, sizeof(buf_size));
+        setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &buf_size, sizeof(buf_size));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(datagram_quic ? quic_port : udp_port);
+        inet_pton(AF_INET, SERVER_IP, &addr.sin_addr);
+        if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            perror("stream connect");
+            close(sock);
+            stats.failed = true;
+            return;
+        }
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+        // QUIC: the connection ID leads a single message and is the channel
+        // of a packed one; replies carry the server's "QUIC Echo: " prefix
+        uint32_t connection_id = 0x51000000 | (uint32_t)stream;
+        uint32_t wire_id = htonl(connection_id);
+        size_t reply_prefix = datagram_quic ? 11 : 0;
+        std::unique_ptr<DatagramPacker> packer;
+        if (pack_mtu) packer.reset(new DatagramPacker(pack_mtu, pack_deadline_ns));
+
+        std::vector<char> buffers(STREAM_RECV_BATCH * STREAM_DATAGRAM_SIZE);
+        struct mmsghdr headers[STREAM_RECV_BATCH];
+        struct iovec iovecs[STREAM_RECV_BATCH];
+        for (int i = 0; i < STREAM_RECV_BATCH; i++) {
+            iovecs[i].iov_base = &buffers[i * STREAM_DATAGRAM_SIZE];
+            iovecs[i].iov_len = STREAM_DATAGRAM_SIZE;
+            memset(&headers[i].msg_hdr, 0, sizeof(headers[i].msg_hdr));
+            headers[i].msg_hdr.msg_iov = &iovecs[i];
+            headers[i].msg_hdr.msg_iovlen = 1;
+        }
+        std::vector<PackedView> views;
+        uint64_t single_datagrams = 0;
+
+        auto on_echo = [&](const char* data, size_t length, uint64_t arrival) {
+            StreamMessage message;
+            if (length != reply_prefix + sizeof(message)) return;
+            memcpy(&message, data + reply_prefix, sizeof(message));
+            if (message.magic != STREAM_MAGIC) return;
+            stats.latencies_us.push_back((arrival - message.send_ns) / 1000.0);
+            stats.messages++;
+        };
+
+        uint64_t next = 0;
+        uint64_t start = journal_now_ns();
         while (!stop_test) {
-            int current = active_connections.load();
-            if (current > peak_connections) {
-                peak_connections = current;
+            uint64_t now = journal_now_ns();
+            uint64_t due = (uint64_t)((now - start) * (rate / 1e9));
+            while (next < due) {
+                StreamMessage message = make_stream_message(stream, next++, start, rate);
+                stats.sent++;
+                if (packer) {
+                    packer->add(addr, datagram_quic ? connection_id : 0, (const char*)&message, sizeof(message), now);
+                    continue;
+                }
+                char datagram[sizeof(uint32_t) + sizeof(StreamMessage)];
+                size_t length = 0;
+                if (datagram_quic) {
+                    memcpy(datagram, &wire_id, sizeof(wire_id));
+                    length = sizeof(wire_id);
+                }
+                memcpy(datagram + length, &message, sizeof(message));
+                send(sock, datagram, length + sizeof(message), 0);
+                stats.syscalls++;
+                single_datagrams++;
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            if (packer) {
+                uint64_t calls = packer->send_calls;
+                packer->flush(sock, now);
+                stats.syscalls += packer->send_calls - calls;
+            }
+
+            int received = recvmmsg(sock, headers, STREAM_RECV_BATCH, MSG_DONTWAIT, nullptr);
+            stats.syscalls++;
+            uint64_t arrival = journal_now_ns();
+            for (int i = 0; i < received; i++) {
+                const char* data = (const char*)iovecs[i].iov_base;
+                size_t length = headers[i].msg_len;
+                uint32_t channel;
+                if (packer) {
+                    if (!unpack_datagram(data, length, channel, views)) continue;
+                    for (const PackedView& view : views) on_echo(view.data, view.length, arrival);
+                } else if (length >= sizeof(uint32_t) * datagram_quic) {
+                    size_t header = datagram_quic ? sizeof(uint32_t) : 0;
+                    on_echo(data + header, length - header, arrival);
+                }
+            }
+
+            if (received <= 0) {
+                uint64_t wake = start + (uint64_t)(next * (1e9 / rate));
+                uint64_t flush_due = packer ? packer->next_deadline() : 0;
+                if (flush_due && flush_due < wake) wake = flush_due;
+                uint64_t now_after = journal_now_ns();
+                wait_socket(sock, false, wake > now_after ? wake - now_after : 0);
+                stats.syscalls++;
+            }
+        }
+        stats.datagrams = packer ? packer->datagrams : single_datagrams;
+        close(sock);
+    }
+
+    // Compresses a feed message for the wire, or copies it when compression is off
+    void encode_feed(LzEncoder* encoder, const std::string& message, std::string& block) {
+        block.clear();
+        if (!encoder) {
+            block = message;
+            return;
         }
+        auto start = std::chrono::steady_clock::now();
+        encoder->compress(message.data(), message.size(), block);
+        codec_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
     }
-    
-    void tcp_client_worker(int client_id) {
-        // Random delay for realistic connection pattern
+
+    bool decode_feed(LzDecoder* decoder, const char* block, size_t length, std::string& message) {
+        message.clear();
+        if (!decoder) {
+            message.assign(block, length);
+            return true;
+        }
+        auto start = std::chrono::steady_clock::now();
+        bool ok = decoder->decompress(block, length, message);
+        codec_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        codec_messages++;
+        return ok;
+    }
+
+    // TCP client sending generated feed messages as [u32 length][payload]
+    // frames, LZ-compressed when a compression mode is set. A server without
+    // --compress echoes the plain frames back unchanged.
+    void feed_tcp_worker(int client_id) {
         std::uniform_int_distribution<int> delay_dist(0, 500);
         std::this_thread::sleep_for(std::chrono::milliseconds(delay_dist(rng)));
-        
+
         int sock = socket(AF_INET, SOCK_STREAM, 0);
         if (sock == -1) return;
-        
+
         struct sockaddr_in server_addr;
         memset(&server_addr, 0, sizeof(server_addr));
         server_addr.sin_family = AF_INET;
-        server_addr.sin_port = htons(TCP_PORT);
+        server_addr.sin_port = htons(tcp_port);
         inet_pton(AF_INET, SERVER_IP, &server_addr.sin_addr);
-        
+
         if (connect(sock, (struct sockaddr*)&server_addr, sizeof(server_addr)) == -1) {
             close(sock);
             return;
         }
-        
+        int nodelay = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
         connections++;
         active_connections++;
-        
-        char send_buffer[BUFFER_SIZE];
-        char recv_buffer[BUFFER_SIZE];
-        memset(send_buffer, 'A', sizeof(send_buffer));
-        
+
+        std::unique_ptr<LzEncoder> encoder;
+        std::unique_ptr<LzDecoder> decoder;
+        LzMode mode;
+        if (parse_lz_mode(compression, mode)) {
+            encoder.reset(new LzEncoder(dictionary, mode, compression_level));
+            decoder.reset(new LzDecoder(dictionary, mode));
+        }
+
+        FeedGenerator feed(client_id + 1);
+        std::string message, block, frame, reply, echoed;
         std::uniform_int_distribution<int> interval_dist(20, 150);
-        
+
         while (!stop_test) {
+            feed.next(message);
             auto request_start = std::chrono::high_resolution_clock::now();
-            
-            ssize_t sent = send(sock, send_buffer, sizeof(send_buffer), 0);
-            if (sent > 0) {
-                ssize_t received = recv(sock, recv_buffer, sizeof(recv_buffer), 0);
-                if (received > 0) {
-                    auto request_end = std::chrono::high_resolution_clock::now();
-                    auto latency = std::chrono::duration_cast<std::chrono::microseconds>(request_end - request_start).count() / 1000.0;
-                    
-                    {
-                        std::lock_guard<std::mutex> lock(results_mutex);
-                        latencies.push_back(latency);
-                    }
-                    
-                    total_bytes += sent + received;
-                } else {
-                    break;
-                }
-            } else {
+
+            encode_feed(encoder.get(), message, block);
+            uint32_t prefix = htonl(block.size());
+            frame.assign((const char*)&prefix, sizeof(prefix));
+            frame += block;
+            uint32_t length;
+            if (!send_all(sock, frame.data(), frame.size()) ||
+                !recv_all(sock, (char*)&length, sizeof(length))) {
                 break;
             }
-            
-            std::this_thread::sleep_for(std::chrono::milliseconds(interval_dist(rng)));
+            length = ntohl(length);
+            if (length > LZ_MAX_OUTPUT) break;
+            reply.resize(length);
+            if (!recv_all(sock, &reply[0], length)) break;
+            if (!decode_feed(decoder.get(), reply.data(), length, echoed) || echoed != message) {
+                codec_errors++;
+            }
+
+            auto request_end = std::chrono::high_resolution_clock::now();
+            auto latency = std::chrono::duration_cast<std::chrono::microseconds>(request_end - request_start).count() / 1000.0;
+            {
+                std::lock_guard<std::mutex> lock(results_mutex);
+                latencies.push_back(latency);
+            }
+            total_bytes += frame.size() + sizeof(length) + length;
+            plain_bytes += 2 * message.size();
+
+            if (think_time) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(interval_dist(rng)));
+            }
         }
-        
+
         active_connections--;
         close(sock);
     }
-    
-    void udp_client_worker(int client_id) {
-        // Random delay for realistic connection pattern
+
+    // UDP client sending one generated feed message per datagram, compressed
+    // per message against the dictionary when compression is on
+    void feed_udp_worker(int client_id) {
         std::uniform_int_distribution<int> delay_dist(0, 500);
         std::this_thread::sleep_for(std::chrono::milliseconds(delay_dist(rng)));
-        
+
         int sock = socket(AF_INET, SOCK_DGRAM, 0);
         if (sock == -1) return;
-        
-        // Set socket options for better network compatibility
-        int reuse = 1;
-        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
-        
-        // Set longer timeout for cross-network communication
+
         struct timeval timeout;
-        timeout.tv_sec = 5;  // Increased from 1 to 5 seconds
+        timeout.tv_sec = 1;
         timeout.tv_usec = 0;
         setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
-        
+
         struct sockaddr_in server_addr;
         memset(&server_addr, 0, sizeof(server_addr));
         server_addr.sin_family = AF_INET;
-        server_addr.sin_port = htons(UDP_PORT);
+        server_addr.sin_port = htons(udp_port);
         inet_pton(AF_INET, SERVER_IP, &server_addr.sin_addr);
-        
+
         connections++;
         active_connections++;
-        
-        char send_buffer[BUFFER_SIZE];
-        char recv_buffer[BUFFER_SIZE];
-        memset(send_buffer, 'A', sizeof(send_buffer));
-        
+
+        std::unique_ptr<LzEncoder> encoder;
+        std::unique_ptr<LzDecoder> decoder;
+        if (!compression.empty()) {
+            encoder.reset(new LzEncoder(dictionary, LzMode::Message, compression_level));
+            decoder.reset(new LzDecoder(dictionary, LzMode::Message));
+        }
+
+        FeedGenerator feed(client_id + 1);
+        std::string message, block, echoed;
+        char reply[BUFFER_SIZE * 4];
         std::uniform_int_distribution<int> interval_dist(10, 100);
-        
+
         while (!stop_test) {
+            feed.next(message);
             auto request_start = std::chrono::high_resolution_clock::now();
-            
-            // Retry logic for UDP packet loss
-            bool success = false;
-            int max_retries = 3;
-            
-            for (int retry = 0; retry < max_retries && !stop_test && !success; ++retry) {
-                ssize_t sent = sendto(sock, send_buffer, sizeof(send_buffer), 0, 
-                                     (struct sockaddr*)&server_addr, sizeof(server_addr));
-                
-                if (sent > 0) {
-                    socklen_t addr_len = sizeof(server_addr);
-                    ssize_t received = recvfrom(sock, recv_buffer, sizeof(recv_buffer), 0,
-                                              (struct sockaddr*)&server_addr, &addr_len);
-                    
-                    if (received > 0) {
-                        auto request_end = std::chrono::high_resolution_clock::now();
-                        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(request_end - request_start).count() / 1000.0;
-                        
-                        {
-                            std::lock_guard<std::mutex> lock(results_mutex);
-                            latencies.push_back(latency);
-                        }
-                        
-                        total_bytes += sent + received;
-                        success = true;
-                    } else if (received == -1) {
-                        // Handle specific error cases
-                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                            // Timeout - this is expected, continue to retry
-                            continue;
-                        } else if (errno == ECONNREFUSED || errno == EHOSTUNREACH || errno == ENETUNREACH) {
-                            // Network/connection issues - break out of retry loop
-                            break;
-                        }
-                        // Other errors - continue to retry
-                    }
-                } else if (sent == -1) {
-                    // Send failed, check errno
-                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                        // Socket busy, wait a bit and retry
-                        std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                        continue;
-                    } else if (errno == ECONNREFUSED || errno == EHOSTUNREACH || errno == ENETUNREACH) {
-                        // Network issues - break out of retry loop
-                        break;
-                    }
-                    // Other send errors - continue to retry
+
+            encode_feed(encoder.get(), message, block);
+            ssize_t sent = sendto(sock, block.data(), block.size(), 0,
+                                  (struct sockaddr*)&server_addr, sizeof(server_addr));
+            ssize_t received = sent > 0 ? recv(sock, reply, sizeof(reply), 0) : -1;
+            if (received > 0) {
+                if (!decode_feed(decoder.get(), reply, received, echoed) || echoed != message) {
+                    codec_errors++;
                 }
-                
-                // Small delay between retries
-                if (retry < max_retries - 1) {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                auto request_end = std::chrono::high_resolution_clock::now();
+                auto latency = std::chrono::duration_cast<std::chrono::microseconds>(request_end - request_start).count() / 1000.0;
+                {
+                    std::lock_guard<std::mutex> lock(results_mutex);
+                    latencies.push_back(latency);
                 }
+                total_bytes += sent + received;
+                plain_bytes += 2 * message.size();
+            }
+
+            if (think_time) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(interval_dist(rng)));
             }
-            
-            std::this_thread::sleep_for(std::chrono::milliseconds(interval_dist(rng)));
         }
-        
+
         active_connections--;
         close(sock);
     }
-    
-    void quic_client_worker(int client_id) {
-        int sock = socket(AF_INET, SOCK_DGRAM, 0);
-        if (sock == -1) return;
+
+    void udp_client_worker(int client_id) {
+        // Random delay for realistic connection pattern
+        std::uniform_int_distribution<int> delay_dist(0, 500);
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay_dist(rng)));
         
-        // Set socket timeout for reliability
-        struct timeval timeout;
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
-        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        // Every request is idempotent: the SDK's header names this client
+        // and the request's sequence, so the server answers retransmissions
+        // and hedges from its cache
+        ClientLoop loop;
+        Client client(loop, worker_client_options(ClientProtocol::Udp, client_id, udp_port, UDP_GIVE_UP_NS,
+                                                  UDP_FIXED_RTO_NS));
+        if (!loop.ok() || !client.open()) return;
         
-        struct sockaddr_in server_addr;
-        memset(&server_addr, 0, sizeof(server_addr));
-        server_addr.sin_family = AF_INET;
-        server_addr.sin_port = htons(QUIC_PORT);
-        inet_pton(AF_INET, SERVER_IP, &server_addr.sin_addr);
+        connections++;
+        active_connections++;
+        
+        // A BUFFER_SIZE datagram with the header
+        std::string payload(BUFFER_SIZE - sizeof(IdempotentHeader), 'A');
+        ClientReply reply;
+        uint64_t accounted = 0;
+        std::uniform_int_distribution<int> interval_dist(10, 100);
         
-        // Generate unique connection ID for this client
-        uint32_t connection_id = htonl(client_id + 1000);
+        while (!stop_test) {
+            if (!worker_request(loop, client, payload, reply)) break;
+            record_datagram_reply(reply);
+            if (reply.status == ClientStatus::Ok) {
+                std::lock_guard<std::mutex> lock(results_mutex);
+                latencies.push_back(reply.latency_ns / 1e6);
+            }
+            record_bytes(client, accounted);
+            
+            if (think_time) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(interval_dist(rng)));
+            }
+        }
+        
+        record_client(client);
+        active_connections--;
+    }
+    
+    void quic_client_worker(int client_id) {
+        ClientLoop loop;
+        Client client(loop, worker_client_options(ClientProtocol::Quic, client_id, quic_port, QUIC_GIVE_UP_NS,
+                                                  QUIC_FIXED_RTO_NS));
+        if (!loop.ok() || !client.open()) return;
         
         connections++;
         active_connections++;
@@ -434,40 +5533,30 @@ private:
             expected = peak_connections;
         }
         
+        // The SDK's "[id:attempt]" tag leads the text
+        std::string payload = " QUIC Client " + std::to_string(client_id) + " Message";
+        if (quic_payload > payload.size()) payload.resize(std::min(quic_payload, client.max_payload()), 'x');
+        ClientReply reply;
+        uint64_t accounted = 0;
+        
         while (!stop_test) {
-            // Create QUIC packet with connection ID header
-            char message[BUFFER_SIZE];
-            memcpy(message, &connection_id, sizeof(uint32_t));
-            snprintf(message + sizeof(uint32_t), BUFFER_SIZE - sizeof(uint32_t), "QUIC Client %d Message", client_id);
-            
-            auto start = std::chrono::high_resolution_clock::now();
-            
-            ssize_t sent = sendto(sock, message, sizeof(uint32_t) + strlen(message + sizeof(uint32_t)), 0,
-                                (struct sockaddr*)&server_addr, sizeof(server_addr));
-            if (sent > 0) {
-                char response[BUFFER_SIZE];
-                socklen_t addr_len = sizeof(server_addr);
-                ssize_t received = recvfrom(sock, response, BUFFER_SIZE, 0,
-                                          (struct sockaddr*)&server_addr, &addr_len);
-                if (received > 0) {
-                    auto end = std::chrono::high_resolution_clock::now();
-                    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
-                    
-                    {
-                        std::lock_guard<std::mutex> lock(results_mutex);
-                        latencies.push_back(duration.count() / 1000.0);  // Convert to milliseconds
-                        total_bytes += sent + received;
-                    }
-                }
+            if (!worker_request(loop, client, payload, reply)) break;
+            record_datagram_reply(reply);
+            if (reply.status == ClientStatus::Ok) {
+                std::lock_guard<std::mutex> lock(results_mutex);
+                latencies.push_back(reply.latency_ns / 1e6);
             }
+            record_bytes(client, accounted);
             
             // Random interval between QUIC messages (10-80 ms)
-            std::uniform_int_distribution<int> dist(10, 80);
-            std::this_thread::sleep_for(std::chrono::milliseconds(dist(rng)));
+            if (think_time) {
+                std::uniform_int_distribution<int> dist(10, 80);
+                std::this_thread::sleep_for(std::chrono::milliseconds(dist(rng)));
+            }
         }
         
+        record_client(client);
         active_connections--;
-        close(sock);
     }
     
     std::vector<double> calculate_all_percentiles(const std::vector<double>& data) {
@@ -491,6 +5580,15 @@ private:
         return percentiles;
     }
     
+    // Nearest-rank percentile of already sorted data, same rank rule as above
+    static double percentile_of(const std::vector<double>& sorted_data, double fraction) {
+        if (sorted_data.empty()) return 0.0;
+        size_t index = (size_t)(sorted_data.size() * fraction);
+        if (index > 0) index--;
+        if (index >= sorted_data.size()) index = sorted_data.size() - 1;
+        return sorted_data[index];
+    }
+
     std::string get_timestamp() {
         auto now = std::chrono::system_clock::now();
         auto time_t = std::chrono::system_clock::to_time_t(now);
@@ -506,29 +5604,6 @@ private:
     void log_result(const ScalabilityResult& result) {
         if (!log_file.is_open()) return;
         
-        // Determine protocol from context
-        std::string protocol = "TCP";  // Default to TCP
-        static bool tcp_done = false;
-        static bool udp_done = false;
-        static int tcp_tests_completed = 0;
-        static int udp_tests_completed = 0;
-        
-        if (!tcp_done) {
-            protocol = "TCP";
-            tcp_tests_completed++;
-            if (tcp_tests_completed >= 5) {  // 5 TCP tests (10,20,50,100,200,500)
-                tcp_done = true;
-            }
-        } else if (!udp_done) {
-            protocol = "UDP";
-            udp_tests_completed++;
-            if (udp_tests_completed >= 5) {  // 5 UDP tests (10,20,50,100,200,500)
-                udp_done = true;
-            }
-        } else {
-            protocol = "QUIC";
-        }
-        
         // Print to console
         std::cout << "Clients: " << result.client_count 
                   << ", Throughput: " << std::fixed << std::setprecision(2) << result.throughput_mbps << " MB/s"
@@ -537,7 +5612,7 @@ private:
                   << ", P99: " << result.percentiles[98] << "ms" << std::endl;
         
         // Write to log file
-        log_file << protocol << "," << result.client_count << "," << result.timestamp << ","
+        log_file << result.protocol << "," << result.client_count << "," << result.timestamp << ","
                  << std::fixed << std::setprecision(6) << result.throughput_mbps << ","
                  << result.connections_per_second << "," << result.peak_concurrent_connections << ","
                  << result.success_rate << "," << result.total_requests << "," << result.successful_requests;
@@ -551,12 +5626,263 @@ private:
     }
 };
 
-int main() {
+void print_usage(const char* program) {
+    std::cerr << "Usage: " << program << " [scenario] [options]\n"
+              << "Scenarios:\n"
+              << "  scalability              TCP/UDP/QUIC client count sweep (default)\n"
+              << "  journal                  Latency cost of each journal durability policy\n"
+              << "  replay                   Server startup time when replaying 10M and 100M message journals\n"
+              << "  failover                 Replication lag to a hot standby and failover time after killing the primary\n"
+              << "  proxy                    Added latency and maximum throughput of the L4 proxy mode\n"
+              << "  gateway                  Latency and backend footprint of the multiplexing gateway\n"
+              << "  logbuffer                Throughput and P99.99 of the log-buffer UDP transport against TCP\n"
+              << "  session                  Resync time and replay throughput of the session layer under injected disconnects\n"
+              << "  compression              Wire bytes, codec CPU and latency of LZ feed compression per level, TCP and UDP\n"
+              << "  packing                  Datagrams, syscalls and latency of MTU-packed UDP/QUIC messages against one per datagram\n"
+              << "  quotes                   Wire bytes, codec cost and latency of fixed against delta quote fan-out\n"
+              << "  websocket                WebSocket unmask cost, TCP against WebSocket echo, and broadcast feed fan-out\n"
+              << "  fix                      FIX 4.4 parse cost per delimiter scan, and order entry rate and latency against --fix\n"
+              << "  balance                  P99 of round-robin, least-outstanding and p2c balancing with one replica slowed\n"
+              << "  hedge                    Tail latency of hedged TCP/UDP/QUIC requests over two stalling replicas, against the extra load\n"
+              << "  dedupe                   Copies of retransmitted/hedged UDP requests the server reprocesses, without and with its idempotency cache\n"
+              << "  sdk                      Async client SDK (pooled, pipelined) against the blocking TCP/UDP/QUIC workers, and through a restart and loss\n"
+              << "  script                   Thousands of scripted FIX trader sessions (C++20 coroutines) per client thread against --fix\n"
+              << "  handlers                 TCP echo throughput, latency and server CPU of callback against coroutine (pooled frame) handlers\n"
+              << "  txqueue                  Replies the server drops or delays when its UDP/QUIC sockets fill, with and without transmit queues\n"
+              << "  rto                      Loss recovery latency of UDP/QUIC clients with fixed timeouts against the adaptive RTO\n"
+              << "  shards                   Consistent-hash routing over M server processes: throughput scaling and rebalance disruption\n"
+              << "  tickstore                Write rate of the columnar tick store, and sendfile against copy query latency\n"
+              << "  analytics                Ingest cost of the VWAP/OHLC bar stage per update, and bar publish latency\n"
+              << "  quic-crypto              Per-packet AES-128-GCM cost and throughput of protected QUIC against plain\n"
+              << "  pipeline                 Per-hop and end-to-end latency: client -> gateway -> matching -> publisher -> subscribers\n"
+              << "Options:\n"
+              << "  --server=PATH            Server binary for spawned servers (default ./build/server)\n"
+              << "  --port-base=N            Base port for spawned servers (default 9000)\n"
+              << "  --clients=N              Client count for single-point scenarios (default 100)\n"
+              << "  --duration=SEC           Measurement time per test (default " << TEST_DURATION_SEC << ")\n"
+              << "  --journal=PATH           Journal file used by the journal and replay scenarios\n"
+              << "  --shards=N[,N...]        Cluster sizes for the shards scenario (default 1,2,4,8)\n"
+              << "  --replicas=N             Equivalent servers for the balance scenario (default 3)\n"
+              << "  --service-us=N           Service time of each balance replica (default 50)\n"
+              << "  --slow-service-us=N      Service time of the slowed balance replica (default 1000)\n"
+              << "  --stall-every=N          Hedge and dedupe scenarios: servers stall every Nth request (default 100)\n"
+              << "  --stall-us=N             Hedge and dedupe scenarios: length of those stalls (default 2000)\n"
+              << "  --drop-every=N           RTO and dedupe scenarios: the server ignores every Nth datagram (default 100)\n"
+              << "  --sdk-connections=N      SDK scenario: connections or sockets in the client pool (default 4)\n"
+              << "  --sdk-pipeline=N         SDK scenario: requests in flight per connection (default 16)\n"
+              << "  --script-sessions=N      Script scenario: scripted FIX traders (default 2000)\n"
+              << "  --script-threads=N       Script scenario: client threads the traders are split over (default 1)\n"
+              << "  --script-orders=N        Script scenario: orders each trader sends, half of them cancelled (default 20)\n"
+              << "  --script-order-rate=N    Script scenario: orders per second per trader (default 20)\n"
+              << "  --tx-saturate-every=N    Txqueue scenario: the server's socket acts full on every Nth reply (default 100)\n"
+              << "  --tx-queue=N             Txqueue scenario: queue size the two drop policies are compared at (default 2)\n"
+              << "  --vnodes=N               Virtual nodes per shard on the consistent-hash ring (default 128)\n"
+              << "  --tick-dir=PATH          Tick store directory for the tickstore scenario, removed afterwards (default /tmp/nettest-ticks)\n"
+              << "  --tick-rows=N            Rows the tickstore scenario writes offline (default 200000000)\n"
+              << "  --messages=N[,N...]      Journal sizes for the replay scenario\n"
+              << "  --upstream-connections=N Gateway-to-backend connections for the gateway scenario (default 4)\n"
+              << "  --subscribers=N          Market data subscribers for the pipeline, quotes and websocket scenarios (default 4)\n"
+              << "  --streams=N              Concurrent streams for the logbuffer and packing scenarios, FIX, shard and balance clients (default 1)\n"
+              << "  --rate=N                 Messages per second over all logbuffer/session/packing streams, quotes, the WebSocket feed and analytics trades (default 1000000)\n"
+              << "  --disconnect-every-ms=N  Session scenario: time between injected disconnects (default 1000)\n"
+              << "  --outage-ms=N            Session scenario: how long the link stalls before each reset (default 50)\n"
+              << "  --levels=N[,N...]        Compression levels swept by the compression scenario (default 1,3,6,9)\n"
+              << "  --dictionary=PATH        Where the compression scenario writes its trained dictionary\n"
+              << "  --dictionary-size=N      Trained dictionary size in bytes (default 4096)\n"
+              << "  --refresh-every=N        Quotes scenario: full refresh per symbol every N updates (default 256)\n"
+              << "  --pack-mtu=N             Packing scenario: datagram size limit (default " << PACK_DEFAULT_MTU << ")\n"
+              << "  --pack-deadlines=N[,N...] Packing scenario: flush deadlines swept, in us (default 20,100,500)\n"
+              << "  --ws-port=N              Scalability sweep: also run WebSocket clients against the server's --ws-port\n";
+}
+
+bool parse_args(int argc, char* argv[], TesterOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.compare(0, 2, "--") != 0) {
+            options.scenario = arg;
+            continue;
+        }
+
+        size_t eq = arg.find('=');
+        std::string key = arg.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+        if (key == "--help") {
+            return false;
+        } else if (key == "--server") {
+            options.server_binary = value;
+        } else if (key == "--port-base") {
+            options.port_base = atoi(value.c_str());
+        } else if (key == "--clients") {
+            options.clients = atoi(value.c_str());
+        } else if (key == "--duration") {
+            options.duration_sec = atoi(value.c_str());
+        } else if (key == "--journal") {
+            options.journal_path = value;
+        } else if (key == "--shards") {
+            options.shard_counts.clear();
+            std::stringstream list(value);
+            std::string item;
+            while (std::getline(list, item, ',')) {
+                if (atoi(item.c_str()) > 0) options.shard_counts.push_back(atoi(item.c_str()));
+            }
+            if (options.shard_counts.empty()) {
+                std::cerr << "--shards needs at least one positive count" << std::endl;
+                return false;
+            }
+        } else if (key == "--replicas") {
+            options.replicas = std::max(2, atoi(value.c_str()));
+        } else if (key == "--service-us") {
+            options.service_us = atoi(value.c_str());
+        } else if (key == "--slow-service-us") {
+            options.slow_service_us = atoi(value.c_str());
+        } else if (key == "--stall-every") {
+            options.stall_every = atoi(value.c_str());
+        } else if (key == "--stall-us") {
+            options.stall_us = atoi(value.c_str());
+        } else if (key == "--drop-every") {
+            options.drop_every = atoi(value.c_str());
+        } else if (key == "--sdk-connections") {
+            options.sdk_connections = std::max(1, atoi(value.c_str()));
+        } else if (key == "--sdk-pipeline") {
+            options.sdk_pipeline = std::max(1, atoi(value.c_str()));
+        } else if (key == "--script-sessions") {
+            options.script_sessions = std::max(1, atoi(value.c_str()));
+        } else if (key == "--script-threads") {
+            options.script_threads = std::max(1, atoi(value.c_str()));
+        } else if (key == "--script-orders") {
+            options.script_orders = std::max(0, atoi(value.c_str()));
+        } else if (key == "--script-order-rate") {
+            options.script_order_rate = std::max(1, atoi(value.c_str()));
+        } else if (key == "--tx-saturate-every") {
+            options.tx_saturate_every = atoi(value.c_str());
+        } else if (key == "--tx-queue") {
+            options.tx_queue = atoi(value.c_str());
+        } else if (key == "--vnodes") {
+            options.vnodes = std::max(1, atoi(value.c_str()));
+        } else if (key == "--tick-dir") {
+            options.tick_dir = value;
+        } else if (key == "--tick-rows") {
+            options.tick_rows = strtoull(value.c_str(), nullptr, 10);
+        } else if (key == "--messages") {
+            options.replay_messages.clear();
+            std::stringstream list(value);
+            std::string item;
+            while (std::getline(list, item, ',')) {
+                options.replay_messages.push_back(strtoull(item.c_str(), nullptr, 10));
+            }
+        } else if (key == "--upstream-connections") {
+            options.upstream_connections = atoi(value.c_str());
+        } else if (key == "--subscribers") {
+            options.subscribers = atoi(value.c_str());
+        } else if (key == "--streams") {
+            options.streams = atoi(value.c_str());
+        } else if (key == "--rate") {
+            options.message_rate = strtoull(value.c_str(), nullptr, 10);
+        } else if (key == "--disconnect-every-ms") {
+            options.disconnect_every_ms = atoi(value.c_str());
+        } else if (key == "--outage-ms") {
+            options.outage_ms = atoi(value.c_str());
+        } else if (key == "--levels") {
+            options.compression_levels.clear();
+            std::stringstream list(value);
+            std::string item;
+            while (std::getline(list, item, ',')) {
+                options.compression_levels.push_back(atoi(item.c_str()));
+            }
+        } else if (key == "--dictionary") {
+            options.dictionary_path = value;
+        } else if (key == "--dictionary-size") {
+            options.dictionary_size = strtoull(value.c_str(), nullptr, 10);
+        } else if (key == "--refresh-every") {
+            options.refresh_every = atoi(value.c_str());
+        } else if (key == "--pack-mtu") {
+            options.pack_mtu = strtoull(value.c_str(), nullptr, 10);
+        } else if (key == "--ws-port") {
+            options.ws_port = atoi(value.c_str());
+        } else if (key == "--pack-deadlines") {
+            options.pack_deadlines_us.clear();
+            std::stringstream list(value);
+            std::string item;
+            while (std::getline(list, item, ',')) {
+                options.pack_deadlines_us.push_back(atoi(item.c_str()));
+            }
+        } else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    TesterOptions options;
+    if (!parse_args(argc, argv, options)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
     std::cout << "Network Scalability Testing Framework" << std::endl;
     std::cout << "=====================================" << std::endl;
     
-    ScalabilityTester tester;
-    tester.run_scalability_tests();
+    ScalabilityTester tester(options);
+    if (options.scenario == "scalability") {
+        tester.run_scalability_tests();
+    } else if (options.scenario == "journal") {
+        tester.run_journal_tests();
+    } else if (options.scenario == "replay") {
+        tester.run_replay_tests();
+    } else if (options.scenario == "failover") {
+        tester.run_failover_tests();
+    } else if (options.scenario == "proxy") {
+        tester.run_proxy_tests();
+    } else if (options.scenario == "gateway") {
+        tester.run_gateway_tests();
+    } else if (options.scenario == "pipeline") {
+        tester.run_pipeline_tests();
+    } else if (options.scenario == "logbuffer") {
+        tester.run_logbuffer_tests();
+    } else if (options.scenario == "session") {
+        tester.run_session_tests();
+    } else if (options.scenario == "compression") {
+        tester.run_compression_tests();
+    } else if (options.scenario == "packing") {
+        tester.run_packing_tests();
+    } else if (options.scenario == "quotes") {
+        tester.run_quote_tests();
+    } else if (options.scenario == "websocket") {
+        tester.run_websocket_tests();
+    } else if (options.scenario == "balance") {
+        tester.run_balance_tests();
+    } else if (options.scenario == "hedge") {
+        tester.run_hedge_tests();
+    } else if (options.scenario == "dedupe") {
+        tester.run_dedupe_tests();
+    } else if (options.scenario == "sdk") {
+        tester.run_sdk_tests();
+    } else if (options.scenario == "script") {
+        tester.run_script_tests();
+    } else if (options.scenario == "handlers") {
+        tester.run_handler_tests();
+    } else if (options.scenario == "txqueue") {
+        tester.run_txqueue_tests();
+    } else if (options.scenario == "rto") {
+        tester.run_rto_tests();
+    } else if (options.scenario == "shards") {
+        tester.run_shard_tests();
+    } else if (options.scenario == "tickstore") {
+        tester.run_tickstore_tests();
+    } else if (options.scenario == "analytics") {
+        tester.run_analytics_tests();
+    } else if (options.scenario == "fix") {
+        tester.run_fix_tests();
+    } else if (options.scenario == "quic-crypto") {
+        tester.run_quic_crypto_tests();
+    } else {
+        std::cerr << "Unknown scenario: " << options.scenario << std::endl;
+        print_usage(argv[0]);
+        return 1;
+    }
     
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,439 @@
+#pragma once
+
+// Columnar tick store: one partition per symbol and UTC day, each a set of
+// memory-mapped column files (timestamps, prices, sizes) plus a sparse time
+// index holding the first timestamp of every TICK_INDEX_STRIDE rows.
+//
+//   DIR/YYYYMMDD/<symbol>.ts   int64 wall-clock ns, non-decreasing
+//   DIR/YYYYMMDD/<symbol>.px   int64 price, 4 decimal places as in MarketMessage
+//   DIR/YYYYMMDD/<symbol>.sz   uint32 size
+//   DIR/YYYYMMDD/<symbol>.idx  TickIndexHeader page, then int64 per stride
+//
+// Files grow by doubling (fallocate, then mremap) and their descriptors are
+// closed once mapped, so thousands of partitions cost mappings, not fds. A
+// day is synced and unmapped once appends roll past it. A time-range query
+// finds its rows through the index and one block of the timestamp column,
+// and returns them as byte ranges of each column file for the caller to send
+// as they are (sendfile).
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+const uint64_t TICK_STORE_MAGIC = 0x314B43495454454EULL;  // "NETTICK1"
+const uint32_t TICK_STORE_VERSION = 1;
+const uint32_t TICK_QUERY_MAGIC = 0x3151544B;             // "KTQ1"
+const size_t TICK_INDEX_HEADER_SIZE = 4096;
+const size_t TICK_INDEX_STRIDE = 1024;                    // Rows per index entry
+const size_t TICK_INITIAL_ROWS = 4096;
+const size_t TICK_MAX_OPEN_PARTITIONS = 4096;             // Past days kept mapped for queries
+const int64_t TICK_NS_PER_DAY = 86400LL * 1000000000LL;
+
+enum TickColumn { TICK_TIMESTAMPS, TICK_PRICES, TICK_SIZES, TICK_COLUMNS };
+
+const char* const TICK_COLUMN_SUFFIX[TICK_COLUMNS] = {".ts", ".px", ".sz"};
+const size_t TICK_COLUMN_WIDTH[TICK_COLUMNS] = {sizeof(int64_t), sizeof(int64_t), sizeof(uint32_t)};
+
+struct TickIndexHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint16_t symbol;
+    uint16_t reserved;
+    uint32_t day;             // Days since the epoch, UTC
+    uint32_t reserved2;
+    uint64_t rows;            // Rows written; bumped after the row is in place
+    uint64_t capacity;        // Rows the column files hold
+};
+
+// Request on the query port: rows of `symbol` with from_ns <= timestamp < to_ns
+struct TickQuery {
+    uint32_t magic;           // TICK_QUERY_MAGIC
+    uint16_t symbol;
+    uint16_t reserved;
+    int64_t from_ns;
+    int64_t to_ns;
+};
+
+// Reply: one segment per day with rows, each followed by `rows` timestamps,
+// `rows` prices and `rows` sizes; a segment with zero rows ends the reply.
+struct TickSegment {
+    uint32_t magic;           // TICK_QUERY_MAGIC
+    uint32_t day;
+    uint64_t rows;
+};
+
+inline int64_t tick_wall_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+inline std::string tick_day_name(uint32_t day) {
+    time_t seconds = (time_t)day * 86400;
+    struct tm date;
+    gmtime_r(&seconds, &date);
+    char name[16];
+    strftime(name, sizeof(name), "%Y%m%d", &date);
+    return name;
+}
+
+// One symbol-day. Owned by the reactor thread, like the journal.
+class TickPartition {
+private:
+    std::string prefix;       // DIR/YYYYMMDD/<symbol>
+    char* columns[TICK_COLUMNS];
+    char* index;
+    TickIndexHeader* header;
+    int64_t last_ns;
+
+    static char* map_file(const std::string& path, size_t size) {
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd == -1) {
+            perror(("tick store open " + path).c_str());
+            return nullptr;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && (size_t)st.st_size < size) {
+            // Reserve the blocks up front so appends never hit ENOSPC via SIGBUS
+            int err = posix_fallocate(fd, 0, size);
+            if (err != 0) {
+                fprintf(stderr, "tick store fallocate %s: %s\n", path.c_str(), strerror(err));
+                ::close(fd);
+                return nullptr;
+            }
+        }
+        void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            perror("tick store mmap");
+            return nullptr;
+        }
+        return static_cast<char*>(mapping);
+    }
+
+    static size_t index_size(size_t capacity) {
+        return TICK_INDEX_HEADER_SIZE + capacity / TICK_INDEX_STRIDE * sizeof(int64_t);
+    }
+
+    static bool grow_file(const std::string& path, char*& mapping, size_t old_size, size_t new_size) {
+        int fd = ::open(path.c_str(), O_RDWR);
+        if (fd == -1) {
+            perror(("tick store open " + path).c_str());
+            return false;
+        }
+        int err = posix_fallocate(fd, 0, new_size);
+        ::close(fd);
+        if (err != 0) {
+            fprintf(stderr, "tick store fallocate %s: %s\n", path.c_str(), strerror(err));
+            return false;
+        }
+        void* moved = mremap(mapping, old_size, new_size, MREMAP_MAYMOVE);
+        if (moved == MAP_FAILED) {
+            perror("tick store mremap");
+            return false;
+        }
+        mapping = static_cast<char*>(moved);
+        return true;
+    }
+
+    bool grow() {
+        size_t capacity = header->capacity;
+        size_t doubled = capacity * 2;
+        for (int column = 0; column < TICK_COLUMNS; column++) {
+            if (!grow_file(path(column), columns[column], capacity * TICK_COLUMN_WIDTH[column],
+                           doubled * TICK_COLUMN_WIDTH[column])) {
+                return false;
+            }
+        }
+        if (!grow_file(prefix + ".idx", index, index_size(capacity), index_size(doubled))) {
+            return false;
+        }
+        header = reinterpret_cast<TickIndexHeader*>(index);
+        header->capacity = doubled;
+        return true;
+    }
+
+    const int64_t* timestamps() const {
+        return reinterpret_cast<const int64_t*>(columns[TICK_TIMESTAMPS]);
+    }
+
+    const int64_t* index_entries() const {
+        return reinterpret_cast<const int64_t*>(index + TICK_INDEX_HEADER_SIZE);
+    }
+
+public:
+    TickPartition() : columns{nullptr, nullptr, nullptr}, index(nullptr), header(nullptr), last_ns(0) {}
+
+    ~TickPartition() {
+        if (!header) return;
+        size_t capacity = header->capacity;
+        for (int column = 0; column < TICK_COLUMNS; column++) {
+            if (columns[column]) munmap(columns[column], capacity * TICK_COLUMN_WIDTH[column]);
+        }
+        munmap(index, index_size(capacity));
+    }
+
+    // Maps an existing partition, or creates one when `create` is set.
+    // Returns false without a message when it does not exist and !create.
+    bool open(const std::string& day_dir, uint16_t symbol, uint32_t day, bool create) {
+        prefix = day_dir + "/" + std::to_string(symbol);
+        struct stat st;
+        bool existing = stat((prefix + ".idx").c_str(), &st) == 0 && (size_t)st.st_size >= TICK_INDEX_HEADER_SIZE;
+        if (!existing && !create) return false;
+
+        size_t capacity = TICK_INITIAL_ROWS;
+        if (existing) {
+            int fd = ::open((prefix + ".idx").c_str(), O_RDONLY);
+            TickIndexHeader stored;
+            bool read_ok = fd != -1 && pread(fd, &stored, sizeof(stored), 0) == (ssize_t)sizeof(stored);
+            if (fd != -1) ::close(fd);
+            if (!read_ok || stored.magic != TICK_STORE_MAGIC || stored.version != TICK_STORE_VERSION) {
+                fprintf(stderr, "tick store %s: bad magic or version\n", prefix.c_str());
+                return false;
+            }
+            capacity = stored.capacity;
+        }
+
+        index = map_file(prefix + ".idx", index_size(capacity));
+        if (!index) return false;
+        header = reinterpret_cast<TickIndexHeader*>(index);
+        if (!existing) {
+            header->magic = TICK_STORE_MAGIC;
+            header->version = TICK_STORE_VERSION;
+            header->symbol = symbol;
+            header->reserved = 0;
+            header->day = day;
+            header->reserved2 = 0;
+            header->rows = 0;
+            header->capacity = capacity;
+        }
+        for (int column = 0; column < TICK_COLUMNS; column++) {
+            columns[column] = map_file(path(column), capacity * TICK_COLUMN_WIDTH[column]);
+            if (!columns[column]) return false;
+        }
+        if (header->rows > 0) last_ns = timestamps()[header->rows - 1];
+        return true;
+    }
+
+    // Appends one row. Timestamps are clamped so the column stays sorted
+    // when the wall clock steps back. Returns false when the files cannot grow.
+    bool append(int64_t timestamp_ns, int64_t price, uint32_t size) {
+        uint64_t row = header->rows;
+        if (row == header->capacity && !grow()) return false;
+        if (timestamp_ns < last_ns) timestamp_ns = last_ns;
+        last_ns = timestamp_ns;
+
+        reinterpret_cast<int64_t*>(columns[TICK_TIMESTAMPS])[row] = timestamp_ns;
+        reinterpret_cast<int64_t*>(columns[TICK_PRICES])[row] = price;
+        reinterpret_cast<uint32_t*>(columns[TICK_SIZES])[row] = size;
+        if (row % TICK_INDEX_STRIDE == 0) {
+            reinterpret_cast<int64_t*>(index + TICK_INDEX_HEADER_SIZE)[row / TICK_INDEX_STRIDE] = timestamp_ns;
+        }
+        __atomic_store_n(&header->rows, row + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    uint64_t rows() const {
+        return header->rows;
+    }
+
+    // Flushes the written rows and the index to stable storage
+    bool sync() const {
+        size_t rows = header->rows;
+        for (int column = 0; column < TICK_COLUMNS; column++) {
+            size_t length = (rows * TICK_COLUMN_WIDTH[column] + 4095) & ~(size_t)4095;
+            if (length && msync(columns[column], length, MS_SYNC) == -1) {
+                perror("tick store msync");
+                return false;
+            }
+        }
+        return msync(index, index_size(header->capacity), MS_SYNC) == 0;
+    }
+
+    uint32_t day() const {
+        return header->day;
+    }
+
+    std::string path(int column) const {
+        return prefix + TICK_COLUMN_SUFFIX[column];
+    }
+
+    // First row with timestamp >= ns: the index narrows it to one block,
+    // which is the only part of the timestamp column touched
+    uint64_t lower_bound(int64_t ns) const {
+        uint64_t rows = header->rows;
+        uint64_t blocks = (rows + TICK_INDEX_STRIDE - 1) / TICK_INDEX_STRIDE;
+        const int64_t* entries = index_entries();
+        uint64_t block = std::lower_bound(entries, entries + blocks, ns) - entries;
+        if (block == 0) return 0;
+        uint64_t begin = (block - 1) * TICK_INDEX_STRIDE;
+        uint64_t end = std::min<uint64_t>(rows, block * TICK_INDEX_STRIDE);
+        return std::lower_bound(timestamps() + begin, timestamps() + end, ns) - timestamps();
+    }
+
+    // Rows [first, first + count) with from_ns <= timestamp < to_ns
+    void range(int64_t from_ns, int64_t to_ns, uint64_t& first, uint64_t& count) const {
+        first = lower_bound(from_ns);
+        uint64_t last = to_ns > from_ns ? lower_bound(to_ns) : first;
+        count = last - first;
+    }
+};
+
+class TickStore {
+private:
+    std::string dir;
+    std::map<uint64_t, std::unique_ptr<TickPartition>> partitions;  // (symbol << 32) | day
+    std::vector<TickPartition*> current;                            // Per symbol, the day last appended to
+    std::set<uint32_t> days;                                        // Day directories present
+    bool full_reported;
+
+    static uint64_t key(uint16_t symbol, uint32_t day) {
+        return ((uint64_t)symbol << 32) | day;
+    }
+
+    std::string day_dir(uint32_t day) const {
+        return dir + "/" + tick_day_name(day);
+    }
+
+    TickPartition* partition(uint16_t symbol, uint32_t day, bool create) {
+        auto found = partitions.find(key(symbol, day));
+        if (found != partitions.end()) return found->second.get();
+        if (create && !days.count(day)) {
+            if (mkdir(day_dir(day).c_str(), 0755) == -1 && errno != EEXIST) {
+                perror(("tick store mkdir " + day_dir(day)).c_str());
+                return nullptr;
+            }
+            days.insert(day);
+        }
+        std::unique_ptr<TickPartition> opened(new TickPartition());
+        if (!opened->open(day_dir(day), symbol, day, create)) return nullptr;
+        TickPartition* result = opened.get();
+        partitions[key(symbol, day)] = std::move(opened);
+        return result;
+    }
+
+    // Syncs and unmaps a partition appends have moved past. Each one holds
+    // four mappings, so keeping every day open runs into vm.max_map_count.
+    void release(uint16_t symbol, uint32_t day) {
+        auto found = partitions.find(key(symbol, day));
+        if (found == partitions.end()) return;
+        found->second->sync();
+        partitions.erase(found);
+        partitions_closed++;
+    }
+
+    // Drops the partitions queries mapped once too many are open; the days
+    // being appended to stay. Callers hold no partition across this.
+    void trim() {
+        if (partitions.size() <= TICK_MAX_OPEN_PARTITIONS) return;
+        for (auto entry = partitions.begin(); entry != partitions.end();) {
+            if (current[entry->first >> 32] == entry->second.get()) {
+                ++entry;
+            } else {
+                entry = partitions.erase(entry);
+                partitions_closed++;
+            }
+        }
+    }
+
+public:
+    uint64_t rows_written = 0;
+    uint64_t partitions_opened = 0;   // By appends: new days and first use after a restart
+    uint64_t partition_open_ns = 0;   // Filesystem work dominates, ~0.1-1ms each
+    uint64_t partitions_closed = 0;   // Rolled-over days and query mappings trimmed
+
+    TickStore() : current(65536, nullptr), full_reported(false) {}
+
+    // Creates the directory if needed and notes the days already in it;
+    // their partitions are mapped on first use
+    bool open(const std::string& path) {
+        dir = path;
+        if (mkdir(dir.c_str(), 0755) == -1 && errno != EEXIST) {
+            perror(("tick store mkdir " + dir).c_str());
+            return false;
+        }
+        DIR* listing = opendir(dir.c_str());
+        if (!listing) {
+            perror(("tick store opendir " + dir).c_str());
+            return false;
+        }
+        while (struct dirent* entry = readdir(listing)) {
+            struct tm date;
+            memset(&date, 0, sizeof(date));
+            const char* end = strptime(entry->d_name, "%Y%m%d", &date);
+            if (!end || *end != '\0') continue;
+            days.insert((uint32_t)(timegm(&date) / 86400));
+        }
+        closedir(listing);
+        return true;
+    }
+
+    bool append(uint16_t symbol, int64_t timestamp_ns, int64_t price, uint32_t size) {
+        uint32_t day = (uint32_t)(timestamp_ns / TICK_NS_PER_DAY);
+        TickPartition* target = current[symbol];
+        if (!target || target->day() != day) {
+            if (target) {
+                current[symbol] = nullptr;
+                release(symbol, target->day());
+            }
+            auto start = std::chrono::steady_clock::now();
+            target = partition(symbol, day, true);
+            partition_open_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            partitions_opened++;
+            if (!target) return false;
+            current[symbol] = target;
+        }
+        if (!target->append(timestamp_ns, price, size)) {
+            if (!full_reported) {
+                fprintf(stderr, "Tick store cannot grow after %llu rows - storing stopped\n",
+                        (unsigned long long)rows_written);
+                full_reported = true;
+            }
+            return false;
+        }
+        rows_written++;
+        return true;
+    }
+
+    // Partitions of `symbol` holding rows in [from_ns, to_ns), in day order
+    std::vector<const TickPartition*> partitions_in(uint16_t symbol, int64_t from_ns, int64_t to_ns) {
+        std::vector<const TickPartition*> found;
+        if (to_ns <= from_ns) return found;
+        trim();
+        uint32_t first_day = (uint32_t)(std::max<int64_t>(0, from_ns) / TICK_NS_PER_DAY);
+        uint32_t last_day = (uint32_t)((to_ns - 1) / TICK_NS_PER_DAY);
+        for (auto day = days.lower_bound(first_day); day != days.end() && *day <= last_day; ++day) {
+            TickPartition* p = partition(symbol, *day, false);
+            if (p) found.push_back(p);
+        }
+        return found;
+    }
+
+    bool sync() const {
+        for (const auto& entry : partitions) {
+            if (!entry.second->sync()) return false;
+        }
+        return true;
+    }
+
+    size_t partition_count() const {
+        return partitions.size();
+    }
+};
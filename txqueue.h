@@ -0,0 +1,167 @@
+#pragma once
+
+// Bounded transmit queue for a non-blocking datagram socket. A reply the
+// socket refuses (EAGAIN, ENOBUFS) is kept instead of dropped, and so is
+// every reply after it until the queue drains, so replies leave in order.
+// The owner waits for EPOLLOUT while the queue is non-empty (wants_out())
+// and calls flush() when it fires.
+//
+// Past capacity the drop policy picks the victim: Newest drops the arriving
+// reply (tail drop), Oldest evicts the head to make room. Under Oldest the
+// replies that go out are the freshest, whose clients are still waiting;
+// the head's client has waited longest and has likely retransmitted.
+//
+// Slots are a ring and keep their buffers, so once every slot has been used
+// queueing does not allocate. A backlog is the time from the first queued
+// reply to the queue draining; its count, total and longest are kept.
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+const size_t TX_QUEUE_DEFAULT = 1024;   // Replies per socket
+const int TX_FLUSH_BATCH = 64;          // Datagrams per sendmmsg when draining
+
+enum class TxDropPolicy { Newest, Oldest };
+
+class DatagramTxQueue {
+private:
+    struct Slot {
+        struct sockaddr_in addr;
+        std::string data;
+    };
+
+    std::vector<Slot> slots;
+    size_t head = 0;
+    size_t depth = 0;
+    TxDropPolicy policy = TxDropPolicy::Oldest;
+    bool blocked = false;          // The socket refused a send; wait for EPOLLOUT
+    uint64_t backlog_start_ns = 0;
+
+    static bool socket_full(int error) {
+        return error == EAGAIN || error == EWOULDBLOCK || error == ENOBUFS;
+    }
+
+    // Returns false if the drop policy turned this reply away
+    bool push(const struct sockaddr_in& addr, const char* data, size_t length, uint64_t now_ns) {
+        if (depth == slots.size()) {
+            dropped++;
+            if (policy == TxDropPolicy::Newest || slots.empty()) return false;
+            head = (head + 1) % slots.size();
+            depth--;
+        }
+        if (depth == 0) {
+            backlog_start_ns = now_ns;
+            backlogs++;
+        }
+        Slot& slot = slots[(head + depth) % slots.size()];
+        slot.addr = addr;
+        slot.data.assign(data, length);
+        depth++;
+        queued++;
+        max_depth = std::max<uint64_t>(max_depth, depth);
+        return true;
+    }
+
+    void pop(size_t count, uint64_t now_ns) {
+        head = (head + count) % slots.size();
+        depth -= count;
+        if (depth == 0) {
+            uint64_t backlog = now_ns - backlog_start_ns;
+            backlog_ns += backlog;
+            longest_backlog_ns = std::max(longest_backlog_ns, backlog);
+        }
+    }
+
+public:
+    uint64_t sent = 0;                 // Datagrams the socket took, directly or from the queue
+    uint64_t queued = 0;
+    uint64_t dropped = 0;              // By the drop policy
+    uint64_t send_errors = 0;          // Refused for good (not a full socket) and discarded
+    uint64_t max_depth = 0;
+    uint64_t backlogs = 0;
+    uint64_t backlog_ns = 0;
+    uint64_t longest_backlog_ns = 0;
+    bool out_armed = false;            // Owner's EPOLLOUT registration
+
+    void configure(size_t capacity, TxDropPolicy drop_policy) {
+        slots.assign(capacity, Slot());
+        head = 0;
+        depth = 0;
+        policy = drop_policy;
+    }
+
+    // True while sends must wait for EPOLLOUT
+    bool wants_out() const {
+        return blocked || depth > 0;
+    }
+
+    // Treat the socket as full until the next flush(), for synthetic
+    // saturation: loopback sockets never fill up
+    void block() {
+        blocked = true;
+    }
+
+    // Sends now if nothing is waiting and the socket takes it, else queues.
+    // Returns false if the reply was dropped.
+    bool send(int fd, const struct sockaddr_in& addr, const char* data, size_t length, uint64_t now_ns) {
+        if (!wants_out()) {
+            if (sendto(fd, data, length, 0, (const struct sockaddr*)&addr, sizeof(addr)) != -1) {
+                sent++;
+                return true;
+            }
+            if (!socket_full(errno)) {
+                perror("sendto");
+                send_errors++;
+                return false;
+            }
+            blocked = true;
+        }
+        return push(addr, data, length, now_ns);
+    }
+
+    // Sends queued replies, a batch per syscall, until the queue is empty or
+    // the socket is full again. Call on EPOLLOUT.
+    void flush(int fd, uint64_t now_ns) {
+        blocked = false;
+        struct mmsghdr headers[TX_FLUSH_BATCH];
+        struct iovec iovecs[TX_FLUSH_BATCH];
+        while (depth > 0) {
+            int batch = (int)std::min<size_t>(TX_FLUSH_BATCH, depth);
+            for (int i = 0; i < batch; i++) {
+                Slot& slot = slots[(head + i) % slots.size()];
+                iovecs[i].iov_base = &slot.data[0];
+                iovecs[i].iov_len = slot.data.size();
+                memset(&headers[i].msg_hdr, 0, sizeof(headers[i].msg_hdr));
+                headers[i].msg_hdr.msg_name = &slot.addr;
+                headers[i].msg_hdr.msg_namelen = sizeof(slot.addr);
+                headers[i].msg_hdr.msg_iov = &iovecs[i];
+                headers[i].msg_hdr.msg_iovlen = 1;
+            }
+            int n = sendmmsg(fd, headers, batch, 0);
+            if (n > 0) {
+                sent += n;
+                pop(n, now_ns);
+                continue;
+            }
+            if (errno == EINTR) continue;
+            if (socket_full(errno)) {
+                blocked = true;
+                return;
+            }
+            perror("sendmmsg");  // The head cannot be sent; discard it and go on
+            send_errors++;
+            pop(1, now_ns);
+        }
+    }
+
+    size_t size() const {
+        return depth;
+    }
+};
@@ -0,0 +1,307 @@
+#pragma once
+
+// WebSocket (RFC 6455) for the server's WebSocket port and the tester's
+// client: the HTTP Upgrade handshake, frame parsing and encoding, and
+// payload masking. Client frames are masked with a 4 byte key; the unmask
+// XORs 32 bytes at a time with AVX2 (16 with SSE2) and finishes the tail a
+// byte at a time. Server frames are unmasked, so one encoded frame can be
+// sent as is to any number of connections.
+
+#include <immintrin.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <string>
+
+const char WS_GUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+const size_t WS_MAX_HANDSHAKE = 8192;
+const uint64_t WS_MAX_PAYLOAD = 1024 * 1024;  // Per frame and per reassembled message
+const size_t WS_MAX_HEADER = 14;             // Longest frame header: 64 bit length and mask key
+const char WS_FEED_PATH[] = "/feed";
+
+enum WsOpcode : uint8_t {
+    WS_CONTINUATION = 0x0,
+    WS_TEXT = 0x1,
+    WS_BINARY = 0x2,
+    WS_CLOSE = 0x8,
+    WS_PING = 0x9,
+    WS_PONG = 0xA
+};
+
+enum class WsUnmask { Scalar, Sse2, Avx2 };
+
+enum class WsStatus {
+    Ok,
+    Incomplete,
+    Malformed
+};
+
+inline WsUnmask ws_best_unmask() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? WsUnmask::Avx2 : WsUnmask::Sse2;
+}
+
+// Returns false for an unknown name or one this CPU cannot run
+inline bool parse_ws_unmask(const std::string& name, WsUnmask& unmask) {
+    if (name == "scalar") {
+        unmask = WsUnmask::Scalar;
+    } else if (name == "sse2") {
+        unmask = WsUnmask::Sse2;
+    } else if (name == "avx2") {
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("avx2")) return false;
+        unmask = WsUnmask::Avx2;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+inline const char* ws_unmask_name(WsUnmask unmask) {
+    switch (unmask) {
+        case WsUnmask::Scalar: return "scalar";
+        case WsUnmask::Sse2: return "sse2";
+        case WsUnmask::Avx2: return "avx2";
+    }
+    return "?";
+}
+
+// SHA-1 of data, for Sec-WebSocket-Accept only
+inline void ws_sha1(const char* data, size_t length, uint8_t digest[20]) {
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    std::string message(data, length);
+    message.push_back((char)0x80);
+    while (message.size() % 64 != 56) message.push_back('\0');
+    uint64_t bits = (uint64_t)length * 8;
+    for (int i = 7; i >= 0; i--) message.push_back((char)(bits >> (i * 8)));
+
+    auto rotate = [](uint32_t value, int n) { return (value << n) | (value >> (32 - n)); };
+    for (size_t block = 0; block < message.size(); block += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; i++) {
+            const uint8_t* p = (const uint8_t*)&message[block + i * 4];
+            w[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+        }
+        for (int i = 16; i < 80; i++) w[i] = rotate(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; i++) {
+            uint32_t f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            uint32_t t = rotate(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rotate(b, 30);
+            b = a;
+            a = t;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+    for (int i = 0; i < 5; i++) {
+        for (int j = 0; j < 4; j++) digest[i * 4 + j] = (uint8_t)(h[i] >> (24 - j * 8));
+    }
+}
+
+inline std::string ws_base64(const uint8_t* data, size_t length) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    for (size_t i = 0; i < length; i += 3) {
+        uint32_t group = (uint32_t)data[i] << 16;
+        if (i + 1 < length) group |= (uint32_t)data[i + 1] << 8;
+        if (i + 2 < length) group |= data[i + 2];
+        out.push_back(alphabet[(group >> 18) & 63]);
+        out.push_back(alphabet[(group >> 12) & 63]);
+        out.push_back(i + 1 < length ? alphabet[(group >> 6) & 63] : '=');
+        out.push_back(i + 2 < length ? alphabet[group & 63] : '=');
+    }
+    return out;
+}
+
+// Sec-WebSocket-Accept for a client's Sec-WebSocket-Key
+inline std::string ws_accept_key(const std::string& key) {
+    std::string text = key + WS_GUID;
+    uint8_t digest[20];
+    ws_sha1(text.data(), text.size(), digest);
+    return ws_base64(digest, sizeof(digest));
+}
+
+// Value of an HTTP header (name matched case-insensitively), or empty
+inline std::string ws_header(const std::string& request, const char* name) {
+    size_t name_length = strlen(name);
+    size_t line = request.find("\r\n");
+    while (line != std::string::npos && line + 2 < request.size()) {
+        size_t start = line + 2;
+        size_t end = request.find("\r\n", start);
+        if (end == std::string::npos) break;
+        if (end - start > name_length && request[start + name_length] == ':' &&
+            strncasecmp(&request[start], name, name_length) == 0) {
+            size_t value = start + name_length + 1;
+            while (value < end && (request[value] == ' ' || request[value] == '\t')) value++;
+            size_t value_end = end;
+            while (value_end > value && (request[value_end - 1] == ' ' || request[value_end - 1] == '\t')) value_end--;
+            return request.substr(value, value_end - value);
+        }
+        line = end;
+    }
+    return std::string();
+}
+
+// Checks a complete request head (through the blank line) and fills in the
+// 101 response and the request path. Returns false if it is not a
+// WebSocket upgrade.
+inline bool ws_handshake(const std::string& request, std::string& response, std::string& path) {
+    if (request.compare(0, 4, "GET ") != 0) return false;
+    size_t path_end = request.find(' ', 4);
+    if (path_end == std::string::npos) return false;
+    path = request.substr(4, path_end - 4);
+
+    std::string upgrade = ws_header(request, "Upgrade");
+    std::string key = ws_header(request, "Sec-WebSocket-Key");
+    if (strcasecmp(upgrade.c_str(), "websocket") != 0 || key.empty()) return false;
+    response = "HTTP/1.1 101 Switching Protocols\r\n"
+               "Upgrade: websocket\r\n"
+               "Connection: Upgrade\r\n"
+               "Sec-WebSocket-Accept: " + ws_accept_key(key) + "\r\n\r\n";
+    return true;
+}
+
+inline void ws_mask_scalar(char* data, size_t length, const uint8_t key[4]) {
+    for (size_t i = 0; i < length; i++) data[i] ^= key[i & 3];
+}
+
+inline void ws_mask_sse2(char* data, size_t length, const uint8_t key[4]) {
+    uint32_t word;
+    memcpy(&word, key, sizeof(word));
+    __m128i mask = _mm_set1_epi32((int)word);
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(data + i));
+        _mm_storeu_si128((__m128i*)(data + i), _mm_xor_si128(block, mask));
+    }
+    for (; i < length; i++) data[i] ^= key[i & 3];
+}
+
+__attribute__((target("avx2")))
+inline void ws_mask_avx2(char* data, size_t length, const uint8_t key[4]) {
+    uint32_t word;
+    memcpy(&word, key, sizeof(word));
+    __m256i mask = _mm256_set1_epi32((int)word);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(data + i));
+        _mm256_storeu_si256((__m256i*)(data + i), _mm256_xor_si256(block, mask));
+    }
+    if (i + 16 <= length) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(data + i));
+        _mm_storeu_si128((__m128i*)(data + i), _mm_xor_si128(block, _mm256_castsi256_si128(mask)));
+        i += 16;
+    }
+    for (; i < length; i++) data[i] ^= key[i & 3];
+}
+
+// Masking and unmasking are the same XOR; the key lines up with data[0]
+inline void ws_mask(char* data, size_t length, const uint8_t key[4], WsUnmask unmask) {
+    switch (unmask) {
+        case WsUnmask::Scalar: ws_mask_scalar(data, length, key); break;
+        case WsUnmask::Sse2: ws_mask_sse2(data, length, key); break;
+        case WsUnmask::Avx2: ws_mask_avx2(data, length, key); break;
+    }
+}
+
+struct WsFrame {
+    bool fin;
+    uint8_t opcode;
+    bool masked;
+    uint8_t key[4];
+    size_t header_length;   // Payload starts here
+    uint64_t payload_length;
+};
+
+// Reads the frame header at the front of data. Consumed is the whole frame
+// (header and payload) when the result is Ok.
+inline WsStatus ws_parse_frame(const char* data, size_t length, WsFrame& frame, size_t& consumed) {
+    if (length < 2) return WsStatus::Incomplete;
+    const uint8_t* p = (const uint8_t*)data;
+    if (p[0] & 0x70) return WsStatus::Malformed;  // No extensions negotiated
+    frame.fin = (p[0] & 0x80) != 0;
+    frame.opcode = p[0] & 0x0F;
+    frame.masked = (p[1] & 0x80) != 0;
+    uint64_t payload = p[1] & 0x7F;
+    size_t header = 2;
+    if (payload == 126) {
+        if (length < 4) return WsStatus::Incomplete;
+        payload = ((uint64_t)p[2] << 8) | p[3];
+        header = 4;
+    } else if (payload == 127) {
+        if (length < 10) return WsStatus::Incomplete;
+        payload = 0;
+        for (int i = 2; i < 10; i++) payload = (payload << 8) | p[i];
+        header = 10;
+    }
+    if (frame.opcode >= WS_CLOSE && (!frame.fin || payload > 125)) return WsStatus::Malformed;
+    if ((frame.opcode > WS_BINARY && frame.opcode < WS_CLOSE) || frame.opcode > WS_PONG) return WsStatus::Malformed;
+    if (payload > WS_MAX_PAYLOAD) return WsStatus::Malformed;
+    if (frame.masked) {
+        if (length < header + 4) return WsStatus::Incomplete;
+        memcpy(frame.key, p + header, 4);
+        header += 4;
+    }
+    if (length - header < payload) return WsStatus::Incomplete;
+    frame.header_length = header;
+    frame.payload_length = payload;
+    consumed = header + payload;
+    return WsStatus::Ok;
+}
+
+// Writes an unmasked (server) frame header into out, returns its length
+inline size_t ws_frame_header(uint8_t opcode, uint64_t length, char* out) {
+    out[0] = (char)(0x80 | opcode);
+    if (length < 126) {
+        out[1] = (char)length;
+        return 2;
+    }
+    if (length <= 0xFFFF) {
+        out[1] = 126;
+        out[2] = (char)(length >> 8);
+        out[3] = (char)length;
+        return 4;
+    }
+    out[1] = 127;
+    for (int i = 0; i < 8; i++) out[2 + i] = (char)(length >> (56 - i * 8));
+    return 10;
+}
+
+inline void ws_append_frame(std::string& out, uint8_t opcode, const char* data, size_t length) {
+    char header[WS_MAX_HEADER];
+    out.append(header, ws_frame_header(opcode, length, header));
+    out.append(data, length);
+}
+
+// Client side: a frame masked with key
+inline void ws_append_masked_frame(std::string& out, uint8_t opcode, const char* data, size_t length,
+                                   const uint8_t key[4], WsUnmask unmask) {
+    char header[WS_MAX_HEADER];
+    size_t header_length = ws_frame_header(opcode, length, header);
+    header[1] = (char)(header[1] | 0x80);
+    memcpy(header + header_length, key, 4);
+    out.append(header, header_length + 4);
+    size_t payload = out.size();
+    out.append(data, length);
+    ws_mask(&out[payload], length, key, unmask);
+}